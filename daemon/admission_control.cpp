@@ -0,0 +1,176 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/lexical_cast.hpp>
+
+#include "admission_control.h"
+
+#include "xscript/config.h"
+#include "xscript/profiler.h"
+#include "xscript/simple_counter.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+AdmissionControl::AdmissionControl(const SimpleCounter *workers) :
+    workers_(workers), enabled_(false), max_queue_time_(0), concurrency_(0),
+    admitted_(0), shed_queue_(0), shed_concurrency_(0), queue_time_total_(0), queue_time_max_(0)
+{}
+
+AdmissionControl::~AdmissionControl() {
+}
+
+void
+AdmissionControl::init(const Config *config) {
+    config->addForbiddenKey("/xscript/admission/*");
+    max_queue_time_ = 1000 * config->as<boost::uint64_t>("/xscript/admission/max-queue-time", 0);
+    concurrency_ = config->as<unsigned int>("/xscript/admission/script-concurrency", 0);
+    start_param_ = config->as<std::string>("/xscript/admission/start-param", "");
+    if (!start_param_.empty()) {
+        start_param_.push_back('=');
+    }
+
+    std::vector<std::string> v;
+    config->subKeys("/xscript/admission/script", v);
+    for (std::vector<std::string>::iterator it = v.begin(), end = v.end(); it != end; ++it) {
+        ScriptClass script_class;
+        script_class.prefix_ = config->as<std::string>(*it + "/@path");
+        script_class.priority_ = config->as<std::string>(*it + "/@priority", "normal") == "high";
+        script_class.concurrency_ = config->as<unsigned int>(*it + "/@concurrency", concurrency_);
+        classes_.push_back(script_class);
+    }
+
+    enabled_ = 0 != max_queue_time_ || 0 != concurrency_ || !classes_.empty();
+}
+
+bool
+AdmissionControl::enabled() const {
+    return enabled_;
+}
+
+timeval
+AdmissionControl::startTime(char *env[], const timeval &accept_time) const {
+    if (start_param_.empty()) {
+        return accept_time;
+    }
+    for (char **var = env; NULL != *var; ++var) {
+        if (0 != strncmp(*var, start_param_.c_str(), start_param_.size())) {
+            continue;
+        }
+        const char *value = *var + start_param_.size();
+        if (0 == strncmp(value, "t=", 2)) {
+            value += 2;
+        }
+        double start = strtod(value, NULL);
+        if (start <= 0.0) {
+            break;
+        }
+        timeval result;
+        result.tv_sec = static_cast<time_t>(start);
+        result.tv_usec = static_cast<suseconds_t>((start - result.tv_sec) * 1000000);
+        return result;
+    }
+    return accept_time;
+}
+
+const AdmissionControl::ScriptClass*
+AdmissionControl::find(const std::string &script_name) const {
+    for (std::vector<ScriptClass>::const_iterator it = classes_.begin(); it != classes_.end(); ++it) {
+        if (0 == script_name.compare(0, it->prefix_.size(), it->prefix_)) {
+            return &(*it);
+        }
+    }
+    return NULL;
+}
+
+bool
+AdmissionControl::admit(const std::string &script_name, const timeval &start_time, Ticket &ticket) {
+    timeval now;
+    gettimeofday(&now, 0);
+    boost::uint64_t queue_time = timercmp(&now, &start_time, >) ? now - start_time : 0;
+
+    const ScriptClass *script_class = find(script_name);
+    bool priority = NULL != script_class && script_class->priority_;
+    unsigned int concurrency = NULL != script_class ? script_class->concurrency_ : concurrency_;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_time_total_ += queue_time;
+    queue_time_max_ = std::max(queue_time_max_, queue_time);
+
+    if (!priority) {
+        if (0 != max_queue_time_ && queue_time > max_queue_time_) {
+            ++shed_queue_;
+            return false;
+        }
+        if (0 != concurrency) {
+            unsigned int &running = running_[script_name];
+            if (running >= concurrency) {
+                ++shed_concurrency_;
+                return false;
+            }
+            ++running;
+            ticket.owner_ = this;
+            ticket.script_ = script_name;
+        }
+    }
+    ++admitted_;
+    return true;
+}
+
+void
+AdmissionControl::release(const std::string &script_name) {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<std::string, unsigned int>::iterator it = running_.find(script_name);
+    if (running_.end() != it && 0 == --it->second) {
+        running_.erase(it);
+    }
+}
+
+XmlNodeHelper
+AdmissionControl::createReport() const {
+    XmlNodeHelper line = workers_->createReport();
+    if (!enabled_) {
+        return line;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    boost::uint64_t admitted = admitted_;
+    boost::uint64_t shed_queue = shed_queue_;
+    boost::uint64_t shed_concurrency = shed_concurrency_;
+    boost::uint64_t queue_time_total = queue_time_total_;
+    boost::uint64_t queue_time_max = queue_time_max_;
+    lock.unlock();
+
+    boost::uint64_t total = admitted + shed_queue + shed_concurrency;
+    double queue_time_avg = 0 == total ? 0.0 : (double)queue_time_total / total / 1000.0;
+
+    xmlSetProp(line.get(), (const xmlChar*) "admitted",
+        (const xmlChar*) boost::lexical_cast<std::string>(admitted).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "shed-queue",
+        (const xmlChar*) boost::lexical_cast<std::string>(shed_queue).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "shed-concurrency",
+        (const xmlChar*) boost::lexical_cast<std::string>(shed_concurrency).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "queue-time-avg",
+        (const xmlChar*) boost::lexical_cast<std::string>(queue_time_avg).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "queue-time-max",
+        (const xmlChar*) boost::lexical_cast<std::string>(queue_time_max / 1000.0).c_str());
+
+    return line;
+}
+
+AdmissionControl::Ticket::Ticket() : owner_(NULL) {
+}
+
+AdmissionControl::Ticket::~Ticket() {
+    if (NULL != owner_) {
+        owner_->release(script_);
+    }
+}
+
+} // namespace xscript
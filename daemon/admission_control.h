@@ -0,0 +1,89 @@
+#ifndef _XSCRIPT_DAEMON_ADMISSION_CONTROL_H_
+#define _XSCRIPT_DAEMON_ADMISSION_CONTROL_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include "xscript/counter_base.h"
+
+namespace xscript {
+
+class Config;
+class SimpleCounter;
+
+/**
+ * Sheds requests before script is invoked: requests waiting since accept
+ * longer than max-queue-time and requests over concurrency limit of their
+ * script are rejected. Scripts of high priority are always admitted.
+ * Reports fcgi-workers counter extended with admission statistics.
+ */
+class AdmissionControl : public CounterBase {
+public:
+    explicit AdmissionControl(const SimpleCounter *workers);
+    virtual ~AdmissionControl();
+
+    void init(const Config *config);
+    bool enabled() const;
+
+    /**
+     * Request start time set by frontend, e.g. nginx $msec, if configured
+     * and present in environment. Otherwise accept_time is returned.
+     */
+    timeval startTime(char *env[], const timeval &accept_time) const;
+
+    class Ticket : private boost::noncopyable {
+    public:
+        Ticket();
+        ~Ticket();
+
+    private:
+        friend class AdmissionControl;
+        AdmissionControl *owner_;
+        std::string script_;
+    };
+
+    /**
+     * Returns false if request must be rejected. Concurrency slot of
+     * admitted script is held until ticket is destroyed.
+     */
+    bool admit(const std::string &script_name, const timeval &start_time, Ticket &ticket);
+
+    virtual XmlNodeHelper createReport() const;
+
+private:
+    struct ScriptClass {
+        std::string prefix_;
+        bool priority_;
+        unsigned int concurrency_;
+    };
+
+    const ScriptClass* find(const std::string &script_name) const;
+    void release(const std::string &script_name);
+
+private:
+    const SimpleCounter *workers_;
+    bool enabled_;
+    boost::uint64_t max_queue_time_;
+    unsigned int concurrency_;
+    std::string start_param_;
+    std::vector<ScriptClass> classes_;
+
+    mutable boost::mutex mutex_;
+    std::map<std::string, unsigned int> running_;
+    boost::uint64_t admitted_;
+    boost::uint64_t shed_queue_;
+    boost::uint64_t shed_concurrency_;
+    boost::uint64_t queue_time_total_;
+    boost::uint64_t queue_time_max_;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_DAEMON_ADMISSION_CONTROL_H_
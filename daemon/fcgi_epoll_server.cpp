@@ -0,0 +1,601 @@
+#include "settings.h"
+
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "fcgi_epoll_server.h"
+
+#include "xscript/config.h"
+#include "xscript/context.h"
+#include "xscript/logger.h"
+#include "xscript/status_info.h"
+#include "xscript/string_utils.h"
+#include "xscript/xml_util.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+static const unsigned int DEFAULT_OUTPUT_LIMIT = 1048576;
+static const unsigned int DEFAULT_INPUT_LIMIT = 67108864;
+static const std::size_t READ_BUFFER_SIZE = 16384;
+static const int MAX_EVENTS = 256;
+
+class EpollFCGIServer::Connection : private boost::noncopyable {
+public:
+    explicit Connection(int fd) :
+        fd_(fd), reading_(true), want_write_(false),
+        out_pos_(0), active_(0), closed_(false), close_after_(false), scheduled_(false)
+    {}
+
+    int fd_;
+
+    // used by epoll thread only
+    std::string in_;
+    std::map<unsigned short, FCGIRequestPtr> requests_;
+    bool reading_;
+    bool want_write_;
+
+    // guarded by mutex_
+    boost::mutex mutex_;
+    boost::condition condition_;
+    std::string out_;
+    std::string::size_type out_pos_;
+    unsigned int active_;
+    bool closed_;
+    bool close_after_;
+    bool scheduled_;
+};
+
+class EpollFCGIServer::FCGIRequest : private boost::noncopyable {
+public:
+    FCGIRequest(unsigned short id, bool keep_conn) : id_(id), keep_conn_(keep_conn) {
+        gettimeofday(&begin_time_, 0);
+    }
+
+    unsigned short id_;
+    bool keep_conn_;
+    std::string params_;
+    std::string stdin_;
+    std::vector<std::string> env_;
+    timeval begin_time_;
+};
+
+class EpollFCGIServer::InputBuf : public std::streambuf {
+public:
+    explicit InputBuf(std::string &data) {
+        char *begin = data.empty() ? NULL : &data[0];
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+class EpollFCGIServer::OutputBuf : public std::streambuf {
+public:
+    OutputBuf(EpollFCGIServer *server, const ConnectionPtr &conn, unsigned short id, std::size_t size) :
+        server_(server), conn_(conn), id_(id), buffer_(size > 0 ? size : 4096)
+    {
+        setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (!send()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    virtual int sync() {
+        return send() ? 0 : -1;
+    }
+
+private:
+    bool send() {
+        std::size_t size = pptr() - pbase();
+        if (0 == size) {
+            return true;
+        }
+        std::string data;
+        FCGIProtocol::appendRecord(data, FCGIProtocol::STDOUT, id_, pbase(), size);
+        setp(&buffer_[0], &buffer_[0] + buffer_.size());
+        return server_->send(conn_, data, true);
+    }
+
+private:
+    EpollFCGIServer *server_;
+    ConnectionPtr conn_;
+    unsigned short id_;
+    std::vector<char> buffer_;
+};
+
+EpollFCGIServer::EpollFCGIServer(Config *config) :
+    FCGIServer(config), epoll_fd_(-1), output_limit_(DEFAULT_OUTPUT_LIMIT), input_limit_(DEFAULT_INPUT_LIMIT),
+    connectionCounter_(SimpleCounterFactory::instance()->createCounter("fcgi-connections", true)),
+    queueCounter_(SimpleCounterFactory::instance()->createCounter("fcgi-queue", true))
+{
+    wake_fds_[0] = wake_fds_[1] = -1;
+    StatusInfo::instance()->getStatBuilder().addCounter(connectionCounter_.get());
+    StatusInfo::instance()->getStatBuilder().addCounter(queueCounter_.get());
+}
+
+EpollFCGIServer::~EpollFCGIServer() {
+    if (-1 != epoll_fd_) {
+        ::close(epoll_fd_);
+    }
+    if (-1 != wake_fds_[0]) {
+        ::close(wake_fds_[0]);
+        ::close(wake_fds_[1]);
+    }
+}
+
+void
+EpollFCGIServer::run() {
+
+    openSocket();
+
+    Config* conf = config();
+    conf->addForbiddenKey("/xscript/fastcgi-epoll-workers");
+    conf->addForbiddenKey("/xscript/fastcgi-epoll-output-limit");
+    conf->addForbiddenKey("/xscript/fastcgi-epoll-input-limit");
+    unsigned int pool_size = conf->as<unsigned int>("/xscript/fastcgi-epoll-workers",
+        boost::thread::hardware_concurrency());
+    if (0 == pool_size) {
+        pool_size = 1;
+    }
+    output_limit_ = conf->as<unsigned int>("/xscript/fastcgi-epoll-output-limit", DEFAULT_OUTPUT_LIMIT);
+    input_limit_ = conf->as<unsigned int>("/xscript/fastcgi-epoll-input-limit", DEFAULT_INPUT_LIMIT);
+
+    conf->stopCollectCache();
+
+    epoll_fd_ = epoll_create(MAX_EVENTS);
+    if (-1 == epoll_fd_ || -1 == pipe(wake_fds_)) {
+        std::stringstream stream;
+        StringUtils::report("fastcgi epoll init failed: ", errno, stream);
+        throw std::runtime_error(stream.str());
+    }
+    fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fds_[0], F_SETFL, fcntl(wake_fds_[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fds_[1], F_SETFL, fcntl(wake_fds_[1], F_GETFL) | O_NONBLOCK);
+    watch(socket_, EPOLL_CTL_ADD, EPOLLIN);
+    watch(wake_fds_[0], EPOLL_CTL_ADD, EPOLLIN);
+
+    workerCounter_->max(pool_size);
+    for (unsigned int i = 0; i < pool_size; ++i) {
+        create_thread(boost::bind(&EpollFCGIServer::work, this));
+    }
+    loop();
+}
+
+void
+EpollFCGIServer::loop() {
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        int count = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (-1 == count && EINTR != errno) {
+            // epoll descriptor is broken, retrying would spin forever
+            std::stringstream stream;
+            StringUtils::report("fastcgi epoll_wait failed: ", errno, stream);
+            log()->crit("%s", stream.str().c_str());
+            throw std::runtime_error(stream.str());
+        }
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == socket_) {
+                acceptConnections();
+                continue;
+            }
+            if (fd == wake_fds_[0]) {
+                writePending();
+                continue;
+            }
+            std::map<int, ConnectionPtr>::iterator it = connections_.find(fd);
+            if (connections_.end() == it) {
+                continue;
+            }
+            ConnectionPtr conn = it->second;
+            if (events[i].events & EPOLLOUT) {
+                writeConnection(conn);
+            }
+            if (events[i].events & EPOLLIN) {
+                readConnection(conn);
+            }
+            else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(conn);
+            }
+        }
+    }
+}
+
+void
+EpollFCGIServer::work() {
+    XmlUtils::registerReporters();
+    while (true) {
+        std::pair<ConnectionPtr, FCGIRequestPtr> job;
+        {
+            boost::mutex::scoped_lock lock(queue_mutex_);
+            while (queue_.empty()) {
+                queue_condition_.wait(lock);
+            }
+            job = queue_.front();
+            queue_.pop_front();
+        }
+        queueCounter_->dec();
+        serve(job.first, job.second);
+    }
+}
+
+void
+EpollFCGIServer::serve(const ConnectionPtr &conn, const FCGIRequestPtr &request) {
+    boost::shared_ptr<Context> ctx;
+    try {
+        std::vector<char*> env;
+        env.reserve(request->env_.size() + 1);
+        for (std::vector<std::string>::iterator it = request->env_.begin(); it != request->env_.end(); ++it) {
+            env.push_back(&(*it)[0]);
+        }
+        env.push_back(NULL);
+
+        InputBuf inbuf(request->stdin_);
+        OutputBuf outbuf(this, conn, request->id_, outbuf_size_);
+
+        std::istream is(&inbuf);
+        std::ostream os(&outbuf);
+
+        processRequest(&is, &os, &env[0], request->begin_time_, ctx);
+        os.flush();
+    }
+    catch (const std::exception &e) {
+        log()->error("caught exception while handling request: %s", e.what());
+    }
+    endRequest(conn, request->id_, FCGIProtocol::REQUEST_COMPLETE, request->keep_conn_, true);
+}
+
+void
+EpollFCGIServer::acceptConnections() {
+    while (true) {
+        int fd = accept(socket_, NULL, NULL);
+        if (-1 == fd) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                log()->error("failed to accept fastcgi connection: %d", errno);
+            }
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        connections_[fd] = ConnectionPtr(new Connection(fd));
+        connectionCounter_->inc();
+        watch(fd, EPOLL_CTL_ADD, EPOLLIN);
+    }
+}
+
+void
+EpollFCGIServer::readConnection(ConnectionPtr conn) {
+    char buf[READ_BUFFER_SIZE];
+    while (conn->reading_) {
+        ssize_t res = ::read(conn->fd_, buf, sizeof(buf));
+        if (res < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                closeConnection(conn);
+            }
+            return;
+        }
+        if (0 == res) {
+            // peer shut down its side, finish requests being handled
+            conn->reading_ = false;
+            bool idle = false;
+            {
+                boost::mutex::scoped_lock lock(conn->mutex_);
+                conn->close_after_ = true;
+                idle = 0 == conn->active_ && conn->out_pos_ == conn->out_.size();
+            }
+            if (idle) {
+                closeConnection(conn);
+            }
+            else {
+                watch(conn->fd_, EPOLL_CTL_MOD, conn->want_write_ ? (unsigned int)EPOLLOUT : 0);
+            }
+            return;
+        }
+
+        conn->in_.append(buf, res);
+        try {
+            std::string::size_type pos = 0;
+            FCGIProtocol::Record record;
+            while (std::size_t size = FCGIProtocol::readRecord(
+                    conn->in_.data() + pos, conn->in_.size() - pos, record)) {
+                processRecord(conn, record);
+                pos += size;
+            }
+            conn->in_.erase(0, pos);
+        }
+        catch (const std::exception &e) {
+            log()->error("closing fastcgi connection: %s", e.what());
+            closeConnection(conn);
+            return;
+        }
+    }
+}
+
+void
+EpollFCGIServer::processRecord(const ConnectionPtr &conn, const FCGIProtocol::Record &record) {
+
+    std::map<unsigned short, FCGIRequestPtr>::iterator it = conn->requests_.find(record.id);
+    FCGIRequest *request = conn->requests_.end() == it ? NULL : it->second.get();
+
+    switch (record.type) {
+        case FCGIProtocol::BEGIN_REQUEST: {
+            if (record.size < 8) {
+                throw std::runtime_error("malformed fastcgi begin request");
+            }
+            const unsigned char *body = (const unsigned char*)record.content;
+            unsigned short role = (unsigned short)((body[0] << 8) | body[1]);
+            bool keep_conn = 0 != (body[2] & FCGIProtocol::KEEP_CONN);
+            if (FCGIProtocol::RESPONDER != role) {
+                endRequest(conn, record.id, FCGIProtocol::UNKNOWN_ROLE, keep_conn, false);
+                break;
+            }
+            conn->requests_[record.id] = FCGIRequestPtr(new FCGIRequest(record.id, keep_conn));
+            break;
+        }
+        case FCGIProtocol::ABORT_REQUEST:
+            // requests already being handled are finished as usual
+            if (NULL != request) {
+                bool keep_conn = request->keep_conn_;
+                conn->requests_.erase(it);
+                endRequest(conn, record.id, FCGIProtocol::REQUEST_COMPLETE, keep_conn, false);
+            }
+            break;
+        case FCGIProtocol::PARAMS:
+            if (NULL == request) {
+                break;
+            }
+            if (record.size > 0) {
+                request->params_.append(record.content, record.size);
+            }
+            else {
+                FCGIProtocol::parseParams(request->params_.data(), request->params_.size(), request->env_);
+                std::string().swap(request->params_);
+            }
+            break;
+        case FCGIProtocol::STDIN:
+            if (NULL == request) {
+                break;
+            }
+            if (record.size > 0) {
+                if (request->stdin_.size() + record.size > input_limit_) {
+                    log()->warn("fastcgi request body exceeds %u bytes, request rejected", input_limit_);
+                    bool keep_conn = request->keep_conn_;
+                    conn->requests_.erase(it);
+                    rejectRequest(conn, record.id, 413, keep_conn);
+                    break;
+                }
+                request->stdin_.append(record.content, record.size);
+            }
+            else {
+                FCGIRequestPtr ready = it->second;
+                conn->requests_.erase(it);
+                dispatch(conn, ready);
+            }
+            break;
+        case FCGIProtocol::DATA:
+            break;
+        case FCGIProtocol::GET_VALUES: {
+            std::vector<std::string> names;
+            FCGIProtocol::parseParams(record.content, record.size, names);
+            std::string values;
+            for (std::vector<std::string>::iterator name = names.begin(); name != names.end(); ++name) {
+                if (*name == "FCGI_MPXS_CONNS=") {
+                    FCGIProtocol::appendParam(values, "FCGI_MPXS_CONNS", "1");
+                }
+            }
+            std::string data;
+            FCGIProtocol::appendRecord(data, FCGIProtocol::GET_VALUES_RESULT, 0, values.data(), values.size());
+            send(conn, data, false);
+            break;
+        }
+        default: {
+            std::string data;
+            FCGIProtocol::appendUnknownType(data, record.type);
+            send(conn, data, false);
+            break;
+        }
+    }
+}
+
+void
+EpollFCGIServer::dispatch(const ConnectionPtr &conn, const FCGIRequestPtr &request) {
+    {
+        boost::mutex::scoped_lock lock(conn->mutex_);
+        ++conn->active_;
+    }
+    queueCounter_->inc();
+    boost::mutex::scoped_lock lock(queue_mutex_);
+    queue_.push_back(std::make_pair(conn, request));
+    queue_condition_.notify_one();
+}
+
+bool
+EpollFCGIServer::send(const ConnectionPtr &conn, const std::string &data, bool wait) {
+    bool schedule = false;
+    {
+        boost::mutex::scoped_lock lock(conn->mutex_);
+        while (wait && !conn->closed_ && conn->out_.size() - conn->out_pos_ > output_limit_) {
+            conn->condition_.wait(lock);
+        }
+        if (conn->closed_) {
+            return false;
+        }
+        conn->out_.append(data);
+        schedule = !conn->scheduled_;
+        conn->scheduled_ = true;
+    }
+    if (schedule) {
+        boost::mutex::scoped_lock lock(pending_mutex_);
+        pending_.push_back(conn);
+        wake();
+    }
+    return true;
+}
+
+void
+EpollFCGIServer::endRequest(const ConnectionPtr &conn, unsigned short id, unsigned char status,
+    bool keep_conn, bool active) {
+
+    std::string data;
+    if (active) {
+        FCGIProtocol::appendRecord(data, FCGIProtocol::STDOUT, id, NULL, 0);
+    }
+    FCGIProtocol::appendEndRequest(data, id, status);
+
+    boost::mutex::scoped_lock lock(conn->mutex_);
+    if (active) {
+        --conn->active_;
+    }
+    if (!keep_conn) {
+        conn->close_after_ = true;
+    }
+    lock.unlock();
+
+    send(conn, data, false);
+}
+
+void
+EpollFCGIServer::rejectRequest(const ConnectionPtr &conn, unsigned short id, unsigned short status,
+    bool keep_conn) {
+
+    // rest of the request records are ignored as they belong to no request
+    std::string response = "Status: " + boost::lexical_cast<std::string>(status) + "\r\n"
+        "Content-Type: text/plain\r\nContent-Length: 0\r\n\r\n";
+    std::string data;
+    FCGIProtocol::appendRecord(data, FCGIProtocol::STDOUT, id, response.data(), response.size());
+    FCGIProtocol::appendRecord(data, FCGIProtocol::STDOUT, id, NULL, 0);
+    FCGIProtocol::appendEndRequest(data, id, FCGIProtocol::REQUEST_COMPLETE);
+
+    if (!keep_conn) {
+        boost::mutex::scoped_lock lock(conn->mutex_);
+        conn->close_after_ = true;
+    }
+    send(conn, data, false);
+}
+
+void
+EpollFCGIServer::writePending() {
+    char buf[64];
+    while (read(wake_fds_[0], buf, sizeof(buf)) > 0) {
+    }
+
+    std::vector<ConnectionPtr> pending;
+    {
+        boost::mutex::scoped_lock lock(pending_mutex_);
+        pending.swap(pending_);
+    }
+    for (std::vector<ConnectionPtr>::iterator it = pending.begin(); it != pending.end(); ++it) {
+        writeConnection(*it);
+    }
+}
+
+void
+EpollFCGIServer::writeConnection(ConnectionPtr conn) {
+    boost::mutex::scoped_lock lock(conn->mutex_);
+    conn->scheduled_ = false;
+    if (conn->closed_) {
+        return;
+    }
+    while (conn->out_pos_ < conn->out_.size()) {
+        ssize_t res = ::write(conn->fd_, conn->out_.data() + conn->out_pos_, conn->out_.size() - conn->out_pos_);
+        if (res < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                break;
+            }
+            lock.unlock();
+            closeConnection(conn);
+            return;
+        }
+        conn->out_pos_ += res;
+    }
+    conn->out_.erase(0, conn->out_pos_);
+    conn->out_pos_ = 0;
+    conn->condition_.notify_all();
+
+    bool drained = conn->out_.empty();
+    bool close = drained && conn->close_after_ && 0 == conn->active_;
+    lock.unlock();
+
+    if (close) {
+        closeConnection(conn);
+    }
+    else if (drained == conn->want_write_) {
+        conn->want_write_ = !drained;
+        unsigned int events = conn->want_write_ ? (unsigned int)EPOLLOUT : 0;
+        if (conn->reading_) {
+            events |= EPOLLIN;
+        }
+        watch(conn->fd_, EPOLL_CTL_MOD, events);
+    }
+}
+
+void
+EpollFCGIServer::closeConnection(ConnectionPtr conn) {
+    {
+        boost::mutex::scoped_lock lock(conn->mutex_);
+        if (conn->closed_) {
+            return;
+        }
+        conn->closed_ = true;
+        conn->condition_.notify_all();
+    }
+    conn->reading_ = false;
+    watch(conn->fd_, EPOLL_CTL_DEL, 0);
+    ::close(conn->fd_);
+    connections_.erase(conn->fd_);
+    connectionCounter_->dec();
+}
+
+void
+EpollFCGIServer::watch(int fd, int op, unsigned int events) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (-1 == epoll_ctl(epoll_fd_, op, fd, &event) && EPOLL_CTL_DEL != op) {
+        log()->error("fastcgi epoll_ctl failed: %d", errno);
+    }
+}
+
+void
+EpollFCGIServer::wake() {
+    char c = 0;
+    ssize_t res = write(wake_fds_[1], &c, 1);
+    (void)res;
+}
+
+} // namespace xscript
@@ -0,0 +1,79 @@
+#ifndef _XSCRIPT_DAEMON_FCGI_EPOLL_SERVER_H_
+#define _XSCRIPT_DAEMON_FCGI_EPOLL_SERVER_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "fcgi_protocol.h"
+#include "fcgi_server.h"
+
+namespace xscript {
+
+/**
+ * FastCGI server with single epoll thread owning all connections. Records
+ * are parsed by that thread, complete requests (possibly multiplexed on one
+ * connection) are handled by a fixed pool of workers and their output is
+ * written back by the epoll thread, so slow clients do not hold workers.
+ */
+class EpollFCGIServer : public FCGIServer {
+public:
+    EpollFCGIServer(Config *config);
+    virtual ~EpollFCGIServer();
+
+    virtual void run();
+
+private:
+    class Connection;
+    class FCGIRequest;
+    class InputBuf;
+    class OutputBuf;
+
+    typedef boost::shared_ptr<Connection> ConnectionPtr;
+    typedef boost::shared_ptr<FCGIRequest> FCGIRequestPtr;
+
+    void loop();
+    void work();
+    void serve(const ConnectionPtr &conn, const FCGIRequestPtr &request);
+
+    void acceptConnections();
+    void readConnection(ConnectionPtr conn);
+    void writeConnection(ConnectionPtr conn);
+    void closeConnection(ConnectionPtr conn);
+    void processRecord(const ConnectionPtr &conn, const FCGIProtocol::Record &record);
+    void dispatch(const ConnectionPtr &conn, const FCGIRequestPtr &request);
+
+    bool send(const ConnectionPtr &conn, const std::string &data, bool wait);
+    void endRequest(const ConnectionPtr &conn, unsigned short id, unsigned char status,
+        bool keep_conn, bool active);
+    void rejectRequest(const ConnectionPtr &conn, unsigned short id, unsigned short status, bool keep_conn);
+    void writePending();
+    void watch(int fd, int op, unsigned int events);
+    void wake();
+
+private:
+    int epoll_fd_;
+    int wake_fds_[2];
+    unsigned int output_limit_;
+    unsigned int input_limit_;
+    std::map<int, ConnectionPtr> connections_;
+
+    boost::mutex queue_mutex_;
+    boost::condition queue_condition_;
+    std::deque<std::pair<ConnectionPtr, FCGIRequestPtr> > queue_;
+
+    boost::mutex pending_mutex_;
+    std::vector<ConnectionPtr> pending_;
+
+    std::auto_ptr<SimpleCounter> connectionCounter_;
+    std::auto_ptr<SimpleCounter> queueCounter_;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_DAEMON_FCGI_EPOLL_SERVER_H_
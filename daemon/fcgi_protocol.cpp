@@ -0,0 +1,131 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "fcgi_protocol.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+const unsigned short FCGIProtocol::RESPONDER;
+const unsigned char FCGIProtocol::KEEP_CONN;
+const std::size_t FCGIProtocol::HEADER_SIZE;
+const std::size_t FCGIProtocol::MAX_CONTENT_SIZE;
+
+static const unsigned char FCGI_VERSION = 1;
+
+static void
+appendHeader(std::string &out, unsigned char type, unsigned short id,
+    std::size_t size, unsigned char padding) {
+    char header[FCGIProtocol::HEADER_SIZE] = {
+        (char)FCGI_VERSION, (char)type, (char)(id >> 8), (char)(id & 0xff),
+        (char)(size >> 8), (char)(size & 0xff), (char)padding, 0
+    };
+    out.append(header, sizeof(header));
+}
+
+static std::size_t
+readLength(const unsigned char *&pos, const unsigned char *end) {
+    if (pos == end) {
+        throw std::runtime_error("truncated fastcgi param length");
+    }
+    if (0 == (*pos & 0x80)) {
+        return *pos++;
+    }
+    if (end - pos < 4) {
+        throw std::runtime_error("truncated fastcgi param length");
+    }
+    std::size_t length = ((std::size_t)(pos[0] & 0x7f) << 24) |
+        ((std::size_t)pos[1] << 16) | ((std::size_t)pos[2] << 8) | pos[3];
+    pos += 4;
+    return length;
+}
+
+static void
+appendLength(std::string &out, std::size_t length) {
+    if (length < 0x80) {
+        out.push_back((char)length);
+        return;
+    }
+    out.push_back((char)(0x80 | ((length >> 24) & 0x7f)));
+    out.push_back((char)((length >> 16) & 0xff));
+    out.push_back((char)((length >> 8) & 0xff));
+    out.push_back((char)(length & 0xff));
+}
+
+std::size_t
+FCGIProtocol::readRecord(const char *data, std::size_t size, Record &record) {
+    if (size < HEADER_SIZE) {
+        return 0;
+    }
+    const unsigned char *header = (const unsigned char*)data;
+    if (FCGI_VERSION != header[0]) {
+        throw std::runtime_error("unsupported fastcgi version");
+    }
+    std::size_t content_size = ((std::size_t)header[4] << 8) | header[5];
+    std::size_t total = HEADER_SIZE + content_size + header[6];
+    if (size < total) {
+        return 0;
+    }
+    record.type = header[1];
+    record.id = (unsigned short)((header[2] << 8) | header[3]);
+    record.content = data + HEADER_SIZE;
+    record.size = content_size;
+    return total;
+}
+
+void
+FCGIProtocol::appendRecord(std::string &out, unsigned char type, unsigned short id,
+    const char *content, std::size_t size) {
+    do {
+        std::size_t chunk = std::min(size, MAX_CONTENT_SIZE);
+        unsigned char padding = (unsigned char)((8 - chunk % 8) % 8);
+        appendHeader(out, type, id, chunk, padding);
+        out.append(content, chunk);
+        out.append(padding, '\0');
+        content += chunk;
+        size -= chunk;
+    } while (size > 0);
+}
+
+void
+FCGIProtocol::appendEndRequest(std::string &out, unsigned short id, unsigned char status) {
+    char body[8] = { 0, 0, 0, 0, (char)status, 0, 0, 0 };
+    appendRecord(out, END_REQUEST, id, body, sizeof(body));
+}
+
+void
+FCGIProtocol::appendUnknownType(std::string &out, unsigned char type) {
+    char body[8] = { (char)type, 0, 0, 0, 0, 0, 0, 0 };
+    appendRecord(out, UNKNOWN_TYPE, 0, body, sizeof(body));
+}
+
+void
+FCGIProtocol::parseParams(const char *data, std::size_t size, std::vector<std::string> &params) {
+    const unsigned char *pos = (const unsigned char*)data, *end = pos + size;
+    while (pos != end) {
+        std::size_t name_size = readLength(pos, end);
+        std::size_t value_size = readLength(pos, end);
+        if ((std::size_t)(end - pos) < name_size + value_size) {
+            throw std::runtime_error("truncated fastcgi param");
+        }
+        std::string param((const char*)pos, name_size);
+        param.push_back('=');
+        param.append((const char*)pos + name_size, value_size);
+        params.push_back(param);
+        pos += name_size + value_size;
+    }
+}
+
+void
+FCGIProtocol::appendParam(std::string &out, const std::string &name, const std::string &value) {
+    appendLength(out, name.size());
+    appendLength(out, value.size());
+    out.append(name).append(value);
+}
+
+} // namespace xscript
@@ -0,0 +1,69 @@
+#ifndef _XSCRIPT_DAEMON_FCGI_PROTOCOL_H_
+#define _XSCRIPT_DAEMON_FCGI_PROTOCOL_H_
+
+#include <string>
+#include <vector>
+
+namespace xscript {
+
+/**
+ * FastCGI record encoding and decoding used by multiplexing server.
+ * Malformed input is reported with std::runtime_error.
+ */
+class FCGIProtocol {
+public:
+    enum RecordType {
+        BEGIN_REQUEST = 1,
+        ABORT_REQUEST = 2,
+        END_REQUEST = 3,
+        PARAMS = 4,
+        STDIN = 5,
+        STDOUT = 6,
+        STDERR = 7,
+        DATA = 8,
+        GET_VALUES = 9,
+        GET_VALUES_RESULT = 10,
+        UNKNOWN_TYPE = 11
+    };
+
+    enum ProtocolStatus {
+        REQUEST_COMPLETE = 0,
+        CANT_MPX_CONN = 1,
+        OVERLOADED = 2,
+        UNKNOWN_ROLE = 3
+    };
+
+    static const unsigned short RESPONDER = 1;
+    static const unsigned char KEEP_CONN = 1;
+    static const std::size_t HEADER_SIZE = 8;
+    static const std::size_t MAX_CONTENT_SIZE = 65535;
+
+    struct Record {
+        unsigned char type;
+        unsigned short id;
+        const char *content;
+        std::size_t size;
+    };
+
+    /**
+     * Reads record starting at data. Returns number of bytes taken by
+     * record with padding or 0 if record is not complete yet.
+     */
+    static std::size_t readRecord(const char *data, std::size_t size, Record &record);
+
+    /**
+     * Appends record of given content, splitting it if too large.
+     * Empty content produces single empty record ending the stream.
+     */
+    static void appendRecord(std::string &out, unsigned char type, unsigned short id,
+        const char *content, std::size_t size);
+    static void appendEndRequest(std::string &out, unsigned short id, unsigned char status);
+    static void appendUnknownType(std::string &out, unsigned char type);
+
+    static void parseParams(const char *data, std::size_t size, std::vector<std::string> &params);
+    static void appendParam(std::string &out, const std::string &name, const std::string &value);
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_DAEMON_FCGI_PROTOCOL_H_
@@ -65,6 +65,8 @@ class FCGIServer::RequestAcceptor {
 FCGIServer::FCGIServer(Config *config) :
         Server(config), socket_(-1), inbuf_size_(0), outbuf_size_(0),
         workerCounter_(SimpleCounterFactory::instance()->createCounter("fcgi-workers", true)),
+        gzip_(false), gzip_min_size_(0),
+        admission_(workerCounter_.get()),
         uptimeCounter_(),
         responseCounter_(boost::shared_ptr<ResponseTimeCounter>(
                 ResponseTimeCounterFactory::instance()->createCounter("response-time").release()))
@@ -72,7 +74,7 @@ FCGIServer::FCGIServer(Config *config) :
     if (0 != FCGX_Init()) {
         throw std::runtime_error("can not init fastcgi library");
     }
-    StatusInfo::instance()->getStatBuilder().addCounter(workerCounter_.get());
+    StatusInfo::instance()->getStatBuilder().addCounter(&admission_);
     StatusInfo::instance()->getStatBuilder().addCounter(&uptimeCounter_);
     
     responseCounter_ = boost::shared_ptr<ResponseTimeCounter>(
@@ -114,6 +116,24 @@ FCGIServer::useXsltProfiler() const {
 void
 FCGIServer::run() {
 
+    openSocket();
+
+    Config* conf = config();
+    boost::function<void()> f = boost::bind(&FCGIServer::handle, this);
+    unsigned short pool_size = conf->as<unsigned short>("/xscript/fastcgi-workers");
+    
+    conf->stopCollectCache();
+    
+    workerCounter_->max(pool_size);
+    for (unsigned short i = 0; i < pool_size; ++i) {
+        create_thread(f);
+    }
+    join_all();
+}
+
+void
+FCGIServer::openSocket() {
+
     Config* conf = config();
     
     conf->addForbiddenKey("/xscript/endpoint/*");
@@ -128,6 +148,13 @@ FCGIServer::run() {
     inbuf_size_ = conf->as<unsigned int>("/xscript/input-buffer", 4096);
     outbuf_size_ = conf->as<unsigned int>("/xscript/output-buffer", 4096);
 
+    conf->addForbiddenKey("/xscript/output-gzip");
+    conf->addForbiddenKey("/xscript/output-gzip-min-size");
+    gzip_ = conf->as<std::string>("/xscript/output-gzip", "no") == "yes";
+    gzip_min_size_ = conf->as<boost::uint32_t>("/xscript/output-gzip-min-size", 1024);
+
+    admission_.init(conf);
+
     if (!socket.empty()) {
         socket_ = FCGX_OpenSocket(socket.c_str(), backlog);
         chmod(socket.c_str(), 0666);
@@ -141,17 +168,6 @@ FCGIServer::run() {
     if (-1 == socket_) {
         throw std::runtime_error("can not open fastcgi socket");
     }
-
-    boost::function<void()> f = boost::bind(&FCGIServer::handle, this);
-    unsigned short pool_size = conf->as<unsigned short>("/xscript/fastcgi-workers");
-    
-    conf->stopCollectCache();
-    
-    workerCounter_->max(pool_size);
-    for (unsigned short i = 0; i < pool_size; ++i) {
-        create_thread(f);
-    }
-    join_all();
 }
 
 void
@@ -172,36 +188,16 @@ FCGIServer::handle() {
             boost::shared_ptr<Context> ctx;
             RequestAcceptor request_acceptor(&req);
             if (request_acceptor.accepted()) {
-                PROFILER_FORCE(log(), "overall time");
-                
-                SimpleCounter::ScopedCount c(workerCounter_.get());
-                
+                timeval accept_time;
+                gettimeofday(&accept_time, 0);
+
                 fcgi_streambuf inbuf(req.in, &inv[0], inv.size());
                 fcgi_streambuf outbuf(req.out, &outv[0], outv.size());
 
                 std::istream is(&inbuf);
                 std::ostream os(&outbuf);
 
-                boost::shared_ptr<Request> request(new Request());
-                boost::shared_ptr<Response> response(new Response(&os));
-                {
-                    ResponseDetacher response_detacher(response.get(), ctx);
-                    try {
-                        request->attach(&is, req.envp);
-                        PROFILER_CHECK_POINT("request read and parse");
-                        
-                        const std::string& script_name = request->getScriptFilename();
-                        PROFILER_SET_INFO("overall time for " + script_name);
-                        log()->info("requested file: %s", script_name.c_str());
-                        
-                        handleRequest(request, response, ctx);
-                    }
-                    catch (const BadRequestError &e) {
-                        OperationMode::instance()->sendError(response.get(), 400, e.what());
-                    }
-                }
-                ctx.get() ? responseCounter_->add(ctx.get(), PROFILER_RELEASE()) :
-                    responseCounter_->add(response.get(), PROFILER_RELEASE());
+                processRequest(&is, &os, req.envp, accept_time, ctx);
             }
         }
         catch (const std::exception &e) {
@@ -211,6 +207,47 @@ FCGIServer::handle() {
     FCGX_Free(&req, 1);
 }
 
+void
+FCGIServer::processRequest(std::istream *is, std::ostream *os, char *env[],
+    const timeval &accept_time, boost::shared_ptr<Context> &ctx) {
+
+    PROFILER_FORCE(log(), "overall time");
+
+    SimpleCounter::ScopedCount c(workerCounter_.get());
+
+    boost::shared_ptr<Request> request(new Request());
+    boost::shared_ptr<Response> response(new Response(os));
+    AdmissionControl::Ticket ticket;
+    {
+        ResponseDetacher response_detacher(response.get(), ctx);
+        try {
+            request->attach(is, env);
+            if (gzip_) {
+                response->enableGzip(request.get(), gzip_min_size_);
+            }
+            PROFILER_CHECK_POINT("request read and parse");
+
+            const std::string& script_name = request->getScriptFilename();
+            PROFILER_SET_INFO("overall time for " + script_name);
+            log()->info("requested file: %s", script_name.c_str());
+
+            if (admission_.enabled() &&
+                !admission_.admit(script_name, admission_.startTime(env, accept_time), ticket)) {
+                log()->warn("request shed by admission control: %s", script_name.c_str());
+                OperationMode::instance()->sendError(response.get(), 503, "server overloaded");
+            }
+            else {
+                handleRequest(request, response, ctx);
+            }
+        }
+        catch (const BadRequestError &e) {
+            OperationMode::instance()->sendError(response.get(), 400, e.what());
+        }
+    }
+    ctx.get() ? responseCounter_->add(ctx.get(), PROFILER_RELEASE()) :
+        responseCounter_->add(response.get(), PROFILER_RELEASE());
+}
+
 void
 FCGIServer::pid(const std::string &file) {
     try {
@@ -1,9 +1,12 @@
 #ifndef _XSCRIPT_DAEMON_SERVER_H_
 #define _XSCRIPT_DAEMON_SERVER_H_
 
+#include <iosfwd>
 #include <string>
 #include <boost/thread.hpp>
 
+#include <sys/time.h>
+
 #include <libxml/tree.h>
 
 #include "xscript/block.h"
@@ -11,28 +14,45 @@
 #include "xscript/server.h"
 #include "xscript/simple_counter.h"
 
+#include "admission_control.h"
 #include "uptime_counter.h"
 
 namespace xscript {
 
 class Config;
+class Context;
 class ControlExtension;
 class Request;
 class ServerResponse;
 class Xml;
 
-class FCGIServer : public Server, private boost::thread_group {
+class FCGIServer : public Server, protected boost::thread_group {
 public:
     FCGIServer(Config *config);
     virtual ~FCGIServer();
 
     virtual bool useXsltProfiler() const;
-    void run();
+    virtual void run();
 
 protected:
+    void openSocket();
     void handle();
+
+    /**
+     * Handles single request. Context is returned to be released by caller
+     * after response is finished, cleanup is not delayed for the client then.
+     * Request is rejected with 503 if admission control sheds it.
+     */
+    void processRequest(std::istream *is, std::ostream *os, char *env[],
+        const timeval &accept_time, boost::shared_ptr<Context> &ctx);
+
     void pid(const std::string &file);
 
+protected:
+    int socket_;
+    int inbuf_size_, outbuf_size_;
+    std::auto_ptr<SimpleCounter> workerCounter_;
+
 private:
     std::auto_ptr<Block>
     createResponseTimeCounterBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node);
@@ -43,10 +63,11 @@ private:
 private:
     class RequestAcceptor;
 
-    int socket_;
-    int inbuf_size_, outbuf_size_;
+    bool gzip_;
+    boost::uint32_t gzip_min_size_;
+
+    AdmissionControl admission_;
 
-    std::auto_ptr<SimpleCounter> workerCounter_;
     UptimeCounter uptimeCounter_;
     boost::shared_ptr<ResponseTimeCounter> responseCounter_;
 };
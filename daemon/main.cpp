@@ -15,6 +15,7 @@
 #include <stdexcept>
 #include <sstream>
 
+#include "fcgi_epoll_server.h"
 #include "fcgi_server.h"
 #include "xscript/config.h"
 #include "xscript/logger.h"
@@ -108,8 +109,14 @@ main(int argc, char *argv[]) {
 
         std::auto_ptr<Config> c = Config::create(argc, argv, false, &processUsage);
         VirtualHostData::instance()->setConfig(c.get());
-        FCGIServer server(c.get());
-        server.run();
+        std::auto_ptr<FCGIServer> server;
+        if (c->as<std::string>("/xscript/fastcgi-mode", "threads") == "epoll") {
+            server.reset(new EpollFCGIServer(c.get()));
+        }
+        else {
+            server.reset(new FCGIServer(c.get()));
+        }
+        server->run();
 
         return EXIT_SUCCESS;
     }
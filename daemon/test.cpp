@@ -2,6 +2,7 @@
 
 #include <sstream>
 #include <fstream>
+#include <stdexcept>
 #include <cppunit/TestFixture.h>
 #include <cppunit/ui/text/TestRunner.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -9,9 +10,13 @@
 #include "xscript/config.h"
 #include "xscript/http_utils.h"
 #include "xscript/request.h"
+#include "xscript/simple_counter.h"
 
 #include "internal/parser.h"
 
+#include "admission_control.h"
+#include "fcgi_protocol.h"
+
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
 #endif
@@ -38,6 +43,34 @@ private:
 
 CPPUNIT_TEST_SUITE_REGISTRATION(RequestTest);
 
+class FCGIProtocolTest : public CppUnit::TestFixture {
+public:
+    void testRecord();
+    void testParams();
+
+private:
+    CPPUNIT_TEST_SUITE(FCGIProtocolTest);
+    CPPUNIT_TEST(testRecord);
+    CPPUNIT_TEST(testParams);
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(FCGIProtocolTest);
+
+class AdmissionControlTest : public CppUnit::TestFixture {
+public:
+    void testConcurrency();
+    void testQueueTime();
+
+private:
+    CPPUNIT_TEST_SUITE(AdmissionControlTest);
+    CPPUNIT_TEST(testConcurrency);
+    CPPUNIT_TEST(testQueueTime);
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AdmissionControlTest);
+
 void
 RequestTest::testGet() {
 
@@ -170,6 +203,124 @@ RequestTest::testStatusString() {
     CPPUNIT_ASSERT_EQUAL(std::string("Method Not Allowed"), std::string(HttpUtils::statusToString(405)));
 }
 
+void
+FCGIProtocolTest::testRecord() {
+
+    using namespace xscript;
+
+    std::string content(70000, 'x'), out;
+    FCGIProtocol::appendRecord(out, FCGIProtocol::STDOUT, 258, content.data(), content.size());
+    FCGIProtocol::appendRecord(out, FCGIProtocol::STDOUT, 258, NULL, 0);
+    CPPUNIT_ASSERT_EQUAL((std::string::size_type)0, out.size() % 8);
+
+    FCGIProtocol::Record record;
+    CPPUNIT_ASSERT_EQUAL((std::size_t)0, FCGIProtocol::readRecord(out.data(), 7, record));
+    CPPUNIT_ASSERT_EQUAL((std::size_t)0, FCGIProtocol::readRecord(out.data(), 100, record));
+
+    std::size_t pos = 0, size = 0;
+    std::string result;
+    while (0 != (size = FCGIProtocol::readRecord(out.data() + pos, out.size() - pos, record))) {
+        CPPUNIT_ASSERT_EQUAL((unsigned char)FCGIProtocol::STDOUT, record.type);
+        CPPUNIT_ASSERT_EQUAL((unsigned short)258, record.id);
+        result.append(record.content, record.size);
+        pos += size;
+    }
+    CPPUNIT_ASSERT_EQUAL(out.size(), pos);
+    CPPUNIT_ASSERT_EQUAL((std::size_t)0, record.size);
+    CPPUNIT_ASSERT(content == result);
+
+    std::string bad(8, '\0');
+    CPPUNIT_ASSERT_THROW(FCGIProtocol::readRecord(bad.data(), bad.size(), record), std::runtime_error);
+}
+
+void
+FCGIProtocolTest::testParams() {
+
+    using namespace xscript;
+
+    std::string out, value(300, 'v');
+    FCGIProtocol::appendParam(out, "REQUEST_METHOD", "GET");
+    FCGIProtocol::appendParam(out, "HTTP_COOKIE", value);
+    FCGIProtocol::appendParam(out, "EMPTY", "");
+
+    std::vector<std::string> params;
+    FCGIProtocol::parseParams(out.data(), out.size(), params);
+    CPPUNIT_ASSERT_EQUAL((std::vector<std::string>::size_type)3, params.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("REQUEST_METHOD=GET"), params[0]);
+    CPPUNIT_ASSERT_EQUAL(std::string("HTTP_COOKIE=") + value, params[1]);
+    CPPUNIT_ASSERT_EQUAL(std::string("EMPTY="), params[2]);
+
+    CPPUNIT_ASSERT_THROW(FCGIProtocol::parseParams(out.data(), out.size() - 1, params), std::runtime_error);
+}
+
+void
+AdmissionControlTest::testConcurrency() {
+
+    using namespace xscript;
+
+    std::auto_ptr<Config> config = Config::create("test.conf");
+    std::auto_ptr<SimpleCounter> workers = SimpleCounterFactory::instance()->createCounter("fcgi-workers");
+    AdmissionControl admission(workers.get());
+    admission.init(config.get());
+    CPPUNIT_ASSERT(admission.enabled());
+
+    timeval now;
+    gettimeofday(&now, 0);
+    {
+        AdmissionControl::Ticket t1, t2, t3;
+        CPPUNIT_ASSERT(admission.admit("/usr/local/www/heavy.xml", now, t1));
+        CPPUNIT_ASSERT(!admission.admit("/usr/local/www/heavy.xml", now, t2));
+        CPPUNIT_ASSERT(admission.admit("/usr/local/www/index.xml", now, t2));
+        CPPUNIT_ASSERT(admission.admit("/usr/local/www/index.xml", now, t3));
+
+        AdmissionControl::Ticket t4, t5, t6;
+        CPPUNIT_ASSERT(!admission.admit("/usr/local/www/index.xml", now, t4));
+        CPPUNIT_ASSERT(admission.admit("/usr/local/www/status/stat.xml", now, t5));
+        CPPUNIT_ASSERT(admission.admit("/usr/local/www/status/stat.xml", now, t6));
+    }
+
+    AdmissionControl::Ticket t1;
+    CPPUNIT_ASSERT(admission.admit("/usr/local/www/heavy.xml", now, t1));
+}
+
+void
+AdmissionControlTest::testQueueTime() {
+
+    using namespace xscript;
+
+    std::auto_ptr<Config> config = Config::create("test.conf");
+    std::auto_ptr<SimpleCounter> workers = SimpleCounterFactory::instance()->createCounter("fcgi-workers");
+    AdmissionControl admission(workers.get());
+    admission.init(config.get());
+
+    timeval now, old;
+    gettimeofday(&now, 0);
+    old = now;
+    old.tv_sec -= 2;
+
+    char *env[] = {
+        (char*)"REQUEST_METHOD=GET",
+        (char*)"REQUEST_START=1500000000.250",
+        (char*)NULL
+    };
+    timeval start = admission.startTime(env, now);
+    CPPUNIT_ASSERT_EQUAL((time_t)1500000000, start.tv_sec);
+    CPPUNIT_ASSERT(start.tv_usec > 249000 && start.tv_usec < 251000);
+
+    char *no_start[] = { (char*)"REQUEST_METHOD=GET", (char*)NULL };
+    start = admission.startTime(no_start, now);
+    CPPUNIT_ASSERT_EQUAL(now.tv_sec, start.tv_sec);
+
+    AdmissionControl::Ticket t1, t2, t3;
+    CPPUNIT_ASSERT(admission.admit("/usr/local/www/index.xml", now, t1));
+    CPPUNIT_ASSERT(!admission.admit("/usr/local/www/index.xml", old, t2));
+    CPPUNIT_ASSERT(admission.admit("/usr/local/www/status/stat.xml", old, t3));
+
+    XmlNodeHelper report = admission.createReport();
+    XmlCharHelper shed(xmlGetProp(report.get(), (const xmlChar*)"shed-queue"));
+    CPPUNIT_ASSERT_EQUAL(std::string("1"), std::string((const char*)shed.get()));
+}
+
 int
 main(int argc, char *argv[]) {
     (void)argc;
@@ -31,6 +31,7 @@
 		    <td>Avg time</td>
 		    <td>Min time</td>
 		    <td>Max time</td>
+		    <td>p50/p95/p99 time</td>
 <!--		    <td>Total response</td>  -->
 		    <td>RPS</td>
 		</tr>
@@ -45,7 +46,7 @@
 </xsl:template>
 
 <xsl:template match="status">
-    <tr colspan="8"><td></td></tr>
+    <tr colspan="9"><td></td></tr>
     <tr align="center" style="font-weight:normal;background-color:#dddddd">
         <td><xsl:value-of select="@code"/></td>
 	<td>all</td>
@@ -63,6 +64,7 @@
         </td>
         <td><xsl:value-of select="format-number(math:min(child::point/@min) div 1e6, '#.###')"/></td>
         <td><xsl:value-of select="format-number(math:max(child::point/@max) div 1e6, '#.###')"/></td>	
+        <td></td>
 <!--        <td><xsl:value-of select="sum(child::point/@total)"/></td>  -->
         <td><xsl:value-of select="format-number(sum(child::point/@count) div $collect-time, '#.###')"/></td>
     </tr>
@@ -79,6 +81,11 @@
 	<td><xsl:value-of select="format-number(@avg div 1e6, '#.######')"/></td>
         <td><xsl:value-of select="format-number(@min div 1e6, '#.###')"/></td>
         <td><xsl:value-of select="format-number(@max div 1e6, '#.###')"/></td>
+        <td>
+            <xsl:value-of select="format-number(@p50 div 1e6, '#.###')"/> /
+            <xsl:value-of select="format-number(@p95 div 1e6, '#.###')"/> /
+            <xsl:value-of select="format-number(@p99 div 1e6, '#.###')"/>
+        </td>
 <!--        <td><xsl:value-of select="@total"/></td>   -->
 	<td><xsl:value-of select="format-number(@count div $collect-time, '#.###')"/></td>
     </tr>
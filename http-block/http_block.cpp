@@ -10,10 +10,13 @@
 #include <sstream>
 #include <stdexcept>
 
+#include <boost/bind.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/checked_delete.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <libxml/HTMLparser.h>
+#include <libxml/parser.h>
 
 #include "http_extension.h"
 
@@ -31,6 +34,7 @@
 #include "xscript/request.h"
 #include "xscript/state.h"
 #include "xscript/string_utils.h"
+#include "xscript/thread_pool.h"
 #include "xscript/util.h"
 #include "xscript/writer.h"
 #include "xscript/xml.h"
@@ -72,6 +76,40 @@ private:
     boost::shared_ptr<std::string> data_;
 };
 
+/**
+ * Asynchronous call runs block method twice. First pass goes up to httpCall,
+ * which hands prepared transfer over to the reactor and unwinds with
+ * HttpAsyncStarted. Second pass runs in the pool after transfer is over,
+ * createHelper gives the method the finished transfer and httpCall only
+ * checks its result instead of performing a new one.
+ */
+struct HttpAsyncCall {
+    HttpAsyncCall() : prepare(false), started(false), finished(false) {}
+    bool prepare;
+    bool started;
+    bool finished;
+    boost::function<void (boost::shared_ptr<HttpHelper>)> done;
+    boost::shared_ptr<HttpHelper> transfer;
+};
+
+struct HttpAsyncStarted {};
+
+static void
+releaseAsyncCall(HttpAsyncCall *call) {
+    (void)call;
+}
+
+static boost::thread_specific_ptr<HttpAsyncCall> async_call_(&releaseAsyncCall);
+
+class HttpAsyncScope : private boost::noncopyable {
+public:
+    explicit HttpAsyncScope(HttpAsyncCall *call) {
+        async_call_.reset(call);
+    }
+    ~HttpAsyncScope() {
+        async_call_.reset(NULL);
+    }
+};
 
 static MethodMap methods_;
 static const std::string CONTENT_TYPE_HEADER_NAME("Content-Type");
@@ -202,6 +240,55 @@ HttpBlock::retryCall(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeCon
     invoke_ctx->resultDoc((this->*method_)(ctx.get(), invoke_ctx.get()));
 }
 
+bool
+HttpBlock::invokeAsync(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const {
+    if (tagged() || !HttpHelper::asyncEnabled() || ctx->stopped()) {
+        return false;
+    }
+
+    HttpAsyncCall call;
+    call.prepare = true;
+    call.done = boost::bind(&HttpBlock::asyncDone, this, InvokeHelper(ctx), invoke_ctx, slot, _1);
+    try {
+        // arguments are already processed into invoke_ctx, invalid params
+        // must not start a transfer
+        const std::vector<Param*> &block_params = params();
+        for (std::vector<Param*>::const_iterator i = block_params.begin(); i != block_params.end(); ++i) {
+            (*i)->checkValidator(ctx.get());
+        }
+        HttpAsyncScope scope(&call);
+        BlockTimerStarter starter(ctx.get(), this);
+        (this->*method_)(ctx.get(), invoke_ctx.get());
+    }
+    catch (const HttpAsyncStarted &) {
+        return call.started;
+    }
+    catch (...) {
+        // let ordinary invocation report the error
+    }
+    return false;
+}
+
+void
+HttpBlock::asyncDone(InvokeHelper helper, boost::shared_ptr<InvokeContext> invoke_ctx,
+    unsigned int slot, boost::shared_ptr<HttpHelper> transfer) const {
+
+    // called from reactor completion thread, which runs the completion itself
+    // only if the pool has no free thread
+    boost::function<void()> f = boost::bind(&HttpBlock::asyncComplete, this, helper, invoke_ctx, slot, transfer);
+    ThreadPool::instance()->invokeEx(f, f);
+}
+
+void
+HttpBlock::asyncComplete(InvokeHelper helper, boost::shared_ptr<InvokeContext> invoke_ctx,
+    unsigned int slot, boost::shared_ptr<HttpHelper> transfer) const {
+
+    HttpAsyncCall call;
+    call.transfer = transfer;
+    HttpAsyncScope scope(&call);
+    callInternalThreadedHelper(helper, invoke_ctx, slot);
+}
+
 void
 HttpBlock::property(const char *name, const char *value) {
 
@@ -317,6 +404,21 @@ HttpBlock::createTagKey(const Context *ctx, const InvokeContext *invoke_ctx) con
     return key;
 }
 
+bool
+HttpBlock::argsFromState() const {
+    for (std::vector<Param*>::const_iterator it = headers_.begin(), end = headers_.end(); it != end; ++it) {
+        if ((*it)->fromState()) {
+            return true;
+        }
+    }
+    for (QueryParams::const_iterator it = query_params_.begin(), end = query_params_.end(); it != end; ++it) {
+        if (it->param()->fromState()) {
+            return true;
+        }
+    }
+    return RemoteTaggedBlock::argsFromState();
+}
+
 ArgList*
 HttpBlock::createArgList(Context *ctx, InvokeContext *invoke_ctx) const {
 
@@ -491,7 +593,8 @@ HttpBlock::head(Context *ctx, InvokeContext *invoke_ctx) const {
     std::string url = createCustomGetUrl(invoke_ctx);
     PROFILER(log(), "http.head: " + url);
 
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
     helper.method(STR_HEAD);
 
@@ -509,10 +612,11 @@ HttpBlock::get(Context *ctx, InvokeContext *invoke_ctx) const {
     std::string url = createCustomGetUrl(invoke_ctx);
     PROFILER(log(), "http.get: " + url);
 
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     appendHeaders(helper, ctx->request(), invoke_ctx, true, false);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
     
     createTagInfo(helper, invoke_ctx);
@@ -536,11 +640,12 @@ HttpBlock::del(Context *ctx, InvokeContext *invoke_ctx) const {
     std::string url = createCustomGetUrl(invoke_ctx);
     PROFILER(log(), "http.delete: " + url);
 
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
     helper.method(STR_DELETE);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
 
     createMeta(helper, invoke_ctx);
@@ -565,7 +670,8 @@ HttpBlock::customPost(const std::string &method, Context *ctx, InvokeContext *in
     std::string url = getUrl(args, 0, size - 1);
     PROFILER(log(), "http." + method + ": " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
 
     std::string post_data;
     bool multipart = createPostData(ctx, invoke_ctx, post_data);
@@ -574,7 +680,7 @@ HttpBlock::customPost(const std::string &method, Context *ctx, InvokeContext *in
     helper.postData(post_data.data(), post_data.size());
     helper.method(method);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
 
     createMeta(helper, invoke_ctx);
@@ -602,7 +708,8 @@ HttpBlock::getBinaryPage(Context *ctx, InvokeContext *invoke_ctx) const {
     std::string url = createCustomGetUrl(invoke_ctx);
     PROFILER(log(), "http.getBinaryPage: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
     httpCall(helper);
@@ -659,7 +766,8 @@ HttpBlock::customPostHttp(const std::string &method, Context *ctx, InvokeContext
     }
     PROFILER(log(), "http." + method + "Http: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
 
@@ -672,7 +780,7 @@ HttpBlock::customPostHttp(const std::string &method, Context *ctx, InvokeContext
     }
     helper.method(method);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
 
     createMeta(helper, invoke_ctx);
@@ -725,7 +833,8 @@ HttpBlock::customPostByRequest(const std::string &method, Context *ctx, InvokeCo
     
     PROFILER(log(), "http." + method + "ByRequest: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     appendHeaders(helper, ctx->request(), invoke_ctx, false, is_postdata);
 
     if (is_postdata) {
@@ -738,7 +847,7 @@ HttpBlock::customPostByRequest(const std::string &method, Context *ctx, InvokeCo
     }
     helper.method(method);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
     createMeta(helper, invoke_ctx);
 
@@ -794,10 +903,11 @@ HttpBlock::getByState(Context *ctx, InvokeContext *invoke_ctx) const {
     }
     PROFILER(log(), "http.getByState: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
     createMeta(helper, invoke_ctx);
     
@@ -857,7 +967,8 @@ HttpBlock::headByRequest(Context *ctx, InvokeContext *invoke_ctx) const {
     std::string url = createGetByRequestUrl(ctx, invoke_ctx);
     PROFILER(log(), "http.headByRequest: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
     helper.method(STR_HEAD);
@@ -877,12 +988,13 @@ HttpBlock::customGetByRequest(const std::string &method, Context *ctx, InvokeCon
     std::string url = createGetByRequestUrl(ctx, invoke_ctx);
     PROFILER(log(), "http." + method + "ByRequest: " + url);
     
-    HttpHelper helper(url, getTimeout(ctx, url));
+    std::auto_ptr<HttpHelper> helper_ptr = createHelper(ctx, url);
+    HttpHelper &helper = *helper_ptr;
     
     appendHeaders(helper, ctx->request(), invoke_ctx, false, false);
     helper.method(method);
 
-    httpCall(helper);
+    httpCall(helper, true);
     checkStatus(helper);
 
     createMeta(helper, invoke_ctx);
@@ -1014,6 +1126,68 @@ parseXmlData(const char *buffer, int size, const char *URL, const char *encoding
     return XmlDocHelper(xmlReadMemory(buffer, size, URL, encoding, XML_PARSE_DTDATTR | XML_PARSE_NOENT));
 }
 
+/**
+ * Feeds response chunks into libxml push parser as they come from curl.
+ */
+class XmlStreamParser : public HttpContentConsumer {
+public:
+    XmlStreamParser(const std::string &encoding, bool force_xml, bool load_entities) :
+        ctxt_(NULL), encoding_(encoding), force_xml_(force_xml), load_entities_(load_entities)
+    {}
+
+    virtual ~XmlStreamParser() {
+        if (NULL != ctxt_) {
+            if (NULL != ctxt_->myDoc) {
+                xmlFreeDoc(ctxt_->myDoc);
+            }
+            xmlFreeParserCtxt(ctxt_);
+        }
+    }
+
+    virtual bool start(const std::string &content_type) {
+        if (!force_xml_ && !HttpHelper::isXmlType(content_type)) {
+            return false;
+        }
+        ctxt_ = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, "");
+        if (NULL == ctxt_) {
+            return false;
+        }
+        if (!encoding_.empty()) {
+            xmlCtxtResetPush(ctxt_, NULL, 0, "", encoding_.c_str());
+        }
+        xmlCtxtUseOptions(ctxt_, XML_PARSE_DTDATTR | XML_PARSE_NOENT);
+        return true;
+    }
+
+    virtual bool consume(const char *data, std::size_t size) {
+        // after an error the rest of the body is skipped, error is reported by finish()
+        if (ctxt_->wellFormed) {
+            std::auto_ptr<XmlEntityBlocker> blocker(load_entities_ ? NULL : new XmlEntityBlocker());
+            xmlParseChunk(ctxt_, data, static_cast<int>(size), 0);
+        }
+        return true;
+    }
+
+    XmlDocHelper finish() {
+        if (ctxt_->wellFormed) {
+            std::auto_ptr<XmlEntityBlocker> blocker(load_entities_ ? NULL : new XmlEntityBlocker());
+            xmlParseChunk(ctxt_, NULL, 0, 1);
+        }
+        XmlDocHelper result(ctxt_->myDoc);
+        ctxt_->myDoc = NULL;
+        if (!ctxt_->wellFormed) {
+            result.reset(NULL);
+        }
+        return result;
+    }
+
+private:
+    xmlParserCtxtPtr ctxt_;
+    std::string encoding_;
+    bool force_xml_;
+    bool load_entities_;
+};
+
 static XmlDocHelper
 responseText(const std::string &str) {
 
@@ -1035,6 +1209,14 @@ responseText(const std::string &str) {
 XmlDocHelper
 HttpBlock::response(const HttpHelper &helper, bool error_mode) const {
 
+    XmlStreamParser *parser = dynamic_cast<XmlStreamParser*>(helper.contentConsumer());
+    if (NULL != parser) {
+        XmlDocHelper result(parser->finish());
+        XmlUtils::throwUnless(NULL != result.get(), "Url", helper.url().c_str());
+        OperationMode::instance()->processXmlError(helper.url());
+        return result;
+    }
+
     boost::shared_ptr<std::string> str = helper.content();
 
     if (!error_mode && (parse_flags_ == PARSE_FLAGS_TEXT)) {
@@ -1153,10 +1335,40 @@ HttpBlock::checkStatus(const HttpHelper &helper) const {
     }
 }
 
+std::auto_ptr<HttpHelper>
+HttpBlock::createHelper(Context *ctx, const std::string &url) const {
+    HttpAsyncCall *call = async_call_.get();
+    if (NULL != call && NULL != call->transfer.get()) {
+        // finished transfer keeps its curl handle, no need to acquire another one
+        std::auto_ptr<HttpHelper> helper = call->transfer->release();
+        call->transfer.reset();
+        call->finished = true;
+        return helper;
+    }
+    return std::auto_ptr<HttpHelper>(new HttpHelper(url, getTimeout(ctx, url)));
+}
+
 void
-HttpBlock::httpCall(HttpHelper &helper) const {
+HttpBlock::httpCall(HttpHelper &helper, bool parse_response) const {
+    HttpAsyncCall *call = async_call_.get();
+    if (NULL != call && call->prepare) {
+        // post data and headers still point to the method's locals here
+        boost::shared_ptr<HttpHelper> transfer(helper.release().release());
+        call->started = transfer->performAsync(boost::bind(call->done, transfer));
+        throw HttpAsyncStarted();
+    }
     try {
-        helper.perform();
+        if (NULL != call && call->finished) {
+            call->finished = false;
+            helper.finishAsync();
+        }
+        else {
+            if (parse_response && HttpExtension::streamXml() && parse_flags_ != PARSE_FLAGS_TEXT) {
+                helper.contentConsumer(std::auto_ptr<HttpContentConsumer>(new XmlStreamParser(
+                    charset_, parse_flags_ == PARSE_FLAGS_XML, load_entities_)));
+            }
+            helper.perform();
+        }
     }
     catch(const std::runtime_error &e) {
         throw RetryInvokeError(e.what(), STR_LWR_URL, helper.url());
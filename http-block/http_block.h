@@ -1,6 +1,7 @@
 #ifndef _XSCRIPT_HTTP_BLOCK_H_
 #define _XSCRIPT_HTTP_BLOCK_H_
 
+#include <memory>
 #include <string>
 #include <set>
 #include <vector>
@@ -28,11 +29,14 @@ public:
     HttpBlock(const HttpExtension *ext, Xml *owner, xmlNodePtr node);
     virtual ~HttpBlock();
 
+    virtual bool argsFromState() const;
+
 protected:
     virtual void parseSubNode(xmlNodePtr node);
     virtual void postParse();
     virtual void property(const char *name, const char *value);
     virtual void retryCall(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx) const throw (std::exception);
+    virtual bool invokeAsync(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const;
 
     virtual std::string info(const Context *ctx) const;
     virtual std::string createTagKey(const Context *ctx, const InvokeContext *invoke_ctx) const;
@@ -82,7 +86,13 @@ private:
     int getTimeout(Context *ctx, const std::string &url) const;
     void wrapError(InvokeError &error, const HttpHelper &helper, const XmlNodeHelper &error_body_node) const;
     void checkStatus(const HttpHelper &helper) const;
-    void httpCall(HttpHelper &helper) const;
+    std::auto_ptr<HttpHelper> createHelper(Context *ctx, const std::string &url) const;
+    void httpCall(HttpHelper &helper, bool parse_response = false) const;
+
+    void asyncDone(InvokeHelper helper, boost::shared_ptr<InvokeContext> invoke_ctx,
+        unsigned int slot, boost::shared_ptr<HttpHelper> transfer) const;
+    void asyncComplete(InvokeHelper helper, boost::shared_ptr<InvokeContext> invoke_ctx,
+        unsigned int slot, boost::shared_ptr<HttpHelper> transfer) const;
     void createMeta(HttpHelper &helper, InvokeContext *invoke_ctx) const;
 
     static void checkHeaderParamId(const std::string &repr_name, const std::string &id);
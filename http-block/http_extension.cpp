@@ -23,6 +23,7 @@ bool HttpExtension::checked_headers_ = true;
 bool HttpExtension::checked_query_params_ = true;
 bool HttpExtension::load_entities_ = true;
 bool HttpExtension::keep_alive_ = true;
+bool HttpExtension::stream_xml_ = true;
 
 HttpExtension::HttpExtension() {
 }
@@ -64,7 +65,7 @@ void
 HttpExtension::init(const Config *config) {
     (void)config;
     try {
-        HttpHelper::init();
+        HttpHelper::init(config);
         config->addForbiddenKey("/xscript/http-block");
         checked_headers_ = 0 != config->as<unsigned int>("/xscript/http-block/checked-headers", 1);
         checked_query_params_ = 0 != config->as<unsigned int>("/xscript/http-block/checked-query-params", 1);
@@ -72,8 +73,11 @@ HttpExtension::init(const Config *config) {
         std::string value = config->as<std::string>("/xscript/http-block/load-entities", "yes"); // TODO: default "no"
         load_entities_ = !strcasecmp(value.c_str(), "yes");
 
-        value = config->as<std::string>("/xscript/http-block/keep-alive", "no");
+        value = config->as<std::string>("/xscript/http-block/keep-alive", "yes");
         keep_alive_ = !strcasecmp(value.c_str(), "yes");
+
+        value = config->as<std::string>("/xscript/http-block/stream-xml", "yes");
+        stream_xml_ = !strcasecmp(value.c_str(), "yes");
     }
     catch (const std::exception &e) {
         std::string error_msg("HttpExtension construction: caught exception: ");
@@ -24,6 +24,7 @@ public:
     static bool checkedQueryParams() { return checked_query_params_; }
     static bool loadEntities() { return load_entities_; }
     static bool keepAlive() {return keep_alive_; }
+    static bool streamXml() { return stream_xml_; }
 
 private:
     HttpExtension(const HttpExtension &);
@@ -33,6 +34,7 @@ private:
     static bool checked_query_params_;
     static bool load_entities_;
     static bool keep_alive_;
+    static bool stream_xml_;
 };
 
 } // namespace xscript
@@ -0,0 +1,38 @@
+#ifndef _XSCRIPT_INTERNAL_BINARY_DOC_H_
+#define _XSCRIPT_INTERNAL_BINARY_DOC_H_
+
+#include <cstddef>
+#include <string>
+
+#include "xscript/xml_helpers.h"
+
+namespace xscript {
+
+/**
+ * Versioned binary tree encoding of xml documents for cache storage.
+ *
+ * Layout: 4 byte header ("XBD" and version), table of interned names,
+ * table of namespaces (href and prefix as name indices) and preorder node
+ * stream. Numbers are LEB128 varints, text is stored as length and bytes.
+ * Decoding builds the xmlDoc directly and never tokenizes xml text.
+ */
+class BinaryDoc {
+public:
+    /**
+     * Appends encoded document to buf. Returns false and leaves buf intact
+     * if document holds nodes the format does not cover (dtd, entity
+     * references, xinclude markers).
+     */
+    static bool encode(xmlDocPtr doc, std::string &buf);
+
+    /**
+     * Throws std::runtime_error on malformed or truncated data.
+     */
+    static XmlDocHelper decode(const char *buf, std::size_t size);
+
+    static const unsigned char VERSION;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_INTERNAL_BINARY_DOC_H_
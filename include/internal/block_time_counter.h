@@ -0,0 +1,50 @@
+#ifndef _XSCRIPT_INTERNAL_BLOCK_TIME_COUNTER_H_
+#define _XSCRIPT_INTERNAL_BLOCK_TIME_COUNTER_H_
+
+#include <map>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "xscript/component.h"
+#include "xscript/xml_helpers.h"
+
+namespace xscript {
+
+class Block;
+class ControlExtension;
+class HistogramCounter;
+class Xml;
+
+/**
+ * Invocation time histograms of blocks per extension method.
+ * Reported by control method block-time.
+ */
+class BlockTimeCounter : public Component<BlockTimeCounter> {
+public:
+    BlockTimeCounter();
+    virtual ~BlockTimeCounter();
+
+    virtual void init(const Config *config);
+
+    /**
+     * Histogram shared by all blocks calling the same method. Histograms
+     * live as long as the component, so blocks may keep raw pointer.
+     */
+    HistogramCounter* counter(const Block *block);
+
+    XmlDocHelper createReport() const;
+
+private:
+    std::auto_ptr<Block> createBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node);
+
+private:
+    typedef std::map<std::string, boost::shared_ptr<HistogramCounter> > CounterMapType;
+    CounterMapType counters_;
+    mutable boost::mutex mutex_;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_INTERNAL_BLOCK_TIME_COUNTER_H_
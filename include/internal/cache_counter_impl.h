@@ -20,6 +20,7 @@ public:
 
     void incUsedMemory(size_t amount);
     void decUsedMemory(size_t amount);
+    void incEvictedMemory(size_t amount);
 
     void incLoaded();
     void incInserted();
@@ -33,6 +34,8 @@ private:
     size_t loaded_;
     size_t expired_;
     size_t excluded_;
+    size_t used_memory_;
+    size_t evicted_memory_;
 };
 
 }
@@ -0,0 +1,566 @@
+#ifndef _XSCRIPT_INTERNAL_CLOCK_CACHE_H_
+#define _XSCRIPT_INTERNAL_CLOCK_CACHE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include "xscript/cache_counter.h"
+#include "xscript/tag.h"
+
+#include "internal/lrucache.h"
+
+namespace xscript {
+
+/**
+ * Sharded cache with the LRUCache interface.
+ *
+ * Each shard keeps elements in a contiguous array indexed by an open addressing
+ * table of (hash, index) slots. A hit only stamps the element with the shard tick,
+ * so the critical section never touches list nodes. Victims are chosen by a CLOCK
+ * hand sampling a few live elements and taking the least recently used of them,
+ * expired elements are found first through a min-heap of expire times. Shards of
+ * up to EXACT_LRU_SIZE elements scan all of them, so pools small enough to have
+ * a single shard evict in exact LRU order.
+ *
+ * ExpireFunc may modify element, so loads take the shard mutex exclusively.
+ */
+template<typename Key, typename Data, typename ExpireFunc = TagExpiredFunc<Data>,
+         typename HashFunc = boost::hash<Key> >
+class ClockCache : private boost::noncopyable {
+public:
+    typedef boost::function<void (const Data &data)> CleanupFunc;
+
+    explicit ClockCache(unsigned int size, bool check_expire, CacheCounter &counter);
+    ~ClockCache();
+
+    void clear();
+
+    bool load(const Key &key, Data &data, Tag &tag);
+    bool load(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc);
+
+    /**
+     * Stale-while-revalidate load, see LRUCache::load.
+     */
+    bool load(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool &prefetch);
+
+    /**
+     * Checks for unexpired element without counting access to it.
+     */
+    bool contains(const Key &key);
+    void save(const Key &key, const Data &data, const Tag &tag);
+    void save(const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc);
+    void save(const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc,
+            std::size_t memory);
+
+    std::size_t shrink(const CleanupFunc &cleanFunc);
+    std::size_t memoryUsage() const;
+
+private:
+    class Shard;
+
+    Shard& shard(std::size_t hash) const;
+    bool loadImpl(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool *prefetch);
+
+    static const unsigned int MAX_SHARD_BITS = 4;
+    static const unsigned int MIN_SHARD_SIZE = 16;
+
+private:
+    std::vector<Shard*> shards_;
+    unsigned int shard_bits_;
+    volatile unsigned int shrink_position_;
+    bool check_expire_;
+    HashFunc hash_;
+    ExpireFunc expired_;
+    CacheCounter &counter_;
+};
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+class ClockCache<Key, Data, ExpireFunc, HashFunc>::Shard : private boost::noncopyable {
+public:
+    Shard(unsigned int capacity) :
+        capacity_(capacity), size_(0), hand_(0), tick_(0), memory_(0), slots_(16)
+    {}
+
+    struct Element {
+        Element() : hash_(0), stored_time_(0), access_(0), memory_(0),
+            generation_(0), used_(false), prefetch_marked_(false) {}
+
+        Key key_;
+        Data data_;
+        Tag tag_;
+        std::size_t hash_;
+        time_t stored_time_;
+        unsigned long access_;
+        std::size_t memory_;
+        unsigned int generation_;
+        bool used_;
+        bool prefetch_marked_;
+    };
+
+    struct Slot {
+        Slot() : hash_(0), index_(0) {}
+        std::size_t hash_;
+        unsigned int index_; // element index + 1, 0 for empty slot
+    };
+
+    struct ExpireItem {
+        ExpireItem(time_t expire_time, unsigned int index, unsigned int generation) :
+            expire_time_(expire_time), index_(index), generation_(generation) {}
+        bool operator > (const ExpireItem &item) const {
+            return expire_time_ > item.expire_time_;
+        }
+        time_t expire_time_;
+        unsigned int index_;
+        unsigned int generation_;
+    };
+
+    static const std::size_t NPOS = static_cast<std::size_t>(-1);
+    static const unsigned int SAMPLE_SIZE = 8;
+    static const unsigned int EXACT_LRU_SIZE = 64;
+
+    std::size_t find(const Key &key, std::size_t hash) const {
+        std::size_t mask = slots_.size() - 1;
+        for (std::size_t pos = hash & mask; 0 != slots_[pos].index_; pos = (pos + 1) & mask) {
+            if (slots_[pos].hash_ == hash && elements_[slots_[pos].index_ - 1].key_ == key) {
+                return pos;
+            }
+        }
+        return NPOS;
+    }
+
+    void insertSlot(std::size_t hash, unsigned int index) {
+        if (2 * (size_ + 1) > slots_.size()) {
+            rehash(2 * slots_.size());
+        }
+        std::size_t mask = slots_.size() - 1;
+        std::size_t pos = hash & mask;
+        while (0 != slots_[pos].index_) {
+            pos = (pos + 1) & mask;
+        }
+        slots_[pos].hash_ = hash;
+        slots_[pos].index_ = index + 1;
+    }
+
+    // backward shift deletion keeps probe sequences intact without tombstones
+    void eraseSlot(std::size_t pos) {
+        std::size_t mask = slots_.size() - 1;
+        slots_[pos] = Slot();
+        for (std::size_t next = (pos + 1) & mask; 0 != slots_[next].index_; next = (next + 1) & mask) {
+            std::size_t ideal = slots_[next].hash_ & mask;
+            bool movable = pos <= next ? (ideal <= pos || ideal > next) : (ideal <= pos && ideal > next);
+            if (movable) {
+                slots_[pos] = slots_[next];
+                slots_[next] = Slot();
+                pos = next;
+            }
+        }
+    }
+
+    void rehash(std::size_t size) {
+        std::vector<Slot> slots(size);
+        slots_.swap(slots);
+        std::size_t mask = slots_.size() - 1;
+        for (typename std::vector<Slot>::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+            if (0 == it->index_) {
+                continue;
+            }
+            std::size_t pos = it->hash_ & mask;
+            while (0 != slots_[pos].index_) {
+                pos = (pos + 1) & mask;
+            }
+            slots_[pos] = *it;
+        }
+    }
+
+    unsigned int allocate() {
+        if (!free_.empty()) {
+            unsigned int index = free_.back();
+            free_.pop_back();
+            return index;
+        }
+        elements_.push_back(Element());
+        return elements_.size() - 1;
+    }
+
+    void pushExpire(unsigned int index) {
+        const Element &element = elements_[index];
+        if (Tag::UNDEFINED_TIME == element.tag_.expire_time) {
+            return;
+        }
+        expire_heap_.push_back(ExpireItem(element.tag_.expire_time, index, element.generation_));
+        std::push_heap(expire_heap_.begin(), expire_heap_.end(), std::greater<ExpireItem>());
+        if (expire_heap_.size() > 2 * size_ + 64) {
+            rebuildExpire();
+        }
+    }
+
+    void rebuildExpire() {
+        expire_heap_.clear();
+        for (unsigned int i = 0; i < elements_.size(); ++i) {
+            const Element &element = elements_[i];
+            if (element.used_ && Tag::UNDEFINED_TIME != element.tag_.expire_time) {
+                expire_heap_.push_back(ExpireItem(element.tag_.expire_time, i, element.generation_));
+            }
+        }
+        std::make_heap(expire_heap_.begin(), expire_heap_.end(), std::greater<ExpireItem>());
+    }
+
+    // element with the earliest expire time if it is expired already
+    std::size_t findExpired(ExpireFunc &expired) {
+        while (!expire_heap_.empty()) {
+            const ExpireItem &item = expire_heap_.front();
+            Element &element = elements_[item.index_];
+            if (element.used_ && element.generation_ == item.generation_) {
+                return expired(element.data_, element.tag_) ? item.index_ : NPOS;
+            }
+            std::pop_heap(expire_heap_.begin(), expire_heap_.end(), std::greater<ExpireItem>());
+            expire_heap_.pop_back();
+        }
+        return NPOS;
+    }
+
+    std::size_t findVictim() {
+        std::size_t victim = NPOS;
+        std::size_t sampled = 0, count = elements_.size();
+        std::size_t limit = capacity_ <= EXACT_LRU_SIZE ? count : SAMPLE_SIZE;
+        for (std::size_t i = 0; i < count && sampled < limit; ++i) {
+            if (hand_ >= count) {
+                hand_ = 0;
+            }
+            const Element &element = elements_[hand_];
+            if (element.used_) {
+                if (NPOS == victim || element.access_ < elements_[victim].access_) {
+                    victim = hand_;
+                }
+                ++sampled;
+            }
+            ++hand_;
+        }
+        return victim;
+    }
+
+    void remove(std::size_t index, Data &data, std::size_t &memory) {
+        Element &element = elements_[index];
+        std::size_t pos = find(element.key_, element.hash_);
+        assert(NPOS != pos);
+        eraseSlot(pos);
+        data = element.data_;
+        memory = element.memory_;
+        element.key_ = Key();
+        element.data_ = Data();
+        element.used_ = false;
+        ++element.generation_;
+        free_.push_back(index);
+        --size_;
+        memory_ -= memory;
+    }
+
+    void clear() {
+        std::vector<Element>().swap(elements_);
+        std::vector<unsigned int>().swap(free_);
+        std::vector<Slot>(16).swap(slots_);
+        std::vector<ExpireItem>().swap(expire_heap_);
+        size_ = 0;
+        hand_ = 0;
+        memory_ = 0;
+    }
+
+    mutable boost::mutex mutex_;
+    unsigned int capacity_;
+    unsigned int size_;
+    unsigned int hand_;
+    unsigned long tick_;
+    std::size_t memory_;
+    std::vector<Element> elements_;
+    std::vector<unsigned int> free_;
+    std::vector<Slot> slots_;
+    std::vector<ExpireItem> expire_heap_;
+};
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+ClockCache<Key, Data, ExpireFunc, HashFunc>::ClockCache(
+    unsigned int size, bool check_expire, CacheCounter &counter) :
+    shard_bits_(0), shrink_position_(0), check_expire_(check_expire), counter_(counter)
+{
+    while (shard_bits_ < MAX_SHARD_BITS && (2u << shard_bits_) * MIN_SHARD_SIZE <= size) {
+        ++shard_bits_;
+    }
+    unsigned int count = 1u << shard_bits_;
+    for (unsigned int i = 0; i < count; ++i) {
+        shards_.push_back(new Shard(size / count + (i < size % count ? 1 : 0)));
+    }
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+ClockCache<Key, Data, ExpireFunc, HashFunc>::~ClockCache() {
+    std::for_each(shards_.begin(), shards_.end(), boost::checked_deleter<Shard>());
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+typename ClockCache<Key, Data, ExpireFunc, HashFunc>::Shard&
+ClockCache<Key, Data, ExpireFunc, HashFunc>::shard(std::size_t hash) const {
+    // low bits index slots inside the shard, so pick shard by the mixed high ones
+    unsigned long long mixed = static_cast<unsigned long long>(hash) * 0x9E3779B97F4A7C15ULL;
+    return *shards_[static_cast<std::size_t>(mixed >> (64 - MAX_SHARD_BITS)) & (shards_.size() - 1)];
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+void
+ClockCache<Key, Data, ExpireFunc, HashFunc>::save(const Key &key, const Data &data, const Tag &tag) {
+    CleanupFunc cleanFunc;
+    save(key, data, tag, cleanFunc, 0);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+void
+ClockCache<Key, Data, ExpireFunc, HashFunc>::save(
+    const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc) {
+    save(key, data, tag, cleanFunc, 0);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+void
+ClockCache<Key, Data, ExpireFunc, HashFunc>::save(
+    const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc,
+    std::size_t memory) {
+
+    std::size_t hash = hash_(key);
+    Shard &s = shard(hash);
+
+    Data data_tmp;
+    std::size_t memory_tmp = 0;
+    bool updated = false, removed = false, expired = false;
+
+    boost::mutex::scoped_lock lock(s.mutex_);
+
+    std::size_t index = Shard::NPOS;
+    std::size_t pos = s.find(key, hash);
+    if (Shard::NPOS != pos) {
+        index = s.slots_[pos].index_ - 1;
+        typename Shard::Element &element = s.elements_[index];
+        data_tmp = element.data_;
+        memory_tmp = element.memory_;
+        s.memory_ -= memory_tmp;
+        ++element.generation_;
+        updated = true;
+    }
+    else {
+        if (s.size_ >= s.capacity_) {
+            std::size_t victim = check_expire_ ? s.findExpired(expired_) : Shard::NPOS;
+            expired = Shard::NPOS != victim;
+            if (!expired) {
+                victim = s.findVictim();
+            }
+            if (Shard::NPOS != victim) {
+                s.remove(victim, data_tmp, memory_tmp);
+                removed = true;
+            }
+        }
+        index = s.allocate();
+        s.insertSlot(hash, index);
+        ++s.size_;
+    }
+
+    typename Shard::Element &element = s.elements_[index];
+    element.key_ = key;
+    element.data_ = data;
+    element.tag_ = tag;
+    element.hash_ = hash;
+    element.stored_time_ = time(NULL);
+    element.access_ = ++s.tick_;
+    element.memory_ = memory;
+    element.used_ = true;
+    element.prefetch_marked_ = false;
+    s.memory_ += memory;
+    if (check_expire_) {
+        s.pushExpire(index);
+    }
+
+    lock.unlock();
+
+    if (updated) {
+        counter_.incUpdated();
+    }
+    else {
+        counter_.incInserted();
+    }
+    if (removed) {
+        if (expired) {
+            counter_.incExpired();
+        }
+        else {
+            counter_.incExcluded();
+            counter_.incEvictedMemory(memory_tmp);
+        }
+    }
+    counter_.decUsedMemory(memory_tmp);
+    counter_.incUsedMemory(memory);
+
+    if ((updated || removed) && !cleanFunc.empty()) {
+        cleanFunc(data_tmp);
+    }
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+std::size_t
+ClockCache<Key, Data, ExpireFunc, HashFunc>::shrink(const CleanupFunc &cleanFunc) {
+    for (unsigned int i = 0, count = shards_.size(); i < count; ++i) {
+        Shard &s = *shards_[__sync_fetch_and_add(&shrink_position_, 1) % count];
+
+        boost::mutex::scoped_lock lock(s.mutex_);
+        if (0 == s.size_) {
+            continue;
+        }
+        std::size_t victim = check_expire_ ? s.findExpired(expired_) : Shard::NPOS;
+        bool expired = Shard::NPOS != victim;
+        if (!expired) {
+            victim = s.findVictim();
+        }
+
+        Data data_tmp;
+        std::size_t memory_tmp = 0;
+        s.remove(victim, data_tmp, memory_tmp);
+        lock.unlock();
+
+        if (expired) {
+            counter_.incExpired();
+        }
+        else {
+            counter_.incExcluded();
+            counter_.incEvictedMemory(memory_tmp);
+        }
+        counter_.decUsedMemory(memory_tmp);
+
+        if (!cleanFunc.empty()) {
+            cleanFunc(data_tmp);
+        }
+        return memory_tmp;
+    }
+    return 0;
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+std::size_t
+ClockCache<Key, Data, ExpireFunc, HashFunc>::memoryUsage() const {
+    std::size_t memory = 0;
+    for (typename std::vector<Shard*>::const_iterator it = shards_.begin(); it != shards_.end(); ++it) {
+        boost::mutex::scoped_lock lock((*it)->mutex_);
+        memory += (*it)->memory_;
+    }
+    return memory;
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+bool
+ClockCache<Key, Data, ExpireFunc, HashFunc>::load(const Key &key, Data &data, Tag &tag) {
+    CleanupFunc cleanFunc;
+    return loadImpl(key, data, tag, cleanFunc, NULL);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+bool
+ClockCache<Key, Data, ExpireFunc, HashFunc>::load(
+    const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc) {
+    return loadImpl(key, data, tag, cleanFunc, NULL);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+bool
+ClockCache<Key, Data, ExpireFunc, HashFunc>::load(
+    const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool &prefetch) {
+    prefetch = false;
+    return loadImpl(key, data, tag, cleanFunc, &prefetch);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+bool
+ClockCache<Key, Data, ExpireFunc, HashFunc>::contains(const Key &key) {
+    std::size_t hash = hash_(key);
+    Shard &s = shard(hash);
+
+    boost::mutex::scoped_lock lock(s.mutex_);
+
+    std::size_t pos = s.find(key, hash);
+    if (Shard::NPOS == pos) {
+        return false;
+    }
+    const typename Shard::Element &element = s.elements_[s.slots_[pos].index_ - 1];
+    return !expired_(element.data_, element.tag_);
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+bool
+ClockCache<Key, Data, ExpireFunc, HashFunc>::loadImpl(
+    const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool *prefetch) {
+
+    std::size_t hash = hash_(key);
+    Shard &s = shard(hash);
+
+    boost::mutex::scoped_lock lock(s.mutex_);
+
+    std::size_t pos = s.find(key, hash);
+    if (Shard::NPOS == pos) {
+        return false;
+    }
+
+    unsigned int index = s.slots_[pos].index_ - 1;
+    typename Shard::Element &element = s.elements_[index];
+
+    if (expired_(element.data_, element.tag_)) {
+        Data data_tmp;
+        std::size_t memory_tmp = 0;
+        s.remove(index, data_tmp, memory_tmp);
+        lock.unlock();
+        counter_.incExpired();
+        counter_.decUsedMemory(memory_tmp);
+        if (!cleanFunc.empty()) {
+            cleanFunc(data_tmp);
+        }
+        return false;
+    }
+
+    if (!element.prefetch_marked_ && element.tag_.needPrefetch(element.stored_time_)) {
+        element.prefetch_marked_ = true;
+        if (NULL == prefetch) {
+            return false;
+        }
+        *prefetch = true;
+    }
+
+    data = element.data_;
+    tag = element.tag_;
+    element.access_ = ++s.tick_;
+
+    lock.unlock();
+
+    counter_.incLoaded();
+
+    return true;
+}
+
+template<typename Key, typename Data, typename ExpireFunc, typename HashFunc>
+void
+ClockCache<Key, Data, ExpireFunc, HashFunc>::clear() {
+    std::size_t memory = 0;
+    for (typename std::vector<Shard*>::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+        std::vector<typename Shard::Element> elements_tmp;
+        boost::mutex::scoped_lock lock((*it)->mutex_);
+        elements_tmp.swap((*it)->elements_);
+        memory += (*it)->memory_;
+        (*it)->clear();
+    }
+    counter_.decUsedMemory(memory);
+}
+
+} // namespace xscript
+
+#endif // _XSCRIPT_INTERNAL_CLOCK_CACHE_H_
@@ -0,0 +1,133 @@
+#ifndef _XSCRIPT_FILE_LOGGER_
+#define _XSCRIPT_FILE_LOGGER_
+
+#include <ctime>
+#include <vector>
+#include <string>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/tss.hpp>
+#include "xscript/logger.h"
+#include "xscript/xml_helpers.h"
+
+namespace xscript {
+
+/**
+ * Logger implementation to output into file
+ */
+class FileLogger : public Logger {
+public:
+    /**
+     * Create logger.
+     * \param key Config key optained via subKeys
+     */
+    FileLogger(Logger::LogLevel level, const Config * config, const std::string& key);
+    ~FileLogger();
+
+    virtual void logRotate();
+
+    /**
+     * Report of lines dropped on overflow and producer waits for space.
+     * Collected by LoggerFactory, so logger does not register counter
+     * outliving it.
+     */
+    XmlNodeHelper createReport() const;
+
+protected:
+    virtual void critInternal(const char *format, va_list args);
+    virtual void errorInternal(const char *format, va_list args);
+    virtual void warnInternal(const char *format, va_list args);
+    virtual void infoInternal(const char *format, va_list args);
+    virtual void debugInternal(const char *format, va_list args);
+
+private:
+    // File name
+    std::string filename_;
+
+    // Open mode
+    mode_t openMode_;
+
+    // Crash on error
+    bool crash_;
+
+    // File descriptor
+    int fd_;
+
+    // Lock of file descriptor to avoid logrotate race-condition
+    boost::mutex	fdMutex_;
+
+
+    // Writing queue.
+    // All writes happens in separate thread. Every producing thread formats
+    // lines into its own ring, writing thread drains all rings with writev.
+
+    /**
+     * Single producer single consumer byte ring. Owned both by logger and
+     * by producing thread, freed when both have released it.
+     */
+    struct Ring {
+        Ring(unsigned int owner, size_t capacity);
+        ~Ring();
+
+        // Logger id, thread specific pointer of destroyed logger may be
+        // found by key of new one allocated at the same address
+        unsigned int owner;
+        char *data;
+        size_t capacity;
+        volatile size_t head;
+        volatile size_t tail;
+        volatile int refs;
+
+        // Timestamp prefix formatted at most once per second
+        time_t stampTime;
+        size_t stampSize;
+        char stamp[32];
+    };
+
+    // Unique logger id
+    unsigned int id_;
+
+    // Logger is stopping.
+    volatile bool stopping_;
+
+    // Per thread ring size and overflow policy.
+    size_t ringSize_;
+    bool blockOnOverflow_;
+
+    // Lines lost on ring overflow and producer waits for space.
+    volatile unsigned long dropped_;
+    volatile unsigned long blocked_;
+
+    // Rings of all producing threads.
+    boost::thread_specific_ptr<Ring>	ring_;
+    std::vector<Ring*>			rings_;
+    boost::mutex				ringsMutex_;
+
+    // Writing thread is waiting for lines.
+    volatile bool sleeping_;
+    boost::condition			queueCondition_;
+    boost::mutex				queueMutex_;
+
+    // Producers waiting for space in their rings.
+    volatile int waiting_;
+    boost::condition			spaceCondition_;
+    boost::mutex				spaceMutex_;
+
+    // Writing thread.
+    boost::thread				writingThread_;
+
+
+    void openFile();
+    Ring* ring();
+    size_t formatLine(Ring *ring, char *buf, size_t size, const char *type, const char *format, va_list args);
+    void pushIntoQueue(const char* type, const char* format, va_list args);
+    void wakeWriter();
+    static void releaseRing(Ring *ring);
+
+    void writingThread();
+    bool drain(std::vector<Ring*> &rings);
+};
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _XSCRIPT_INTERNAL_GZIP_H_
+#define _XSCRIPT_INTERNAL_GZIP_H_
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <zlib.h>
+
+namespace xscript {
+
+/**
+ * gzip content coding of http output.
+ */
+class Gzip {
+public:
+    /**
+     * Checks Accept-Encoding request header for gzip with nonzero quality.
+     */
+    static bool accepted(const std::string &accept_encoding);
+    static bool compressible(const std::string &content_type);
+
+    static void compress(const char *data, std::size_t size, std::string &result, int level);
+
+    /**
+     * Throws std::runtime_error on malformed data.
+     */
+    static void decompress(const char *data, std::size_t size, std::string &result);
+};
+
+/**
+ * Compresses data written in chunks into stream.
+ */
+class GzipWriter : private boost::noncopyable {
+public:
+    GzipWriter(std::ostream *os, int level);
+    ~GzipWriter();
+
+    void write(const char *data, std::size_t size);
+
+    /**
+     * Makes all data written so far decodable by client.
+     */
+    void flush();
+    void finish();
+
+private:
+    void deflate(int flush);
+
+private:
+    std::ostream *os_;
+    z_stream stream_;
+    std::vector<char> buffer_;
+    bool finished_;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_INTERNAL_GZIP_H_
@@ -0,0 +1,64 @@
+#ifndef _XSCRIPT_INTERNAL_HISTOGRAM_COUNTER_IMPL_H
+#define _XSCRIPT_INTERNAL_HISTOGRAM_COUNTER_IMPL_H
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+
+#include "xscript/histogram_counter.h"
+#include "internal/counter_impl.h"
+
+namespace xscript {
+
+/**
+ * Log-bucketed time histogram. Every power of two range is split into
+ * 16 linear sub-buckets, so reported percentiles are accurate within 1/16
+ * of value. Measures are spread over per-thread shards with own locks and
+ * shards are merged only when report is built.
+ */
+class HistogramCounterImpl : public HistogramCounter, private CounterImpl {
+public:
+    HistogramCounterImpl(const std::string& name);
+    ~HistogramCounterImpl();
+
+    /**
+     * Add single measure.
+     */
+    virtual void add(boost::uint64_t value);
+
+    virtual boost::uint64_t count() const;
+    virtual boost::uint64_t percentile(double fraction) const;
+
+    virtual XmlNodeHelper createReport() const;
+
+    static unsigned int bucket(boost::uint64_t value);
+    static boost::uint64_t bucketLimit(unsigned int bucket);
+
+    static const unsigned int SUB_BUCKET_BITS = 4;
+    static const unsigned int BUCKET_COUNT = (33 - SUB_BUCKET_BITS) << SUB_BUCKET_BITS;
+    static const unsigned int SHARD_COUNT = 16;
+
+private:
+    struct Shard;
+
+    struct Snapshot {
+        Snapshot();
+        boost::uint64_t percentile(double fraction) const;
+
+        boost::uint64_t count_;
+        boost::uint64_t total_;
+        boost::uint64_t max_;
+        boost::uint64_t min_;
+        std::vector<boost::uint64_t> buckets_;
+    };
+
+    void merge(Snapshot &snapshot) const;
+
+private:
+    boost::scoped_array<Shard> shards_;
+};
+
+}
+
+#endif
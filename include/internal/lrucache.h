@@ -1,6 +1,7 @@
 #ifndef _XSCRIPT_INTERNAL_LRUCACHE_H_
 #define _XSCRIPT_INTERNAL_LRUCACHE_H_
 
+#include <cstddef>
 #include <list>
 #include <map>
 #include <stdexcept>
@@ -41,22 +42,24 @@ public:
 private:
     class ListElement {
     public:
-        ListElement(const Data &data, const Tag &tag, const iterator &iter) :
+        ListElement(const Data &data, const Tag &tag, const iterator &iter, std::size_t memory) :
             data_(data), tag_(tag), map_iterator_(iter),
-            stored_time_(time(NULL)), prefetch_marked_(false) {}
+            stored_time_(time(NULL)), prefetch_marked_(false), memory_(memory) {}
 
         Data data_;
         Tag tag_;
         iterator map_iterator_;
         time_t stored_time_;
         bool prefetch_marked_;
+        std::size_t memory_;
     };
 
     Map key2data_;
     List data_;
     unsigned int max_size_;
     bool check_expire_;
-    boost::mutex mutex_;
+    std::size_t memory_;
+    mutable boost::mutex mutex_;
     ExpireFunc expired_;
 
     CacheCounter& counter_;
@@ -72,18 +75,39 @@ public:
 
     bool load(const Key &key, Data &data, Tag &tag);
     bool load(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc);
+
+    /**
+     * Stale-while-revalidate load. An element due for prefetch is returned
+     * as a hit and \a prefetch is set once for it, so the caller can rebuild
+     * it in background instead of taking a miss.
+     */
+    bool load(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool &prefetch);
     void save(const Key &key, const Data &data, const Tag &tag);
     void save(const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc);
+
+    /**
+     * Save element accounting \a memory bytes for it in memoryUsage().
+     */
+    void save(const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc,
+            std::size_t memory);
+
+    /**
+     * Remove single element from the tail, expired ones first.
+     * Returns number of bytes released or 0 if nothing was removed.
+     */
+    std::size_t shrink(const CleanupFunc &cleanFunc);
+    std::size_t memoryUsage() const;
     
 private:
-    void push_front(const Key &key, const Data &data, const Tag &tag);
-    typename List::iterator getShrinked();
+    void push_front(const Key &key, const Data &data, const Tag &tag, std::size_t memory);
+    typename List::iterator getShrinked(bool &expired);
+    bool loadImpl(const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool *prefetch);
 };
 
 
 template<typename Key, typename Data, typename ExpireFunc>
 LRUCache<Key, Data, ExpireFunc>::LRUCache(unsigned int size, bool check_expire, CacheCounter &counter) :
-    max_size_(size), check_expire_(check_expire), counter_(counter)
+    max_size_(size), check_expire_(check_expire), memory_(0), counter_(counter)
 {}
 
 template<typename Key, typename Data, typename ExpireFunc>
@@ -101,24 +125,37 @@ template<typename Key, typename Data, typename ExpireFunc>
 void
 LRUCache<Key, Data, ExpireFunc>::save(
     const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc) {
+    save(key, data, tag, cleanFunc, 0);
+}
+
+template<typename Key, typename Data, typename ExpireFunc>
+void
+LRUCache<Key, Data, ExpireFunc>::save(
+    const Key &key, const Data &data, const Tag &tag, const CleanupFunc &cleanFunc,
+    std::size_t memory) {
 
     boost::mutex::scoped_lock lock(mutex_);
     
     if (key2data_.empty()) {
-        push_front(key, data, tag);
+        push_front(key, data, tag, memory);
         lock.unlock();
         counter_.incInserted();
+        counter_.incUsedMemory(memory);
         return;
     }
     
     iterator it = key2data_.find(key);
     if (key2data_.end() != it) {
         Data data_tmp = it->second->data_;
+        std::size_t memory_tmp = it->second->memory_;
         data_.erase(it->second);
-        data_.push_front(ListElement(data, tag, it));
+        data_.push_front(ListElement(data, tag, it, memory));
         it->second = data_.begin();
+        memory_ = memory_ - memory_tmp + memory;
         lock.unlock();
         counter_.incUpdated();
+        counter_.decUsedMemory(memory_tmp);
+        counter_.incUsedMemory(memory);
         if (!cleanFunc.empty()) {
             cleanFunc(data_tmp);
         }
@@ -126,44 +163,88 @@ LRUCache<Key, Data, ExpireFunc>::save(
     }
 
     if (key2data_.size() < max_size_) {
-        push_front(key, data, tag);
+        push_front(key, data, tag, memory);
         lock.unlock();
         counter_.incInserted();
+        counter_.incUsedMemory(memory);
         return;
     }
 
-    typename List::iterator erase_it = getShrinked();    
+    bool expired = false;
+    typename List::iterator erase_it = getShrinked(expired);
     Data data_tmp = erase_it->data_;
+    std::size_t memory_tmp = erase_it->memory_;
     key2data_.erase(erase_it->map_iterator_);
     data_.erase(erase_it);
-    push_front(key, data, tag);
+    memory_ -= memory_tmp;
+    push_front(key, data, tag, memory);
     
     lock.unlock();
     counter_.incInserted();
+    counter_.decUsedMemory(memory_tmp);
+    counter_.incUsedMemory(memory);
+    if (!expired) {
+        counter_.incEvictedMemory(memory_tmp);
+    }
+
+    if (!cleanFunc.empty()) {
+        cleanFunc(data_tmp);
+    }
+}
+
+template<typename Key, typename Data, typename ExpireFunc>
+std::size_t
+LRUCache<Key, Data, ExpireFunc>::shrink(const CleanupFunc &cleanFunc) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (data_.empty()) {
+        return 0;
+    }
+
+    bool expired = false;
+    typename List::iterator erase_it = getShrinked(expired);
+    Data data_tmp = erase_it->data_;
+    std::size_t memory_tmp = erase_it->memory_;
+    key2data_.erase(erase_it->map_iterator_);
+    data_.erase(erase_it);
+    memory_ -= memory_tmp;
+
+    lock.unlock();
+    counter_.decUsedMemory(memory_tmp);
+    if (!expired) {
+        counter_.incEvictedMemory(memory_tmp);
+    }
 
     if (!cleanFunc.empty()) {
         cleanFunc(data_tmp);
     }
+    return memory_tmp;
+}
+
+template<typename Key, typename Data, typename ExpireFunc>
+std::size_t
+LRUCache<Key, Data, ExpireFunc>::memoryUsage() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return memory_;
 }
 
 template<typename Key, typename Data, typename ExpireFunc>
 typename LRUCache<Key, Data, ExpireFunc>::List::iterator
-LRUCache<Key, Data, ExpireFunc>::getShrinked() {
+LRUCache<Key, Data, ExpireFunc>::getShrinked(bool &expired) {
     typename List::reverse_iterator delete_it = data_.rbegin();
-    bool expired_found = false;
+    expired = false;
     if (check_expire_) {
         for(typename List::reverse_iterator it = data_.rbegin();
             it != data_.rend();
             ++it) {
             if (expired_(it->data_, it->tag_)) {
-                expired_found = true;
+                expired = true;
                 delete_it = it;
                 break;
             }
         }
     }
     
-    if (expired_found) {
+    if (expired) {
         counter_.incExpired();
     }
     else {
@@ -175,10 +256,12 @@ LRUCache<Key, Data, ExpireFunc>::getShrinked() {
 
 template<typename Key, typename Data, typename ExpireFunc>
 void
-LRUCache<Key, Data, ExpireFunc>::push_front(const Key &key, const Data &data, const Tag &tag) {
-    data_.push_front(ListElement(data, tag, key2data_.end()));
+LRUCache<Key, Data, ExpireFunc>::push_front(
+    const Key &key, const Data &data, const Tag &tag, std::size_t memory) {
+    data_.push_front(ListElement(data, tag, key2data_.end(), memory));
     std::pair<iterator, bool> res = key2data_.insert(std::make_pair(key, data_.begin()));
     data_.begin()->map_iterator_ = res.first;
+    memory_ += memory;
 }
 
 template<typename Key, typename Data, typename ExpireFunc>
@@ -192,6 +275,21 @@ template<typename Key, typename Data, typename ExpireFunc>
 bool
 LRUCache<Key, Data, ExpireFunc>::load(
     const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc) {
+    return loadImpl(key, data, tag, cleanFunc, NULL);
+}
+
+template<typename Key, typename Data, typename ExpireFunc>
+bool
+LRUCache<Key, Data, ExpireFunc>::load(
+    const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool &prefetch) {
+    prefetch = false;
+    return loadImpl(key, data, tag, cleanFunc, &prefetch);
+}
+
+template<typename Key, typename Data, typename ExpireFunc>
+bool
+LRUCache<Key, Data, ExpireFunc>::loadImpl(
+    const Key &key, Data &data, Tag &tag, const CleanupFunc &cleanFunc, bool *prefetch) {
 
     boost::mutex::scoped_lock lock(mutex_);
     
@@ -204,10 +302,13 @@ LRUCache<Key, Data, ExpireFunc>::load(
     
     if (expired_(element.data_, element.tag_)) {
         Data data_tmp = element.data_;       
+        std::size_t memory_tmp = element.memory_;
         data_.erase(it->second);
         key2data_.erase(it);
+        memory_ -= memory_tmp;
         lock.unlock();
         counter_.incExpired();
+        counter_.decUsedMemory(memory_tmp);
         if (!cleanFunc.empty()) {
             cleanFunc(data_tmp);
         }
@@ -216,7 +317,10 @@ LRUCache<Key, Data, ExpireFunc>::load(
     
     if (!element.prefetch_marked_ && element.tag_.needPrefetch(element.stored_time_)) {
         element.prefetch_marked_ = true;
-        return false;
+        if (NULL == prefetch) {
+            return false;
+        }
+        *prefetch = true;
     }
     
     data = element.data_;
@@ -243,6 +347,10 @@ LRUCache<Key, Data, ExpireFunc>::clear() {
     boost::mutex::scoped_lock lock(mutex_);
     key2data_.swap(key2data_tmp);
     data_.swap(data_tmp);
+    std::size_t memory_tmp = memory_;
+    memory_ = 0;
+    lock.unlock();
+    counter_.decUsedMemory(memory_tmp);
 }
 
 } // namespace xscript
@@ -0,0 +1,50 @@
+#ifndef _XSCRIPT_INTERNAL_PAYLOAD_CODEC_H_
+#define _XSCRIPT_INTERNAL_PAYLOAD_CODEC_H_
+
+#include <cstddef>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+namespace xscript {
+
+/**
+ * Compression of serialized cache data. Encoded payload starts with
+ * SIGNATURE, codec id and uncompressed size, so it can be told apart
+ * from raw cache data stored by older versions or below threshold.
+ */
+class PayloadCodec {
+public:
+    enum Type {
+        NONE = 0,
+        DEFLATE = 1,
+        LZ4 = 2
+    };
+
+    /**
+     * Throws std::runtime_error for unknown codec or codec not compiled in.
+     */
+    static Type type(const std::string &name);
+    static const char* name(Type type);
+    static bool available(Type type);
+
+    /**
+     * Replaces data with encoded payload. Returns false and leaves data
+     * intact if compression does not reduce its size.
+     */
+    static bool encode(Type type, std::string &data);
+
+    static bool encoded(const char *data, std::size_t size);
+
+    /**
+     * Throws std::runtime_error on malformed data or codec not compiled in.
+     */
+    static void decode(const char *data, std::size_t size, std::string &result);
+
+    static const boost::uint32_t SIGNATURE;
+    static const std::size_t HEADER_SIZE;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_INTERNAL_PAYLOAD_CODEC_H_
@@ -6,7 +6,7 @@
 
 #include <boost/shared_ptr.hpp>
 
-#include "xscript/average_counter.h"
+#include "xscript/histogram_counter.h"
 #include "xscript/response_time_counter.h"
 #include "xscript/xml_util.h"
 
@@ -15,7 +15,9 @@
 namespace xscript {
 
 /**
- * Counter for measure response time statistic.
+ * Counter for measure response time statistic. Keeps time histograms per
+ * response status and auth type and per script. Histograms are looked up
+ * under counter lock but filled outside of it.
  */
 class ResponseTimeCounterImpl : virtual public ResponseTimeCounter, virtual public CounterImpl {
 public:
@@ -28,19 +30,22 @@ public:
     
     struct StatusInfo {       
         StatusInfo();
-        void add(const char *info, boost::uint64_t value);
+        boost::shared_ptr<HistogramCounter> findCounter(const char *info);
         void createReport(xmlNodePtr root);
         
-        typedef std::map<std::string, boost::shared_ptr<AverageCounter> > CounterMapType;
+        typedef std::map<std::string, boost::shared_ptr<HistogramCounter> > CounterMapType;
         CounterMapType custom_counters_;
     };
     
 private:
     boost::shared_ptr<StatusInfo> findStatusInfo(unsigned short status);
+    boost::shared_ptr<HistogramCounter> findScriptCounter(const std::string &script);
     
 private:   
     typedef std::map<unsigned short, boost::shared_ptr<StatusInfo> > StatusCounterMapType;
     StatusCounterMapType status_counters_;
+    typedef std::map<std::string, boost::shared_ptr<HistogramCounter> > ScriptCounterMapType;
+    ScriptCounterMapType script_counters_;
     time_t reset_time_;
 };
 
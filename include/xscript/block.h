@@ -51,6 +51,12 @@ public:
     const Param* param(const std::string &id, bool throw_error = true) const;
     const std::vector<Param*>& params() const;
 
+    /**
+     * True if arguments or stylesheet of block are read from page state,
+     * so they may differ before and after previous blocks are invoked.
+     */
+    virtual bool argsFromState() const;
+
     virtual void parse();
     virtual std::string fullName(const std::string &name) const;
 
@@ -59,6 +65,8 @@ public:
     virtual void invokeCheckThreaded(boost::shared_ptr<Context> ctx, unsigned int slot); //TODO: remove this
 
     bool invokeCheckThreadedEx(boost::shared_ptr<Context> ctx, unsigned int slot) const;
+    bool invokeCheckThreadedEx(boost::shared_ptr<Context> ctx,
+        boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const;
     virtual bool applyStylesheet(boost::shared_ptr<Context> ctx, XmlDocSharedHelper &doc);
 
     boost::shared_ptr<InvokeContext> errorResult(const char *error, bool info) const;
@@ -75,8 +83,10 @@ public:
     virtual void stopTimer(Context *ctx); //TODO: const
 
     typedef xmlNodePtr (*insertFunc)(xmlNodePtr, xmlNodePtr);
+
+    // move_root allows to take whole root of doc instead of copying it if doc is not used afterwards
     xmlNodePtr processXPointer(const InvokeContext *invoke_ctx, xmlDocPtr doc, xmlDocPtr meta_doc,
-            xmlNodePtr insert_node, insertFunc func) const;
+            xmlNodePtr insert_node, insertFunc func, bool move_root = false) const;
     
     const Extension* extension() const;
     MetaBlock* metaBlock() const;
@@ -101,6 +111,12 @@ protected:
     void callInternalThreaded_Ex(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const;
     void callInternalThreadedHelper(InvokeHelper helper, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const;
 
+    /**
+     * Lets threaded block start its work without occupying a pool thread.
+     * Returns true if the block took care of storing result into slot.
+     */
+    virtual bool invokeAsync(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const;
+
     virtual void callMetaLua(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx); //TODO: const
     virtual ArgList* createArgList(Context *ctx, InvokeContext *invoke_ctx) const;
     void processArguments(Context *ctx, InvokeContext *invoke_ctx) const;
@@ -19,6 +19,7 @@ class CacheCounter : public CounterBase {
 public:
     virtual void incUsedMemory(std::size_t amount) = 0;
     virtual void decUsedMemory(std::size_t amount) = 0;
+    virtual void incEvictedMemory(std::size_t amount) = 0;
 
     virtual void incLoaded() = 0;
     virtual void incInserted() = 0;
@@ -27,6 +27,7 @@ public:
     
     virtual std::string createTagKey(const Context *ctx, const InvokeContext *invoke_ctx) const = 0;
     virtual bool allowDistributed() const;
+    bool allowCoalescing() const;
    
     enum Strategy {
         UNKNOWN = 0,
@@ -59,6 +59,13 @@ public:
             const boost::shared_ptr<InvokeContext> &invoke_ctx,
             const boost::shared_ptr<TypedMap> &local_params,
             unsigned int proxy_flags);
+
+    /**
+     * Detached copy of the context for work outliving the request, like background
+     * cache refresh. Shares script, request and local params, copies state and gets
+     * its own response and timer.
+     */
+    static boost::shared_ptr<Context> createSnapshot(const boost::shared_ptr<Context> &ctx);
     
     void wait(const boost::xtime &until);
     void expect(unsigned int count);
@@ -153,6 +160,9 @@ private:
             InvokeContext *invoke_ctx,
             const boost::shared_ptr<TypedMap> &local_params,
             unsigned int proxy_flags);
+    Context(const boost::shared_ptr<Script> &script,
+            const boost::shared_ptr<RequestData> &request_data,
+            const boost::shared_ptr<TypedMap> &local_params);
     void init();
     bool insertParam(const std::string &key, const boost::any &value);
     bool findParam(const std::string &key, boost::any &value) const;
@@ -1,10 +1,12 @@
 #ifndef _XSCRIPT_DOC_CACHE_H_
 #define _XSCRIPT_DOC_CACHE_H_
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 #include <boost/cstdint.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <xscript/cached_object.h>
@@ -16,6 +18,7 @@
 namespace xscript {
 
 class CachedObject;
+class CacheFlight;
 class Config;
 class Context;
 class DocCacheStrategy;
@@ -36,13 +39,46 @@ public:
     Context* context() const;
     bool allowDistributed() const;
     void allowDistributed(bool flag);
+    bool allowCoalescing() const;
+    void allowCoalescing(bool flag);
+
+    /**
+     * Set when this context became the leader of a coalesced cache miss.
+     * Waiting followers are released when the last copy of it is dropped.
+     */
+    const boost::shared_ptr<CacheFlight>& flight() const;
+    void flight(const boost::shared_ptr<CacheFlight> &flight);
+
+    typedef boost::function<void()> RefreshTask;
+    typedef boost::function<RefreshTask()> RefreshFactory;
+
+    /**
+     * Set by callers able to rebuild the cached object in background. A document
+     * due for prefetch is then loaded as a hit with needRefresh() raised and the
+     * task created by the factory is queued to the cache refresher.
+     */
+    bool allowRefresh() const;
+    void refreshFactory(const RefreshFactory &factory);
+    RefreshTask createRefreshTask() const;
+    bool needRefresh() const;
+    void needRefresh(bool flag);
     
 private:
     CachedObject* obj_;
     Context* ctx_;
     bool allow_distributed_;
+    bool allow_coalescing_;
+    boost::shared_ptr<CacheFlight> flight_;
+    RefreshFactory refresh_factory_;
+    bool need_refresh_;
 };
 
+/**
+ * Objects whose cached documents are fetched in one batch before they
+ * are loaded one by one, see DocCache::prefetchDocs.
+ */
+typedef std::vector<std::pair<InvokeContext*, CacheContext*> > CachePrefetchList;
+
 class CacheData : private boost::noncopyable {
 public:
     CacheData();
@@ -52,7 +88,19 @@ public:
     
     virtual bool parse(const char *buf, boost::uint32_t size) = 0;
     virtual bool serialize(std::string &buf) = 0;
+
+    /**
+     * Serializes using compact binary document encoding where supported,
+     * falls back to serialize() otherwise. parse() reads both forms.
+     */
+    virtual bool serializeBinary(std::string &buf);
+
     virtual void cleanup(Context *ctx) = 0;
+
+    /**
+     * Approximate heap footprint used to keep memory caches in byte budget.
+     */
+    virtual std::size_t memoryUsage() const = 0;
 };
 
 class BlockCacheData : public CacheData {
@@ -65,14 +113,20 @@ public:
 
     virtual bool parse(const char *buf, boost::uint32_t size);
     virtual bool serialize(std::string &buf);
+    virtual bool serializeBinary(std::string &buf);
     virtual void cleanup(Context *ctx);
+    virtual std::size_t memoryUsage() const;
 
     const XmlDocSharedHelper& doc() const;
     const boost::shared_ptr<MetaCore>& meta() const;
+private:
+    void serializeMeta(std::string &buf, boost::uint32_t signature) const;
+
 private:
     XmlDocSharedHelper doc_;
     boost::shared_ptr<MetaCore> meta_;
     static const boost::uint32_t SIGNATURE;
+    static const boost::uint32_t BINARY_SIGNATURE;
 };
 
 class PageCacheData : public CacheData, public BinaryWriter {
@@ -86,15 +140,23 @@ public:
     virtual bool parse(const char *buf, boost::uint32_t size);
     virtual bool serialize(std::string &buf);
     virtual void cleanup(Context *ctx);
+    virtual std::size_t memoryUsage() const;
     
     void append(const char *buf, std::streamsize size);
     void addHeader(const std::string &name, const std::string &value);
     void expireTimeDelta(boost::uint32_t delta);
     
+    /**
+     * Stores page gzipped if its content type is compressible and it is
+     * not smaller than min_size. Should be called after all data appended.
+     */
+    void compress(boost::uint32_t min_size);
+    bool gzipped() const;
+
     virtual void write(std::ostream *os, const Response *response) const; // TODO: remove const
     virtual std::streamsize size() const;
     
-    const std::string& etag() const;
+    std::string etag(bool gzip = false) const;
     bool notModified(Context *ctx) const;
 
 private:
@@ -105,7 +167,9 @@ private:
     std::vector<std::pair<std::string, std::string> > headers_;
     boost::uint32_t expire_time_delta_;
     mutable std::string etag_; // TODO: remove mutable
+    bool gzipped_;
     static const boost::uint32_t SIGNATURE;
+    static const boost::uint32_t GZIP_SIGNATURE;
 };
 
 class DocCacheBase {
@@ -118,6 +182,13 @@ public:
     virtual void init(const Config *config);
     void addStrategy(DocCacheStrategy *strategy, const std::string &name);
 
+    /**
+     * Joins background writers, whose queued saves may be bound to strategy,
+     * and forgets the strategy. Saves of other strategies are stored in the
+     * calling thread afterwards. Not safe while requests are served.
+     */
+    void removeStrategy(DocCacheStrategy *strategy);
+
     static bool checkTag(const Context *ctx, const TaggedBlock *block, const Tag &tag, const char *operation);
 
 protected:
@@ -125,8 +196,12 @@ protected:
             Tag &tag, boost::shared_ptr<CacheData> &cache_data);
     bool saveDocImpl(const InvokeContext *invoke_ctx, CacheContext *cache_ctx,
             const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
+    void prefetchDocsImpl(const CachePrefetchList &objects);
     
     bool allow(const DocCacheStrategy* strategy, const CacheContext *cache_ctx) const;
+    bool prefetchSupported() const;
+    bool coalesceMiss(CacheContext *cache_ctx, const std::string &key,
+            Tag &tag, boost::shared_ptr<CacheData> &cache_data);
     
     class StatInfo;
     virtual void createUsageCounter(boost::shared_ptr<StatInfo> info) = 0;
@@ -147,6 +222,15 @@ public:
     bool saveDoc(const InvokeContext *invoke_ctx, CacheContext *cache_ctx,
         const Tag &tag, const boost::shared_ptr<BlockCacheData> &cache_data);
 
+    /**
+     * Lets strategies able to batch requests fetch documents of all objects
+     * missing in the local strategies before them at once. Fetched documents
+     * are kept in context and created keys in invoke contexts for later
+     * loadDoc calls.
+     */
+    void prefetchDocs(const CachePrefetchList &objects);
+    bool prefetchEnabled() const;
+
 protected:
     DocCache();
     
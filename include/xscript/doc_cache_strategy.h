@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
 #include <boost/utility.hpp>
 
 #include <xscript/cached_object.h>
@@ -13,6 +15,7 @@
 
 namespace xscript {
 
+class AverageCounter;
 class Context;
 class StatBuilder;
 class Tag;
@@ -44,12 +47,66 @@ public:
             const Tag& tag, const boost::shared_ptr<CacheData> &cache_data) = 0;
     
     virtual void fillStatBuilder(StatBuilder *builder);
+
+    /**
+     * Strategies with batch requests fetch documents of all keys at once
+     * and keep them in context until loadDoc of the same key.
+     */
+    virtual bool prefetchSupported() const;
+    virtual void prefetchDocs(Context *ctx, const std::vector<const TagKey*> &keys);
+
+    /**
+     * Local strategies check for a document without loading it, objects
+     * found there are not prefetched from the strategies that follow.
+     */
+    virtual bool containsDoc(const TagKey *key);
+
+    /**
+     * Strategies with slow storage split saving in two steps: document is
+     * serialized in the calling thread and returned task stores it later in
+     * a background writer thread. Task must not use context of the request.
+     * Empty task means document is not saved.
+     */
+    virtual bool writeBehindSupported() const;
+    virtual boost::function<bool()> createSaveTask(const TagKey *key,
+            const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
     
     virtual CachedObject::Strategy strategy() const = 0;
 
 protected:
     
     virtual void insert2Cache(const std::string &no_cache);
+
+    /**
+     * Removes strategy from caches it was inserted into. Write-behind
+     * strategies call it in destructor, before members used by their
+     * save tasks are destroyed.
+     */
+    void removeFromCaches();
+
+    /**
+     * Reads document format (text or binary) used to store cache data.
+     */
+    void docFormat(const std::string &format);
+
+    /**
+     * Sets codec (none, deflate or lz4) for serialized data of at least
+     * threshold bytes. Compressed data is read regardless of settings.
+     */
+    void compression(const std::string &codec, boost::uint32_t threshold);
+
+    bool serialize(CacheData *cache_data, std::string &buf) const;
+    bool parse(CacheData *cache_data, const char *buf, boost::uint32_t size) const;
+
+private:
+    bool page_cache_;
+    bool block_cache_;
+    bool binary_format_;
+    int codec_;
+    boost::uint32_t compress_threshold_;
+    std::auto_ptr<AverageCounter> compress_ratio_counter_;
+    std::auto_ptr<AverageCounter> compress_time_counter_;
+    std::auto_ptr<AverageCounter> decompress_time_counter_;
 };
 
 } // namespace xscript
@@ -0,0 +1,44 @@
+#ifndef _XSCRIPT_HISTOGRAM_COUNTER_H_
+#define _XSCRIPT_HISTOGRAM_COUNTER_H_
+
+#include <string>
+#include <memory>
+#include <boost/cstdint.hpp>
+
+#include <xscript/component.h>
+#include <xscript/counter_base.h>
+
+namespace xscript {
+
+/**
+ * Time distribution gatherer. Reports min/max/avg time for something
+ * like AverageCounter does together with p50/p95/p99/p999 percentiles.
+ */
+class HistogramCounter : public CounterBase {
+
+public:
+    /**
+     * Add single measure.
+     */
+    virtual void add(boost::uint64_t value) = 0;
+
+    virtual boost::uint64_t count() const = 0;
+
+    /**
+     * Value not exceeded by given fraction of measures, e.g. 0.99.
+     */
+    virtual boost::uint64_t percentile(double fraction) const = 0;
+};
+
+class HistogramCounterFactory : public Component<HistogramCounterFactory> {
+public:
+    HistogramCounterFactory();
+    ~HistogramCounterFactory();
+
+    virtual void init(const Config *config);
+    virtual std::auto_ptr<HistogramCounter> createCounter(const std::string& name, bool want_real = false);
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_HISTOGRAM_COUNTER_H_
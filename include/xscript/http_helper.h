@@ -1,12 +1,14 @@
 #ifndef _XSCRIPT_HTTP_HELPER_H_
 #define _XSCRIPT_HTTP_HELPER_H_
 
+#include <cstddef>
 #include <string>
 #include <map>
 #include <vector>
 
 #include <time.h>
 
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 
@@ -16,8 +18,24 @@
 
 namespace xscript {
 
+class Config;
 class Request;
 
+/**
+ * Takes body of successful (200, 201) response chunk by chunk as it arrives
+ * instead of collecting it into HttpHelper::content().
+ */
+class HttpContentConsumer {
+public:
+    virtual ~HttpContentConsumer() {}
+
+    // called before the first chunk, false leaves the body in content()
+    virtual bool start(const std::string &content_type) = 0;
+
+    // false aborts the transfer
+    virtual bool consume(const char *data, std::size_t size) = 0;
+};
+
 class HttpHelper : private boost::noncopyable {
 public:
     HttpHelper(const std::string &url, long timeout);
@@ -25,6 +43,18 @@ public:
 
     static void init();
 
+    /**
+     * Also configures reuse of keep-alive connections from /xscript/http-block:
+     * keep-alive (yes/no), keep-alive-idle-per-host, keep-alive-idle-max.
+     */
+    static void init(const Config *config);
+
+    /**
+     * True if /xscript/http-block/async is on and transfers may be driven by
+     * the reactor thread instead of blocking the caller.
+     */
+    static bool asyncEnabled();
+
     void appendHeaders(const std::vector<std::string> &headers, time_t modified_since);
     void postData(const void* data, long size);
 
@@ -33,6 +63,20 @@ public:
     long perform();
     long fastPerform(); // without checking result code and detecting content type
 
+    /**
+     * Starts the transfer on the reactor thread. Callback is called from the
+     * reactor completion thread when the transfer is over, the helper must be
+     * alive until then. finishAsync() checks the result the same way perform() does.
+     */
+    bool performAsync(const boost::function<void()> &callback);
+    long finishAsync();
+
+    void contentConsumer(std::auto_ptr<HttpContentConsumer> consumer); // before perform
+    HttpContentConsumer* contentConsumer() const; // NULL unless consumer took the body
+
+    std::auto_ptr<HttpHelper> release(); // moves transfer to new helper, this one becomes unusable
+    void swap(HttpHelper &helper);
+
     long status() const;
 
     long errorCode() const;
@@ -65,10 +109,13 @@ public:
     bool isJson() const; 
     bool isOk() const;
 
+    static bool isXmlType(const std::string &content_type);
+
 protected:
     void detectContentType();
 
 private:
+    HttpHelper();
     HttpHelper(const HttpHelper &);
     HttpHelper& operator = (const HttpHelper &);
 
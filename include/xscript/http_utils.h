@@ -41,6 +41,12 @@ public:
     static const std::string IF_NONE_MATCH_HEADER_NAME;
     static const std::string EXPIRES_HEADER_NAME;
     static const std::string ETAG_HEADER_NAME;
+    static const std::string ACCEPT_ENCODING_HEADER_NAME;
+    static const std::string STATUS_HEADER_NAME;
+    static const std::string CONTENT_TYPE_HEADER_NAME;
+    static const std::string CONTENT_LENGTH_HEADER_NAME;
+    static const std::string CONTENT_ENCODING_HEADER_NAME;
+    static const std::string VARY_HEADER_NAME;
 
 private:
     HttpUtils();
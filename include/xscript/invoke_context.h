@@ -1,7 +1,10 @@
 #ifndef _XSCRIPT_INVOKE_CONTEXT_H_
 #define _XSCRIPT_INVOKE_CONTEXT_H_
 
+#include <vector>
+
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "xscript/xml_helpers.h"
 
@@ -37,6 +40,11 @@ public:
     bool tagged() const;
     bool haveCachedCopy() const;
     void haveCachedCopy(bool flag);
+
+    // result doc is also held by block cache, its nodes must be copied, not moved
+    bool sharedResult() const;
+    void sharedResult(bool flag);
+
     void tagKey(const boost::shared_ptr<TagKey> &key);
     
     void resultDoc(const XmlDocSharedHelper &doc);
@@ -52,6 +60,13 @@ public:
     bool success() const;
     bool noCache() const;
     TagKey* tagKey() const;
+
+    /**
+     * Keys created by doc cache strategies while prefetching, indexed by
+     * strategy. Loading the document reuses them instead of new ones.
+     */
+    void prefetchKeys(std::vector<boost::shared_ptr<TagKey> > &keys);
+    const boost::shared_ptr<TagKey>& prefetchKey(unsigned int strategy) const;
     
     void setLocalContext(const boost::shared_ptr<Context> &ctx);
     const boost::shared_ptr<Context>& getLocalContext() const;
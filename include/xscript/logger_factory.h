@@ -12,6 +12,8 @@
 
 namespace xscript {
 
+class CounterBase;
+
 class LoggerFactory : public Component<LoggerFactory> {
 public:
     LoggerFactory();
@@ -44,15 +46,18 @@ public:
     // flags != 0
     static bool wrapFormat(const char *fmt, unsigned char flags, std::string &fmt_new);
 
+    typedef std::map<std::string, boost::shared_ptr<Logger> > LoggerMap;
+
 private:
     // Get level from string. Fallback to LEVEL_CRIT if passed something wrong.
     Logger::LogLevel stringToLevel(const std::string& level);
 
     Logger *defaultLogger_;
 
-    typedef std::map<std::string, boost::shared_ptr<Logger> > LoggerMap;
     LoggerMap loggers_;
 
+    std::auto_ptr<CounterBase> counter_;
+
 };
 
 } // namespace xscript
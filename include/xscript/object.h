@@ -25,6 +25,8 @@ public:
     std::string xsltName(const Context *ctx) const;
     bool xsltDefined() const;
     const std::vector<Param*>& xsltParams() const;
+    bool xsltParamDuplicated(unsigned int index) const;
+    bool xsltFromState() const;
 
     virtual std::string fullName(const std::string &name) const = 0;
     virtual bool applyStylesheet(boost::shared_ptr<Context> ctx, XmlDocSharedHelper &doc) = 0;
@@ -33,6 +33,11 @@ public:
 
     virtual bool constant() const;
 
+    /**
+     * True if value is read from page state, previous blocks may change it.
+     */
+    virtual bool fromState() const;
+
     virtual std::string asString(const Context *ctx) const = 0;
     virtual void add(const Context *ctx, ArgList &al) const = 0;
 
@@ -53,6 +53,20 @@ public:
     const CookieSet& outCookies() const;
     boost::uint32_t expireDelta() const;
     
+    /**
+     * Allows gzip content coding of text output and cached pages if request
+     * accepts it. Pages are stored in cache gzipped regardless of request.
+     */
+    void enableGzip(const Request *request, boost::uint32_t min_size);
+    bool acceptGzip() const;
+
+    /**
+     * Flushes text output after its first chunk and/or every flush_size
+     * bytes. With either set, a page being cached is also written to the
+     * stream as it is produced instead of after it is complete.
+     */
+    void setFlushPolicy(bool flush_head, boost::uint32_t flush_size);
+
     void detach(Context *ctx);
     void setCacheable(
         boost::shared_ptr<PageCacheData> cache_data = boost::shared_ptr<PageCacheData>());
@@ -37,6 +37,13 @@ public:
 
     bool forceStylesheet() const;
     bool binaryPage() const;
+
+    /**
+     * Output flush policy: flush after the first chunk of the page is
+     * serialized and/or every flushSize() bytes, 0 means never.
+     */
+    bool flushHead() const;
+    boost::uint32_t flushSize() const;
     boost::uint32_t expireTimeDelta() const;
     bool expireTimeDeltaUndefined() const;
     bool allowMethod(const std::string& value) const;
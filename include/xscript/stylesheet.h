@@ -36,6 +36,12 @@ public:
     static boost::shared_ptr<Context> getContext(xsltTransformContextPtr tctx);
     static Stylesheet* getStylesheet(xsltTransformContextPtr tctx);
     static const Block* getBlock(xsltTransformContextPtr tctx);
+
+    /**
+     * Number of idle transform contexts kept by each stylesheet for reuse.
+     * Zero disables reuse, every transform gets a fresh context.
+     */
+    static void transformContextPoolSize(unsigned int size);
     
     Block* block(xmlNodePtr node);
 
@@ -14,6 +14,8 @@ public:
     StylesheetFactory();
     virtual ~StylesheetFactory();
 
+    virtual void init(const Config *config);
+
     static boost::shared_ptr<Stylesheet> createStylesheet(const std::string &name);
     
 protected:    
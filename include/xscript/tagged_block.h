@@ -2,6 +2,9 @@
 #define _XSCRIPT_TAGGED_BLOCK_H_
 
 #include <ctime>
+#include <vector>
+
+#include <boost/function.hpp>
 
 #include <xscript/block.h>
 #include <xscript/cached_object.h>
@@ -34,9 +37,20 @@ public:
 
     void cacheLevel(unsigned char type, bool value);
     bool cacheLevel(unsigned char type) const;
+
+    /**
+     * Computes cache keys of tagged blocks in list and lets cache strategies
+     * fetch their documents in one batch before invocation. Blocks with
+     * arguments read from state are skipped, previous blocks may change them.
+     * Invoke contexts of prefetched blocks are returned by block position
+     * to be used for invocation.
+     */
+    static void prefetchCachedDocs(boost::shared_ptr<Context> ctx, const std::vector<Block*> &blocks,
+        std::vector<boost::shared_ptr<InvokeContext> > &invoke_contexts);
     
 protected:
     bool cacheTimeUndefined() const;
+    bool useCache(const Context *ctx) const;
     virtual void invokeInternal(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx);
     virtual void postCall(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx);
     virtual void postParse();
@@ -56,6 +70,10 @@ protected:
 
     bool processCachedDoc(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, const Tag &tag);
 
+private:
+    boost::function<void()> createRefreshTask(boost::shared_ptr<Context> ctx);
+    void refresh(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx);
+
 private:
     struct TaggedBlockData;
     std::auto_ptr<TaggedBlockData> tb_data_;
@@ -42,6 +42,7 @@ public:
     }
     virtual bool serialize(std::string &buf) { (void)buf; return false; }
     virtual void cleanup(Context *ctx) { (void)ctx; }
+    virtual std::size_t memoryUsage() const;
 
     const std::string& key() const { return key_; }
     const TypedValue& value() const { return value_; }
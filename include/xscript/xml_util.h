@@ -1,6 +1,7 @@
 #ifndef _XSCRIPT_XML_UTIL_H_
 #define _XSCRIPT_XML_UTIL_H_
 
+#include <cstddef>
 #include <map>
 #include <string>
 
@@ -80,6 +81,19 @@ public:
     static bool validate(const std::string &data);
     
     static std::string getUniqueNodeId(xmlNodePtr node);
+
+    /**
+     * Approximate heap footprint of document: nodes, attributes, namespaces,
+     * text and dictionary strings referenced by the tree.
+     */
+    static std::size_t memoryUsage(xmlDocPtr doc);
+
+    /**
+     * Unlinks node with its subtree from its document and adopts it into doc
+     * without copying: dictionary strings and namespaces are reconciled.
+     * Returns node, which is not linked anywhere in doc yet.
+     */
+    static xmlNodePtr moveNode(xmlNodePtr node, xmlDocPtr doc);
     
     static int xmlVersionNumber();
     static int xsltVersionNumber();
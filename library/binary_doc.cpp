@@ -0,0 +1,499 @@
+#include "settings.h"
+
+#include <cstring>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <libxml/tree.h>
+#include <libxml/dict.h>
+#include <libxml/parserInternals.h>
+#include <libxml/valid.h>
+
+#include "internal/binary_doc.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+const unsigned char BinaryDoc::VERSION = 1;
+
+namespace {
+
+enum RecordType {
+    RECORD_END = 0,
+    RECORD_ELEMENT,
+    RECORD_TEXT,
+    RECORD_TEXT_NOENC,
+    RECORD_CDATA,
+    RECORD_COMMENT,
+    RECORD_PI
+};
+
+const char HEADER[] = { 'X', 'B', 'D' };
+const std::size_t HEADER_SIZE = sizeof(HEADER) + 1;
+
+void
+appendNumber(std::string &buf, boost::uint32_t value) {
+    while (value >= 0x80) {
+        buf.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    buf.push_back(static_cast<char>(value));
+}
+
+void
+appendString(std::string &buf, const xmlChar *str) {
+    boost::uint32_t size = NULL == str ? 0 : xmlStrlen(str);
+    appendNumber(buf, size);
+    buf.append((const char*)str, size);
+}
+
+class Encoder {
+public:
+    bool encode(xmlDocPtr doc, std::string &buf);
+
+private:
+    boost::uint32_t name(const xmlChar *name);
+    boost::uint32_t ns(xmlNsPtr ns);
+    bool element(xmlNodePtr node);
+    bool node(xmlNodePtr node);
+
+    std::map<const xmlChar*, boost::uint32_t> name_ptrs_;
+    std::map<std::string, boost::uint32_t> name_index_;
+    std::vector<const xmlChar*> names_;
+    std::map<xmlNsPtr, boost::uint32_t> ns_index_;
+    std::vector<xmlNsPtr> namespaces_;
+    std::string nodes_;
+    std::string value_;
+};
+
+boost::uint32_t
+Encoder::name(const xmlChar *name) {
+    if (NULL == name) {
+        name = (const xmlChar*)"";
+    }
+    std::map<const xmlChar*, boost::uint32_t>::iterator it = name_ptrs_.find(name);
+    if (name_ptrs_.end() != it) {
+        return it->second;
+    }
+    std::pair<std::map<std::string, boost::uint32_t>::iterator, bool> res =
+        name_index_.insert(std::make_pair(std::string((const char*)name), names_.size()));
+    if (res.second) {
+        names_.push_back(name);
+    }
+    name_ptrs_.insert(std::make_pair(name, res.first->second));
+    return res.first->second;
+}
+
+boost::uint32_t
+Encoder::ns(xmlNsPtr ns) {
+    std::pair<std::map<xmlNsPtr, boost::uint32_t>::iterator, bool> res =
+        ns_index_.insert(std::make_pair(ns, namespaces_.size()));
+    if (res.second) {
+        namespaces_.push_back(ns);
+        name(ns->href);
+        if (NULL != ns->prefix) {
+            name(ns->prefix);
+        }
+    }
+    return res.first->second;
+}
+
+bool
+Encoder::element(xmlNodePtr node) {
+    nodes_.push_back(RECORD_ELEMENT);
+    appendNumber(nodes_, name(node->name));
+
+    boost::uint32_t count = 0;
+    for (xmlNsPtr def = node->nsDef; NULL != def; def = def->next) {
+        ++count;
+    }
+    appendNumber(nodes_, count);
+    for (xmlNsPtr def = node->nsDef; NULL != def; def = def->next) {
+        appendNumber(nodes_, ns(def));
+    }
+    appendNumber(nodes_, NULL == node->ns ? 0 : ns(node->ns) + 1);
+
+    count = 0;
+    for (xmlAttrPtr attr = node->properties; NULL != attr; attr = attr->next) {
+        ++count;
+    }
+    appendNumber(nodes_, count);
+    for (xmlAttrPtr attr = node->properties; NULL != attr; attr = attr->next) {
+        appendNumber(nodes_, name(attr->name));
+        appendNumber(nodes_, NULL == attr->ns ? 0 : ns(attr->ns) + 1);
+        value_.clear();
+        for (xmlNodePtr child = attr->children; NULL != child; child = child->next) {
+            if (XML_TEXT_NODE != child->type) {
+                return false;
+            }
+            if (NULL != child->content) {
+                value_.append((const char*)child->content);
+            }
+        }
+        appendNumber(nodes_, value_.size());
+        nodes_.append(value_);
+    }
+    return true;
+}
+
+bool
+Encoder::node(xmlNodePtr node) {
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+            return element(node);
+        case XML_TEXT_NODE:
+            nodes_.push_back(node->name == xmlStringTextNoenc ? RECORD_TEXT_NOENC : RECORD_TEXT);
+            appendString(nodes_, node->content);
+            return true;
+        case XML_CDATA_SECTION_NODE:
+            nodes_.push_back(RECORD_CDATA);
+            appendString(nodes_, node->content);
+            return true;
+        case XML_COMMENT_NODE:
+            nodes_.push_back(RECORD_COMMENT);
+            appendString(nodes_, node->content);
+            return true;
+        case XML_PI_NODE:
+            nodes_.push_back(RECORD_PI);
+            appendNumber(nodes_, name(node->name));
+            appendString(nodes_, node->content);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+Encoder::encode(xmlDocPtr doc, std::string &buf) {
+    xmlNodePtr node = doc->children;
+    while (NULL != node) {
+        if (!this->node(node)) {
+            return false;
+        }
+        if (XML_ELEMENT_NODE == node->type) {
+            if (NULL != node->children) {
+                node = node->children;
+                continue;
+            }
+            nodes_.push_back(RECORD_END);
+        }
+        while (NULL != node && NULL == node->next) {
+            node = node->parent;
+            if ((xmlNodePtr)doc == node) {
+                node = NULL;
+                break;
+            }
+            nodes_.push_back(RECORD_END);
+        }
+        if (NULL != node) {
+            node = node->next;
+        }
+    }
+    nodes_.push_back(RECORD_END);
+
+    std::size_t size = buf.size();
+    buf.reserve(size + nodes_.size() + 16 * names_.size() + 64);
+    buf.append(HEADER, sizeof(HEADER));
+    buf.push_back(static_cast<char>(BinaryDoc::VERSION));
+
+    appendNumber(buf, names_.size());
+    for (std::vector<const xmlChar*>::iterator it = names_.begin(), end = names_.end(); it != end; ++it) {
+        appendString(buf, *it);
+    }
+
+    appendNumber(buf, namespaces_.size());
+    for (std::vector<xmlNsPtr>::iterator it = namespaces_.begin(), end = namespaces_.end(); it != end; ++it) {
+        appendNumber(buf, name((*it)->href));
+        appendNumber(buf, NULL == (*it)->prefix ? 0 : name((*it)->prefix) + 1);
+    }
+
+    buf.append(nodes_);
+    return true;
+}
+
+class Decoder {
+public:
+    Decoder(const char *buf, std::size_t size);
+    XmlDocHelper decode();
+
+private:
+    boost::uint32_t number();
+    const xmlChar* string(boost::uint32_t &size);
+    const xmlChar* name();
+    xmlNsPtr ns(xmlNodePtr node);
+    void element(xmlNodePtr parent);
+    void append(xmlNodePtr parent, xmlNodePtr node);
+
+    const unsigned char *pos_;
+    const unsigned char *end_;
+    xmlDocPtr doc_;
+    std::vector<const xmlChar*> names_;
+    std::vector<std::pair<const xmlChar*, const xmlChar*> > ns_specs_;
+    std::vector<xmlNsPtr> ns_;
+    std::string value_;
+};
+
+Decoder::Decoder(const char *buf, std::size_t size) :
+    pos_((const unsigned char*)buf), end_((const unsigned char*)buf + size), doc_(NULL)
+{}
+
+boost::uint32_t
+Decoder::number() {
+    boost::uint32_t value = 0;
+    for (unsigned int shift = 0; shift < 35; shift += 7) {
+        if (pos_ == end_) {
+            throw std::runtime_error("binary doc is truncated");
+        }
+        unsigned char byte = *pos_++;
+        value |= static_cast<boost::uint32_t>(byte & 0x7f) << shift;
+        if (0 == (byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("bad number in binary doc");
+}
+
+const xmlChar*
+Decoder::string(boost::uint32_t &size) {
+    size = number();
+    if (static_cast<std::size_t>(end_ - pos_) < size) {
+        throw std::runtime_error("binary doc is truncated");
+    }
+    const xmlChar *str = (const xmlChar*)pos_;
+    pos_ += size;
+    return str;
+}
+
+const xmlChar*
+Decoder::name() {
+    boost::uint32_t index = number();
+    if (index >= names_.size()) {
+        throw std::runtime_error("bad name index in binary doc");
+    }
+    return names_[index];
+}
+
+xmlNsPtr
+Decoder::ns(xmlNodePtr node) {
+    boost::uint32_t index = number();
+    if (0 == index) {
+        return NULL;
+    }
+    if (--index >= ns_.size()) {
+        throw std::runtime_error("bad namespace index in binary doc");
+    }
+    if (NULL != ns_[index]) {
+        return ns_[index];
+    }
+
+    // namespace declared outside of the tree, xml: one as a rule
+    const std::pair<const xmlChar*, const xmlChar*> &spec = ns_specs_[index];
+    xmlNsPtr ns = xmlSearchNsByHref(doc_, node, spec.first);
+    if (NULL == ns) {
+        ns = xmlNewNs(node, spec.first, spec.second);
+    }
+    if (NULL == ns) {
+        throw std::runtime_error("can not resolve namespace in binary doc");
+    }
+    return ns;
+}
+
+void
+Decoder::append(xmlNodePtr parent, xmlNodePtr node) {
+    node->parent = parent;
+    if (NULL == parent->last) {
+        parent->children = node;
+    }
+    else {
+        node->prev = parent->last;
+        parent->last->next = node;
+    }
+    parent->last = node;
+}
+
+void
+Decoder::element(xmlNodePtr node) {
+    boost::uint32_t count = number();
+    for (boost::uint32_t i = 0; i < count; ++i) {
+        boost::uint32_t index = number();
+        if (index >= ns_.size()) {
+            throw std::runtime_error("bad namespace index in binary doc");
+        }
+        ns_[index] = xmlNewNs(node, ns_specs_[index].first, ns_specs_[index].second);
+        if (NULL == ns_[index]) {
+            throw std::runtime_error("bad namespace declaration in binary doc");
+        }
+    }
+
+    node->ns = ns(node);
+
+    count = number();
+    for (boost::uint32_t i = 0; i < count; ++i) {
+        xmlChar *name = const_cast<xmlChar*>(this->name());
+        xmlNsPtr ns = this->ns(node);
+        boost::uint32_t size = 0;
+        const xmlChar *value = string(size);
+
+        xmlAttrPtr attr = xmlNewNsPropEatName(node, ns, name, NULL);
+        if (NULL == attr) {
+            throw std::runtime_error("can not create attribute from binary doc");
+        }
+        if (0 == size) {
+            continue;
+        }
+        xmlNodePtr text = xmlNewDocTextLen(doc_, value, size);
+        if (NULL == text) {
+            throw std::bad_alloc();
+        }
+        append((xmlNodePtr)attr, text);
+        if (xmlIsID(doc_, node, attr)) {
+            value_.assign((const char*)value, size);
+            xmlAddID(NULL, doc_, (const xmlChar*)value_.c_str(), attr);
+        }
+    }
+}
+
+XmlDocHelper
+Decoder::decode() {
+    if (static_cast<std::size_t>(end_ - pos_) < HEADER_SIZE || 0 != memcmp(pos_, HEADER, sizeof(HEADER))) {
+        throw std::runtime_error("bad binary doc header");
+    }
+    if (BinaryDoc::VERSION != pos_[sizeof(HEADER)]) {
+        throw std::runtime_error("unsupported binary doc version");
+    }
+    pos_ += HEADER_SIZE;
+
+    XmlDocHelper doc(xmlNewDoc((const xmlChar*)"1.0"));
+    if (NULL == doc.get()) {
+        throw std::bad_alloc();
+    }
+    doc_ = doc.get();
+    doc_->encoding = xmlStrdup((const xmlChar*)"UTF-8");
+    doc_->dict = xmlDictCreate();
+    if (NULL == doc_->dict) {
+        throw std::bad_alloc();
+    }
+
+    boost::uint32_t count = number();
+    if (count > static_cast<std::size_t>(end_ - pos_)) {
+        throw std::runtime_error("bad name count in binary doc");
+    }
+    names_.reserve(count);
+    for (boost::uint32_t i = 0; i < count; ++i) {
+        boost::uint32_t size = 0;
+        const xmlChar *str = string(size);
+        const xmlChar *name = xmlDictLookup(doc_->dict, str, size);
+        if (NULL == name) {
+            throw std::bad_alloc();
+        }
+        names_.push_back(name);
+    }
+
+    count = number();
+    if (count > static_cast<std::size_t>(end_ - pos_)) {
+        throw std::runtime_error("bad namespace count in binary doc");
+    }
+    ns_specs_.reserve(count);
+    for (boost::uint32_t i = 0; i < count; ++i) {
+        const xmlChar *href = name();
+        boost::uint32_t prefix = number();
+        if (prefix > names_.size()) {
+            throw std::runtime_error("bad name index in binary doc");
+        }
+        ns_specs_.push_back(std::make_pair(href, 0 == prefix ? NULL : names_[prefix - 1]));
+    }
+    ns_.resize(count, NULL);
+
+    xmlNodePtr parent = (xmlNodePtr)doc_;
+    while (NULL != parent) {
+        if (pos_ == end_) {
+            throw std::runtime_error("binary doc is truncated");
+        }
+        unsigned char type = *pos_++;
+        if (RECORD_END == type) {
+            parent = (xmlNodePtr)doc_ == parent ? NULL : parent->parent;
+            continue;
+        }
+
+        xmlNodePtr node = NULL;
+        boost::uint32_t size = 0;
+        if (RECORD_ELEMENT == type) {
+            node = xmlNewDocNodeEatName(doc_, NULL, const_cast<xmlChar*>(name()), NULL);
+            if (NULL == node) {
+                throw std::bad_alloc();
+            }
+            append(parent, node);
+            element(node);
+            parent = node;
+            continue;
+        }
+
+        switch (type) {
+            case RECORD_TEXT:
+            case RECORD_TEXT_NOENC: {
+                const xmlChar *content = string(size);
+                node = xmlNewDocTextLen(doc_, content, size);
+                if (NULL != node && RECORD_TEXT_NOENC == type) {
+                    node->name = xmlStringTextNoenc;
+                }
+                break;
+            }
+            case RECORD_CDATA: {
+                const xmlChar *content = string(size);
+                node = xmlNewCDataBlock(doc_, content, size);
+                break;
+            }
+            case RECORD_COMMENT: {
+                const xmlChar *content = string(size);
+                node = xmlNewDocComment(doc_, NULL);
+                if (NULL != node) {
+                    node->content = xmlStrndup(content, size);
+                }
+                break;
+            }
+            case RECORD_PI: {
+                const xmlChar *name = this->name();
+                const xmlChar *content = string(size);
+                node = xmlNewDocPI(doc_, name, NULL);
+                if (NULL != node) {
+                    node->content = xmlStrndup(content, size);
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("bad record type in binary doc");
+        }
+        if (NULL == node) {
+            throw std::bad_alloc();
+        }
+        append(parent, node);
+    }
+
+    if (pos_ != end_) {
+        throw std::runtime_error("trailing data in binary doc");
+    }
+    return doc;
+}
+
+} // namespace
+
+bool
+BinaryDoc::encode(xmlDocPtr doc, std::string &buf) {
+    Encoder encoder;
+    return encoder.encode(doc, buf);
+}
+
+XmlDocHelper
+BinaryDoc::decode(const char *buf, std::size_t size) {
+    Decoder decoder(buf, size);
+    return decoder.decode();
+}
+
+} // namespace xscript
@@ -17,11 +17,13 @@
 #include <libxml/xpathInternals.h>
 
 #include "internal/block_helpers.h"
+#include "internal/block_time_counter.h"
 #include "internal/param_factory.h"
 
 #include "xscript/args.h"
 #include "xscript/block.h"
 #include "xscript/context.h"
+#include "xscript/histogram_counter.h"
 #include "xscript/logger.h"
 #include "xscript/meta.h"
 #include "xscript/meta_block.h"
@@ -88,6 +90,7 @@ struct Block::BlockData {
     std::string base_;
     std::map<std::string, std::string> namespaces_;
     bool disable_output_;
+    HistogramCounter *time_counter_;
 
     std::auto_ptr<MetaBlock> meta_block_;
 };
@@ -99,7 +102,7 @@ static const std::string STR_BAD_BLOCK_ATTRIBUTE = "bad block attribute: ";
 
 Block::BlockData::BlockData(const Extension *ext, Xml *owner, xmlNodePtr node, Block *block) :
     extension_(ext), owner_(owner), node_(node), block_(block), xpointer_expr_(new XPathExpr()),
-    disable_output_(false)
+    disable_output_(false), time_counter_(NULL)
 {}
 
 Block::BlockData::~BlockData() {
@@ -310,6 +313,18 @@ Block::params() const {
     return data_->params_;
 }
 
+bool
+Block::argsFromState() const {
+    for (std::vector<Param*>::const_iterator it = data_->params_.begin(), end = data_->params_.end();
+         it != end;
+         ++it) {
+        if ((*it)->fromState()) {
+            return true;
+        }
+    }
+    return xsltFromState();
+}
+
 bool
 Block::threaded() const {
     return false;
@@ -338,7 +353,7 @@ Block::processEmptyXPointer(const InvokeContext *invoke_ctx, xmlDocPtr meta_doc,
 // return last insert node
 xmlNodePtr
 Block::processXPointer(const InvokeContext *invoke_ctx, xmlDocPtr doc, xmlDocPtr meta_doc,
-        xmlNodePtr insert_node, insertFunc func) const {
+        xmlNodePtr insert_node, insertFunc func, bool move_root) const {
     if (NULL == doc || data_->disable_output_) {
         return processEmptyXPointer(invoke_ctx, meta_doc, insert_node, func);
     }
@@ -348,7 +363,8 @@ Block::processXPointer(const InvokeContext *invoke_ctx, xmlDocPtr doc, xmlDocPtr
         invoke_ctx->metaXPointer() : invoke_ctx->xpointer();
 
     if (NULL == xpointer.get()) {
-        xmlNodePtr node = xmlCopyNode(root_node, 1);
+        xmlNodePtr node = move_root ?
+            XmlUtils::moveNode(root_node, insert_node->doc) : xmlCopyNode(root_node, 1);
         func(insert_node, node);
         if (meta_doc && data_->meta_block_.get()) {
             return data_->meta_block_->processXPointer(
@@ -486,6 +502,7 @@ Block::parse() {
             parseSubNode(node);
         }
         postParse();
+        data_->time_counter_ = BlockTimeCounter::instance()->counter(this);
     }
     catch (ParseError &e) {
         e.add(data_->errorLocation());
@@ -560,6 +577,9 @@ Block::invoke_Ex(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext
         return fakeResult(false);
     }
 
+    timeval start_time;
+    gettimeofday(&start_time, 0);
+
     try {
         BlockTimerStarter starter(ctx.get(), this);
         Block *self = const_cast<Block*>(this); //TODO: remove const_cast
@@ -592,6 +612,12 @@ Block::invoke_Ex(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext
     catch (const std::exception &e) {
         invoke_ctx = errorResult(e.what(), false);
     }
+
+    if (NULL != data_->time_counter_) {
+        timeval end_time;
+        gettimeofday(&end_time, 0);
+        data_->time_counter_->add(end_time - start_time);
+    }
     
     if (!invoke_ctx->success()) {
         ctx->setNoCache();
@@ -639,10 +665,26 @@ Block::createInvokeContext(boost::shared_ptr<Context> ctx) const {
     return invoke_ctx;
 }
 
+bool
+Block::invokeAsync(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const {
+    (void)ctx;
+    (void)invoke_ctx;
+    (void)slot;
+    return false;
+}
+
 bool
 Block::invokeCheckThreadedEx(boost::shared_ptr<Context> ctx, unsigned int slot) const {
-    boost::shared_ptr<InvokeContext> invoke_ctx = createInvokeContext(ctx);
+    return invokeCheckThreadedEx(ctx, createInvokeContext(ctx), slot);
+}
+
+bool
+Block::invokeCheckThreadedEx(boost::shared_ptr<Context> ctx,
+    boost::shared_ptr<InvokeContext> invoke_ctx, unsigned int slot) const {
     if (threaded()) {
+        if (invokeAsync(ctx, invoke_ctx, slot)) {
+            return true;
+        }
         InvokeHelper helper(ctx);
         boost::function<void()> f_threaded = boost::bind(&Block::callInternalThreadedHelper, this, helper, invoke_ctx, slot);
         boost::function<void()> f_unthreaded = boost::bind(&Block::callInternal_Ex, this, ctx, invoke_ctx, slot);
@@ -0,0 +1,91 @@
+#include "settings.h"
+
+#include <boost/bind.hpp>
+
+#include "xscript/block.h"
+#include "xscript/control_extension.h"
+#include "xscript/extension.h"
+#include "xscript/histogram_counter.h"
+#include "xscript/xml_util.h"
+
+#include "internal/block_time_counter.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+class BlockTimeCounterBlock : public Block {
+public:
+    BlockTimeCounterBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node, const BlockTimeCounter *counter)
+            : Block(ext, owner, node), counter_(counter) {
+    }
+
+    void call(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx) const throw (std::exception) {
+        ControlExtension::setControlFlag(ctx.get());
+        invoke_ctx->resultDoc(counter_->createReport());
+    }
+private:
+    const BlockTimeCounter *counter_;
+};
+
+BlockTimeCounter::BlockTimeCounter() {
+}
+
+BlockTimeCounter::~BlockTimeCounter() {
+}
+
+void
+BlockTimeCounter::init(const Config *config) {
+    (void)config;
+    ControlExtension::Constructor f = boost::bind(boost::mem_fn(&BlockTimeCounter::createBlock), this, _1, _2, _3);
+    ControlExtension::registerConstructor("block-time", f);
+}
+
+HistogramCounter*
+BlockTimeCounter::counter(const Block *block) {
+    std::string method(block->name());
+    if (!block->method().empty()) {
+        method.append(":").append(block->method());
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    CounterMapType::iterator it = counters_.find(method);
+    if (counters_.end() != it) {
+        return it->second.get();
+    }
+    boost::shared_ptr<HistogramCounter> counter(
+        HistogramCounterFactory::instance()->createCounter("block").release());
+    counters_.insert(std::make_pair(method, counter));
+    return counter.get();
+}
+
+XmlDocHelper
+BlockTimeCounter::createReport() const {
+    XmlDocHelper doc(xmlNewDoc((const xmlChar*) "1.0"));
+    XmlUtils::throwUnless(NULL != doc.get());
+
+    xmlNodePtr root = xmlNewDocNode(doc.get(), NULL, (const xmlChar*) "block-time", NULL);
+    XmlUtils::throwUnless(NULL != root);
+    xmlDocSetRootElement(doc.get(), root);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    for(CounterMapType::const_iterator it = counters_.begin();
+        it != counters_.end();
+        ++it) {
+        XmlNodeHelper line = it->second->createReport();
+        xmlSetProp(line.get(), (const xmlChar*) "method", (const xmlChar*) it->first.c_str());
+        xmlAddChild(root, line.release());
+    }
+    return doc;
+}
+
+std::auto_ptr<Block>
+BlockTimeCounter::createBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node) {
+    return std::auto_ptr<Block>(new BlockTimeCounterBlock(ext, owner, node, this));
+}
+
+static ComponentRegisterer<BlockTimeCounter> reg_;
+
+} // namespace xscript
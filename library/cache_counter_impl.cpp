@@ -1,5 +1,7 @@
 #include "settings.h"
 
+#include <algorithm>
+
 #include <boost/lexical_cast.hpp>
 
 #include "xscript/average_counter.h"
@@ -13,18 +15,27 @@
 namespace xscript {
 
 CacheCounterImpl::CacheCounterImpl(const std::string& name)
-        : CounterImpl(name), inserted_(0), updated_(0), loaded_(0), expired_(0), excluded_(0)
+        : CounterImpl(name), inserted_(0), updated_(0), loaded_(0), expired_(0), excluded_(0),
+          used_memory_(0), evicted_memory_(0)
 {}
 
 // FIXME We should use atomic_increment in this methods
 void
 CacheCounterImpl::incUsedMemory(size_t amount) {
-    (void)amount;
+    boost::mutex::scoped_lock lock(mtx_);
+    used_memory_ += amount;
 }
 
 void
 CacheCounterImpl::decUsedMemory(size_t amount) {
-    (void)amount;
+    boost::mutex::scoped_lock lock(mtx_);
+    used_memory_ -= std::min(amount, used_memory_);
+}
+
+void
+CacheCounterImpl::incEvictedMemory(size_t amount) {
+    boost::mutex::scoped_lock lock(mtx_);
+    evicted_memory_ += amount;
 }
 
 void
@@ -71,6 +82,12 @@ XmlNodeHelper CacheCounterImpl::createReport() const {
             (const xmlChar*) boost::lexical_cast<std::string>(expired_).c_str());
     xmlSetProp(report.get(), (const xmlChar*) "excluded",
             (const xmlChar*) boost::lexical_cast<std::string>(excluded_).c_str());
+    if (used_memory_ > 0 || evicted_memory_ > 0) {
+        xmlSetProp(report.get(), (const xmlChar*) "used-memory",
+                (const xmlChar*) boost::lexical_cast<std::string>(used_memory_).c_str());
+        xmlSetProp(report.get(), (const xmlChar*) "evicted-memory",
+                (const xmlChar*) boost::lexical_cast<std::string>(evicted_memory_).c_str());
+    }
     
     return report;
 }
@@ -37,10 +37,12 @@ public:
     int strategy_;
     boost::shared_ptr<CacheStrategy> cache_strategy_;
     time_t cache_time_;
+    bool coalescing_;
 };
 
 CachedObject::ObjectData::ObjectData() :
-    strategy_(default_cache_strategy), cache_time_(CACHE_TIME_UNDEFINED)
+    strategy_(default_cache_strategy), cache_time_(CACHE_TIME_UNDEFINED),
+    coalescing_(true)
 {}
 
 CachedObject::ObjectData::~ObjectData()
@@ -74,6 +76,11 @@ CachedObject::cacheTimeUndefined() const {
 
 bool
 CachedObject::checkProperty(const char *name, const char *value) {
+    if (strncasecmp(name, "cache-coalescing", sizeof("cache-coalescing")) == 0) {
+        data_->coalescing_ = (strncasecmp(value, "no", sizeof("no")) != 0);
+        return true;
+    }
+
     if (strncasecmp(name, "cache-strategy", sizeof("cache-strategy")) != 0) {
         return false;
     }
@@ -154,6 +161,11 @@ CachedObject::allowDistributed() const {
     return checkStrategy(DISTRIBUTED);
 }
 
+bool
+CachedObject::allowCoalescing() const {
+    return data_->coalescing_;
+}
+
 bool
 CachedObject::checkStrategy(Strategy strategy) const {
     return data_->strategy_ & strategy;
@@ -33,6 +33,7 @@
 
 #include "details/xml_config.h"
 
+#include "internal/block_time_counter.h"
 #include "internal/extension_list.h"
 #include "internal/hash.h"
 #include "internal/hashmap.h"
@@ -76,6 +77,9 @@ Config::startup() {
     StatusInfo::instance()->init(this);
     log()->debug("status info started");
 
+    BlockTimeCounter::instance()->init(this);
+    log()->debug("block time counter started");
+
     Authorizer::instance()->init(this);
     log()->debug("authorizer started");
 
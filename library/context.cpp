@@ -317,6 +317,15 @@ Context::Context(const boost::shared_ptr<Script> &script,
     }
 }
 
+Context::Context(const boost::shared_ptr<Script> &script,
+                 const boost::shared_ptr<RequestData> &request_data,
+                 const boost::shared_ptr<TypedMap> &local_params) {
+    assert(script.get());
+    ctx_data_ = std::auto_ptr<ContextData>(new ContextData(request_data, script));
+    ctx_data_->local_params_ = local_params;
+    init();
+}
+
 Context::~Context() {    
     ExtensionList::instance()->destroyContext(this);
 }
@@ -343,6 +352,24 @@ Context::createChildContext(const boost::shared_ptr<Script> &script,
     return child_ctx;
 }
 
+boost::shared_ptr<Context>
+Context::createSnapshot(const boost::shared_ptr<Context> &ctx) {
+    boost::shared_ptr<RequestData> request_data = ctx->requestData()->clone(true, false, false);
+
+    std::map<std::string, TypedValue> values;
+    ctx->state()->values(values);
+    for(std::map<std::string, TypedValue>::const_iterator it = values.begin();
+        it != values.end();
+        ++it) {
+        request_data->state()->setTypedValue(it->first, it->second);
+    }
+
+    boost::shared_ptr<Context> snapshot(
+        new Context(ctx->script(), request_data, ctx->localParamsMap()));
+    snapshot->ctx_data_->authContext(ctx->authContext());
+    return snapshot;
+}
+
 const boost::shared_ptr<RequestData>&
 Context::requestData() const {
     return ctx_data_->requestData();
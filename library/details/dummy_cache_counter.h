@@ -11,6 +11,7 @@ class DummyCacheCounter : public CacheCounter {
 public:
     void incUsedMemory(size_t amount);
     void decUsedMemory(size_t amount);
+    void incEvictedMemory(size_t amount);
 
     void incLoaded();
     void incInserted();
@@ -0,0 +1,31 @@
+#ifndef _XSCRIPT_DETAILS_DUMMY_HISTOGRAM_COUNTER_H
+#define _XSCRIPT_DETAILS_DUMMY_HISTOGRAM_COUNTER_H
+
+#include "xscript/histogram_counter.h"
+
+namespace xscript {
+
+
+/**
+ * Do nothing counter
+ */
+class DummyHistogramCounter : public HistogramCounter {
+public:
+    DummyHistogramCounter();
+    ~DummyHistogramCounter();
+
+    /**
+     * Add single measure.
+     */
+    virtual void add(boost::uint64_t value);
+
+    virtual boost::uint64_t count() const;
+    virtual boost::uint64_t percentile(double fraction) const;
+
+    virtual XmlNodeHelper createReport() const;
+};
+
+
+}
+
+#endif
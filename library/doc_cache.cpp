@@ -1,23 +1,36 @@
 #include "settings.h"
 
+#include <deque>
+#include <list>
+#include <map>
+
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/xtime.hpp>
 #include <boost/tokenizer.hpp>
 
 #include "xscript/algorithm.h"
 #include "xscript/average_counter.h"
+#include "xscript/config.h"
 #include "xscript/context.h"
 #include "xscript/doc_cache.h"
 #include "xscript/doc_cache_strategy.h"
+#include "xscript/histogram_counter.h"
 #include "xscript/http_utils.h"
 #include "xscript/logger.h"
 #include "xscript/profiler.h"
+#include "xscript/simple_counter.h"
 #include "xscript/stat_builder.h"
 #include "xscript/tag.h"
 #include "xscript/tagged_block.h"
 #include "xscript/tagged_cache_usage_counter.h"
 #include "xscript/xml_util.h"
 
+#include "internal/binary_doc.h"
+#include "internal/gzip.h"
 #include "internal/parser.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -29,10 +42,357 @@ namespace xscript {
 class DocCacheBase::StatInfo {
 public:
     std::auto_ptr<StatBuilder> statBuilder_;
-    std::auto_ptr<AverageCounter> hitCounter_;
-    std::auto_ptr<AverageCounter> missCounter_;
-    std::auto_ptr<AverageCounter> saveCounter_;
+    std::auto_ptr<HistogramCounter> hitCounter_;
+    std::auto_ptr<HistogramCounter> missCounter_;
+    std::auto_ptr<HistogramCounter> saveCounter_;
     std::auto_ptr<TaggedCacheUsageCounter> usageCounter_;
+    std::auto_ptr<SimpleCounter> refreshQueueCounter_;
+    std::auto_ptr<SimpleCounter> refreshDropCounter_;
+    std::auto_ptr<AverageCounter> refreshCounter_;
+};
+
+/**
+ * Bounded pool rebuilding documents due for prefetch in background.
+ * Threads are started on first use, tasks over the queue limit are dropped.
+ */
+class CacheRefresher : private boost::noncopyable {
+public:
+    CacheRefresher() : threads_count_(0), queue_size_(0), started_(false), running_(true) {}
+    ~CacheRefresher();
+
+    void init(unsigned int threads, unsigned int queue_size);
+    bool enabled() const;
+    bool enqueue(const boost::function<void()> &task);
+    void stop();
+
+private:
+    void run();
+
+private:
+    boost::mutex mutex_;
+    boost::condition condition_;
+    std::deque<boost::function<void()> > tasks_;
+    boost::thread_group threads_;
+    unsigned int threads_count_;
+    unsigned int queue_size_;
+    bool started_;
+    bool running_;
+};
+
+CacheRefresher::~CacheRefresher() {
+    stop();
+}
+
+void
+CacheRefresher::init(unsigned int threads, unsigned int queue_size) {
+    boost::mutex::scoped_lock lock(mutex_);
+    threads_count_ = threads;
+    queue_size_ = queue_size;
+}
+
+bool
+CacheRefresher::enabled() const {
+    return threads_count_ > 0 && queue_size_ > 0;
+}
+
+bool
+CacheRefresher::enqueue(const boost::function<void()> &task) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!running_ || tasks_.size() >= queue_size_) {
+        return false;
+    }
+    if (!started_) {
+        started_ = true;
+        for (unsigned int i = 0; i < threads_count_; ++i) {
+            threads_.create_thread(boost::bind(&CacheRefresher::run, this));
+        }
+    }
+    tasks_.push_back(task);
+    condition_.notify_one();
+    return true;
+}
+
+void
+CacheRefresher::stop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    tasks_.clear();
+    condition_.notify_all();
+    lock.unlock();
+    threads_.join_all();
+}
+
+void
+CacheRefresher::run() {
+    while (true) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (running_ && tasks_.empty()) {
+            condition_.wait(lock);
+        }
+        if (!running_) {
+            return;
+        }
+        boost::function<void()> task = tasks_.front();
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+    }
+}
+
+/**
+ * Bounded FIFO of cache saves stored by background writer threads.
+ * Pending save of the same key is replaced by the newer one in place.
+ * When the queue is full either the new save or the oldest pending one
+ * is dropped.
+ */
+class CacheWriter : private boost::noncopyable {
+public:
+    CacheWriter() : threads_count_(0), queue_size_(0), drop_oldest_(false), started_(false), running_(true) {}
+    ~CacheWriter();
+
+    void init(unsigned int threads, unsigned int queue_size, bool drop_oldest);
+    bool enabled() const;
+    bool enqueue(const std::string &key, const boost::function<void()> &task);
+    void stop();
+
+    std::auto_ptr<SimpleCounter> queueCounter_;
+    std::auto_ptr<SimpleCounter> dropCounter_;
+    std::auto_ptr<SimpleCounter> coalescedCounter_;
+
+private:
+    void run();
+
+private:
+    typedef std::list<std::pair<std::string, boost::function<void()> > > TaskList;
+
+    boost::mutex mutex_;
+    boost::condition condition_;
+    TaskList tasks_;
+    std::map<std::string, TaskList::iterator> pending_;
+    boost::thread_group threads_;
+    unsigned int threads_count_;
+    unsigned int queue_size_;
+    bool drop_oldest_;
+    bool started_;
+    bool running_;
+};
+
+CacheWriter::~CacheWriter() {
+    stop();
+}
+
+void
+CacheWriter::init(unsigned int threads, unsigned int queue_size, bool drop_oldest) {
+    boost::mutex::scoped_lock lock(mutex_);
+    threads_count_ = threads;
+    queue_size_ = queue_size;
+    drop_oldest_ = drop_oldest;
+    queueCounter_ = SimpleCounterFactory::instance()->createCounter("write-queue");
+    dropCounter_ = SimpleCounterFactory::instance()->createCounter("write-dropped");
+    coalescedCounter_ = SimpleCounterFactory::instance()->createCounter("write-coalesced");
+}
+
+bool
+CacheWriter::enabled() const {
+    return threads_count_ > 0 && queue_size_ > 0 && running_;
+}
+
+bool
+CacheWriter::enqueue(const std::string &key, const boost::function<void()> &task) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!running_) {
+        return false;
+    }
+
+    std::map<std::string, TaskList::iterator>::iterator it = pending_.find(key);
+    if (pending_.end() != it) {
+        it->second->second = task;
+        coalescedCounter_->inc();
+        return true;
+    }
+
+    if (tasks_.size() >= queue_size_) {
+        dropCounter_->inc();
+        if (!drop_oldest_) {
+            return false;
+        }
+        pending_.erase(tasks_.front().first);
+        tasks_.pop_front();
+        queueCounter_->dec();
+    }
+
+    if (!started_) {
+        started_ = true;
+        for (unsigned int i = 0; i < threads_count_; ++i) {
+            threads_.create_thread(boost::bind(&CacheWriter::run, this));
+        }
+    }
+    pending_.insert(std::make_pair(key, tasks_.insert(tasks_.end(), std::make_pair(key, task))));
+    queueCounter_->inc();
+    condition_.notify_one();
+    return true;
+}
+
+void
+CacheWriter::stop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    tasks_.clear();
+    pending_.clear();
+    condition_.notify_all();
+    lock.unlock();
+    threads_.join_all();
+}
+
+void
+CacheWriter::run() {
+    while (true) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (running_ && tasks_.empty()) {
+            condition_.wait(lock);
+        }
+        if (!running_) {
+            return;
+        }
+        boost::function<void()> task = tasks_.front().second;
+        pending_.erase(tasks_.front().first);
+        tasks_.pop_front();
+        queueCounter_->dec();
+        lock.unlock();
+        task();
+    }
+}
+
+/**
+ * State of a single cache miss shared by the caller computing the result
+ * (leader) and callers waiting for it (followers).
+ */
+class FlightState : private boost::noncopyable {
+public:
+    FlightState() : done_(false) {}
+
+    void finish(const boost::shared_ptr<CacheData> &cache_data, const Tag *tag);
+    bool wait(int timeout, boost::shared_ptr<CacheData> &cache_data, Tag &tag);
+
+private:
+    boost::mutex mutex_;
+    boost::condition condition_;
+    bool done_;
+    boost::shared_ptr<CacheData> cache_data_;
+    Tag tag_;
+};
+
+void
+FlightState::finish(const boost::shared_ptr<CacheData> &cache_data, const Tag *tag) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (done_) {
+        return;
+    }
+    done_ = true;
+    if (NULL != tag) {
+        cache_data_ = cache_data;
+        tag_ = *tag;
+    }
+    condition_.notify_all();
+}
+
+bool
+FlightState::wait(int timeout, boost::shared_ptr<CacheData> &cache_data, Tag &tag) {
+    boost::xtime xt = Context::delay(timeout);
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!done_) {
+        if (!condition_.timed_wait(lock, xt)) {
+            return false;
+        }
+    }
+    if (NULL == cache_data_.get()) {
+        return false;
+    }
+    cache_data = cache_data_;
+    tag = tag_;
+    return true;
+}
+
+/**
+ * Registry of cache misses currently being computed, keyed by tag key.
+ */
+class FlightMap : private boost::noncopyable {
+public:
+    boost::shared_ptr<FlightState> join(const std::string &key, bool &leader);
+    void publish(const std::string &key, const boost::shared_ptr<CacheData> &cache_data, const Tag &tag);
+    void release(const std::string &key, const boost::shared_ptr<FlightState> &state);
+
+private:
+    typedef std::map<std::string, boost::shared_ptr<FlightState> > MapType;
+    boost::mutex mutex_;
+    MapType flights_;
+};
+
+boost::shared_ptr<FlightState>
+FlightMap::join(const std::string &key, bool &leader) {
+    boost::mutex::scoped_lock lock(mutex_);
+    MapType::iterator it = flights_.find(key);
+    if (flights_.end() != it) {
+        leader = false;
+        return it->second;
+    }
+    leader = true;
+    boost::shared_ptr<FlightState> state(new FlightState());
+    flights_.insert(std::make_pair(key, state));
+    return state;
+}
+
+void
+FlightMap::publish(const std::string &key, const boost::shared_ptr<CacheData> &cache_data, const Tag &tag) {
+    boost::shared_ptr<FlightState> state;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        MapType::iterator it = flights_.find(key);
+        if (flights_.end() == it) {
+            return;
+        }
+        state = it->second;
+        flights_.erase(it);
+    }
+    state->finish(cache_data, &tag);
+}
+
+void
+FlightMap::release(const std::string &key, const boost::shared_ptr<FlightState> &state) {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        MapType::iterator it = flights_.find(key);
+        if (flights_.end() != it && it->second == state) {
+            flights_.erase(it);
+        }
+    }
+    state->finish(boost::shared_ptr<CacheData>(), NULL);
+}
+
+/**
+ * Held by the leader of a coalesced miss. Followers still waiting when it is
+ * destroyed without a published result go on to compute the result themselves.
+ */
+class CacheFlight : private boost::noncopyable {
+public:
+    CacheFlight(FlightMap *map, const std::string &key, const boost::shared_ptr<FlightState> &state) :
+        map_(map), key_(key), state_(state)
+    {}
+
+    ~CacheFlight() {
+        map_->release(key_, state_);
+    }
+
+private:
+    FlightMap *map_;
+    std::string key_;
+    boost::shared_ptr<FlightState> state_;
 };
 
 class DocCacheBase::DocCacheData {
@@ -43,6 +403,10 @@ public:
     std::auto_ptr<Block> createBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node);
     XmlDocHelper createReport() const;
 
+    void refresh(const boost::shared_ptr<StatInfo> &info, CacheContext *cache_ctx);
+    static void runRefresh(const boost::shared_ptr<StatInfo> &info, const CacheContext::RefreshTask &task);
+    static void runSave(const boost::shared_ptr<StatInfo> &info, const boost::function<bool()> &task);
+
     class DocCacheBlock : public Block {
     public:
         DocCacheBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node, const DocCacheData &cache_data)
@@ -61,19 +425,88 @@ public:
     std::vector<std::string> strategiesOrder_;
     typedef std::vector<std::pair<DocCacheStrategy*, boost::shared_ptr<StatInfo> > > StrategyMap;
     StrategyMap strategies_;
+
+    bool coalescing_;
+    int coalescing_max_wait_;
+    FlightMap flights_;
+    std::auto_ptr<AverageCounter> coalescedCounter_;
+    std::auto_ptr<AverageCounter> coalesceFailedCounter_;
+
+    CacheRefresher refresher_;
+    CacheWriter writer_;
+
+    static const int DEFAULT_COALESCING_MAX_WAIT;
+    static const unsigned int DEFAULT_REFRESH_THREADS;
+    static const unsigned int DEFAULT_REFRESH_QUEUE_SIZE;
+    static const unsigned int DEFAULT_WRITE_THREADS;
+    static const unsigned int DEFAULT_WRITE_QUEUE_SIZE;
 };
 
-DocCacheBase::DocCacheData::DocCacheData(DocCacheBase *owner) : owner_(owner)
-{}
+const int DocCacheBase::DocCacheData::DEFAULT_COALESCING_MAX_WAIT = 5000;
+const unsigned int DocCacheBase::DocCacheData::DEFAULT_REFRESH_THREADS = 2;
+const unsigned int DocCacheBase::DocCacheData::DEFAULT_REFRESH_QUEUE_SIZE = 64;
+const unsigned int DocCacheBase::DocCacheData::DEFAULT_WRITE_THREADS = 0;
+const unsigned int DocCacheBase::DocCacheData::DEFAULT_WRITE_QUEUE_SIZE = 256;
 
-DocCacheBase::DocCacheData::~DocCacheData()
+DocCacheBase::DocCacheData::DocCacheData(DocCacheBase *owner) :
+    owner_(owner), coalescing_(false), coalescing_max_wait_(DEFAULT_COALESCING_MAX_WAIT)
 {}
 
+DocCacheBase::DocCacheData::~DocCacheData() {
+    writer_.stop();
+    refresher_.stop();
+}
+
 std::auto_ptr<Block>
 DocCacheBase::DocCacheData::createBlock(const ControlExtension *ext, Xml *owner, xmlNodePtr node) {
     return std::auto_ptr<Block>(new DocCacheBlock(ext, owner, node, *this));
 }
 
+void
+DocCacheBase::DocCacheData::refresh(const boost::shared_ptr<StatInfo> &info, CacheContext *cache_ctx) {
+    CacheContext::RefreshTask task;
+    try {
+        task = cache_ctx->createRefreshTask();
+    }
+    catch (const std::exception &e) {
+        log()->error("caught exception while creating refresh task: %s", e.what());
+        return;
+    }
+    if (task.empty()) {
+        return;
+    }
+
+    info->refreshQueueCounter_->inc();
+    if (!refresher_.enqueue(boost::bind(&DocCacheData::runRefresh, info, task))) {
+        info->refreshQueueCounter_->dec();
+        info->refreshDropCounter_->inc();
+        log()->info("%s refresh queue is full, refresh dropped", owner_->name().c_str());
+    }
+}
+
+void
+DocCacheBase::DocCacheData::runRefresh(const boost::shared_ptr<StatInfo> &info,
+    const CacheContext::RefreshTask &task) {
+    info->refreshQueueCounter_->dec();
+    try {
+        info->refreshCounter_->add(profile(task));
+    }
+    catch (const std::exception &e) {
+        log()->error("caught exception while refreshing cached doc: %s", e.what());
+    }
+}
+
+void
+DocCacheBase::DocCacheData::runSave(const boost::shared_ptr<StatInfo> &info,
+    const boost::function<bool()> &task) {
+    try {
+        info->saveCounter_->add(profile(task).second);
+    }
+    catch (const std::exception &e) {
+        log()->error("caught exception while saving cached doc: %s", e.what());
+    }
+}
+
 XmlDocHelper
 DocCacheBase::DocCacheData::createReport() const {
     XmlDocHelper doc(xmlNewDoc((const xmlChar*) "1.0"));
@@ -101,6 +534,17 @@ DocCacheBase::DocCacheData::createReport() const {
         node.release();
     }
 
+    if (coalescing_) {
+        xmlAddChild(root, coalescedCounter_->createReport().release());
+        xmlAddChild(root, coalesceFailedCounter_->createReport().release());
+    }
+
+    if (writer_.enabled()) {
+        xmlAddChild(root, writer_.queueCounter_->createReport().release());
+        xmlAddChild(root, writer_.dropCounter_->createReport().release());
+        xmlAddChild(root, writer_.coalescedCounter_->createReport().release());
+    }
+
     return doc;
 }
 
@@ -116,6 +560,20 @@ DocCacheBase::init(const Config *config) {
     ControlExtension::registerConstructor(name().append("-stat"), f);
     
     TaggedCacheUsageCounterFactory::instance()->init(config);
+
+    std::string config_prefix = std::string("/xscript/").append(name()).append("-strategies/");
+    data_->coalescing_ = config->as<bool>(config_prefix + "coalescing", true);
+    data_->coalescing_max_wait_ = config->as<int>(config_prefix + "coalescing-max-wait",
+        DocCacheData::DEFAULT_COALESCING_MAX_WAIT);
+    data_->coalescedCounter_ = AverageCounterFactory::instance()->createCounter("coalesced");
+    data_->coalesceFailedCounter_ = AverageCounterFactory::instance()->createCounter("coalesce-failed");
+    data_->refresher_.init(
+        config->as<unsigned int>(config_prefix + "refresh-threads", DocCacheData::DEFAULT_REFRESH_THREADS),
+        config->as<unsigned int>(config_prefix + "refresh-queue-size", DocCacheData::DEFAULT_REFRESH_QUEUE_SIZE));
+    data_->writer_.init(
+        config->as<unsigned int>(config_prefix + "write-threads", DocCacheData::DEFAULT_WRITE_THREADS),
+        config->as<unsigned int>(config_prefix + "write-queue-size", DocCacheData::DEFAULT_WRITE_QUEUE_SIZE),
+        config->as<std::string>(config_prefix + "write-drop", "newest") == "oldest");
     
     for(DocCacheData::StrategyMap::iterator i = data_->strategies_.begin();
         i != data_->strategies_.end();
@@ -123,9 +581,12 @@ DocCacheBase::init(const Config *config) {
         std::string builder_name = name() + "-" + i->first->name();
         std::auto_ptr<StatBuilder> builder(new StatBuilder(builder_name));
         boost::shared_ptr<StatInfo> stat_info(new StatInfo());
-        stat_info->hitCounter_ = AverageCounterFactory::instance()->createCounter("hits");
-        stat_info->missCounter_ = AverageCounterFactory::instance()->createCounter("miss");
-        stat_info->saveCounter_ = AverageCounterFactory::instance()->createCounter("save");
+        stat_info->hitCounter_ = HistogramCounterFactory::instance()->createCounter("hits");
+        stat_info->missCounter_ = HistogramCounterFactory::instance()->createCounter("miss");
+        stat_info->saveCounter_ = HistogramCounterFactory::instance()->createCounter("save");
+        stat_info->refreshQueueCounter_ = SimpleCounterFactory::instance()->createCounter("refresh-queue");
+        stat_info->refreshDropCounter_ = SimpleCounterFactory::instance()->createCounter("refresh-dropped");
+        stat_info->refreshCounter_ = AverageCounterFactory::instance()->createCounter("refresh");
         
         createUsageCounter(stat_info);
         
@@ -135,6 +596,11 @@ DocCacheBase::init(const Config *config) {
         if (stat_info->usageCounter_.get()) {
             builder->addCounter(stat_info->usageCounter_.get());
         }
+        if (data_->refresher_.enabled()) {
+            builder->addCounter(stat_info->refreshQueueCounter_.get());
+            builder->addCounter(stat_info->refreshDropCounter_.get());
+            builder->addCounter(stat_info->refreshCounter_.get());
+        }
         
         i->first->fillStatBuilder(builder.get());
         
@@ -151,6 +617,19 @@ DocCacheBase::addStrategy(DocCacheStrategy *strategy, const std::string &name) {
     data_->strategies_.push_back(std::make_pair(strategy, boost::shared_ptr<StatInfo>()));
 }
 
+void
+DocCacheBase::removeStrategy(DocCacheStrategy *strategy) {
+    data_->writer_.stop();
+    for (DocCacheData::StrategyMap::iterator i = data_->strategies_.begin();
+         i != data_->strategies_.end();
+         ++i) {
+        if (i->first == strategy) {
+            data_->strategies_.erase(i);
+            break;
+        }
+    }
+}
+
 time_t
 DocCacheBase::minimalCacheTime() const {
     // FIXME.Do we actually need this in public part? Better to embed logic
@@ -213,8 +692,12 @@ DocCacheBase::loadDocImpl(InvokeContext *invoke_ctx, CacheContext *cache_ctx,
     
     bool loaded = false;
     bool check_tag_key = NULL != invoke_ctx;
+    boost::shared_ptr<TagKey> first_key;
     Context *ctx = cache_ctx->context();
     CachedObject* object = cache_ctx->object();
+    if (cache_ctx->allowRefresh() && !data_->refresher_.enabled()) {
+        cache_ctx->refreshFactory(CacheContext::RefreshFactory());
+    }
     DocCacheData::StrategyMap::iterator i = data_->strategies_.begin();
     while(!loaded && i != data_->strategies_.end()) {
         DocCacheStrategy* strategy = i->first;
@@ -223,7 +706,14 @@ DocCacheBase::loadDocImpl(InvokeContext *invoke_ctx, CacheContext *cache_ctx,
             continue;
         }
         
-        boost::shared_ptr<TagKey> key(strategy->createKey(ctx, invoke_ctx, object).release());
+        boost::shared_ptr<TagKey> key;
+        if (NULL != invoke_ctx) {
+            key = invoke_ctx->prefetchKey(i - data_->strategies_.begin());
+        }
+        if (NULL == key.get()) {
+            key.reset(strategy->createKey(ctx, invoke_ctx, object).release());
+        }
+        cache_ctx->needRefresh(false);
         
         boost::function<bool()> f = boost::bind(&DocCacheStrategy::loadDoc,
                 strategy, boost::cref(key.get()), cache_ctx, boost::ref(tag), boost::ref(cache_data));
@@ -235,6 +725,9 @@ DocCacheBase::loadDocImpl(InvokeContext *invoke_ctx, CacheContext *cache_ctx,
                 i->second->usageCounter_->fetchedHit(ctx, object);
             }
             i->second->hitCounter_->add(res.second);
+            if (cache_ctx->needRefresh()) {
+                data_->refresh(i->second, cache_ctx);
+            }
         }
         else {
             if (i->second->usageCounter_.get()) {
@@ -248,11 +741,21 @@ DocCacheBase::loadDocImpl(InvokeContext *invoke_ctx, CacheContext *cache_ctx,
             check_tag_key = false;
             invoke_ctx->tagKey(key);
         }
+
+        if (NULL == first_key.get()) {
+            first_key = key;
+        }
         
         loaded = res.first;
         ++i;
     }
 
+    if (!loaded && NULL != first_key.get()) {
+        if (coalesceMiss(cache_ctx, first_key->asString(), tag, cache_data)) {
+            return true;
+        }
+    }
+
     if (!loaded) {
         const TaggedBlock *block = NULL == invoke_ctx ? NULL : dynamic_cast<const TaggedBlock*>(object);
         checkTag(ctx, block, tag, "loading doc from tagged cache");
@@ -326,6 +829,20 @@ DocCacheBase::saveDocImpl(const InvokeContext *invoke_ctx, CacheContext *cache_c
             }
         }
         
+        if (data_->writer_.enabled() && strategy->writeBehindSupported()) {
+            boost::function<bool()> task = strategy->createSaveTask(key.get(), tag, cache_data);
+            bool queued = !task.empty() && data_->writer_.enqueue(strategy->name() + key->asString(),
+                boost::bind(&DocCacheData::runSave, i->second, task));
+            if (!task.empty() && !queued) {
+                log()->info("%s write queue is full, save dropped", name().c_str());
+            }
+            if (queued && data_->coalescing_) {
+                data_->flights_.publish(key->asString(), cache_data, tag);
+            }
+            saved |= queued;
+            continue;
+        }
+
         boost::function<bool()> f =
             boost::bind(&DocCacheStrategy::saveDoc, strategy,
                     boost::cref(key.get()), cache_ctx, boost::cref(tag), boost::cref(cache_data));
@@ -333,11 +850,119 @@ DocCacheBase::saveDocImpl(const InvokeContext *invoke_ctx, CacheContext *cache_c
         std::pair<bool, uint64_t> res = profile(f);
         i->second->saveCounter_->add(res.second); 
         
+        if (res.first && data_->coalescing_) {
+            data_->flights_.publish(key->asString(), cache_data, tag);
+        }
         saved |= res.first;
     }
     return saved;
 }
 
+bool
+DocCacheBase::prefetchSupported() const {
+    for (DocCacheData::StrategyMap::const_iterator i = data_->strategies_.begin();
+         i != data_->strategies_.end();
+         ++i) {
+        if (i->first->prefetchSupported()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+DocCacheBase::prefetchDocsImpl(const CachePrefetchList &objects) {
+    if (objects.empty()) {
+        return;
+    }
+
+    // Strategies are walked in the order loadDocImpl uses. An object found in
+    // a local strategy is loaded from there, so later ones do not fetch it.
+    const DocCacheData::StrategyMap &strategies = data_->strategies_;
+    std::vector<std::vector<boost::shared_ptr<TagKey> > > keys(objects.size(),
+        std::vector<boost::shared_ptr<TagKey> >(strategies.size()));
+    std::vector<bool> pending(objects.size(), true);
+    Context *ctx = objects.front().second->context();
+
+    for (unsigned int n = 0; n < strategies.size(); ++n) {
+        DocCacheStrategy* strategy = strategies[n].first;
+        bool batch = strategy->prefetchSupported();
+        std::vector<const TagKey*> batch_keys;
+        for (unsigned int k = 0; k < objects.size(); ++k) {
+            const CachePrefetchList::value_type &object = objects[k];
+            if (!pending[k] || !allow(strategy, object.second)) {
+                continue;
+            }
+            try {
+                boost::shared_ptr<TagKey> &key = keys[k][n];
+                key.reset(strategy->createKey(ctx, object.first, object.second->object()).release());
+                if (batch) {
+                    batch_keys.push_back(key.get());
+                }
+                else if (strategy->containsDoc(key.get())) {
+                    pending[k] = false;
+                }
+            }
+            catch (const std::exception &e) {
+                log()->debug("skip cache prefetch in %s: %s", strategy->name().c_str(), e.what());
+                pending[k] = false;
+            }
+        }
+        if (batch_keys.empty()) {
+            continue;
+        }
+
+        try {
+            strategy->prefetchDocs(ctx, batch_keys);
+        }
+        catch (const std::exception &e) {
+            log()->error("caught exception while prefetching docs from %s: %s",
+                strategy->name().c_str(), e.what());
+        }
+    }
+
+    for (unsigned int k = 0; k < objects.size(); ++k) {
+        objects[k].first->prefetchKeys(keys[k]);
+    }
+}
+
+bool
+DocCacheBase::coalesceMiss(CacheContext *cache_ctx, const std::string &key,
+    Tag &tag, boost::shared_ptr<CacheData> &cache_data) {
+
+    if (!data_->coalescing_ || !cache_ctx->allowCoalescing() || NULL != cache_ctx->flight().get()) {
+        return false;
+    }
+
+    bool leader = false;
+    boost::shared_ptr<FlightState> state = data_->flights_.join(key, leader);
+    if (leader) {
+        cache_ctx->flight(boost::shared_ptr<CacheFlight>(
+            new CacheFlight(&data_->flights_, key, state)));
+        return false;
+    }
+
+    int timeout = cache_ctx->context()->timer().remained();
+    if (timeout > data_->coalescing_max_wait_) {
+        timeout = data_->coalescing_max_wait_;
+    }
+    if (timeout <= 0) {
+        return false;
+    }
+
+    log()->debug("waiting for coalesced cache miss, key: %s", key.c_str());
+    boost::function<bool()> f = boost::bind(&FlightState::wait,
+        state.get(), timeout, boost::ref(cache_data), boost::ref(tag));
+    std::pair<bool, uint64_t> res = profile(f);
+    if (res.first) {
+        data_->coalescedCounter_->add(res.second);
+    }
+    else {
+        data_->coalesceFailedCounter_->add(res.second);
+    }
+    return res.first;
+}
+
 DocCache::DocCache() {
 }
 
@@ -381,6 +1006,16 @@ DocCache::saveDoc(const InvokeContext *invoke_ctx, CacheContext *cache_ctx,
     return false;
 }
 
+void
+DocCache::prefetchDocs(const CachePrefetchList &objects) {
+    prefetchDocsImpl(objects);
+}
+
+bool
+DocCache::prefetchEnabled() const {
+    return prefetchSupported();
+}
+
 PageCache::PageCache() : use_etag_(false) {
 }
 
@@ -431,11 +1066,13 @@ PageCache::saveDoc(CacheContext *cache_ctx, const Tag &tag,
 }
 
 CacheContext::CacheContext(CachedObject *obj, Context *ctx) :
-    obj_(obj), ctx_(ctx), allow_distributed_(true)
+    obj_(obj), ctx_(ctx), allow_distributed_(true), allow_coalescing_(false),
+    need_refresh_(false)
 {}
 
 CacheContext::CacheContext(CachedObject *obj, Context *ctx, bool allow_distributed) :
-    obj_(obj), ctx_(ctx), allow_distributed_(allow_distributed)
+    obj_(obj), ctx_(ctx), allow_distributed_(allow_distributed), allow_coalescing_(false),
+    need_refresh_(false)
 {}
 
 CachedObject*
@@ -458,17 +1095,67 @@ CacheContext::allowDistributed(bool flag) {
     allow_distributed_ = flag;
 }
 
+bool
+CacheContext::allowCoalescing() const {
+    return allow_coalescing_;
+}
+
+void
+CacheContext::allowCoalescing(bool flag) {
+    allow_coalescing_ = flag;
+}
+
+const boost::shared_ptr<CacheFlight>&
+CacheContext::flight() const {
+    return flight_;
+}
+
+void
+CacheContext::flight(const boost::shared_ptr<CacheFlight> &flight) {
+    flight_ = flight;
+}
+
+bool
+CacheContext::allowRefresh() const {
+    return !refresh_factory_.empty();
+}
+
+void
+CacheContext::refreshFactory(const RefreshFactory &factory) {
+    refresh_factory_ = factory;
+}
+
+CacheContext::RefreshTask
+CacheContext::createRefreshTask() const {
+    return refresh_factory_.empty() ? RefreshTask() : refresh_factory_();
+}
+
+bool
+CacheContext::needRefresh() const {
+    return need_refresh_;
+}
+
+void
+CacheContext::needRefresh(bool flag) {
+    need_refresh_ = flag;
+}
+
 CacheData::CacheData()
 {}
 
 CacheData::~CacheData()
 {}
 
-PageCacheData::PageCacheData() : expire_time_delta_(0)
+bool
+CacheData::serializeBinary(std::string &buf) {
+    return serialize(buf);
+}
+
+PageCacheData::PageCacheData() : expire_time_delta_(0), gzipped_(false)
 {}
 
 PageCacheData::PageCacheData(const char *buf, std::streamsize size) :
-    data_(buf, size), expire_time_delta_(0)
+    data_(buf, size), expire_time_delta_(0), gzipped_(false)
 {}
 
 PageCacheData::~PageCacheData()
@@ -502,13 +1189,14 @@ PageCacheData::parse(const char *buf, boost::uint32_t size) {
     }
     
     boost::uint32_t sign = *((boost::uint32_t*)buf);
-    if (SIGNATURE != sign) {
+    if (SIGNATURE != sign && GZIP_SIGNATURE != sign) {
         log()->error("error while parsing page cache data: incorrect sign: %d", sign);
         return false;
     }
     
     data_.clear();
     headers_.clear();
+    gzipped_ = GZIP_SIGNATURE == sign;
     
     const char *buf_orig = buf;
 
@@ -566,7 +1254,7 @@ PageCacheData::serialize(std::string &buf) {
     buf.clear();
     buf.reserve(sizeof(SIGNATURE) + sizeof(expire_time_delta_) + sizeof(etag_size) + etag_size + sz + 2 + data_.size());
 
-    buf.append((const char*)&SIGNATURE, sizeof(SIGNATURE));
+    buf.append((const char*)(gzipped_ ? &GZIP_SIGNATURE : &SIGNATURE), sizeof(SIGNATURE));
     buf.append((const char*)&expire_time_delta_, sizeof(expire_time_delta_));
 
     buf.append((char*)&etag_size, sizeof(etag_size));
@@ -590,9 +1278,62 @@ PageCacheData::cleanup(Context *ctx) {
     (void)ctx;
 }
 
-const std::string&
-PageCacheData::etag() const {
-    return etag_;
+std::size_t
+PageCacheData::memoryUsage() const {
+    std::size_t size = sizeof(*this) + data_.capacity() + etag_.capacity();
+    for(std::vector<std::pair<std::string, std::string> >::const_iterator i = headers_.begin();
+        i != headers_.end(); ++i) {
+        size += sizeof(*i) + i->first.capacity() + i->second.capacity();
+    }
+    return size;
+}
+
+std::string
+PageCacheData::etag(bool gzip) const {
+    if (!gzip || !gzipped_ || etag_.size() < 2) {
+        return etag_;
+    }
+    std::string result(etag_, 0, etag_.size() - 1);
+    result.append("-gz\"");
+    return result;
+}
+
+void
+PageCacheData::compress(boost::uint32_t min_size) {
+    if (gzipped_ || data_.size() < min_size) {
+        return;
+    }
+    bool compressible = false;
+    typedef std::vector<std::pair<std::string, std::string> > HeaderMap;
+    for (HeaderMap::const_iterator it = headers_.begin(), end = headers_.end(); it != end; ++it) {
+        if (0 == strcasecmp(it->first.c_str(), HttpUtils::STATUS_HEADER_NAME.c_str())) {
+            if (0 != strncmp(it->second.c_str(), "200", 3)) {
+                return;
+            }
+        }
+        else if (0 == strcasecmp(it->first.c_str(), HttpUtils::CONTENT_ENCODING_HEADER_NAME.c_str())) {
+            return;
+        }
+        else if (0 == strcasecmp(it->first.c_str(), HttpUtils::CONTENT_TYPE_HEADER_NAME.c_str())) {
+            compressible = Gzip::compressible(it->second);
+        }
+    }
+    if (!compressible) {
+        return;
+    }
+
+    checkETag();
+    std::string result;
+    Gzip::compress(data_.c_str(), data_.size(), result, Z_BEST_SPEED);
+    if (result.size() < data_.size()) {
+        data_.swap(result);
+        gzipped_ = true;
+    }
+}
+
+bool
+PageCacheData::gzipped() const {
+    return gzipped_;
 }
 
 void
@@ -618,12 +1359,36 @@ PageCacheData::checkETag() const {
 void
 PageCacheData::write(std::ostream *os, const Response *response) const {
     checkETag();
+    bool gzip = gzipped_ && response->acceptGzip();
+    std::string gunzipped;
+    if (gzipped_ && !gzip) {
+        Gzip::decompress(data_.c_str(), data_.size(), gunzipped);
+    }
+    const std::string &body = gzipped_ && !gzip ? gunzipped : data_;
+
+    bool vary_sent = false;
     typedef std::vector<std::pair<std::string, std::string> > HeaderMap;
     for (HeaderMap::const_iterator it = headers_.begin(), end = headers_.end();
         it != end;
-        ++it) {       
-        (*os) << it->first << ": " << it->second << "\r\n";
+        ++it) {
+        if (0 == strcasecmp(it->first.c_str(), HttpUtils::CONTENT_LENGTH_HEADER_NAME.c_str())) {
+            continue;
+        }
+        (*os) << it->first << ": " << it->second;
+        if (gzipped_ && 0 == strcasecmp(it->first.c_str(), HttpUtils::VARY_HEADER_NAME.c_str())) {
+            (*os) << ", " << HttpUtils::ACCEPT_ENCODING_HEADER_NAME;
+            vary_sent = true;
+        }
+        (*os) << "\r\n";
     }
+
+    if (gzipped_ && !vary_sent) {
+        (*os) << HttpUtils::VARY_HEADER_NAME << ": " << HttpUtils::ACCEPT_ENCODING_HEADER_NAME << "\r\n";
+    }
+    if (gzip) {
+        (*os) << HttpUtils::CONTENT_ENCODING_HEADER_NAME << ": gzip\r\n";
+    }
+    (*os) << HttpUtils::CONTENT_LENGTH_HEADER_NAME << ": " << body.size() << "\r\n";
     
     const CookieSet& cookies = response->outCookies();
     for (CookieSet::const_iterator it = cookies.begin(), end = cookies.end(); it != end; ++it) {
@@ -631,13 +1396,13 @@ PageCacheData::write(std::ostream *os, const Response *response) const {
     }
 
     if (PageCache::instance()->useETag()) {
-        (*os) << "ETag: " << etag_ << "\r\n";
+        (*os) << "ETag: " << etag(gzip) << "\r\n";
     }
 
     boost::int32_t expires = HttpDateUtils::expires(expire_time_delta_);
     (*os) << "Expires: " << HttpDateUtils::format(expires) << "\r\n\r\n";
     
-    os->write(data_.c_str(), data_.size());
+    os->write(body.c_str(), body.size());
 }
 
 bool
@@ -655,7 +1420,7 @@ PageCacheData::notModified(Context *ctx) const {
     typedef boost::tokenizer<Separator> Tokenizer;
     Tokenizer tok(if_none_match, Separator(", "));
     for (Tokenizer::iterator it = tok.begin(), it_end = tok.end(); it != it_end; ++it) {
-        if (*it == etag_) {
+        if (*it == etag_ || (gzipped_ && *it == etag(true))) {
             matched = true;
             break;
         }
@@ -669,7 +1434,9 @@ PageCacheData::size() const {
 }
 
 const boost::uint32_t BlockCacheData::SIGNATURE = 0xffffff3a;
+const boost::uint32_t BlockCacheData::BINARY_SIGNATURE = 0xffffff3c;
 const boost::uint32_t PageCacheData::SIGNATURE = 0xffffff1b;
+const boost::uint32_t PageCacheData::GZIP_SIGNATURE = 0xffffff1d;
 
 BlockCacheData::BlockCacheData()
 {}
@@ -705,7 +1472,7 @@ BlockCacheData::parse(const char *buf, boost::uint32_t size) {
         }
         
         boost::uint32_t sign = *((boost::uint32_t*)buf);
-        if (SIGNATURE != sign) {
+        if (SIGNATURE != sign && BINARY_SIGNATURE != sign) {
             log()->error("error while parsing block cache data: incorrect sign: %d", sign);
             return false;
         }
@@ -731,9 +1498,15 @@ BlockCacheData::parse(const char *buf, boost::uint32_t size) {
             return true;
         }
 
-        XmlDocHelper newdoc(xmlReadMemory(buf + meta_size, size - meta_size, "",
-            "UTF-8", XML_PARSE_DTDATTR | XML_PARSE_NOENT));
-        XmlUtils::throwUnless(NULL != newdoc.get());
+        XmlDocHelper newdoc;
+        if (BINARY_SIGNATURE == sign) {
+            newdoc = BinaryDoc::decode(buf + meta_size, size - meta_size);
+        }
+        else {
+            newdoc = XmlDocHelper(xmlReadMemory(buf + meta_size, size - meta_size, "",
+                "UTF-8", XML_PARSE_DTDATTR | XML_PARSE_NOENT));
+            XmlUtils::throwUnless(NULL != newdoc.get());
+        }
         if (NULL == xmlDocGetRootElement(newdoc.get())) {
             log()->warn("get document with no root while parsing block cache data");
             return false;
@@ -766,29 +1539,55 @@ cacheCloseFunc(void *ctx) {
     return 0;
 }
 
-bool
-BlockCacheData::serialize(std::string &buf) {
+void
+BlockCacheData::serializeMeta(std::string &buf, boost::uint32_t signature) const {
     buf.clear();
-    buf.append((char*)&SIGNATURE, sizeof(SIGNATURE));
+    buf.append((char*)&signature, sizeof(signature));
     boost::uint32_t meta_size = 0;
     buf.append((char*)&meta_size, sizeof(meta_size));
     if (meta_.get()) {
         meta_->serialize(buf);
     }
-    meta_size = buf.size() - sizeof(SIGNATURE) - sizeof(meta_size);
+    meta_size = buf.size() - sizeof(signature) - sizeof(meta_size);
     if (meta_size > 0) {
-        buf.replace(sizeof(SIGNATURE), sizeof(meta_size),
+        buf.replace(sizeof(signature), sizeof(meta_size),
             (char*)&meta_size, sizeof(meta_size));
     }
+}
+
+bool
+BlockCacheData::serialize(std::string &buf) {
+    serializeMeta(buf, SIGNATURE);
     xmlOutputBufferPtr buffer = NULL;
     buffer = xmlOutputBufferCreateIO(&cacheWriteFunc, &cacheCloseFunc, &buf, NULL);
     xmlSaveFormatFileTo(buffer, doc_.get(), "UTF-8", 0);
     return true;
 }
 
+bool
+BlockCacheData::serializeBinary(std::string &buf) {
+    serializeMeta(buf, BINARY_SIGNATURE);
+    if (BinaryDoc::encode(doc_.get(), buf)) {
+        return true;
+    }
+    log()->debug("document is not suitable for binary cache format, saving as text");
+    return serialize(buf);
+}
+
 void
 BlockCacheData::cleanup(Context *ctx) {
     ctx->addDoc(doc_);
 }
 
+std::size_t
+BlockCacheData::memoryUsage() const {
+    std::size_t size = sizeof(*this) + XmlUtils::memoryUsage(doc_.get());
+    if (meta_.get()) {
+        std::string buf;
+        meta_->serialize(buf);
+        size += sizeof(MetaCore) + buf.size();
+    }
+    return size;
+}
+
 } // namespace xscript
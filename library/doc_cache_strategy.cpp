@@ -1,15 +1,24 @@
 #include "settings.h"
 
+#include <stdexcept>
+
+#include <sys/time.h>
+
 #include <boost/bind.hpp>
 #include <boost/tokenizer.hpp>
 
+#include "xscript/average_counter.h"
 #include "xscript/config.h"
 #include "xscript/control_extension.h"
 #include "xscript/doc_cache.h"
 #include "xscript/doc_cache_strategy.h"
 #include "xscript/logger.h"
+#include "xscript/profiler.h"
+#include "xscript/stat_builder.h"
 #include "xscript/tag.h"
 
+#include "internal/payload_codec.h"
+
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
 #endif
@@ -22,7 +31,8 @@ TagKey::TagKey() {
 TagKey::~TagKey() {
 }
 
-DocCacheStrategy::DocCacheStrategy() {
+DocCacheStrategy::DocCacheStrategy() :
+    page_cache_(false), block_cache_(false), binary_format_(false), codec_(PayloadCodec::NONE), compress_threshold_(0) {
 }
 
 DocCacheStrategy::~DocCacheStrategy() {
@@ -52,15 +62,130 @@ DocCacheStrategy::insert2Cache(const std::string &no_cache) {
         
     if (cache_page) {
         PageCache::instance()->addStrategy(this, name());
+        page_cache_ = true;
     }
     if (cache_block) {
         DocCache::instance()->addStrategy(this, name());
+        block_cache_ = true;
+    }
+}
+
+void
+DocCacheStrategy::removeFromCaches() {
+    if (page_cache_) {
+        PageCache::instance()->removeStrategy(this);
+        page_cache_ = false;
+    }
+    if (block_cache_) {
+        DocCache::instance()->removeStrategy(this);
+        block_cache_ = false;
+    }
+}
+
+void
+DocCacheStrategy::docFormat(const std::string &format) {
+    if (format.empty() || strcasecmp(format.c_str(), "text") == 0) {
+        binary_format_ = false;
+    }
+    else if (strcasecmp(format.c_str(), "binary") == 0) {
+        binary_format_ = true;
+    }
+    else {
+        throw std::runtime_error("Unknown cache doc format: " + format);
     }
 }
 
+void
+DocCacheStrategy::compression(const std::string &codec, boost::uint32_t threshold) {
+    codec_ = PayloadCodec::type(codec);
+    compress_threshold_ = threshold;
+
+    AverageCounterFactory *factory = AverageCounterFactory::instance();
+    compress_ratio_counter_ = factory->createCounter(name() + "-compress-ratio-percent");
+    compress_time_counter_ = factory->createCounter(name() + "-compress-time-usec");
+    decompress_time_counter_ = factory->createCounter(name() + "-decompress-time-usec");
+}
+
+bool
+DocCacheStrategy::serialize(CacheData *cache_data, std::string &buf) const {
+    bool res = binary_format_ ? cache_data->serializeBinary(buf) : cache_data->serialize(buf);
+    if (!res || PayloadCodec::NONE == codec_ || buf.size() < compress_threshold_ || buf.empty()) {
+        return res;
+    }
+
+    std::string::size_type size = buf.size();
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+    PayloadCodec::encode((PayloadCodec::Type)codec_, buf);
+    gettimeofday(&end, 0);
+
+    compress_time_counter_->add(end - start);
+    compress_ratio_counter_->add((boost::uint64_t)buf.size() * 100 / size);
+    return true;
+}
+
+bool
+DocCacheStrategy::parse(CacheData *cache_data, const char *buf, boost::uint32_t size) const {
+    if (!PayloadCodec::encoded(buf, size)) {
+        return cache_data->parse(buf, size);
+    }
+
+    std::string data;
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+    try {
+        PayloadCodec::decode(buf, size, data);
+    }
+    catch (const std::exception &e) {
+        log()->error("cannot decompress cached doc in %s: %s", name().c_str(), e.what());
+        return false;
+    }
+    gettimeofday(&end, 0);
+
+    if (NULL != decompress_time_counter_.get()) {
+        decompress_time_counter_->add(end - start);
+    }
+    return cache_data->parse(data.data(), data.size());
+}
+
 void
 DocCacheStrategy::fillStatBuilder(StatBuilder *builder) {
-    (void)builder;
+    if (PayloadCodec::NONE != codec_) {
+        builder->addCounter(compress_ratio_counter_.get());
+        builder->addCounter(compress_time_counter_.get());
+        builder->addCounter(decompress_time_counter_.get());
+    }
+}
+
+bool
+DocCacheStrategy::prefetchSupported() const {
+    return false;
+}
+
+void
+DocCacheStrategy::prefetchDocs(Context *ctx, const std::vector<const TagKey*> &keys) {
+    (void)ctx;
+    (void)keys;
+}
+
+bool
+DocCacheStrategy::containsDoc(const TagKey *key) {
+    (void)key;
+    return false;
+}
+
+bool
+DocCacheStrategy::writeBehindSupported() const {
+    return false;
+}
+
+boost::function<bool()>
+DocCacheStrategy::createSaveTask(const TagKey *key,
+    const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
+    (void)key;
+    (void)tag;
+    (void)cache_data;
+    return boost::function<bool()>();
 }
 
 } // namespace xscript
@@ -19,6 +19,11 @@ DummyCacheCounter::decUsedMemory(size_t amount) {
     (void)amount;
 }
 
+void
+DummyCacheCounter::incEvictedMemory(size_t amount) {
+    (void)amount;
+}
+
 void
 DummyCacheCounter::incLoaded() {
 }
@@ -0,0 +1,36 @@
+#include "settings.h"
+
+#include "details/dummy_histogram_counter.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+DummyHistogramCounter::DummyHistogramCounter() {
+}
+
+DummyHistogramCounter::~DummyHistogramCounter() {
+}
+
+void DummyHistogramCounter::add(boost::uint64_t value) {
+    (void)value;
+}
+
+boost::uint64_t
+DummyHistogramCounter::count() const {
+    return 0;
+}
+
+boost::uint64_t
+DummyHistogramCounter::percentile(double fraction) const {
+    (void)fraction;
+    return 0;
+}
+
+XmlNodeHelper DummyHistogramCounter::createReport() const {
+    return XmlNodeHelper(xmlNewNode(0, (const xmlChar*) "dummy"));
+}
+
+} // namespace xscript
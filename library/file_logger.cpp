@@ -2,27 +2,59 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <time.h>
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "xscript/config.h"
 #include "xscript/logger.h"
 #include "xscript/util.h"
-#include "details/file_logger.h"
+#include "internal/file_logger.h"
 
 
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
 #endif
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 const size_t BUF_SIZE = 5120;
 
 namespace xscript {
 
+static const unsigned int DEFAULT_BUFFER_SIZE = 65536;
+
+static unsigned int next_logger_id_ = 0;
+
+static boost::xtime
+deadline(int millis) {
+    boost::xtime xt;
+    boost::xtime_get(&xt, boost::TIME_UTC_);
+    boost::uint64_t nsec = xt.nsec + millis * 1000000ULL;
+    xt.sec += nsec / 1000000000;
+    xt.nsec = nsec % 1000000000;
+    return xt;
+}
+
+FileLogger::Ring::Ring(unsigned int owner, size_t capacity) :
+    owner(owner), data(new char[capacity]), capacity(capacity), head(0), tail(0), refs(2),
+    stampTime(0), stampSize(0)
+{}
+
+FileLogger::Ring::~Ring() {
+    delete [] data;
+}
 
 FileLogger::FileLogger(Logger::LogLevel level, const Config * config, const std::string &key)
         :
@@ -30,7 +62,15 @@ FileLogger::FileLogger(Logger::LogLevel level, const Config * config, const std:
         openMode_(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH),
         crash_(true),
         fd_(-1),
+        id_(__sync_add_and_fetch(&next_logger_id_, 1)),
         stopping_(false),
+        ringSize_(DEFAULT_BUFFER_SIZE),
+        blockOnOverflow_(true),
+        dropped_(0),
+        blocked_(0),
+        ring_(&FileLogger::releaseRing),
+        sleeping_(false),
+        waiting_(0),
         writingThread_(boost::bind(&FileLogger::writingThread, this)) {
     filename_ = config->as<std::string>(key + "/file");
 
@@ -52,6 +92,11 @@ FileLogger::FileLogger(Logger::LogLevel level, const Config * config, const std:
         crash_ = false;
     }
 
+    // Ring must hold at least one line of maximum size
+    ringSize_ = std::max(BUF_SIZE,
+        (size_t)config->as<unsigned int>(key + "/buffer-size", DEFAULT_BUFFER_SIZE));
+    blockOnOverflow_ = config->as<std::string>(key + "/overflow", "block") != "drop";
+
     std::string::size_type pos = 0;
     while (true) {
         pos = filename_.find('/', pos + 1);
@@ -60,18 +105,22 @@ FileLogger::FileLogger(Logger::LogLevel level, const Config * config, const std:
         }
         FileUtils::makeDir(filename_.substr(0, pos), openMode_ | S_IXUSR | S_IXGRP | S_IXOTH);
     }
-    
+
     openFile();
 }
 
 FileLogger::~FileLogger() {
     stopping_ = true;
-    queueCondition_.notify_one();
+    wakeWriter();
     writingThread_.join();
 
     if (fd_ != -1) {
         close(fd_);
     }
+
+    for (std::vector<Ring*>::iterator i = rings_.begin(); i != rings_.end(); ++i) {
+        releaseRing(*i);
+    }
 }
 
 void FileLogger::openFile() {
@@ -93,6 +142,17 @@ void FileLogger::logRotate() {
     openFile();
 }
 
+XmlNodeHelper
+FileLogger::createReport() const {
+    XmlNodeHelper line(xmlNewNode(NULL, (const xmlChar*) "file-logger"));
+    xmlSetProp(line.get(), (const xmlChar*) "file", (const xmlChar*) filename_.c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "dropped",
+        (const xmlChar*) boost::lexical_cast<std::string>(dropped_).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "blocked",
+        (const xmlChar*) boost::lexical_cast<std::string>(blocked_).c_str());
+    return line;
+}
+
 void
 FileLogger::critInternal(const char *format, va_list args) {
     pushIntoQueue("crit", format, args);
@@ -120,6 +180,51 @@ FileLogger::debugInternal(const char *format, va_list args) {
     pushIntoQueue("debug", format, args);
 }
 
+FileLogger::Ring*
+FileLogger::ring() {
+    Ring *ring = ring_.get();
+    if (NULL == ring || id_ != ring->owner) {
+        ring = new Ring(id_, ringSize_);
+        {
+            boost::mutex::scoped_lock lock(ringsMutex_);
+            rings_.push_back(ring);
+        }
+        ring_.reset(ring);
+    }
+    return ring;
+}
+
+void
+FileLogger::releaseRing(Ring *ring) {
+    if (0 == __sync_sub_and_fetch(&ring->refs, 1)) {
+        delete ring;
+    }
+}
+
+size_t
+FileLogger::formatLine(Ring *ring, char *buf, size_t size, const char *type, const char *format, va_list args) {
+    time_t now = time(NULL);
+    if (now != ring->stampTime) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        ring->stampSize = strftime(ring->stamp, sizeof(ring->stamp), "[%Y/%m/%d %T] ", &tm);
+        ring->stampTime = now;
+    }
+
+    memcpy(buf, ring->stamp, ring->stampSize);
+    size_t pos = ring->stampSize;
+    pos += snprintf(buf + pos, size - pos, "%s: ", type);
+
+    // Reserve room for line feed
+    int res = vsnprintf(buf + pos, size - pos - 1, format, args);
+    if (res < 0) {
+        return 0;
+    }
+    pos += std::min((size_t)res, size - pos - 2);
+    buf[pos++] = '\n';
+    return pos;
+}
+
 void
 FileLogger::pushIntoQueue(const char* type, const char* format, va_list args) {
 
@@ -127,51 +232,170 @@ FileLogger::pushIntoQueue(const char* type, const char* format, va_list args) {
     if (fd_ == -1)
         return;
 
-    char fmt[BUF_SIZE];
-    prepareFormat(fmt, sizeof(fmt), type, format);
+    Ring *ring = this->ring();
 
     char buf[BUF_SIZE];
-    int size = vsnprintf(buf, BUF_SIZE - 1, fmt, args);
-    if (size > 0) {
-        buf[BUF_SIZE - 1] = '\0';
-        boost::mutex::scoped_lock lock(queueMutex_);
-        queue_.push_back(buf);
-        queueCondition_.notify_one();
+    size_t size = formatLine(ring, buf, sizeof(buf), type, format, args);
+    if (0 == size) {
+        return;
+    }
+
+    size_t head = ring->head;
+    bool counted = false;
+    while (true) {
+        size_t tail = ring->tail;
+        __sync_synchronize();
+        if (head - tail + size <= ring->capacity) {
+            break;
+        }
+        if (!blockOnOverflow_ || stopping_) {
+            __sync_fetch_and_add(&dropped_, 1);
+            return;
+        }
+        if (!counted) {
+            __sync_fetch_and_add(&blocked_, 1);
+            counted = true;
+        }
+        __sync_fetch_and_add(&waiting_, 1);
+        wakeWriter();
+        {
+            boost::mutex::scoped_lock lock(spaceMutex_);
+            if (ring->tail == tail) {
+                spaceCondition_.timed_wait(lock, deadline(10));
+            }
+        }
+        __sync_fetch_and_sub(&waiting_, 1);
+    }
+
+    size_t pos = head % ring->capacity;
+    size_t first = std::min(size, ring->capacity - pos);
+    memcpy(ring->data + pos, buf, first);
+    memcpy(ring->data, buf + first, size - first);
+
+    __sync_synchronize();
+    ring->head = head + size;
+    __sync_synchronize();
+
+    if (sleeping_) {
+        wakeWriter();
     }
 }
 
 void
-FileLogger::prepareFormat(char * buf, size_t size, const char* type, const char* format) {
-    time_t t;
-    struct tm tm;
-    time(&t);
-    localtime_r(&t, &tm);
+FileLogger::wakeWriter() {
+    boost::mutex::scoped_lock lock(queueMutex_);
+    queueCondition_.notify_one();
+}
 
-    char timestr[64];
-    strftime(timestr, sizeof(timestr) - 1, "[%Y/%m/%d %T]", &tm);
+bool
+FileLogger::drain(std::vector<Ring*> &rings) {
+    std::vector<iovec> iov;
+    std::vector<std::pair<Ring*, size_t> > drained;
+    bool written = false;
+
+    std::vector<Ring*>::iterator i = rings.begin();
+    while (true) {
+        if (rings.end() != i && iov.size() + 2 <= IOV_MAX) {
+            Ring *ring = *i++;
+            size_t head = ring->head;
+            __sync_synchronize();
+            size_t tail = ring->tail;
+            if (head == tail) {
+                continue;
+            }
+
+            size_t pos = tail % ring->capacity;
+            size_t size = head - tail;
+            size_t first = std::min(size, ring->capacity - pos);
+            iovec v = { ring->data + pos, first };
+            iov.push_back(v);
+            if (size > first) {
+                iovec w = { ring->data, size - first };
+                iov.push_back(w);
+            }
+            drained.push_back(std::make_pair(ring, head));
+            continue;
+        }
+
+        if (iov.empty()) {
+            break;
+        }
 
-    snprintf(buf, size - 1, "%s %s: %s\n", timestr, type, format);
-    buf[size - 1] = '\0';
+        {
+            boost::mutex::scoped_lock fdlock(fdMutex_);
+            for (size_t n = 0; fd_ != -1 && n < iov.size(); ) {
+                ssize_t res = ::writev(fd_, &iov[n], iov.size() - n);
+                if (res < 0) {
+                    if (EINTR == errno) {
+                        continue;
+                    }
+                    break;
+                }
+                for (; n < iov.size() && (size_t)res >= iov[n].iov_len; ++n) {
+                    res -= iov[n].iov_len;
+                }
+                if (n < iov.size()) {
+                    iov[n].iov_base = (char*)iov[n].iov_base + res;
+                    iov[n].iov_len -= res;
+                }
+            }
+        }
+
+        __sync_synchronize();
+        for (std::vector<std::pair<Ring*, size_t> >::iterator d = drained.begin(); d != drained.end(); ++d) {
+            d->first->tail = d->second;
+        }
+        __sync_synchronize();
+        if (waiting_ > 0) {
+            boost::mutex::scoped_lock lock(spaceMutex_);
+            spaceCondition_.notify_all();
+        }
+
+        iov.clear();
+        drained.clear();
+        written = true;
+    }
+    return written;
 }
 
 void
 FileLogger::writingThread() {
-    while (!stopping_) {
-        std::vector<std::string> queueCopy;
-
+    std::vector<Ring*> rings;
+    while (true) {
         {
-            boost::mutex::scoped_lock lock(queueMutex_);
-            queueCondition_.wait(lock);
-            std::swap(queueCopy, queue_);
-            // unlock mutex
+            boost::mutex::scoped_lock lock(ringsMutex_);
+            std::vector<Ring*>::iterator end = rings_.begin();
+            for (std::vector<Ring*>::iterator i = rings_.begin(); i != rings_.end(); ++i) {
+                // Producing thread has exited and everything is written
+                if (1 == (*i)->refs && (*i)->head == (*i)->tail) {
+                    releaseRing(*i);
+                }
+                else {
+                    *end++ = *i;
+                }
+            }
+            rings_.erase(end, rings_.end());
+            rings = rings_;
         }
 
-        boost::mutex::scoped_lock fdlock(fdMutex_);
-        if (fd_ != -1) {
-            for (std::vector<std::string>::iterator i = queueCopy.begin(); i != queueCopy.end(); ++i) {
-                ::write(fd_, i->c_str(), i->length());
-            }
+        if (drain(rings)) {
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(queueMutex_);
+        if (stopping_) {
+            break;
+        }
+        sleeping_ = true;
+        __sync_synchronize();
+        bool empty = true;
+        for (std::vector<Ring*>::iterator i = rings.begin(); empty && i != rings.end(); ++i) {
+            empty = (*i)->head == (*i)->tail;
+        }
+        if (empty) {
+            queueCondition_.timed_wait(lock, deadline(1000));
         }
+        sleeping_ = false;
     }
 }
 
@@ -0,0 +1,171 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+
+#include <boost/tokenizer.hpp>
+
+#include "xscript/algorithm.h"
+#include "xscript/range.h"
+
+#include "internal/gzip.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+static const int GZIP_WINDOW_BITS = 15 + 16;
+static const int GZIP_MEM_LEVEL = 8;
+static const std::size_t GZIP_BUFFER_SIZE = 16384;
+
+static bool
+acceptedQuality(const Range &params) {
+    Range param, tail = params;
+    while (!tail.empty()) {
+        split(tail, ';', param, tail);
+        param = trim(param);
+        if (param.size() > 2 && 0 == strncasecmp(param.begin(), "q=", 2)) {
+            return strtod(std::string(param.begin() + 2, param.end()).c_str(), NULL) > 0.0;
+        }
+    }
+    return true;
+}
+
+bool
+Gzip::accepted(const std::string &accept_encoding) {
+    typedef boost::char_separator<char> Separator;
+    typedef boost::tokenizer<Separator> Tokenizer;
+
+    bool any = false;
+    Tokenizer tok(accept_encoding, Separator(","));
+    for (Tokenizer::iterator it = tok.begin(), end = tok.end(); it != end; ++it) {
+        Range coding, params;
+        split(createRange(*it), ';', coding, params);
+        coding = trim(coding);
+        if ((coding.size() == 4 && 0 == strncasecmp(coding.begin(), "gzip", 4)) ||
+            (coding.size() == 6 && 0 == strncasecmp(coding.begin(), "x-gzip", 6))) {
+            return acceptedQuality(params);
+        }
+        if (coding.size() == 1 && '*' == *coding.begin()) {
+            any = acceptedQuality(params);
+        }
+    }
+    return any;
+}
+
+bool
+Gzip::compressible(const std::string &content_type) {
+    Range type, params;
+    split(createRange(content_type), ';', type, params);
+    type = trim(type);
+    std::string value(type.begin(), type.end());
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return 0 == value.compare(0, 5, "text/") ||
+        std::string::npos != value.find("xml") ||
+        std::string::npos != value.find("json") ||
+        std::string::npos != value.find("javascript");
+}
+
+void
+Gzip::compress(const char *data, std::size_t size, std::string &result, int level) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY)) {
+        throw std::runtime_error("cannot init gzip stream");
+    }
+
+    result.resize(deflateBound(&stream, size));
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef*)&result[0];
+    stream.avail_out = result.size();
+    int res = ::deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (Z_STREAM_END != res) {
+        throw std::runtime_error("cannot gzip data");
+    }
+}
+
+void
+Gzip::decompress(const char *data, std::size_t size, std::string &result) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != inflateInit2(&stream, GZIP_WINDOW_BITS)) {
+        throw std::runtime_error("cannot init gunzip stream");
+    }
+
+    result.clear();
+    char buffer[GZIP_BUFFER_SIZE];
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = size;
+    int res = Z_OK;
+    while (Z_OK == res) {
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = sizeof(buffer);
+        res = inflate(&stream, Z_NO_FLUSH);
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+
+    if (Z_STREAM_END != res) {
+        throw std::runtime_error("cannot gunzip data");
+    }
+}
+
+GzipWriter::GzipWriter(std::ostream *os, int level) :
+    os_(os), buffer_(GZIP_BUFFER_SIZE), finished_(false)
+{
+    memset(&stream_, 0, sizeof(stream_));
+    if (Z_OK != deflateInit2(&stream_, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY)) {
+        throw std::runtime_error("cannot init gzip stream");
+    }
+}
+
+GzipWriter::~GzipWriter() {
+    deflateEnd(&stream_);
+}
+
+void
+GzipWriter::write(const char *data, std::size_t size) {
+    stream_.next_in = (Bytef*)data;
+    stream_.avail_in = size;
+    deflate(Z_NO_FLUSH);
+}
+
+void
+GzipWriter::flush() {
+    if (!finished_) {
+        stream_.next_in = NULL;
+        stream_.avail_in = 0;
+        deflate(Z_SYNC_FLUSH);
+    }
+}
+
+void
+GzipWriter::finish() {
+    if (!finished_) {
+        finished_ = true;
+        stream_.next_in = NULL;
+        stream_.avail_in = 0;
+        deflate(Z_FINISH);
+    }
+}
+
+void
+GzipWriter::deflate(int flush) {
+    do {
+        stream_.next_out = (Bytef*)&buffer_[0];
+        stream_.avail_out = buffer_.size();
+        ::deflate(&stream_, flush);
+        os_->write(&buffer_[0], buffer_.size() - stream_.avail_out);
+    } while (0 == stream_.avail_out);
+}
+
+} // namespace xscript
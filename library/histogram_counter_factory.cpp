@@ -0,0 +1,35 @@
+#include "settings.h"
+
+#include "xscript/histogram_counter.h"
+#include "internal/histogram_counter_impl.h"
+#include "details/dummy_histogram_counter.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript
+{
+
+HistogramCounterFactory::HistogramCounterFactory() {
+}
+
+HistogramCounterFactory::~HistogramCounterFactory() {
+}
+
+void
+HistogramCounterFactory::init(const Config *config) {
+    (void)config;
+}
+
+std::auto_ptr<HistogramCounter>
+HistogramCounterFactory::createCounter(const std::string& name, bool want_real) {
+    if (want_real)
+        return std::auto_ptr<HistogramCounter>(new HistogramCounterImpl(name));
+    else
+        return std::auto_ptr<HistogramCounter>(new DummyHistogramCounter());
+}
+
+static ComponentRegisterer<HistogramCounterFactory> reg_;
+
+}
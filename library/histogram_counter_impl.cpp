@@ -0,0 +1,172 @@
+#include "settings.h"
+
+#include <cmath>
+#include <limits>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "internal/histogram_counter_impl.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+const unsigned int HistogramCounterImpl::SUB_BUCKET_BITS;
+const unsigned int HistogramCounterImpl::BUCKET_COUNT;
+const unsigned int HistogramCounterImpl::SHARD_COUNT;
+
+static const boost::uint64_t MAX_TRACKED_VALUE = 0xffffffffULL;
+
+static boost::thread_specific_ptr<unsigned int> shard_index_;
+static unsigned int next_shard_index_ = 0;
+
+static unsigned int
+shardIndex() {
+    unsigned int *index = shard_index_.get();
+    if (NULL == index) {
+        index = new unsigned int(__sync_fetch_and_add(&next_shard_index_, 1));
+        shard_index_.reset(index);
+    }
+    return *index % HistogramCounterImpl::SHARD_COUNT;
+}
+
+struct HistogramCounterImpl::Shard {
+    Shard() : count_(0), total_(0), max_(0), min_(std::numeric_limits<boost::uint64_t>::max()) {}
+
+    boost::mutex mutex_;
+    boost::uint64_t count_;
+    boost::uint64_t total_;
+    boost::uint64_t max_;
+    boost::uint64_t min_;
+    std::vector<boost::uint64_t> buckets_;
+
+    // keeps shards updated by different threads off one cache line
+    char padding_[64];
+};
+
+HistogramCounterImpl::Snapshot::Snapshot() :
+    count_(0), total_(0), max_(0), min_(std::numeric_limits<boost::uint64_t>::max()),
+    buckets_(BUCKET_COUNT, 0)
+{}
+
+boost::uint64_t
+HistogramCounterImpl::Snapshot::percentile(double fraction) const {
+    if (0 == count_) {
+        return 0;
+    }
+    boost::uint64_t rank = static_cast<boost::uint64_t>(ceil(fraction * count_));
+    rank = std::min(std::max(rank, (boost::uint64_t)1), count_);
+
+    boost::uint64_t seen = 0;
+    for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            return std::min(bucketLimit(i), max_);
+        }
+    }
+    return max_;
+}
+
+HistogramCounterImpl::HistogramCounterImpl(const std::string& name) :
+    CounterImpl(name), shards_(new Shard[SHARD_COUNT])
+{}
+
+HistogramCounterImpl::~HistogramCounterImpl() {
+}
+
+unsigned int
+HistogramCounterImpl::bucket(boost::uint64_t value) {
+    value = std::min(value, MAX_TRACKED_VALUE);
+    if (value < (1 << SUB_BUCKET_BITS)) {
+        return static_cast<unsigned int>(value);
+    }
+    unsigned int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return (shift << SUB_BUCKET_BITS) + static_cast<unsigned int>(value >> shift);
+}
+
+boost::uint64_t
+HistogramCounterImpl::bucketLimit(unsigned int bucket) {
+    if (bucket < (2 << SUB_BUCKET_BITS)) {
+        return bucket;
+    }
+    unsigned int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+    boost::uint64_t mantissa = bucket - (shift << SUB_BUCKET_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void
+HistogramCounterImpl::add(boost::uint64_t value) {
+    Shard &shard = shards_[shardIndex()];
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+    if (shard.buckets_.empty()) {
+        shard.buckets_.resize(BUCKET_COUNT, 0);
+    }
+    ++shard.buckets_[bucket(value)];
+    ++shard.count_;
+    shard.total_ += value;
+    shard.max_ = std::max(shard.max_, value);
+    shard.min_ = std::min(shard.min_, value);
+}
+
+boost::uint64_t
+HistogramCounterImpl::count() const {
+    boost::uint64_t result = 0;
+    for (unsigned int i = 0; i < SHARD_COUNT; ++i) {
+        boost::mutex::scoped_lock lock(shards_[i].mutex_);
+        result += shards_[i].count_;
+    }
+    return result;
+}
+
+boost::uint64_t
+HistogramCounterImpl::percentile(double fraction) const {
+    Snapshot snapshot;
+    merge(snapshot);
+    return snapshot.percentile(fraction);
+}
+
+void
+HistogramCounterImpl::merge(Snapshot &snapshot) const {
+    for (unsigned int i = 0; i < SHARD_COUNT; ++i) {
+        Shard &shard = shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex_);
+        if (0 == shard.count_) {
+            continue;
+        }
+        snapshot.count_ += shard.count_;
+        snapshot.total_ += shard.total_;
+        snapshot.max_ = std::max(snapshot.max_, shard.max_);
+        snapshot.min_ = std::min(snapshot.min_, shard.min_);
+        for (unsigned int b = 0; b < BUCKET_COUNT; ++b) {
+            snapshot.buckets_[b] += shard.buckets_[b];
+        }
+    }
+}
+
+XmlNodeHelper
+HistogramCounterImpl::createReport() const {
+    XmlNodeHelper line(xmlNewNode(0, (const xmlChar*) name_.c_str()));
+
+    Snapshot snapshot;
+    merge(snapshot);
+
+    xmlSetProp(line.get(), (const xmlChar*) "count", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.count_).c_str());
+    if (snapshot.count_ != 0) {
+        xmlSetProp(line.get(), (const xmlChar*) "total", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.total_).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "min", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.min_).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "max", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.max_).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "avg", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.total_ / snapshot.count_).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "p50", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.percentile(0.5)).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "p95", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.percentile(0.95)).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "p99", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.percentile(0.99)).c_str());
+        xmlSetProp(line.get(), (const xmlChar*) "p999", (const xmlChar*) boost::lexical_cast<std::string>(snapshot.percentile(0.999)).c_str());
+    }
+
+    return line;
+}
+
+} // namespace xscript
@@ -6,12 +6,19 @@
 #include <iterator>
 #include <stdexcept>
 #include <algorithm>
+#include <deque>
 #include <map>
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/current_function.hpp>
 #include <boost/tokenizer.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/once.hpp>
+#include <boost/thread/thread.hpp>
 
+#include "xscript/config.h"
 #include "xscript/http_helper.h"
 #include "xscript/http_utils.h"
 #include "xscript/logger.h"
@@ -19,11 +26,19 @@
 #include "xscript/range.h"
 #include "xscript/remote_tagged_block.h"
 #include "xscript/request.h"
+#include "xscript/simple_counter.h"
+#include "xscript/stat_builder.h"
+#include "xscript/status_info.h"
 #include "xscript/string_utils.h"
 #include "xscript/util.h"
 
 #include "internal/algorithm.h"
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
 #include <curl/curl.h>
 #include <openssl/crypto.h>
 
@@ -131,6 +146,472 @@ struct HttpCurlCheck {
     }
 };
 
+/**
+ * Idle curl easy handles kept per scheme://host:port. A handle keeps its
+ * connection cache after curl_easy_reset, so taking a handle used for the
+ * same host lets curl reuse the keep-alive connection. All handles share
+ * DNS and TLS session caches.
+ */
+class HttpHandlePool : public HttpCurlCheck, private boost::noncopyable {
+public:
+    HttpHandlePool() :
+        share_(NULL), keep_alive_(false), idle_count_(0), max_idle_per_host_(0), max_idle_(0)
+    {
+        share_ = curl_share_init();
+        if (NULL == share_) {
+            throw std::runtime_error("libcurl share init failed");
+        }
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &lockShare);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &unlockShare);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if (LIBCURL_VERSION_MAJOR > 7) || ((LIBCURL_VERSION_MAJOR == 7) && (LIBCURL_VERSION_MINOR >= 23))
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif
+        createCounters();
+    }
+
+    ~HttpHandlePool() {
+        clear();
+        curl_share_cleanup(share_);
+    }
+
+    void init(const Config *config) {
+        std::string value = config->as<std::string>("/xscript/http-block/keep-alive", "yes");
+        unsigned int max_idle_per_host = config->as<unsigned int>("/xscript/http-block/keep-alive-idle-per-host", 8);
+        unsigned int max_idle = config->as<unsigned int>("/xscript/http-block/keep-alive-idle-max", 256);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        keep_alive_ = !strcasecmp(value.c_str(), "yes");
+        max_idle_per_host_ = max_idle_per_host;
+        max_idle_ = max_idle;
+
+        // statistic module is loaded by now, recreate counters as real ones
+        createCounters();
+        StatBuilder &builder = StatusInfo::instance()->getStatBuilder();
+        builder.addCounter(handles_created_.get());
+        builder.addCounter(handles_reused_.get());
+        builder.addCounter(handles_idle_.get());
+        builder.addCounter(connections_new_.get());
+        builder.addCounter(connections_reused_.get());
+    }
+
+    bool keepAlive() const {
+        return keep_alive_;
+    }
+
+    CURL* acquire(const std::string &host) {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            HandleMap::iterator it = idle_.find(host);
+            if (idle_.end() != it) {
+                CURL *curl = it->second.back();
+                it->second.pop_back();
+                if (it->second.empty()) {
+                    idle_.erase(it);
+                }
+                --idle_count_;
+                lock.unlock();
+
+                handles_idle_->dec();
+                handles_reused_->inc();
+                return curl;
+            }
+        }
+
+        CURL *curl = curl_easy_init();
+        if (NULL != curl) {
+            handles_created_->inc();
+        }
+        return curl;
+    }
+
+    void release(const std::string &host, CURL *curl, bool reusable) {
+        if (reusable && keep_alive_) {
+            curl_easy_reset(curl);
+            boost::mutex::scoped_lock lock(mutex_);
+            if (idle_count_ < max_idle_) {
+                std::vector<CURL*> &handles = idle_[host];
+                if (handles.size() < max_idle_per_host_) {
+                    handles.push_back(curl);
+                    ++idle_count_;
+                    lock.unlock();
+                    handles_idle_->inc();
+                    return;
+                }
+                if (handles.empty()) {
+                    idle_.erase(host);
+                }
+            }
+        }
+        curl_easy_cleanup(curl);
+    }
+
+    void setup(CURL *curl) {
+        check(curl_easy_setopt(curl, CURLOPT_SHARE, share_));
+        if (!keep_alive_) {
+            check(curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, static_cast<long>(1)));
+        }
+    }
+
+    void performed(CURL *curl) {
+        long connects = 0;
+        if (CURLE_OK == curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects)) {
+            if (0 == connects) {
+                connections_reused_->inc();
+            }
+            else {
+                connections_new_->inc();
+            }
+        }
+    }
+
+    void clear() {
+        boost::mutex::scoped_lock lock(mutex_);
+        for (HandleMap::iterator it = idle_.begin(), end = idle_.end(); it != end; ++it) {
+            std::for_each(it->second.begin(), it->second.end(), &curl_easy_cleanup);
+        }
+        idle_.clear();
+        idle_count_ = 0;
+    }
+
+    static std::string hostKey(const std::string &url) {
+        std::string::size_type pos = url.find("://");
+        pos = (std::string::npos == pos) ? 0 : pos + sizeof("://") - 1;
+        return url.substr(0, url.find_first_of("/?#", pos));
+    }
+
+private:
+    void createCounters() {
+        handles_created_ = SimpleCounterFactory::instance()->createCounter("http-handles-created");
+        handles_reused_ = SimpleCounterFactory::instance()->createCounter("http-handles-reused");
+        handles_idle_ = SimpleCounterFactory::instance()->createCounter("http-handles-idle");
+        connections_new_ = SimpleCounterFactory::instance()->createCounter("http-connections-new");
+        connections_reused_ = SimpleCounterFactory::instance()->createCounter("http-connections-reused");
+    }
+
+    static void lockShare(CURL *curl, curl_lock_data data, curl_lock_access access, void *arg) {
+        (void)curl;
+        (void)access;
+        static_cast<HttpHandlePool*>(arg)->share_mutexes_[data % CURL_LOCK_DATA_LAST].lock();
+    }
+
+    static void unlockShare(CURL *curl, curl_lock_data data, void *arg) {
+        (void)curl;
+        static_cast<HttpHandlePool*>(arg)->share_mutexes_[data % CURL_LOCK_DATA_LAST].unlock();
+    }
+
+private:
+    typedef std::map<std::string, std::vector<CURL*> > HandleMap;
+
+    CURLSH *share_;
+    boost::mutex share_mutexes_[CURL_LOCK_DATA_LAST];
+
+    boost::mutex mutex_;
+    HandleMap idle_;
+    bool keep_alive_;
+    unsigned int idle_count_;
+    unsigned int max_idle_per_host_;
+    unsigned int max_idle_;
+
+    std::auto_ptr<SimpleCounter> handles_created_;
+    std::auto_ptr<SimpleCounter> handles_reused_;
+    std::auto_ptr<SimpleCounter> handles_idle_;
+    std::auto_ptr<SimpleCounter> connections_new_;
+    std::auto_ptr<SimpleCounter> connections_reused_;
+};
+
+static HttpHandlePool *handle_pool = NULL;
+
+/**
+ * Single thread driving all asynchronous transfers through curl multi
+ * socket interface on top of epoll. Transfer timeouts set on easy handles
+ * are enforced by the multi timer. Completion callbacks are queued to a
+ * separate completion thread, so a slow callback never stalls the transfers.
+ */
+class HttpReactor : private boost::noncopyable {
+public:
+    typedef boost::function<void (CURLcode)> Callback;
+
+    HttpReactor() :
+        multi_(NULL), epoll_fd_(-1), deadline_(0), running_(true), completing_(true)
+    {
+        wake_fds_[0] = wake_fds_[1] = -1;
+        multi_ = curl_multi_init();
+        if (NULL == multi_) {
+            throw std::runtime_error("libcurl multi init failed");
+        }
+        epoll_fd_ = epoll_create(64);
+        if (-1 == epoll_fd_ || -1 == pipe(wake_fds_)) {
+            std::stringstream stream;
+            StringUtils::report("http reactor init failed: ", errno, stream);
+            close();
+            throw std::runtime_error(stream.str());
+        }
+        fcntl(wake_fds_[0], F_SETFL, fcntl(wake_fds_[0], F_GETFL) | O_NONBLOCK);
+        fcntl(wake_fds_[1], F_SETFL, fcntl(wake_fds_[1], F_GETFL) | O_NONBLOCK);
+        watch(wake_fds_[0], EPOLL_CTL_ADD, EPOLLIN);
+
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &socketCallback);
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &timerCallback);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+
+        completion_thread_.reset(new boost::thread(boost::bind(&HttpReactor::complete, this)));
+        thread_.reset(new boost::thread(boost::bind(&HttpReactor::run, this)));
+    }
+
+    ~HttpReactor() {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            running_ = false;
+        }
+        wake();
+        thread_->join();
+        {
+            // cancelled transfers are already queued and get completed
+            boost::mutex::scoped_lock lock(completion_mutex_);
+            completing_ = false;
+            completion_condition_.notify_one();
+        }
+        completion_thread_->join();
+        close();
+    }
+
+    bool submit(CURL *curl, const Callback &callback) {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (!running_) {
+                return false;
+            }
+            pending_.push_back(std::make_pair(curl, callback));
+        }
+        wake();
+        return true;
+    }
+
+private:
+    typedef std::map<CURL*, Callback> TransferMap;
+    typedef std::vector<std::pair<CURL*, Callback> > PendingList;
+    typedef std::deque<std::pair<Callback, CURLcode> > CompletionQueue;
+
+    void run() {
+        const int max_events = 64;
+        epoll_event events[max_events];
+        while (true) {
+            int count = epoll_wait(epoll_fd_, events, max_events, waitTime());
+            if (-1 == count && EINTR != errno) {
+                log()->error("http reactor epoll_wait failed: %d", errno);
+            }
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fds_[0]) {
+                    continue;
+                }
+                int mask = 0;
+                if (events[i].events & EPOLLIN) {
+                    mask |= CURL_CSELECT_IN;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    mask |= CURL_CSELECT_OUT;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    mask |= CURL_CSELECT_ERR;
+                }
+                action(fd, mask);
+            }
+            if (0 != deadline_ && now() >= deadline_) {
+                deadline_ = 0;
+                action(CURL_SOCKET_TIMEOUT, 0);
+            }
+            if (!addPending()) {
+                break;
+            }
+        }
+        cancelAll();
+    }
+
+    int waitTime() const {
+        if (0 == deadline_) {
+            return -1;
+        }
+        boost::uint64_t current = now();
+        return deadline_ > current ? static_cast<int>(deadline_ - current) : 0;
+    }
+
+    static boost::uint64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<boost::uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    bool addPending() {
+        char buf[64];
+        while (read(wake_fds_[0], buf, sizeof(buf)) > 0) {
+        }
+
+        PendingList pending;
+        bool running = true;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            pending.swap(pending_);
+            running = running_;
+        }
+        for (PendingList::iterator it = pending.begin(); it != pending.end(); ++it) {
+            CURLMcode code = curl_multi_add_handle(multi_, it->first);
+            if (CURLM_OK != code) {
+                done(it->second, CURLE_FAILED_INIT);
+                continue;
+            }
+            transfers_.insert(*it);
+        }
+        if (!pending.empty()) {
+            action(CURL_SOCKET_TIMEOUT, 0);
+        }
+        return running;
+    }
+
+    void action(curl_socket_t fd, int mask) {
+        int running = 0;
+        while (CURLM_CALL_MULTI_PERFORM == curl_multi_socket_action(multi_, fd, mask, &running)) {
+        }
+        int left = 0;
+        CURLMsg *msg = NULL;
+        while (NULL != (msg = curl_multi_info_read(multi_, &left))) {
+            if (CURLMSG_DONE != msg->msg) {
+                continue;
+            }
+            CURL *curl = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi_, curl);
+            TransferMap::iterator it = transfers_.find(curl);
+            if (transfers_.end() != it) {
+                Callback callback = it->second;
+                transfers_.erase(it);
+                done(callback, result);
+            }
+        }
+    }
+
+    void cancelAll() {
+        for (TransferMap::iterator it = transfers_.begin(); it != transfers_.end(); ++it) {
+            curl_multi_remove_handle(multi_, it->first);
+            done(it->second, CURLE_ABORTED_BY_CALLBACK);
+        }
+        transfers_.clear();
+    }
+
+    void done(const Callback &callback, CURLcode code) {
+        boost::mutex::scoped_lock lock(completion_mutex_);
+        completions_.push_back(std::make_pair(callback, code));
+        completion_condition_.notify_one();
+    }
+
+    void complete() {
+        while (true) {
+            std::pair<Callback, CURLcode> completion;
+            {
+                boost::mutex::scoped_lock lock(completion_mutex_);
+                while (completions_.empty() && completing_) {
+                    completion_condition_.wait(lock);
+                }
+                if (completions_.empty()) {
+                    break;
+                }
+                completion = completions_.front();
+                completions_.pop_front();
+            }
+            try {
+                completion.first(completion.second);
+            }
+            catch (const std::exception &e) {
+                log()->error("caught exception in http reactor callback: %s", e.what());
+            }
+            catch (...) {
+                log()->error("caught unknown exception in http reactor callback");
+            }
+        }
+    }
+
+    void wake() {
+        char c = 0;
+        ssize_t res = write(wake_fds_[1], &c, 1);
+        (void)res;
+    }
+
+    void watch(int fd, int op, unsigned int events) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = fd;
+        if (-1 == epoll_ctl(epoll_fd_, op, fd, &event) && EPOLL_CTL_DEL != op) {
+            log()->error("http reactor epoll_ctl failed: %d", errno);
+        }
+    }
+
+    void close() {
+        if (-1 != epoll_fd_) {
+            ::close(epoll_fd_);
+        }
+        if (-1 != wake_fds_[0]) {
+            ::close(wake_fds_[0]);
+            ::close(wake_fds_[1]);
+        }
+        if (NULL != multi_) {
+            curl_multi_cleanup(multi_);
+        }
+    }
+
+    static int socketCallback(CURL *curl, curl_socket_t fd, int what, void *arg, void *socket_arg) {
+        (void)curl;
+        HttpReactor *reactor = static_cast<HttpReactor*>(arg);
+        if (CURL_POLL_REMOVE == what) {
+            reactor->watch(fd, EPOLL_CTL_DEL, 0);
+            curl_multi_assign(reactor->multi_, fd, NULL);
+            return 0;
+        }
+        unsigned int events = 0;
+        if (what & CURL_POLL_IN) {
+            events |= EPOLLIN;
+        }
+        if (what & CURL_POLL_OUT) {
+            events |= EPOLLOUT;
+        }
+        reactor->watch(fd, NULL == socket_arg ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, events);
+        if (NULL == socket_arg) {
+            curl_multi_assign(reactor->multi_, fd, reactor);
+        }
+        return 0;
+    }
+
+    static int timerCallback(CURLM *multi, long timeout_ms, void *arg) {
+        (void)multi;
+        HttpReactor *reactor = static_cast<HttpReactor*>(arg);
+        reactor->deadline_ = timeout_ms < 0 ? 0 : now() + timeout_ms;
+        return 0;
+    }
+
+private:
+    CURLM *multi_;
+    int epoll_fd_;
+    int wake_fds_[2];
+    boost::uint64_t deadline_; // monotonic ms of next curl timeout, 0 if none
+    bool running_;
+
+    boost::mutex mutex_;
+    PendingList pending_;
+    TransferMap transfers_;
+    std::auto_ptr<boost::thread> thread_;
+
+    bool completing_;
+    boost::mutex completion_mutex_;
+    boost::condition completion_condition_;
+    CompletionQueue completions_;
+    std::auto_ptr<boost::thread> completion_thread_;
+};
+
+static HttpReactor *reactor = NULL;
+
 
 class HttpHelper::HelperData : public HttpCurlCheck {
 public:
@@ -146,11 +627,24 @@ public:
 
     HelperData(const std::string &url, long timeout) :
         url_(url), content_(new std::string),
-        curl_(NULL), curl_code_(CURLE_OK), status_(0), 
-        sent_modified_since_(false), headers_received_(false), aborted_(false), no_body_(false) {
+        curl_(NULL), curl_code_(CURLE_OK), status_(0), post_data_(NULL), post_size_(0),
+        sent_modified_since_(false), headers_received_(false), aborted_(false), no_body_(false),
+        consumed_(false) {
 
-        curl_ = curl_easy_init();
+        if (NULL != handle_pool) {
+            host_ = HttpHandlePool::hostKey(url_);
+            curl_ = handle_pool->acquire(host_);
+        }
+        else {
+            curl_ = curl_easy_init();
+        }
         if (NULL != curl_) {
+            if (NULL != handle_pool) {
+                handle_pool->setup(curl_);
+            }
+            else {
+                setopt(CURLOPT_FORBID_REUSE, static_cast<long>(1));
+            }
             if (timeout > 0) {
 #if (LIBCURL_VERSION_MAJOR > 7) || ((LIBCURL_VERSION_MAJOR == 7) && (LIBCURL_VERSION_MINOR >= 16))
                 setopt(CURLOPT_TIMEOUT_MS, timeout);
@@ -162,7 +656,6 @@ public:
 
             setopt(CURLOPT_NOSIGNAL, static_cast<long>(1));
             setopt(CURLOPT_NOPROGRESS, static_cast<long>(1));
-            setopt(CURLOPT_FORBID_REUSE, static_cast<long>(1));
 
             setopt(CURLOPT_WRITEDATA, this);
             setopt(CURLOPT_WRITEFUNCTION, &curlWrite);
@@ -173,10 +666,15 @@ public:
     }
     
     ~HelperData() {
-        headers_helper_.clear();
         if (NULL != curl_) {
-            curl_easy_cleanup(curl_);
+            if (NULL != handle_pool) {
+                handle_pool->release(host_, curl_, CURLE_OK == curl_code_ && !aborted_);
+            }
+            else {
+                curl_easy_cleanup(curl_);
+            }
         }
+        headers_helper_.clear();
     }
 
     void appendHeaders(const std::vector<std::string> &headers, time_t modified_since) {
@@ -206,7 +704,7 @@ public:
             headers_helper_.append("Expect:");
         }
         
-        if (!connection) {
+        if (!connection && (NULL == handle_pool || !handle_pool->keepAlive())) {
             headers_helper_.append("Connection: close");
         }
         
@@ -229,6 +727,8 @@ public:
         setopt(CURLOPT_HTTPPOST, static_cast<long>(1));
         setopt(CURLOPT_POSTFIELDS, data);
         setopt(CURLOPT_POSTFIELDSIZE, size);
+        post_data_ = static_cast<const char*>(data);
+        post_size_ = size;
     }
 
     void method(const std::string &value) {
@@ -248,6 +748,41 @@ public:
             return UNKNOWN_HTTP_STATUS;
         }
         check(curl_code_);
+        if (NULL != handle_pool) {
+            handle_pool->performed(curl_);
+        }
+        getinfo(CURLINFO_RESPONSE_CODE, &status_);
+        headers_received_ = true;
+        detectContentType();
+        return status_;
+    }
+
+    bool performAsync(const boost::function<void()> &callback) {
+        if (NULL == reactor) {
+            return false;
+        }
+        if (NULL != post_data_) {
+            // caller's buffer does not live until the transfer is over
+            post_copy_.assign(post_data_, post_size_);
+            setopt(CURLOPT_POSTFIELDS, post_copy_.data());
+        }
+        return reactor->submit(curl_, boost::bind(&HelperData::asyncDone, this, _1, callback));
+    }
+
+    void asyncDone(CURLcode code, const boost::function<void()> &callback) {
+        curl_code_ = code;
+        callback();
+    }
+
+    long finishAsync() {
+        if (aborted_) {
+            curl_code_ = CURLE_ABORTED_BY_CALLBACK;
+            return UNKNOWN_HTTP_STATUS;
+        }
+        check(curl_code_);
+        if (NULL != handle_pool) {
+            handle_pool->performed(curl_);
+        }
         getinfo(CURLINFO_RESPONSE_CODE, &status_);
         headers_received_ = true;
         detectContentType();
@@ -263,6 +798,9 @@ public:
         if (CURLE_OK != curl_code_) {
             return UNKNOWN_HTTP_STATUS;
         }
+        if (NULL != handle_pool) {
+            handle_pool->performed(curl_);
+        }
         getinfo(CURLINFO_RESPONSE_CODE, &status_);
         headers_received_ = true;
         return status_;
@@ -309,15 +847,34 @@ public:
         }
     }
     
+    void startConsumer() {
+        if (NULL == consumer_.get()) {
+            return;
+        }
+        long status = UNKNOWN_HTTP_STATUS;
+        if (CURLE_OK != curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &status) ||
+            (200 != status && 201 != status)) {
+            return;
+        }
+        if (headers_.end() != headers_.find(HEADER_NAME_CONTENT_TYPE)) {
+            detectContentType();
+        }
+        consumed_ = consumer_->start(content_type_);
+    }
+
     static size_t curlWrite(void *ptr, size_t size, size_t nmemb, void *arg) {
         try {
             HelperData *self = static_cast<HelperData*>(arg);
             if (!self->headers_received_) {
                 self->headers_received_ = true;
+                self->startConsumer();
             }
             if (self->aborted_) {
                 return -1; //CURL_WRITEFUNC_PAUSE;
             }
+            if (self->consumed_) {
+                return self->consumer_->consume((const char*) ptr, size * nmemb) ? (size * nmemb) : 0;
+            }
             self->content_->append((const char*) ptr, size * nmemb);
             return (size * nmemb);
         }
@@ -405,9 +962,14 @@ public:
         if (CURLE_OK != curl_global_init(CURL_GLOBAL_ALL)) {
             throw std::runtime_error("libcurl init failed");
         }
+        handle_pool = new HttpHandlePool();
     }
 
     static void destroyEnvironment() {
+        delete reactor;
+        reactor = NULL;
+        delete handle_pool;
+        handle_pool = NULL;
         curl_global_cleanup();
         CRYPTO_thread_cleanup();
     }
@@ -416,15 +978,20 @@ public:
 
     HeadersHelper headers_helper_;
     HeaderMap headers_;
-    std::string url_, charset_, content_type_;
+    std::string url_, host_, charset_, content_type_;
     boost::shared_ptr<std::string> content_;
     CURL *curl_;
     CURLcode curl_code_;
     long status_;
+    const char *post_data_;
+    long post_size_;
+    std::string post_copy_;
     bool sent_modified_since_;
     bool headers_received_;
     bool aborted_;
     bool no_body_;
+    std::auto_ptr<HttpContentConsumer> consumer_;
+    bool consumed_;
 
     static boost::once_flag init_flag_;
     static const std::string HEADER_NAME_LAST_MODIFIED;
@@ -443,14 +1010,70 @@ HttpHelper::HttpHelper(const std::string &url, long timeout) :
     data_(new HelperData(url, timeout))
 {}
 
+HttpHelper::HttpHelper() {
+}
+
 HttpHelper::~HttpHelper() {
 }
 
+void
+HttpHelper::contentConsumer(std::auto_ptr<HttpContentConsumer> consumer) {
+    data_->consumer_ = consumer;
+    data_->consumed_ = false;
+}
+
+HttpContentConsumer*
+HttpHelper::contentConsumer() const {
+    return data_->consumed_ ? data_->consumer_.get() : NULL;
+}
+
+std::auto_ptr<HttpHelper>
+HttpHelper::release() {
+    std::auto_ptr<HttpHelper> helper(new HttpHelper());
+    helper->data_ = data_;
+    return helper;
+}
+
+void
+HttpHelper::swap(HttpHelper &helper) {
+    std::auto_ptr<HelperData> tmp = data_;
+    data_ = helper.data_;
+    helper.data_ = tmp;
+}
+
+bool
+HttpHelper::performAsync(const boost::function<void()> &callback) {
+    log()->entering(BOOST_CURRENT_FUNCTION);
+    return data_->performAsync(callback);
+}
+
+long
+HttpHelper::finishAsync() {
+    log()->entering(BOOST_CURRENT_FUNCTION);
+    return data_->finishAsync();
+}
+
 void
 HttpHelper::init() {
     boost::call_once(&initEnvironment, HelperData::init_flag_);
 }
 
+void
+HttpHelper::init(const Config *config) {
+    init();
+    handle_pool->init(config);
+
+    std::string value = config->as<std::string>("/xscript/http-block/async", "no");
+    if (NULL == reactor && !strcasecmp(value.c_str(), "yes")) {
+        reactor = new HttpReactor();
+    }
+}
+
+bool
+HttpHelper::asyncEnabled() {
+    return NULL != reactor;
+}
+
 void
 HttpHelper::appendHeaders(const std::vector<std::string> &headers, time_t modified_since) {
     data_->appendHeaders(headers, modified_since);    
@@ -616,7 +1239,11 @@ HttpHelper::isPlain() const {
 
 bool
 HttpHelper::isXml() const {
-    const std::string &content_type = contentType();
+    return isXmlType(contentType());
+}
+
+bool
+HttpHelper::isXmlType(const std::string &content_type) {
     std::string::size_type pos = content_type.find('/');
     if (pos == std::string::npos) {
         return false;
@@ -98,6 +98,12 @@ const std::string HttpUtils::ACCEPT_HEADER_NAME = "Accept";
 const std::string HttpUtils::IF_NONE_MATCH_HEADER_NAME = "If-None-Match";
 const std::string HttpUtils::EXPIRES_HEADER_NAME = "Expires";
 const std::string HttpUtils::ETAG_HEADER_NAME = "ETag";
+const std::string HttpUtils::ACCEPT_ENCODING_HEADER_NAME = "Accept-Encoding";
+const std::string HttpUtils::STATUS_HEADER_NAME = "Status";
+const std::string HttpUtils::CONTENT_TYPE_HEADER_NAME = "Content-Type";
+const std::string HttpUtils::CONTENT_LENGTH_HEADER_NAME = "Content-Length";
+const std::string HttpUtils::CONTENT_ENCODING_HEADER_NAME = "Content-Encoding";
+const std::string HttpUtils::VARY_HEADER_NAME = "Vary";
 
 HttpUtils::HttpUtils() {
 }
@@ -20,11 +20,13 @@
 
 namespace xscript {
 
+static const boost::shared_ptr<TagKey> EMPTY_TAG_KEY;
+
 struct InvokeContext::ContextData {
     ContextData() : tagged_(false), result_type_(ERROR),
-        have_cached_copy_(false), base_(NULL), meta_(new Meta) {}
+        have_cached_copy_(false), shared_result_(false), base_(NULL), meta_(new Meta) {}
     ContextData(InvokeContext *base) :  tagged_(false), result_type_(ERROR),
-        have_cached_copy_(false), base_(base), meta_(new Meta) {}
+        have_cached_copy_(false), shared_result_(false), base_(base), meta_(new Meta) {}
 
     XmlDocSharedHelper doc_;
     XmlDocSharedHelper meta_doc_;
@@ -32,8 +34,10 @@ struct InvokeContext::ContextData {
     Tag tag_;
     ResultType result_type_;
     bool have_cached_copy_;
+    bool shared_result_;
     boost::shared_ptr<Context> local_context_;
     boost::shared_ptr<TagKey> key_;
+    std::vector<boost::shared_ptr<TagKey> > prefetch_keys_;
     std::string xslt_;
 
     InvokeContext* base_;
@@ -129,6 +133,16 @@ InvokeContext::haveCachedCopy(bool flag) {
     ctx_data_->have_cached_copy_ = flag;
 }
 
+bool
+InvokeContext::sharedResult() const {
+    return ctx_data_->shared_result_;
+}
+
+void
+InvokeContext::sharedResult(bool flag) {
+    ctx_data_->shared_result_ = flag;
+}
+
 void
 InvokeContext::resultDoc(const XmlDocSharedHelper &doc) {
     ctx_data_->doc_.reset();
@@ -201,6 +215,17 @@ InvokeContext::tagKey() const {
     return ctx_data_->key_.get();
 }
 
+void
+InvokeContext::prefetchKeys(std::vector<boost::shared_ptr<TagKey> > &keys) {
+    ctx_data_->prefetch_keys_.swap(keys);
+}
+
+const boost::shared_ptr<TagKey>&
+InvokeContext::prefetchKey(unsigned int strategy) const {
+    return strategy < ctx_data_->prefetch_keys_.size() ?
+        ctx_data_->prefetch_keys_[strategy] : EMPTY_TAG_KEY;
+}
+
 void
 InvokeContext::setLocalContext(const boost::shared_ptr<Context> &ctx) {
     ctx_data_->local_context_ = ctx;
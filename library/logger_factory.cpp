@@ -7,11 +7,13 @@
 #include "xscript/logger_factory.h"
 #include "xscript/config.h"
 #include "xscript/control_extension.h"
+#include "xscript/counter_base.h"
 #include "xscript/request.h"
+#include "xscript/status_info.h"
 #include "xscript/vhost_data.h"
 #include "xscript/xml_util.h"
 #include "details/syslog_logger.h"
-#include "details/file_logger.h"
+#include "internal/file_logger.h"
 
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
@@ -23,6 +25,32 @@ static const unsigned char FLAG_PRINT_THREAD_ID = 1;
 static const unsigned char FLAG_PRINT_REQUEST_ID = 2;
 
 
+/**
+ * Reports file loggers currently owned by factory. Registered once, so
+ * status info never refers to replaced loggers.
+ */
+class LoggerFactoryCounter : public CounterBase {
+public:
+    LoggerFactoryCounter(const LoggerFactory::LoggerMap &loggers) : loggers_(loggers) {
+    }
+
+    virtual XmlNodeHelper createReport() const {
+        XmlNodeHelper line(xmlNewNode(NULL, (const xmlChar*) "loggers"));
+        for (LoggerFactory::LoggerMap::const_iterator l = loggers_.begin(); l != loggers_.end(); ++l) {
+            const FileLogger *logger = dynamic_cast<const FileLogger*>(l->second.get());
+            if (NULL != logger) {
+                XmlNodeHelper child = logger->createReport();
+                xmlSetProp(child.get(), (const xmlChar*) "id", (const xmlChar*) l->first.c_str());
+                xmlAddChild(line.get(), child.release());
+            }
+        }
+        return line;
+    }
+
+private:
+    const LoggerFactory::LoggerMap &loggers_;
+};
+
 LoggerFactory::LoggerFactory() : defaultLogger_(0)
 {
 }
@@ -60,6 +88,11 @@ LoggerFactory::init(const Config * config) {
     ControlExtension::registerConstructor("logrotate", f);
     
     config->addForbiddenKey("/xscript/logger/*");
+
+    if (NULL == counter_.get()) {
+        counter_.reset(new LoggerFactoryCounter(loggers_));
+        StatusInfo::instance()->getStatBuilder().addCounter(counter_.get());
+    }
     
     std::vector<std::string> v;
     std::string key("/xscript/logger-factory/logger");
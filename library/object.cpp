@@ -34,6 +34,7 @@ public:
     
     DynamicParam xslt_name_;
     std::vector<Param*> params_;
+    std::vector<bool> duplicated_;
 };
 
 Object::ObjectData::ObjectData() {
@@ -70,8 +71,17 @@ Object::ObjectData::checkParam(Param *param) {
             boost::lexical_cast<std::string>(i + 1) +
             std::string(" character in id: ") + id);
     }
-    
+
+    bool duplicated = false;
+    for (std::vector<Param*>::iterator it = params_.begin(), end = params_.end(); it != end; ++it) {
+        if ((*it)->id() == id) {
+            duplicated = true;
+            break;
+        }
+    }
+
     params_.push_back(param);
+    duplicated_.push_back(duplicated);
 }
 
 Object::Object() : data_(new ObjectData()) {
@@ -94,6 +104,26 @@ Object::xsltParams() const {
     return data_->params_;
 }
 
+bool
+Object::xsltParamDuplicated(unsigned int index) const {
+    return data_->duplicated_[index];
+}
+
+bool
+Object::xsltFromState() const {
+    if (data_->xslt_name_.fromState()) {
+        return true;
+    }
+    for (std::vector<Param*>::const_iterator it = data_->params_.begin(), end = data_->params_.end();
+         it != end;
+         ++it) {
+        if ((*it)->fromState()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void
 Object::postParse() {
 }
@@ -67,6 +67,11 @@ Param::constant() const {
     return false;
 }
 
+bool
+Param::fromState() const {
+    return false;
+}
+
 void
 Param::parse() {
     data_->parse();
@@ -0,0 +1,175 @@
+#include "settings.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include <boost/lexical_cast.hpp>
+
+#include "internal/payload_codec.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+const boost::uint32_t PayloadCodec::SIGNATURE = 0xffffff5e;
+const std::size_t PayloadCodec::HEADER_SIZE = 2 * sizeof(boost::uint32_t) + 1;
+
+static const boost::uint32_t MAX_DECODED_SIZE = 0x40000000;
+
+PayloadCodec::Type
+PayloadCodec::type(const std::string &name) {
+    Type result;
+    if (name.empty() || strcasecmp(name.c_str(), "none") == 0) {
+        result = NONE;
+    }
+    else if (strcasecmp(name.c_str(), "deflate") == 0) {
+        result = DEFLATE;
+    }
+    else if (strcasecmp(name.c_str(), "lz4") == 0) {
+        result = LZ4;
+    }
+    else {
+        throw std::runtime_error("Unknown cache compression: " + name);
+    }
+    if (!available(result)) {
+        throw std::runtime_error("Cache compression is not available: " + name);
+    }
+    return result;
+}
+
+const char*
+PayloadCodec::name(Type type) {
+    switch (type) {
+        case DEFLATE:
+            return "deflate";
+        case LZ4:
+            return "lz4";
+        default:
+            return "none";
+    }
+}
+
+bool
+PayloadCodec::available(Type type) {
+#ifdef HAVE_LZ4
+    (void)type;
+    return true;
+#else
+    return LZ4 != type;
+#endif
+}
+
+bool
+PayloadCodec::encode(Type type, std::string &data) {
+    if (NONE == type || data.size() >= MAX_DECODED_SIZE) {
+        return false;
+    }
+
+    boost::uint32_t size = data.size();
+    std::string result;
+    std::size_t bound = 0;
+    if (DEFLATE == type) {
+        bound = compressBound(size);
+    }
+#ifdef HAVE_LZ4
+    else if (LZ4 == type) {
+        bound = LZ4_compressBound(size);
+    }
+#endif
+    else {
+        return false;
+    }
+    result.resize(HEADER_SIZE + bound);
+
+    char *out = &result[0];
+    memcpy(out, &SIGNATURE, sizeof(SIGNATURE));
+    out[sizeof(SIGNATURE)] = (char)type;
+    memcpy(out + sizeof(SIGNATURE) + 1, &size, sizeof(size));
+    out += HEADER_SIZE;
+
+    std::size_t encoded = 0;
+    if (DEFLATE == type) {
+        uLongf dest_len = bound;
+        if (Z_OK != compress2((Bytef*)out, &dest_len, (const Bytef*)data.data(), size, Z_BEST_SPEED)) {
+            return false;
+        }
+        encoded = dest_len;
+    }
+#ifdef HAVE_LZ4
+    else {
+        int res = LZ4_compress_default(data.data(), out, size, bound);
+        if (res <= 0) {
+            return false;
+        }
+        encoded = res;
+    }
+#endif
+
+    if (HEADER_SIZE + encoded >= data.size()) {
+        return false;
+    }
+    result.resize(HEADER_SIZE + encoded);
+    data.swap(result);
+    return true;
+}
+
+bool
+PayloadCodec::encoded(const char *data, std::size_t size) {
+    if (size < HEADER_SIZE) {
+        return false;
+    }
+    boost::uint32_t sig;
+    memcpy(&sig, data, sizeof(sig));
+    return SIGNATURE == sig;
+}
+
+void
+PayloadCodec::decode(const char *data, std::size_t size, std::string &result) {
+    if (!encoded(data, size)) {
+        throw std::runtime_error("bad compressed payload signature");
+    }
+
+    Type type = (Type)(unsigned char)data[sizeof(SIGNATURE)];
+    boost::uint32_t decoded_size;
+    memcpy(&decoded_size, data + sizeof(SIGNATURE) + 1, sizeof(decoded_size));
+    if (decoded_size > MAX_DECODED_SIZE) {
+        throw std::runtime_error("bad compressed payload size");
+    }
+
+    data += HEADER_SIZE;
+    size -= HEADER_SIZE;
+    result.resize(decoded_size);
+    if (0 == decoded_size) {
+        return;
+    }
+
+    if (DEFLATE == type) {
+        uLongf dest_len = decoded_size;
+        if (Z_OK != uncompress((Bytef*)&result[0], &dest_len, (const Bytef*)data, size) ||
+            dest_len != decoded_size) {
+            throw std::runtime_error("cannot inflate payload");
+        }
+        return;
+    }
+#ifdef HAVE_LZ4
+    if (LZ4 == type) {
+        int res = LZ4_decompress_safe(data, &result[0], size, decoded_size);
+        if (res < 0 || (boost::uint32_t)res != decoded_size) {
+            throw std::runtime_error("cannot decompress lz4 payload");
+        }
+        return;
+    }
+#endif
+    throw std::runtime_error("unsupported payload codec: " +
+        boost::lexical_cast<std::string>((unsigned int)type));
+}
+
+} // namespace xscript
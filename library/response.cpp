@@ -1,6 +1,7 @@
 #include "settings.h"
 
 #include <sstream>
+#include <stdexcept>
 
 #include <boost/current_function.hpp>
 #include <boost/lexical_cast.hpp>
@@ -20,6 +21,7 @@
 #include "xscript/writer.h"
 #include "xscript/xml_util.h"
 
+#include "internal/gzip.h"
 #include "internal/parser.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -36,6 +38,7 @@ static const std::string STR_CONTENT_ENCODING("Content-Encoding");
 static const std::string STR_LOCATION("Location");
 static const std::string STR_REFERER("Referer");
 static const std::string STR_TEXT_HTML("text/html");
+static const std::string STR_GZIP("gzip");
 
 class Response::ResponseData {
 public:
@@ -45,6 +48,7 @@ public:
     void sendHeaders();
     bool isBinary() const;
     bool cacheable() const;
+    bool tee() const;
 
     void checkAllowedHeaders() const;
 
@@ -54,6 +58,12 @@ public:
 
     void redirectToPath(const std::string &path, unsigned short status = 302);
 
+    void startGzip();
+    void writeStream(const char *buf, std::streamsize size);
+    void flush(std::streamsize size);
+    void finishStream();
+    void compressCached();
+
 private:
     void patchHeaderValidName(const std::string &name, const std::string &value);
 
@@ -67,7 +77,11 @@ public:
     std::auto_ptr<BinaryWriter> writer_;
     mutable boost::mutex write_mutex_, resp_mutex_;
     boost::shared_ptr<PageCacheData> cache_data_;
+    std::auto_ptr<GzipWriter> gzip_writer_;
     boost::uint32_t expire_delta_;
+    boost::uint32_t gzip_min_size_;
+    boost::uint32_t flush_size_;
+    boost::uint32_t unflushed_size_;
     unsigned short status_;
     bool direct_binary_;
     bool headers_sent_;
@@ -75,13 +89,22 @@ public:
     bool suppress_body_;
     bool detached_;
     bool stream_locked_;
+    bool gzip_enabled_;
+    bool gzip_accepted_;
+    bool gzip_streamable_;
+    bool flush_head_;
+    bool head_flushed_;
+    bool tee_failed_;
 };
 
 Response::ResponseData::ResponseData(Response *response, std::ostream *stream) :
     response_(response), stream_(stream), writer_(NULL),
-    expire_delta_(DEFAULT_EXPIRE_TIME_DELTA), status_(200),
+    expire_delta_(DEFAULT_EXPIRE_TIME_DELTA), gzip_min_size_(0),
+    flush_size_(0), unflushed_size_(0), status_(200),
     direct_binary_(false), headers_sent_(false), have_cached_copy_(false),
-    suppress_body_(false), detached_(false), stream_locked_(false)
+    suppress_body_(false), detached_(false), stream_locked_(false),
+    gzip_enabled_(false), gzip_accepted_(false), gzip_streamable_(false),
+    flush_head_(false), head_flushed_(false), tee_failed_(false)
 {}
 
 Response::ResponseData::~ResponseData()
@@ -102,6 +125,13 @@ Response::ResponseData::sendHeaders() {
         std::stringstream stream;
         stream << status_ << " " << HttpUtils::statusToString(status_);
         out_headers_[STR_STATUS] = stream.str();
+        bool tee_mode = tee();
+        if (tee_mode) {
+            stream_locked_ = true;
+        }
+        if (gzip_streamable_ && (!cacheable() || tee_mode)) {
+            startGzip();
+        }
         response_->writeHeaders();
         headers_sent_ = true;
     }
@@ -117,6 +147,12 @@ Response::ResponseData::cacheable() const {
     return NULL != cache_data_.get();
 }
 
+inline bool
+Response::ResponseData::tee() const {
+    return cacheable() && !have_cached_copy_ && NULL != stream_ &&
+        (flush_head_ || flush_size_ > 0) && !tee_failed_;
+}
+
 void
 Response::ResponseData::setCookie(const Cookie &cookie) {
     if (!cookie.check()) {
@@ -170,6 +206,60 @@ Response::ResponseData::redirectToPath(const std::string &path, unsigned short s
     status_ = status;
 }
 
+void
+Response::ResponseData::startGzip() {
+    if (isBinary() || !stream_ || 200 != status_ || suppress_body_ ||
+        !Gzip::compressible(Parser::get(out_headers_, STR_CONTENT_TYPE)) ||
+        !Parser::get(out_headers_, STR_CONTENT_ENCODING).empty()) {
+        return;
+    }
+
+    gzip_writer_.reset(new GzipWriter(stream_, Z_BEST_SPEED));
+}
+
+void
+Response::ResponseData::writeStream(const char *buf, std::streamsize size) {
+    if (gzip_writer_.get()) {
+        gzip_writer_->write(buf, size);
+    }
+    else {
+        stream_->write(buf, size);
+    }
+}
+
+void
+Response::ResponseData::flush(std::streamsize size) {
+    unflushed_size_ += size;
+    if ((flush_head_ && !head_flushed_) || (flush_size_ > 0 && unflushed_size_ >= flush_size_)) {
+        head_flushed_ = true;
+        unflushed_size_ = 0;
+        if (gzip_writer_.get()) {
+            gzip_writer_->flush();
+        }
+        stream_->flush();
+    }
+}
+
+void
+Response::ResponseData::finishStream() {
+    if (gzip_writer_.get() && stream_->good()) {
+        gzip_writer_->finish();
+    }
+}
+
+void
+Response::ResponseData::compressCached() {
+    if (!gzip_enabled_ || have_cached_copy_) {
+        return;
+    }
+    try {
+        cache_data_->compress(gzip_min_size_);
+    }
+    catch (const std::exception &e) {
+        log()->error("Error in compressing page: %s", e.what());
+    }
+}
+
 
 Response::Response() : data_(new ResponseData(this, NULL)) {
 }
@@ -257,6 +347,9 @@ Response::write(const char *buf, std::streamsize size, Request *request) {
     data_->sendHeaders();
     if (request && !request->suppressBody()) {
         writeBuffer(buf, size);
+        if (data_->stream_locked_ && (!data_->cacheable() || data_->tee())) {
+            data_->flush(size);
+        }
     }
     return size;
 }
@@ -335,16 +428,26 @@ Response::detach(Context *ctx) {
     
     if (data_->stream_locked_) {
         data_->sendHeaders();
+        data_->finishStream();
     }
     else if (cacheable) {
         if (data_->have_cached_copy_ && data_->cache_data_->notModified(ctx)) {
             setStatus(304);
             setExpiresHeader();
-            data_->setHeaderValidName(HttpUtils::ETAG_HEADER_NAME, data_->cache_data_->etag());
+            data_->setHeaderValidName(HttpUtils::ETAG_HEADER_NAME,
+                data_->cache_data_->etag(data_->gzip_accepted_));
+            if (data_->cache_data_->gzipped()) {
+                data_->setHeaderValidName(HttpUtils::VARY_HEADER_NAME, HttpUtils::ACCEPT_ENCODING_HEADER_NAME);
+            }
             data_->cache_data_ = boost::shared_ptr<PageCacheData>(); //need for sending headers in non-cache mode
             data_->sendHeaders();
         }
         else {
+            // compressed before writing only if client takes it gzipped,
+            // others get the body without gzip and gunzip round trip
+            if (data_->gzip_accepted_) {
+                data_->compressCached();
+            }
             writeByWriter(data_->cache_data_.get());
         }
     }
@@ -355,6 +458,7 @@ Response::detach(Context *ctx) {
     }
     else if (!data_->direct_binary_) {
         data_->sendHeaders();
+        data_->finishStream();
     }
 
     data_->detached_ = true;
@@ -364,6 +468,7 @@ Response::detach(Context *ctx) {
     }
     
     if (cacheable && !data_->have_cached_copy_ && ctx) {
+        data_->compressCached();
         try {
             Tag tag;
             Script* script = ctx->script().get();
@@ -390,9 +495,21 @@ void
 Response::writeBuffer(const char *buf, std::streamsize size) {
     if (data_->cacheable()) {
         data_->cache_data_->append(buf, size);
+        if (data_->tee()) {
+            try {
+                data_->writeStream(buf, size);
+                if (!data_->stream_->good()) {
+                    throw std::runtime_error("output stream is broken");
+                }
+            }
+            catch (const std::exception &e) {
+                log()->warn("Error in writing cached page to client: %s", e.what());
+                data_->tee_failed_ = true;
+            }
+        }
     }
     else if (data_->stream_) {
-        data_->stream_->write(buf, size);
+        data_->writeStream(buf, size);
     }
 }
 
@@ -419,6 +536,9 @@ Response::writeHeaders() {
     if (!cacheable && !data_->stream_) {
         return;
     }
+    bool to_stream = !cacheable || data_->tee();
+    bool gzip = NULL != data_->gzip_writer_.get();
+    bool vary_sent = false;
     const HeaderMap& headers = outHeaders();
     for (HeaderMap::const_iterator i = headers.begin(), end = headers.end(); i != end; ++i) {
         if (cacheable) {
@@ -428,12 +548,33 @@ Response::writeHeaders() {
             }
             data_->cache_data_->addHeader(i->first, i->second);
         }
-        else {
-            (*data_->stream_) << i->first << ": " << i->second << "\r\n";
+        if (!to_stream) {
+            continue;
+        }
+        if (gzip && 0 == strcasecmp(i->first.c_str(), STR_CONTENT_LENGTH.c_str())) {
+            continue;
         }
+        (*data_->stream_) << i->first << ": " << i->second;
+        if (gzip && 0 == strcasecmp(i->first.c_str(), HttpUtils::VARY_HEADER_NAME.c_str())) {
+            (*data_->stream_) << ", " << HttpUtils::ACCEPT_ENCODING_HEADER_NAME;
+            vary_sent = true;
+        }
+        (*data_->stream_) << "\r\n";
     }
 
-    if (!cacheable) {
+    if (to_stream) {
+        if (gzip) {
+            if (!vary_sent) {
+                (*data_->stream_) << HttpUtils::VARY_HEADER_NAME << ": " <<
+                    HttpUtils::ACCEPT_ENCODING_HEADER_NAME << "\r\n";
+            }
+            (*data_->stream_) << STR_CONTENT_ENCODING << ": " << STR_GZIP << "\r\n";
+        }
+        if (cacheable) {
+            boost::int32_t expires = HttpDateUtils::expires(data_->expire_delta_);
+            (*data_->stream_) << HttpUtils::EXPIRES_HEADER_NAME << ": " <<
+                HttpDateUtils::format(expires) << "\r\n";
+        }
         const CookieSet& cookies = outCookies();
         for (CookieSet::const_iterator i = cookies.begin(), end = cookies.end(); i != end; ++i) {
             (*data_->stream_) << "Set-Cookie: " << i->toString() << "\r\n";
@@ -491,6 +632,29 @@ Response::setContentEncoding(const std::string &encoding) {
     data_->setHeaderValidName(STR_CONTENT_ENCODING, encoding);
 }
 
+void
+Response::enableGzip(const Request *request, boost::uint32_t min_size) {
+    boost::mutex::scoped_lock sl(data_->resp_mutex_);
+    data_->gzip_enabled_ = true;
+    data_->gzip_min_size_ = min_size;
+    data_->gzip_accepted_ = NULL != request &&
+        Gzip::accepted(request->getHeader(HttpUtils::ACCEPT_ENCODING_HEADER_NAME));
+    data_->gzip_streamable_ = data_->gzip_accepted_ && !request->suppressBody();
+}
+
+bool
+Response::acceptGzip() const {
+    boost::mutex::scoped_lock sl(data_->resp_mutex_);
+    return data_->gzip_accepted_;
+}
+
+void
+Response::setFlushPolicy(bool flush_head, boost::uint32_t flush_size) {
+    boost::mutex::scoped_lock wl(data_->write_mutex_);
+    data_->flush_head_ = flush_head;
+    data_->flush_size_ = flush_size;
+}
+
 void
 Response::setCacheable(boost::shared_ptr<PageCacheData> cache_data) {
     if (NULL != cache_data.get()) {
@@ -5,6 +5,7 @@
 #include "xscript/authorizer.h"
 #include "xscript/context.h"
 #include "xscript/control_extension.h"
+#include "xscript/script.h"
 #include "internal/response_time_counter_impl.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -16,20 +17,20 @@ namespace xscript {
 ResponseTimeCounterImpl::StatusInfo::StatusInfo()
 {}
 
-void
-ResponseTimeCounterImpl::StatusInfo::add(const char *info, boost::uint64_t value) {
-    boost::shared_ptr<AverageCounter> counter;
+boost::shared_ptr<HistogramCounter>
+ResponseTimeCounterImpl::StatusInfo::findCounter(const char *info) {
+    boost::shared_ptr<HistogramCounter> counter;
     std::string auth(info ? info : AuthContext::NOAUTH_STATUS.c_str());
     CounterMapType::iterator it = custom_counters_.find(auth);
     if (custom_counters_.end() == it) {
-        counter = boost::shared_ptr<AverageCounter>(
-            AverageCounterFactory::instance()->createCounter("point").release());
+        counter = boost::shared_ptr<HistogramCounter>(
+            HistogramCounterFactory::instance()->createCounter("point").release());
         custom_counters_.insert(std::make_pair(auth, counter));
     }
     else {
         counter = it->second;
     }
-    counter->add(value);
+    return counter;
 }
 
 void
@@ -62,14 +63,22 @@ ResponseTimeCounterImpl::createReport() const {
         it->second->createReport(status.get());
         xmlAddChild(root.get(), status.release());
     }
+    for(ScriptCounterMapType::const_iterator it = script_counters_.begin();
+        it != script_counters_.end();
+        ++it) {
+        XmlNodeHelper script = it->second->createReport();
+        xmlSetProp(script.get(), (const xmlChar*)"name", (const xmlChar*) it->first.c_str());
+        xmlAddChild(root.get(), script.release());
+    }
     return root;
 }
 
 void
 ResponseTimeCounterImpl::add(const Response *resp, boost::uint64_t value) {
     boost::mutex::scoped_lock lock(mtx_);
-    boost::shared_ptr<StatusInfo> status_info = findStatusInfo(resp->status());   
-    status_info->add(NULL, value);
+    boost::shared_ptr<HistogramCounter> counter = findStatusInfo(resp->status())->findCounter(NULL);
+    lock.unlock();
+    counter->add(value);
 }
 
 void
@@ -77,11 +86,20 @@ ResponseTimeCounterImpl::add(const Context *ctx, boost::uint64_t value) {
     if (ControlExtension::isControl(ctx)) {
         return;
     }
+    boost::shared_ptr<HistogramCounter> script_counter;
     boost::mutex::scoped_lock lock(mtx_);
-    boost::shared_ptr<StatusInfo> status_info =
-        findStatusInfo(ctx->response()->status());
-    status_info->add(ctx->authContext().get() ?
-        ctx->authContext()->status().c_str() : NULL, value);
+    boost::shared_ptr<HistogramCounter> counter =
+        findStatusInfo(ctx->response()->status())->findCounter(ctx->authContext().get() ?
+            ctx->authContext()->status().c_str() : NULL);
+    if (NULL != ctx->script().get()) {
+        script_counter = findScriptCounter(ctx->script()->name());
+    }
+    lock.unlock();
+
+    counter->add(value);
+    if (NULL != script_counter.get()) {
+        script_counter->add(value);
+    }
 }
 
 boost::shared_ptr<ResponseTimeCounterImpl::StatusInfo>
@@ -98,10 +116,23 @@ ResponseTimeCounterImpl::findStatusInfo(unsigned short status) {
     return status_info;
 }
 
+boost::shared_ptr<HistogramCounter>
+ResponseTimeCounterImpl::findScriptCounter(const std::string &script) {
+    ScriptCounterMapType::iterator it = script_counters_.find(script);
+    if (script_counters_.end() != it) {
+        return it->second;
+    }
+    boost::shared_ptr<HistogramCounter> counter(
+        HistogramCounterFactory::instance()->createCounter("script").release());
+    script_counters_.insert(std::make_pair(script, counter));
+    return counter;
+}
+
 void
 ResponseTimeCounterImpl::reset() {
     boost::mutex::scoped_lock lock(mtx_);
     status_counters_.clear();
+    script_counters_.clear();
     reset_time_ = time(NULL);
 }
 
@@ -37,6 +37,7 @@
 #include "xscript/script.h"
 #include "xscript/stylesheet.h"
 #include "xscript/stylesheet_factory.h"
+#include "xscript/tagged_block.h"
 #include "xscript/threaded_block.h"
 #include "xscript/xml_util.h"
 
@@ -65,6 +66,8 @@ public:
     bool threaded() const;
     bool forceStylesheet() const;
     bool binaryPage() const;
+    bool flushHead() const;
+    boost::uint32_t flushSize() const;
     boost::uint32_t expireTimeDelta() const;
     bool expireTimeDeltaUndefined() const;
     bool allowMethod(const std::string &value) const;
@@ -86,6 +89,8 @@ public:
     void forceStylesheet(bool value);
     void expireTimeDelta(boost::uint32_t value);
     void binaryPage(bool value);
+    void flushHead(bool value);
+    void flushSize(boost::uint32_t value);
     void allowMethods(const char *value);
     void flag(unsigned int type, bool value);
     
@@ -99,6 +104,8 @@ public:
     XmlDocSharedHelper fetchResults(Context *ctx) const;
     void fetchRecursive(Context *ctx, xmlNodePtr node, xmlNodePtr newnode,
                         unsigned int &count, unsigned int &xscript_count) const;
+    void buildSkeleton();
+    void stripBlocks(xmlNodePtr node, xmlNodePtr newnode, unsigned int &count) const;
     void parseXScriptNode(const xmlNodePtr node);
     void replaceXScriptNode(xmlNodePtr node, xmlNodePtr newnode, Context *ctx) const;
     void property(const char *name, const char *value);
@@ -107,9 +114,11 @@ public:
     const Script *parent_;
     Script *owner_;
     XmlDocHelper doc_;
+    XmlDocHelper skeleton_; // copy of doc_ without block contents, used as result template
     std::vector<Block*> blocks_;
     unsigned int flags_;
     boost::uint32_t expire_time_delta_;
+    boost::uint32_t flush_size_;
     std::set<xmlNodePtr> xscript_node_set_;
     std::map<std::string, std::string> headers_;
     std::vector<std::string> allow_methods_;
@@ -117,6 +126,7 @@ public:
     static const unsigned int FLAG_THREADED = 1;
     static const unsigned int FLAG_FORCE_STYLESHEET = 1 << 1;
     static const unsigned int FLAG_BINARY_PAGE = 1 << 2;
+    static const unsigned int FLAG_FLUSH_HEAD = 1 << 3;
 };
 
 class Script::ParseXScriptNodeHandler : public MessageHandler {
@@ -134,7 +144,7 @@ class Script::CachableHandler : public MessageHandler {
 
 Script::ScriptData::ScriptData(Script *owner) :
     parent_(NULL), owner_(owner), flags_(FLAG_FORCE_STYLESHEET),
-    expire_time_delta_(EXPIRE_TIME_DELTA_UNDEFINED)
+    expire_time_delta_(EXPIRE_TIME_DELTA_UNDEFINED), flush_size_(0)
 {}
 
 Script::ScriptData::~ScriptData() {
@@ -156,6 +166,16 @@ Script::ScriptData::binaryPage() const {
     return flags_ & FLAG_BINARY_PAGE;
 }
 
+bool
+Script::ScriptData::flushHead() const {
+    return flags_ & FLAG_FLUSH_HEAD;
+}
+
+boost::uint32_t
+Script::ScriptData::flushSize() const {
+    return flush_size_;
+}
+
 boost::uint32_t
 Script::ScriptData::expireTimeDelta() const {
     return expire_time_delta_;
@@ -230,6 +250,16 @@ Script::ScriptData::binaryPage(bool value) {
     flag(FLAG_BINARY_PAGE, value);
 }
 
+void
+Script::ScriptData::flushHead(bool value) {
+    flag(FLAG_FLUSH_HEAD, value);
+}
+
+void
+Script::ScriptData::flushSize(boost::uint32_t value) {
+    flush_size_ = value;
+}
+
 void
 Script::ScriptData::flag(unsigned int type, bool value) {
     flags_ = value ? (flags_ | type) : (flags_ &= ~type);
@@ -435,7 +465,7 @@ Script::ScriptData::addHeaders(Context *ctx) const {
 XmlDocSharedHelper
 Script::ScriptData::fetchResults(Context *ctx) const {
 
-    XmlDocSharedHelper newdoc(xmlCopyDoc(doc_.get(), 1));
+    XmlDocSharedHelper newdoc(xmlCopyDoc(skeleton_.get() ? skeleton_.get() : doc_.get(), 1));
     XmlUtils::throwUnless(NULL != newdoc.get());
      
     unsigned int count = 0, xscript_count = 0;
@@ -462,17 +492,21 @@ Script::ScriptData::fetchRecursive(Context *ctx, xmlNodePtr node, xmlNodePtr new
         xmlNodePtr next = newnode->next;
         if (count < blocks_num && block(count)->node() == node) {
             boost::shared_ptr<InvokeContext> result = ctx->result(count);
-            xmlDocPtr doc = result->resultDoc().get();
+            XmlDocSharedHelper result_doc = result->resultDoc();
+            xmlDocPtr doc = result_doc.get();
             assert(doc);
+            // root of the doc can be moved unless block cache holds the doc as well
+            bool move = !result->sharedResult();
             xmlNodePtr result_doc_root_node = xmlDocGetRootElement(doc);
             if (result_doc_root_node) {
                 if (result->error()) {
-                    xmlReplaceNode(newnode, xmlCopyNode(result_doc_root_node, 1));
+                    xmlReplaceNode(newnode, move ? XmlUtils::moveNode(result_doc_root_node, newnode->doc) :
+                        xmlCopyNode(result_doc_root_node, 1));
                 }
                 else {
                     xmlDocPtr meta_doc = result->meta_error() ? NULL : result->metaDoc().get();
                     xmlNodePtr last_node = block(count)->processXPointer(
-                        result.get(), doc, meta_doc, newnode, &xmlReplaceNode);
+                        result.get(), doc, meta_doc, newnode, &xmlReplaceNode, move);
                     meta_doc = result->metaDoc().get();
                     xmlNodePtr root = meta_doc ? xmlDocGetRootElement(meta_doc) : NULL;
                     if (result->meta_error() && root) {  //add error meta
@@ -506,6 +540,36 @@ Script::ScriptData::fetchRecursive(Context *ctx, xmlNodePtr node, xmlNodePtr new
     }
 }
 
+void
+Script::ScriptData::buildSkeleton() {
+    skeleton_ = XmlDocHelper(xmlCopyDoc(doc_.get(), 1));
+    XmlUtils::throwUnless(NULL != skeleton_.get());
+
+    unsigned int count = 0;
+    stripBlocks(xmlDocGetRootElement(doc_.get()), xmlDocGetRootElement(skeleton_.get()), count);
+}
+
+void
+Script::ScriptData::stripBlocks(xmlNodePtr node, xmlNodePtr newnode, unsigned int &count) const {
+    unsigned int blocks_num = blocksNumber();
+    while (node && newnode && count < blocks_num) {
+        if (block(count)->node() == node) {
+            // block node is replaced by block result, its params are never copied into result
+            xmlFreeNodeList(newnode->children);
+            newnode->children = NULL;
+            newnode->last = NULL;
+            xmlFreePropList(newnode->properties);
+            newnode->properties = NULL;
+            count++;
+        }
+        else if (node->children) {
+            stripBlocks(node->children, newnode->children, count);
+        }
+        node = node->next;
+        newnode = newnode->next;
+    }
+}
+
 void
 Script::ScriptData::parseXScriptNode(const xmlNodePtr node) {
     MessageParam<Script> script_param(owner_);
@@ -635,6 +699,18 @@ Script::PropertyHandler::process(const MessageParams &params,
     else if (strncasecmp(prop, "binary-page", sizeof("binary-page")) == 0) {
         script->data_->binaryPage(strncasecmp(value, "yes", sizeof("yes")) == 0);
     }
+    else if (strncasecmp(prop, "output-flush-head", sizeof("output-flush-head")) == 0) {
+        script->data_->flushHead(strncasecmp(value, "yes", sizeof("yes")) == 0);
+    }
+    else if (strncasecmp(prop, "output-flush-size", sizeof("output-flush-size")) == 0) {
+        try {
+            script->data_->flushSize(boost::lexical_cast<boost::uint32_t>(value));
+        }
+        catch(const boost::bad_lexical_cast &e) {
+            throw std::runtime_error(
+                std::string("cannot parse output-flush-size value: ") + value);
+        }
+    }
     else if (script->checkProperty(prop, value)) {
     }
     else {
@@ -750,6 +826,16 @@ Script::binaryPage() const {
     return data_->binaryPage();
 }
 
+bool
+Script::flushHead() const {
+    return data_->flushHead();
+}
+
+boost::uint32_t
+Script::flushSize() const {
+    return data_->flushSize();
+}
+
 boost::uint32_t
 Script::expireTimeDelta() const {
     return data_->expireTimeDelta();
@@ -830,6 +916,7 @@ Script::parseXScript() {
     data_->parseBlocks();
     data_->buildXScriptNodeSet(xscript_nodes);
     postParse();
+    data_->buildSkeleton();
 }
 
 void
@@ -906,6 +993,8 @@ Script::invokeBlocks(boost::shared_ptr<Context> ctx) {
     boost::xtime end_time = Context::delay(0);
     std::vector<Block*> &blocks = data_->blocks();
     ctx->expect(blocks.size());
+    std::vector<boost::shared_ptr<InvokeContext> > prefetched;
+    TaggedBlock::prefetchCachedDocs(ctx, blocks, prefetched);
     bool stop = false;
     for (std::vector<Block*>::iterator it = blocks.begin();
          it != blocks.end();
@@ -934,7 +1023,13 @@ Script::invokeBlocks(boost::shared_ptr<Context> ctx) {
         }
 
         try {
-            if (block->invokeCheckThreadedEx(ctx, count)) {
+            boost::shared_ptr<InvokeContext> invoke_ctx;
+            if (count < prefetched.size()) {
+                invoke_ctx.swap(prefetched[count]);
+            }
+            bool threaded = NULL == invoke_ctx.get() ? block->invokeCheckThreadedEx(ctx, count) :
+                block->invokeCheckThreadedEx(ctx, invoke_ctx, count);
+            if (threaded) {
                 const ThreadedBlock *tb = dynamic_cast<const ThreadedBlock*>(block);
                 assert(tb);
                 boost::xtime tmp = Context::delay(tb->timeout());
@@ -60,6 +60,9 @@ namespace xscript {
 extern "C" int closeFunc(void *ctx);
 extern "C" int writeFunc(void *ctx, const char *data, int len);
 
+// Keeps the page cache miss coalesced until the page is saved in Response::detach
+static const std::string PAGE_CACHE_FLIGHT_PARAM = "xscript.page-cache-flight";
+
 class Server::ServerData {
 public:
     ServerData(Config *config) : config_(config) {
@@ -221,9 +224,13 @@ Server::processCachedDoc(Context *ctx, Script *script) {
     try {       
         Tag tag(true, 1, 1); // fake undefined Tag
         CacheContext cache_ctx(script, ctx, script->allowDistributed());
+        cache_ctx.allowCoalescing(script->allowCoalescing());
         boost::shared_ptr<PageCacheData> cache_data =
             PageCache::instance()->loadDoc(&cache_ctx, tag);
         if (NULL == cache_data.get()) {
+            if (NULL != cache_ctx.flight().get()) {
+                ctx->param(PAGE_CACHE_FLIGHT_PARAM, cache_ctx.flight());
+            }
             return false;
         }
         ctx->response()->setCacheable(cache_data);
@@ -237,6 +244,8 @@ Server::processCachedDoc(Context *ctx, Script *script) {
 
 void
 Server::sendResponse(Context *ctx, XmlDocSharedHelper doc) {
+    const Script *script = ctx->script().get();
+    ctx->response()->setFlushPolicy(script->flushHead(), script->flushSize());
     sendHeaders(ctx);
     if (ctx->response()->suppressBody(ctx->request())) {
         return;
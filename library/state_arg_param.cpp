@@ -19,6 +19,7 @@ public:
     virtual ~StateArgParam();
 
     virtual const char* type() const;
+    virtual bool fromState() const;
     virtual std::string asString(const Context *ctx) const;
     
     virtual void add(const Context *ctx, ArgList &al) const;
@@ -37,6 +38,11 @@ StateArgParam::StateArgParam(Object *owner, xmlNodePtr node) :
 StateArgParam::~StateArgParam() {
 }
 
+bool
+StateArgParam::fromState() const {
+    return true;
+}
+
 const char*
 StateArgParam::type() const {
     return "StateArg";
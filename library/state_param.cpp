@@ -21,6 +21,7 @@ public:
     virtual ~StateParam();
 
     virtual const char* type() const;
+    virtual bool fromState() const;
     virtual std::string asString(const Context *ctx) const;
     virtual void add(const Context *ctx, ArgList &al) const;
 
@@ -34,6 +35,11 @@ StateParam::StateParam(Object *owner, xmlNodePtr node) :
 StateParam::~StateParam() {
 }
 
+bool
+StateParam::fromState() const {
+    return true;
+}
+
 const char*
 StateParam::type() const {
     return "State";
@@ -3,7 +3,6 @@
 #include <algorithm>
 #include <iterator>
 #include <map>
-#include <set>
 #include <sstream>
 #include <stdexcept>
 
@@ -12,6 +11,7 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "xscript/block.h"
 #include "xscript/context.h"
@@ -36,6 +36,7 @@
 #include "internal/profiler.h"
 
 #include <libxslt/attributes.h>
+#include <libxslt/documents.h>
 #include <libxslt/extensions.h>
 #include <libxslt/imports.h>
 #include <libxslt/transform.h>
@@ -72,6 +73,61 @@ private:
 
 static XsltInitalizer xsltInitalizer;
 
+static unsigned int transform_context_pool_size = 2;
+
+// contexts are retired after a number of uses to bound growth of their dictionaries
+static const unsigned int MAX_TRANSFORM_CONTEXT_USES = 256;
+
+/**
+ * Idle transform contexts of a stylesheet. A context released in good state
+ * is cleared instead of being freed: documents, global variables, extension
+ * data (with the page context it refers to) and result tree fragments are
+ * dropped, its xpath context, dictionary, stacks and caches are kept.
+ */
+class TransformContextPool : private boost::noncopyable {
+public:
+    TransformContextPool();
+    ~TransformContextPool();
+
+    xsltTransformContextPtr acquire(xsltStylesheetPtr style, xmlDocPtr doc, unsigned int &uses);
+    void release(xsltTransformContextPtr tctx, unsigned int uses);
+
+private:
+    static bool clear(xsltTransformContextPtr tctx);
+    static bool prepare(xsltTransformContextPtr tctx, xmlDocPtr doc);
+
+    typedef std::pair<xsltTransformContextPtr, unsigned int> EntryType;
+
+    boost::mutex mutex_;
+    std::vector<EntryType> idle_;
+};
+
+class TransformContextHolder : private boost::noncopyable {
+public:
+    TransformContextHolder(TransformContextPool *pool, xsltStylesheetPtr style, xmlDocPtr doc) :
+        pool_(pool), uses_(0), tctx_(pool_->acquire(style, doc, uses_))
+    {}
+
+    ~TransformContextHolder() {
+        if (NULL != tctx_) {
+            pool_->release(tctx_, uses_);
+        }
+    }
+
+    xsltTransformContextPtr get() const {
+        return tctx_;
+    }
+
+    xsltTransformContextPtr operator -> () const {
+        return tctx_;
+    }
+
+private:
+    TransformContextPool *pool_;
+    unsigned int uses_;
+    xsltTransformContextPtr tctx_;
+};
+
 const std::string Stylesheet::DETECT_OUTPUT_METHOD = "STYLESHEET_DETECT_OUTPUT_METHOD";
 
 class Stylesheet::StylesheetData {
@@ -87,7 +143,7 @@ public:
     void parseStylesheet(xsltStylesheetPtr style);    
     void parseNode(xmlNodePtr node);
     std::string detectContentType(const XmlDocHelper &doc) const;
-    void appendXsltParams(const std::vector<Param*>& params,
+    void appendXsltParams(const Object *obj,
                           const Context *ctx,
                           const InvokeContext *invoke_ctx,
                           xsltTransformContextPtr tctx);
@@ -104,10 +160,110 @@ public:
     std::string output_encoding_;
     int omitXmlDeclaration;
     int indent;
+    std::auto_ptr<TransformContextPool> pool_;
 };
 
+TransformContextPool::TransformContextPool() {
+}
+
+TransformContextPool::~TransformContextPool() {
+    for (std::vector<EntryType>::iterator it = idle_.begin(), end = idle_.end(); it != end; ++it) {
+        xsltFreeTransformContext(it->first);
+    }
+}
+
+xsltTransformContextPtr
+TransformContextPool::acquire(xsltStylesheetPtr style, xmlDocPtr doc, unsigned int &uses) {
+    while (true) {
+        EntryType entry;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (idle_.empty()) {
+                break;
+            }
+            entry = idle_.back();
+            idle_.pop_back();
+        }
+        if (prepare(entry.first, doc)) {
+            uses = entry.second;
+            return entry.first;
+        }
+        xsltFreeTransformContext(entry.first);
+    }
+    uses = 0;
+    return xsltNewTransformContext(style, doc);
+}
+
+void
+TransformContextPool::release(xsltTransformContextPtr tctx, unsigned int uses) {
+    if (!tctx->profile && ++uses < MAX_TRANSFORM_CONTEXT_USES && clear(tctx)) {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (idle_.size() < transform_context_pool_size) {
+            idle_.push_back(std::make_pair(tctx, uses));
+            return;
+        }
+    }
+    xsltFreeTransformContext(tctx);
+}
+
+bool
+TransformContextPool::clear(xsltTransformContextPtr tctx) {
+    if (XSLT_STATE_OK != tctx->state || 0 != tctx->varsNr || 0 != tctx->templNr) {
+        return false;
+    }
+
+    // same order as in xsltFreeTransformContext, shutdown of extensions
+    // deletes ContextDataHelper if transform did not get to do it
+    xsltShutdownCtxtExts(tctx);
+    xsltFreeGlobalVariables(tctx);
+    tctx->globalVars = NULL;
+    xsltFreeDocuments(tctx);
+    tctx->docList = NULL;
+    tctx->styleList = NULL;
+    tctx->document = NULL;
+    xsltFreeCtxtExts(tctx);
+    tctx->extElements = NULL;
+    tctx->extFunctions = NULL;
+    xsltFreeRVTs(tctx);
+    for (int i = 0; i < tctx->extrasNr; ++i) {
+        if (NULL != tctx->extras[i].deallocate && NULL != tctx->extras[i].info) {
+            tctx->extras[i].deallocate(tctx->extras[i].info);
+        }
+        tctx->extras[i].info = NULL;
+    }
+
+    // source and output documents belong to the caller and may be freed
+    tctx->xpathCtxt->doc = NULL;
+    tctx->xpathCtxt->node = NULL;
+    tctx->node = NULL;
+    tctx->inst = NULL;
+    tctx->output = NULL;
+    tctx->insert = NULL;
+    tctx->lasttext = NULL;
+    tctx->lasttsize = 0;
+    tctx->lasttuse = 0;
+    tctx->initialContextDoc = NULL;
+    tctx->initialContextNode = NULL;
+    return true;
+}
+
+bool
+TransformContextPool::prepare(xsltTransformContextPtr tctx, xmlDocPtr doc) {
+    xsltDocumentPtr document = xsltNewDocument(tctx, doc);
+    if (NULL == document) {
+        return false;
+    }
+    document->main = 1;
+    tctx->document = document;
+
+    tctx->xpathCtxt->doc = doc;
+    tctx->xpathCtxt->node = (xmlNodePtr)doc;
+    return true;
+}
+
 Stylesheet::StylesheetData::StylesheetData(Stylesheet *owner) :
-        owner_(owner), stylesheet_(NULL), blocks_(), omitXmlDeclaration(-1), indent(-1)
+        owner_(owner), stylesheet_(NULL), blocks_(), omitXmlDeclaration(-1), indent(-1),
+        pool_(new TransformContextPool())
 {}
     
 Stylesheet::StylesheetData::~StylesheetData() {
@@ -265,50 +421,39 @@ Stylesheet::StylesheetData::detectContentType(const XmlDocHelper &doc) const {
 }
 
 void
-Stylesheet::StylesheetData::appendXsltParams(const std::vector<Param*>& params,
+Stylesheet::StylesheetData::appendXsltParams(const Object *obj,
                                              const Context *ctx,
                                              const InvokeContext *invoke_ctx,
                                              xsltTransformContextPtr tctx) {
+    const std::vector<Param*> &params = obj->xsltParams();
     if (params.empty()) {
         return;
     }
 
     log()->debug("param list contains %llu elements", static_cast<unsigned long long>(params.size()));
 
-    typedef std::set<std::string> ParamSetType;
-    ParamSetType unique_params;
-
-    std::vector<std::string>::const_iterator val_iter;
-    if (invoke_ctx) {
-        if (invoke_ctx->xsltParams().size() != params.size()) {
-            throw std::logic_error("Incorrect xslt arg list");
-        }
-        val_iter = invoke_ctx->xsltParams().begin();
+    if (invoke_ctx && invoke_ctx->xsltParams().size() != params.size()) {
+        throw std::logic_error("Incorrect xslt arg list");
     }
-    for (std::vector<Param*>::const_iterator it = params.begin(), end = params.end();
-        it != end;
-        ++it) {
-        const Param *param = *it;
+
+    for (unsigned int i = 0, size = params.size(); i < size; ++i) {
+        const Param *param = params[i];
         const std::string &id = param->id();
-        std::pair<ParamSetType::iterator, bool> result = unique_params.insert(id);
-        if (result.second == false) {
+        if (obj->xsltParamDuplicated(i)) {
             std::stringstream stream;
             stream << "duplicated xslt-param: " << id << ". Url: " << ctx->request()->getOriginalUrl();
             OperationMode::instance()->processError(stream.str());
+            continue;
         }
-        else {
-            std::string value = invoke_ctx ? *val_iter : param->asString(ctx);
-            if (!value.empty()) {
-                log()->debug("add xslt-param %s: %s", id.c_str(), value.c_str());
-                XmlUtils::throwUnless(xsltQuoteOneUserParam(
-                        tctx, (const xmlChar*)id.c_str(), (const xmlChar*)value.c_str()) == 0);
-            }
-            else {
-                log()->debug("skip empty xslt-param: %s", id.c_str());
-            }
+
+        std::string value = invoke_ctx ? invoke_ctx->xsltParams()[i] : param->asString(ctx);
+        if (!value.empty()) {
+            log()->debug("add xslt-param %s: %s", id.c_str(), value.c_str());
+            XmlUtils::throwUnless(xsltQuoteOneUserParam(
+                    tctx, (const xmlChar*)id.c_str(), (const xmlChar*)value.c_str()) == 0);
         }
-        if (invoke_ctx) {
-            ++val_iter;
+        else {
+            log()->debug("skip empty xslt-param: %s", id.c_str());
         }
     }
 }
@@ -375,10 +520,10 @@ Stylesheet::apply(Object *obj, boost::shared_ptr<Context> ctx,
 
     log()->entering("Stylesheet::apply");
     
-    XsltTransformContextHelper tctx(xsltNewTransformContext(data_->stylesheet_.get(), doc));
+    TransformContextHolder tctx(data_->pool_.get(), data_->stylesheet_.get(), doc);
     XmlUtils::throwUnless(NULL != tctx.get());
 
-    log()->debug("%s: transform context created", name().c_str());
+    log()->debug("%s: transform context acquired", name().c_str());
 
     data_->attachContextData(tctx.get(), ctx, this, dynamic_cast<const Block*>(obj));
 
@@ -391,7 +536,7 @@ Stylesheet::apply(Object *obj, boost::shared_ptr<Context> ctx,
     }
 
     if (obj) {
-        data_->appendXsltParams(obj->xsltParams(), ctx.get(), invoke_ctx.get(), tctx.get());
+        data_->appendXsltParams(obj, ctx.get(), invoke_ctx.get(), tctx.get());
     }
 
     internal::Profiler profiler("Total apply time");
@@ -486,9 +631,8 @@ Stylesheet::parse() {
     data_->detectOutputEncoding();
     data_->detectOutputInfo();
     
-    XsltTransformContextHelper tctx(
-        xsltNewTransformContext(data_->stylesheet_.get(), XmlUtils::fakeXml()));
-    
+    // the check context becomes the first pooled one
+    TransformContextHolder tctx(data_->pool_.get(), data_->stylesheet_.get(), XmlUtils::fakeXml());
     XmlUtils::throwUnless(NULL != tctx.get());
 }
 
@@ -516,6 +660,11 @@ Stylesheet::getBlock(xsltTransformContextPtr tctx) {
     return data->block;
 }
 
+void
+Stylesheet::transformContextPoolSize(unsigned int size) {
+    transform_context_pool_size = size;
+}
+
 Block*
 Stylesheet::block(xmlNodePtr node) {
     return data_->block(node);
@@ -2,6 +2,7 @@
 
 #include <boost/current_function.hpp>
 
+#include "xscript/config.h"
 #include "xscript/logger.h"
 #include "xscript/stylesheet.h"
 #include "xscript/stylesheet_cache.h"
@@ -19,6 +20,12 @@ StylesheetFactory::StylesheetFactory() {
 StylesheetFactory::~StylesheetFactory() {
 }
 
+void
+StylesheetFactory::init(const Config *config) {
+    Stylesheet::transformContextPoolSize(
+        config->as<unsigned int>("/xscript/xslt/transform-context-pool", 2));
+}
+
 boost::shared_ptr<Stylesheet>
 StylesheetFactory::create(const std::string &name) {
     return boost::shared_ptr<Stylesheet>(new Stylesheet(name));
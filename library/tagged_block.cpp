@@ -1,5 +1,6 @@
 #include "settings.h"
 
+#include <boost/bind.hpp>
 #include <boost/current_function.hpp>
 #include <boost/tokenizer.hpp>
 
@@ -14,6 +15,7 @@
 #include "details/tag_param.h"
 #include "xscript/tagged_block.h"
 #include "xscript/vhost_data.h"
+#include "xscript/xml_util.h"
 
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
@@ -102,17 +104,7 @@ TaggedBlock::invokeInternal(boost::shared_ptr<Context> ctx, boost::shared_ptr<In
 
     log()->debug("%s", BOOST_CURRENT_FUNCTION);
 
-    if (!tagged()) {
-        Block::invokeInternal(ctx, invoke_ctx);
-        return;
-    }
-
-    if (xsltDefined() && ctx->noXsltPort()) {
-        Block::invokeInternal(ctx, invoke_ctx);
-        return;
-    }
-    
-    if (!Policy::instance()->allowCaching(ctx.get(), this)) {
+    if (!useCache(ctx.get())) {
         Block::invokeInternal(ctx, invoke_ctx);
         return;
     }
@@ -122,12 +114,18 @@ TaggedBlock::invokeInternal(boost::shared_ptr<Context> ctx, boost::shared_ptr<In
     const int EXPIRED_TIME = Tag::EXPIRED_TIME;
 
     Tag cache_tag(true, EXPIRED_TIME, EXPIRED_TIME); // fake expired Tag
+
+    // Lives until the block is invoked so that concurrent misses of the same key
+    // can wait for the result saved in postCall instead of invoking the block too
+    CacheContext cache_ctx(this, ctx.get(), this->allowDistributed());
+    cache_ctx.allowCoalescing(this->allowCoalescing());
+    cache_ctx.refreshFactory(boost::bind(&TaggedBlock::createRefreshTask, this, ctx));
     try {
-        CacheContext cache_ctx(this, ctx.get(), this->allowDistributed());
         boost::shared_ptr<BlockCacheData> cache_data = 
             DocCache::instance()->loadDoc(invoke_ctx.get(), &cache_ctx, cache_tag);
         if (cache_data.get() && cache_data->doc().get()) {
             invoke_ctx->resultDoc(cache_data->doc());
+            invoke_ctx->sharedResult(true);
             if (metaBlock()) {
                 invoke_ctx->meta()->setCore(cache_data->meta());
                 invoke_ctx->meta()->setCacheParams(
@@ -167,6 +165,78 @@ TaggedBlock::invokeInternal(boost::shared_ptr<Context> ctx, boost::shared_ptr<In
     processCachedDoc(ctx, invoke_ctx, cache_tag);
 }
 
+bool
+TaggedBlock::useCache(const Context *ctx) const {
+    if (!tagged()) {
+        return false;
+    }
+    if (xsltDefined() && ctx->noXsltPort()) {
+        return false;
+    }
+    return Policy::instance()->allowCaching(ctx, this);
+}
+
+void
+TaggedBlock::prefetchCachedDocs(boost::shared_ptr<Context> ctx, const std::vector<Block*> &blocks,
+    std::vector<boost::shared_ptr<InvokeContext> > &invoke_contexts) {
+
+    invoke_contexts.clear();
+    DocCache *cache = DocCache::instance();
+    if (!cache->prefetchEnabled()) {
+        return;
+    }
+
+    std::vector<boost::shared_ptr<InvokeContext> > prefetched(blocks.size());
+    std::vector<boost::shared_ptr<CacheContext> > cache_contexts;
+    CachePrefetchList objects;
+    for (unsigned int i = 0; i < blocks.size(); ++i) {
+        TaggedBlock *block = dynamic_cast<TaggedBlock*>(blocks[i]);
+        if (NULL == block || block->argsFromState()) {
+            continue;
+        }
+        try {
+            if (!block->useCache(ctx.get())) {
+                continue;
+            }
+            boost::shared_ptr<InvokeContext> invoke_ctx = block->createInvokeContext(ctx);
+            boost::shared_ptr<CacheContext> cache_ctx(new CacheContext(block, ctx.get(), block->allowDistributed()));
+            prefetched[i] = invoke_ctx;
+            cache_contexts.push_back(cache_ctx);
+            objects.push_back(std::make_pair(invoke_ctx.get(), cache_ctx.get()));
+        }
+        catch (const std::exception &e) {
+            block->log()->debug("skip cache prefetch of block %s: %s", block->name(), e.what());
+        }
+    }
+
+    if (objects.size() > 1) {
+        cache->prefetchDocs(objects);
+    }
+    invoke_contexts.swap(prefetched);
+}
+
+boost::function<void()>
+TaggedBlock::createRefreshTask(boost::shared_ptr<Context> ctx) {
+    boost::shared_ptr<Context> snapshot = Context::createSnapshot(ctx);
+    boost::shared_ptr<InvokeContext> invoke_ctx = createInvokeContext(snapshot);
+    return boost::bind(&TaggedBlock::refresh, this, snapshot, invoke_ctx);
+}
+
+// invoked by cache refresher for a document served from cache but due for prefetch
+void
+TaggedBlock::refresh(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext> invoke_ctx) {
+    log()->debug("%s", BOOST_CURRENT_FUNCTION);
+
+    // refresher thread gets the same setup as threaded blocks
+    XmlUtils::registerReporters();
+    VirtualHostData::instance()->set(ctx->rootContext()->request());
+    Context::resetTimer();
+
+    BlockTimerStarter starter(ctx.get(), this);
+    invoke_ctx->meta()->cacheParamsWritable(cacheTimeUndefined());
+    Block::invokeInternal(ctx, invoke_ctx);
+}
+
 // return true if cache copy processed
 bool
 TaggedBlock::processCachedDoc(boost::shared_ptr<Context> ctx,
@@ -176,6 +246,7 @@ TaggedBlock::processCachedDoc(boost::shared_ptr<Context> ctx,
         invoke_ctx->meta()->reset();
         invoke_ctx->meta()->cacheParamsWritable(cacheTimeUndefined());
         invoke_ctx->resultDoc(XmlDocSharedHelper());
+        invoke_ctx->sharedResult(false);
         Block::invokeInternal(ctx, invoke_ctx);
         return false;
     }
@@ -273,6 +344,8 @@ TaggedBlock::postCall(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeCo
         }
         boost::shared_ptr<BlockCacheData> cache_data(
             new BlockCacheData(invoke_ctx->resultDoc(), meta));
+        // memory caches and background writers keep the doc itself
+        invoke_ctx->sharedResult(true);
         res = cache->saveDoc(invoke_ctx.get(), &cache_ctx, tag, cache_data);
     }
 
@@ -34,6 +34,13 @@ TypedCacheData::TypedCacheData(const std::string &key, TypedValue &value) : key_
 TypedCacheData::~TypedCacheData() {
 }
 
+std::size_t
+TypedCacheData::memoryUsage() const {
+    std::string buf;
+    value_.serialize(buf);
+    return sizeof(*this) + key_.capacity() + buf.size();
+}
+
 
 TypedCache::TypedCache() {
 }
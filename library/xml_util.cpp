@@ -3,6 +3,8 @@
 #include <cctype>
 #include <cstdarg>
 #include <cassert>
+#include <set>
+#include <stdexcept>
 
 #include <string.h>
 
@@ -746,6 +748,104 @@ XmlUtils::getUniqueNodeId(xmlNodePtr node) {
     return id;
 }
 
+class XmlMemoryCounter {
+public:
+    explicit XmlMemoryCounter(xmlDictPtr dict) : dict_(dict), size_(0) {}
+
+    void string(const xmlChar *str) {
+        if (NULL == str) {
+            return;
+        }
+        if (NULL != dict_ && xmlDictOwns(dict_, str) > 0) {
+            if (dict_strings_.insert(str).second) {
+                size_ += xmlStrlen(str) + 1 + 2 * sizeof(void*);
+            }
+            return;
+        }
+        size_ += xmlStrlen(str) + 1;
+    }
+
+    void node(xmlNodePtr node) {
+        size_ += sizeof(xmlNode);
+        if (XML_ELEMENT_NODE == node->type) {
+            string(node->name);
+            for (xmlNsPtr ns = node->nsDef; NULL != ns; ns = ns->next) {
+                size_ += sizeof(xmlNs);
+                string(ns->href);
+                string(ns->prefix);
+            }
+            for (xmlAttrPtr attr = node->properties; NULL != attr; attr = attr->next) {
+                size_ += sizeof(xmlAttr);
+                string(attr->name);
+                for (xmlNodePtr child = attr->children; NULL != child; child = child->next) {
+                    this->node(child);
+                }
+            }
+        }
+        else if (XML_PI_NODE == node->type || XML_ENTITY_REF_NODE == node->type) {
+            string(node->name);
+        }
+        // compact text nodes keep short content in place of properties
+        if (NULL != node->content && node->content != (xmlChar*)&node->properties) {
+            string(node->content);
+        }
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+private:
+    xmlDictPtr dict_;
+    std::set<const xmlChar*> dict_strings_;
+    std::size_t size_;
+};
+
+std::size_t
+XmlUtils::memoryUsage(xmlDocPtr doc) {
+    if (NULL == doc) {
+        return 0;
+    }
+
+    XmlMemoryCounter counter(doc->dict);
+    counter.string(doc->URL);
+    counter.string(doc->version);
+    counter.string(doc->encoding);
+
+    xmlNodePtr node = doc->children;
+    while (NULL != node) {
+        if (XML_DTD_NODE == node->type) {
+            counter.string(node->name);
+            node = node->next;
+            continue;
+        }
+        counter.node(node);
+        if (NULL != node->children && XML_ENTITY_REF_NODE != node->type) {
+            node = node->children;
+            continue;
+        }
+        while (NULL != node && NULL == node->next) {
+            node = node->parent;
+            if ((xmlNodePtr)doc == node) {
+                node = NULL;
+            }
+        }
+        if (NULL != node) {
+            node = node->next;
+        }
+    }
+    return sizeof(xmlDoc) + counter.size();
+}
+
+xmlNodePtr
+XmlUtils::moveNode(xmlNodePtr node, xmlDocPtr doc) {
+    if (node->doc != doc && 0 != xmlDOMWrapAdoptNode(NULL, node->doc, node, doc, NULL, 0)) {
+        throw std::runtime_error("can not move xml node to another document");
+    }
+    xmlUnlinkNode(node);
+    return node;
+}
+
 int
 XmlUtils::xmlVersionNumber() {
     return xscript::xmlVersion;
@@ -1,8 +1,20 @@
 #include "settings.h"
 
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include <xscript/context.h>
+#include <xscript/invoke_context.h>
+#include <xscript/request.h>
 #include <xscript/script.h>
+#include <xscript/state.h>
+#include <xscript/thread_pool.h>
 #include <xscript/typed_map.h>
+#include <xscript/vhost_data.h>
 #include <xscript/xml_util.h>
 
 #include "while_block.h"
@@ -47,8 +59,155 @@ ContextStopper::reset() {
     return ctx_.reset();
 }
 
+static const unsigned int MAX_PARALLEL_ITERATIONS = 1000;
+static const std::string ITERATION_INDEX_PARAM = "index";
+
+/**
+ * Iterations of parallel while block. Every lane takes next iteration
+ * until all are taken, so at most lanes iterations run at once.
+ * Iteration fails if any of its blocks fails, and the first failed
+ * iteration stops the rest.
+ */
+class WhileIterations {
+public:
+    WhileIterations(boost::shared_ptr<Script> script, boost::shared_ptr<Context> ctx, unsigned int count) :
+        script_(script), helper_(ctx), ctxs_(count), docs_(count), errors_(count),
+        next_(0), done_(0), stopped_(false)
+    {}
+
+    void add(unsigned int index, boost::shared_ptr<Context> ctx) {
+        ctxs_[index] = ctx;
+    }
+
+    void run() {
+        while (true) {
+            unsigned int index;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (stopped_ || next_ == ctxs_.size()) {
+                    return;
+                }
+                index = next_++;
+            }
+
+            XmlDocSharedHelper doc;
+            std::string error;
+            try {
+                const boost::shared_ptr<Context> &ctx = ctxs_[index];
+                ctx->wait(script_->invokeBlocks(ctx));
+                checkResults(ctx.get());
+                doc = script_->processResults(ctx);
+                XmlUtils::throwUnless(NULL != doc.get());
+                XmlUtils::throwUnless(NULL != xmlDocGetRootElement(doc.get()));
+            }
+            catch (const std::exception &e) {
+                error = e.what();
+            }
+
+            boost::mutex::scoped_lock lock(mutex_);
+            docs_[index] = doc;
+            errors_[index] = error;
+            if (NULL == doc.get()) {
+                stopped_ = true;
+            }
+            ++done_;
+            condition_.notify_all();
+        }
+    }
+
+    bool wait(const boost::xtime &end_time) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (done_ != next_ || (!stopped_ && next_ != ctxs_.size())) {
+            if (!condition_.timed_wait(lock, end_time)) {
+                stopped_ = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const boost::shared_ptr<Context>& context(unsigned int index) const {
+        return ctxs_[index];
+    }
+
+    XmlDocSharedHelper doc(unsigned int index) const {
+        return docs_[index];
+    }
+
+    const std::string& error(unsigned int index) const {
+        return errors_[index];
+    }
+
+private:
+    void checkResults(Context *ctx) const {
+        for (unsigned int i = 0, size = script_->blocksNumber(); i < size; ++i) {
+            boost::shared_ptr<InvokeContext> result = ctx->result(i);
+            if (NULL != result.get() && InvokeContext::ERROR == result->resultType()) {
+                throw std::runtime_error("block " + script_->block(i)->method() + " failed");
+            }
+        }
+    }
+
+    boost::shared_ptr<Script> script_;
+    InvokeHelper helper_;
+    std::vector<boost::shared_ptr<Context> > ctxs_;
+    std::vector<XmlDocSharedHelper> docs_;
+    std::vector<std::string> errors_;
+
+    boost::mutex mutex_;
+    boost::condition condition_;
+    unsigned int next_;
+    unsigned int done_;
+    bool stopped_;
+};
+
+static void
+runIterations(boost::shared_ptr<WhileIterations> iterations, boost::shared_ptr<Context> ctx) {
+    // same thread setup as for threaded blocks
+    XmlUtils::registerReporters();
+    VirtualHostData::instance()->set(ctx->rootContext()->request());
+    Context::resetTimer();
+    iterations->run();
+}
+
+static void
+skipIterations() {
+}
+
+static InvokeError
+timeoutError(Context *ctx) {
+    InvokeError error("block is timed out");
+    error.add("timeout", boost::lexical_cast<std::string>(ctx->timer().timeout()));
+    return error;
+}
+
+static void
+appendResult(xmlNodePtr root, XmlDocSharedHelper doc) {
+    xmlNodePtr next = xmlDocGetRootElement(doc.get())->children;
+    while (next) {
+        xmlNodePtr node = next;
+        next = next->next;
+        xmlAddChild(root, XmlUtils::moveNode(node, root->doc));
+    }
+}
+
+static unsigned int
+parseIterations(const char *name, const char *value) {
+    unsigned int number = 0;
+    try {
+        number = boost::lexical_cast<unsigned int>(value);
+    }
+    catch(const boost::bad_lexical_cast &) {
+        throw std::runtime_error(std::string("cannot parse ") + name + " value: " + value);
+    }
+    if (0 == number || number > MAX_PARALLEL_ITERATIONS) {
+        throw std::runtime_error(std::string("bad ") + name + " value: " + value);
+    }
+    return number;
+}
+
 WhileBlock::WhileBlock(const Extension *ext, Xml *owner, xmlNodePtr node) :
-    Block(ext, owner, node), LocalBlock(ext, owner, node)
+    Block(ext, owner, node), LocalBlock(ext, owner, node), parallel_(0), count_(0)
 {
     proxy_flags(Context::PROXY_ALL);
 }
@@ -58,7 +217,21 @@ WhileBlock::~WhileBlock() {
 
 void
 WhileBlock::property(const char *name, const char *value) {
-    LocalBlock::propertyInternal(name, value);
+    if (strncasecmp(name, "parallel", sizeof("parallel")) == 0) {
+        parallel_ = parseIterations(name, value);
+    }
+    else if (strncasecmp(name, "count", sizeof("count")) == 0) {
+        count_ = parseIterations(name, value);
+    }
+    else if (strncasecmp(name, "count-state", sizeof("count-state")) == 0) {
+        count_state_.assign(value);
+    }
+    else if (strncasecmp(name, "count-arg", sizeof("count-arg")) == 0) {
+        count_arg_.assign(value);
+    }
+    else {
+        LocalBlock::propertyInternal(name, value);
+    }
 }
 
 void
@@ -73,6 +246,11 @@ WhileBlock::call(boost::shared_ptr<Context> ctx,
         return;
     }
 
+    if (0 != parallel_) {
+        callParallel(ctx, invoke_ctx);
+        return;
+    }
+
     bool no_cache = false;
     boost::shared_ptr<Context> main_child_ctx;
     std::list<boost::shared_ptr<Context> > ctxs;
@@ -80,9 +258,7 @@ WhileBlock::call(boost::shared_ptr<Context> ctx,
     boost::xtime end_time = Context::delay(0);
     while (1) {
         if (remainedTime(ctx.get()) <= 0) {
-            InvokeError error("block is timed out");
-            error.add("timeout", boost::lexical_cast<std::string>(ctx->timer().timeout()));
-            throw error;
+            throw timeoutError(ctx.get());
         }
 
         main_child_ctx = Context::createChildContext(
@@ -119,12 +295,7 @@ WhileBlock::call(boost::shared_ptr<Context> ctx,
         xmlNodePtr root_tmp = xmlDocGetRootElement(doc_tmp.get());
         XmlUtils::throwUnless(NULL != root_tmp);
         if (doc.get()) {
-            xmlNodePtr next = root_tmp->children;
-            while (next) {
-                xmlAddChild(root, xmlCopyNode(next, 1));
-                ctx->addDoc(doc_tmp);
-                next = next->next;
-            }
+            appendResult(root, doc_tmp);
         }
         else {
             doc = doc_tmp;
@@ -148,6 +319,103 @@ WhileBlock::call(boost::shared_ptr<Context> ctx,
     ctx_stopper.reset();
 }
 
+void
+WhileBlock::callParallel(boost::shared_ptr<Context> ctx,
+    boost::shared_ptr<InvokeContext> invoke_ctx) const {
+
+    if (remainedTime(ctx.get()) <= 0) {
+        throw timeoutError(ctx.get());
+    }
+
+    unsigned int count = iterationCount(ctx.get());
+    boost::shared_ptr<WhileIterations> iterations(new WhileIterations(script(), ctx, count));
+    ContextListStopper ctx_list_stopper;
+    for (unsigned int i = 0; i < count; ++i) {
+        // Iterations are independent: request is shared, state and
+        // response are own for every iteration. Headers, cookies and
+        // redirects set inside an iteration are discarded with its response
+        boost::shared_ptr<TypedMap> local_params(new TypedMap(*ctx->localParamsMap()));
+        local_params->setULong(ITERATION_INDEX_PARAM, i);
+        boost::shared_ptr<Context> local_ctx = Context::createChildContext(
+            script(), ctx, invoke_ctx, local_params, Context::PROXY_REQUEST);
+        iterations->add(i, local_ctx);
+        ctx_list_stopper.add(local_ctx);
+    }
+
+    // Current thread is one of the lanes, so iterations complete even
+    // if thread pool is exhausted
+    for (unsigned int i = 1, lanes = std::min(parallel_, count); i < lanes; ++i) {
+        ThreadPool::instance()->invokeEx(boost::bind(&runIterations, iterations, ctx), &skipIterations);
+    }
+    iterations->run();
+
+    if (!iterations->wait(Context::delay(std::max(remainedTime(ctx.get()), 0)))) {
+        throw timeoutError(ctx.get());
+    }
+
+    bool no_cache = false;
+    boost::shared_ptr<Context> main_child_ctx = iterations->context(0);
+    XmlDocSharedHelper doc;
+    xmlNodePtr root = NULL;
+    for (unsigned int i = 0; i < count; ++i) {
+        XmlDocSharedHelper doc_tmp = iterations->doc(i);
+        if (NULL == doc_tmp.get()) {
+            InvokeError error(iterations->error(i).empty() ? "iteration failed" : iterations->error(i));
+            error.add("iteration", boost::lexical_cast<std::string>(i));
+            throw error;
+        }
+
+        if (doc.get()) {
+            appendResult(root, doc_tmp);
+        }
+        else {
+            doc = doc_tmp;
+            root = xmlDocGetRootElement(doc.get());
+        }
+
+        const boost::shared_ptr<Context> &local_ctx = iterations->context(i);
+        if (local_ctx->noCache()) {
+            no_cache = true;
+        }
+        if (main_child_ctx.get() != local_ctx.get() && !local_ctx->expireDeltaUndefined()) {
+            main_child_ctx->setExpireDelta(local_ctx->expireDelta());
+        }
+    }
+
+    if (no_cache) {
+        invoke_ctx->resultType(InvokeContext::NO_CACHE);
+    }
+
+    invoke_ctx->resultDoc(doc);
+}
+
+unsigned int
+WhileBlock::iterationCount(Context *ctx) const {
+    std::string value;
+    if (!count_state_.empty()) {
+        value = ctx->state()->asString(count_state_, "");
+    }
+    else if (!count_arg_.empty()) {
+        value = ctx->request()->getArg(count_arg_);
+    }
+    else {
+        return count_;
+    }
+
+    unsigned int count = 0;
+    try {
+        count = boost::lexical_cast<unsigned int>(value);
+    }
+    catch(const boost::bad_lexical_cast &) {
+    }
+    if (0 == count || count > MAX_PARALLEL_ITERATIONS) {
+        InvokeError error("bad iteration count");
+        error.addEscaped("count", value);
+        throw error;
+    }
+    return count;
+}
+
 void
 WhileBlock::postParse() {
     postParseInternal();
@@ -155,7 +423,12 @@ WhileBlock::postParse() {
         throw std::runtime_error("params is not allowed in while block");
     }
 
-    if (!hasStateGuard()) {
+    if (0 != parallel_) {
+        if (0 == count_ && count_state_.empty() && count_arg_.empty()) {
+            throw std::runtime_error("count should be specified in parallel while block");
+        }
+    }
+    else if (!hasStateGuard()) {
         throw std::runtime_error("state guard should be specified in while block");
     }
 
@@ -1,6 +1,8 @@
 #ifndef _XSCRIPT_WHILE_BLOCK_H_
 #define _XSCRIPT_WHILE_BLOCK_H_
 
+#include <string>
+
 #include "local_block.h"
 
 namespace xscript {
@@ -22,6 +24,19 @@ private:
     virtual void property(const char *name, const char *value);
     virtual void call(boost::shared_ptr<Context> ctx,
         boost::shared_ptr<InvokeContext> invoke_ctx) const throw (std::exception);
+
+    void callParallel(boost::shared_ptr<Context> ctx,
+        boost::shared_ptr<InvokeContext> invoke_ctx) const;
+    unsigned int iterationCount(Context *ctx) const;
+
+private:
+    // Iterations run at once, zero for sequential loop checking state guard
+    unsigned int parallel_;
+
+    // Iteration count known up front: literal, state variable or query arg
+    unsigned int count_;
+    std::string count_state_;
+    std::string count_arg_;
 };
 
 } // namespace xscript
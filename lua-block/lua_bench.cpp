@@ -0,0 +1,143 @@
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <libxml/parser.h>
+
+#include <lua.hpp>
+
+#include "xscript/profiler.h"
+#include "xscript/xml_helpers.h"
+#include "xscript/xml_util.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+/**
+ * Compares compiling lua block code on every call with loading bytecode
+ * dumped once at parse time. Execution itself is the same for both paths
+ * and is not measured.
+ * Usage: lua-bench [iterations] [xml file ...]
+ */
+
+using namespace xscript;
+
+extern "C" int
+luaBenchWriter(lua_State *lua, const void *data, size_t size, void *buffer) {
+    (void)lua;
+    static_cast<std::string*>(buffer)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+namespace {
+
+void
+collectCode(xmlNodePtr node, std::vector<std::string> &codes) {
+    for (; NULL != node; node = node->next) {
+        if (XML_ELEMENT_NODE != node->type) {
+            continue;
+        }
+        if (NULL != node->ns && 0 == strcmp((const char*)node->ns->href, XmlUtils::XSCRIPT_NAMESPACE) &&
+            0 == strcmp((const char*)node->name, "lua")) {
+            std::string code;
+            if (XmlUtils::loadScriptCode(node, code)) {
+                codes.push_back(code);
+            }
+            continue;
+        }
+        collectCode(node->children, codes);
+    }
+}
+
+void
+loadSource(lua_State *lua, const std::vector<std::string> *codes, unsigned int iterations) {
+    for (unsigned int i = 0; i < iterations; ++i) {
+        for (std::vector<std::string>::const_iterator it = codes->begin(); it != codes->end(); ++it) {
+            if (0 != luaL_loadstring(lua, it->c_str())) {
+                throw std::runtime_error(lua_tostring(lua, -1));
+            }
+            lua_pop(lua, 1);
+        }
+    }
+}
+
+void
+loadBytecode(lua_State *lua, const std::vector<std::string> *codes,
+    const std::vector<std::string> *bytecodes, unsigned int iterations) {
+    for (unsigned int i = 0; i < iterations; ++i) {
+        for (unsigned int n = 0; n < bytecodes->size(); ++n) {
+            const std::string &bytecode = (*bytecodes)[n];
+            if (0 != luaL_loadbuffer(lua, bytecode.data(), bytecode.size(), (*codes)[n].c_str())) {
+                throw std::runtime_error(lua_tostring(lua, -1));
+            }
+            lua_pop(lua, 1);
+        }
+    }
+}
+
+void
+bench(const char *file, unsigned int iterations) {
+    XmlDocHelper doc(xmlReadFile(file, NULL, XML_PARSE_NOENT));
+    XmlUtils::throwUnless(NULL != doc.get());
+
+    std::vector<std::string> codes, bytecodes;
+    collectCode(xmlDocGetRootElement(doc.get()), codes);
+    if (codes.empty()) {
+        return;
+    }
+
+    lua_State *lua = luaL_newstate();
+    luaL_openlibs(lua);
+
+    std::size_t source_size = 0, bytecode_size = 0;
+    for (std::vector<std::string>::const_iterator it = codes.begin(); it != codes.end(); ++it) {
+        if (0 != luaL_loadstring(lua, it->c_str())) {
+            fprintf(stderr, "%s: %s\n", file, lua_tostring(lua, -1));
+            lua_close(lua);
+            return;
+        }
+        std::string bytecode;
+        lua_dump(lua, &luaBenchWriter, &bytecode);
+        lua_pop(lua, 1);
+        source_size += it->size();
+        bytecode_size += bytecode.size();
+        bytecodes.push_back(bytecode);
+    }
+
+    double source = static_cast<double>(profile(boost::bind(&loadSource, lua, &codes, iterations))) / iterations;
+    double bytecode = static_cast<double>(profile(boost::bind(&loadBytecode, lua, &codes, &bytecodes, iterations))) / iterations;
+    lua_close(lua);
+
+    printf("%-32s %6llu %10llu %10llu %10.2f %10.2f\n", file, static_cast<unsigned long long>(codes.size()),
+        static_cast<unsigned long long>(source_size), static_cast<unsigned long long>(bytecode_size),
+        source, bytecode);
+}
+
+} // namespace
+
+int
+main(int argc, char *argv[]) {
+    try {
+        unsigned int iterations = argc > 1 ? boost::lexical_cast<unsigned int>(argv[1]) : 1000;
+
+        printf("%-32s %6s %10s %10s %10s %10s\n", "script", "blocks", "src size", "bc size",
+            "src load", "bc load");
+        for (int i = 2; i < argc; ++i) {
+            bench(argv[i], iterations);
+        }
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -2,10 +2,12 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <new>
 #include <memory>
 #include <stdexcept>
 #include <boost/current_function.hpp>
+#include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/bind.hpp>
 
@@ -13,10 +15,14 @@
 #include "xscript/util.h"
 #include "xscript/resource_holder.h"
 #include "xscript/logger.h"
+#include "xscript/config.h"
 #include "xscript/context.h"
 #include "xscript/message_interface.h"
 #include "xscript/operation_mode.h"
 #include "xscript/profiler.h"
+#include "xscript/simple_counter.h"
+#include "xscript/stat_builder.h"
+#include "xscript/status_info.h"
 #include "xscript/xml.h"
 
 #include "lua_block.h"
@@ -45,13 +51,54 @@ struct LuaState {
     std::string buffer;
     LuaStackTrace trace;
     LuaHolder state;
+    int globals;
+    int libraries;
 
-    LuaState(lua_State *l) : state(l) {
+    LuaState(lua_State *l) : state(l), globals(LUA_NOREF), libraries(LUA_NOREF) {
     }
 };
 
 typedef boost::shared_ptr<LuaState> LuaSharedContext;
 
+/**
+ * Lua states with all xscript libraries registered, shared by requests.
+ * Every checkout gets empty globals table falling back to library globals,
+ * so globals set by one request are not visible to the next one. Library
+ * tables changed by a request are restored when the state is released.
+ */
+class LuaStatePool {
+public:
+    explicit LuaStatePool(const LuaExtension *extension);
+    ~LuaStatePool();
+
+    void init(unsigned int pool_size, unsigned int max_states);
+
+    /**
+     * Checks out a state. If max-states are in use, waits for one to be
+     * returned or, unless wait is set, returns empty pointer.
+     */
+    LuaSharedContext acquire(bool wait);
+
+private:
+    LuaStatePool(const LuaStatePool &);
+    LuaStatePool& operator = (const LuaStatePool &);
+
+    LuaState* create() const;
+    void release(LuaState *lua_context);
+
+private:
+    const LuaExtension *extension_;
+    unsigned int pool_size_;
+    unsigned int max_states_;
+    unsigned int states_;
+    std::vector<LuaState*> idle_;
+    boost::mutex mutex_;
+    boost::condition condition_;
+
+    std::auto_ptr<SimpleCounter> createdCounter_;
+    std::auto_ptr<SimpleCounter> reusedCounter_;
+};
+
 class LuaThread {
 public:
     LuaThread(lua_State *parent, Context::MutexPtr mutex) :
@@ -90,7 +137,7 @@ private:
 typedef boost::shared_ptr<LuaThread> LuaSharedThread;
 
 LuaBlock::LuaBlock(const LuaExtension *ext, Xml *owner, xmlNodePtr node) :
-        RenamedBlock(ext, owner, node), ext_(ext) {
+        RenamedBlock(ext, owner, node), ext_(ext), isolated_(ext->isolatedBlocks()) {
 }
 
 LuaBlock::~LuaBlock() {
@@ -101,6 +148,23 @@ LuaBlock::getBase() const {
     return Block::getBase();
 }
 
+extern "C" int
+luaBytecodeWriter(lua_State *lua, const void *data, size_t size, void *buffer) {
+    (void)lua;
+    static_cast<std::string*>(buffer)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+void
+LuaBlock::property(const char *name, const char *value) {
+    if (strncasecmp(name, "isolated", sizeof("isolated")) == 0) {
+        isolated_ = (strncasecmp(value, "yes", sizeof("yes")) == 0);
+    }
+    else {
+        RenamedBlock::property(name, value);
+    }
+}
+
 void
 LuaBlock::postParse() {
 
@@ -108,6 +172,7 @@ LuaBlock::postParse() {
         return;
     }
 
+    // compiled once here, invocations only load dumped bytecode
     LuaHolder lua(luaL_newstate());
     int res = luaL_loadstring(lua.get(), code_.c_str());
     if (LUA_ERRSYNTAX == res) {
@@ -117,6 +182,9 @@ LuaBlock::postParse() {
     if (LUA_ERRMEM == res) {
         throw std::bad_alloc();
     }
+    if (0 != lua_dump(lua.get(), &luaBytecodeWriter, &bytecode_)) {
+        throw std::runtime_error("can not dump lua code");
+    }
 }
 void
 LuaExtension::registerLib(lua_State *lua, const char *name, bool builtin,
@@ -155,6 +223,139 @@ LuaExtension::registerLib(lua_State *lua, const char *name, bool builtin,
     lua_pop(lua, 2);
 }
 
+/**
+ * Copies contents and metatable of table on top of the stack into
+ * snapshots table keyed by the table itself, then does the same for
+ * every table and userdata metatable reachable from it.
+ */
+static void
+snapshotTable(lua_State *lua, int snapshots) {
+    int table = lua_gettop(lua);
+    lua_pushvalue(lua, table);
+    lua_rawget(lua, snapshots);
+    bool seen = !lua_isnil(lua, -1);
+    lua_pop(lua, 1);
+    if (seen) {
+        return;
+    }
+
+    lua_checkstack(lua, 8);
+    lua_createtable(lua, 2, 0);
+    int entry = table + 1;
+    lua_pushvalue(lua, table);
+    lua_pushvalue(lua, entry);
+    lua_rawset(lua, snapshots);
+
+    lua_newtable(lua);
+    int contents = table + 2;
+    lua_pushnil(lua);
+    while (lua_next(lua, table)) {
+        lua_pushvalue(lua, -2);
+        lua_pushvalue(lua, -2);
+        lua_rawset(lua, contents);
+        if (lua_istable(lua, -1)) {
+            snapshotTable(lua, snapshots);
+        }
+        else if (lua_isuserdata(lua, -1) && lua_getmetatable(lua, -1)) {
+            snapshotTable(lua, snapshots);
+            lua_pop(lua, 1);
+        }
+        lua_pop(lua, 1);
+    }
+    lua_rawseti(lua, entry, 1);
+
+    if (lua_getmetatable(lua, table)) {
+        snapshotTable(lua, snapshots);
+        lua_rawseti(lua, entry, 2);
+    }
+    lua_pop(lua, 1);
+}
+
+/**
+ * Library tables of pooled states are shared by requests. Pushes table
+ * with snapshots of library globals and string metatable taken before
+ * the state is used, restoreLibraries puts them back on release.
+ */
+static void
+snapshotLibraries(lua_State *lua) {
+    lua_newtable(lua);
+    int snapshots = lua_gettop(lua);
+    lua_pushvalue(lua, LUA_GLOBALSINDEX);
+    snapshotTable(lua, snapshots);
+    lua_pop(lua, 1);
+
+    // string metatable is also stored by the empty string key to restore it if replaced
+    lua_pushliteral(lua, "");
+    lua_getmetatable(lua, -1);
+    snapshotTable(lua, snapshots);
+    lua_rawset(lua, snapshots);
+}
+
+/**
+ * Puts back contents and metatables of tables in snapshots table on top
+ * of the stack. Only changed fields are written.
+ */
+static void
+restoreLibraries(lua_State *lua) {
+    int snapshots = lua_gettop(lua);
+
+    lua_pushliteral(lua, "");
+    lua_pushvalue(lua, -1);
+    lua_rawget(lua, snapshots);
+    lua_setmetatable(lua, -2);
+    lua_pop(lua, 1);
+
+    lua_pushnil(lua);
+    while (lua_next(lua, snapshots)) {
+        int table = lua_gettop(lua) - 1;
+        int entry = table + 1;
+        if (!lua_istable(lua, table)) {
+            lua_pop(lua, 1);
+            continue;
+        }
+        lua_rawgeti(lua, entry, 1);
+        int contents = table + 2;
+
+        // fields added or changed since snapshot, clearing them during traversal is allowed
+        lua_pushnil(lua);
+        while (lua_next(lua, table)) {
+            lua_pushvalue(lua, -2);
+            lua_rawget(lua, contents);
+            if (!lua_rawequal(lua, -1, -2)) {
+                lua_pushvalue(lua, -3);
+                lua_insert(lua, -2);
+                lua_rawset(lua, table);
+            }
+            else {
+                lua_pop(lua, 1);
+            }
+            lua_pop(lua, 1);
+        }
+
+        // fields removed since snapshot
+        lua_pushnil(lua);
+        while (lua_next(lua, contents)) {
+            lua_pushvalue(lua, -2);
+            lua_rawget(lua, table);
+            bool removed = lua_isnil(lua, -1);
+            lua_pop(lua, 1);
+            if (removed) {
+                lua_pushvalue(lua, -2);
+                lua_insert(lua, -2);
+                lua_rawset(lua, table);
+            }
+            else {
+                lua_pop(lua, 1);
+            }
+        }
+        lua_pop(lua, 1);
+
+        lua_rawgeti(lua, entry, 2);
+        lua_setmetatable(lua, table);
+        lua_pop(lua, 1);
+    }
+}
+
 static void
 setupLocalData(lua_State * lua, InvokeContext *invoke_ctx, Context *ctx, const LuaBlock *block) {
     lua_getglobal(lua, "xscript");
@@ -215,18 +416,132 @@ setupDebug(lua_State *lua, LuaStackTrace *trace) {
     lua_setfield(lua, -2, "_trace");
 }
 
-static LuaSharedContext
-createLua(const LuaExtension *extension) {
-    LuaSharedContext lua_context(new LuaState(luaL_newstate()));
+LuaStatePool::LuaStatePool(const LuaExtension *extension) :
+    extension_(extension), pool_size_(0), max_states_(0), states_(0),
+    createdCounter_(SimpleCounterFactory::instance()->createCounter("lua-states-created")),
+    reusedCounter_(SimpleCounterFactory::instance()->createCounter("lua-states-reused"))
+{}
+
+LuaStatePool::~LuaStatePool() {
+    for (std::vector<LuaState*>::iterator it = idle_.begin(); it != idle_.end(); ++it) {
+        delete *it;
+    }
+}
+
+void
+LuaStatePool::init(unsigned int pool_size, unsigned int max_states) {
+    // statistic module is loaded by now, recreate counters as real ones
+    createdCounter_ = SimpleCounterFactory::instance()->createCounter("lua-states-created");
+    reusedCounter_ = SimpleCounterFactory::instance()->createCounter("lua-states-reused");
+    StatBuilder &builder = StatusInfo::instance()->getStatBuilder();
+    builder.addCounter(createdCounter_.get());
+    builder.addCounter(reusedCounter_.get());
+
+    pool_size_ = pool_size;
+    max_states_ = 0 == max_states ? 0 : std::max(max_states, pool_size);
+    for (unsigned int i = 0; i < pool_size_; ++i) {
+        idle_.push_back(create());
+        ++states_;
+    }
+}
+
+LuaState*
+LuaStatePool::create() const {
+    std::auto_ptr<LuaState> lua_context(new LuaState(luaL_newstate()));
     lua_State *lua = lua_context->state.get();
+    if (NULL == lua) {
+        throw std::bad_alloc();
+    }
     luaL_openlibs(lua);
     setupXScript(lua, &(lua_context->buffer));
-    extension->registerExtensions(lua);
-    if (!OperationMode::instance()->isProduction()) {
+    extension_->registerExtensions(lua);
+    bool debug = !OperationMode::instance()->isProduction();
+    if (debug) {
         setupDebug(lua, &(lua_context->trace));
+    }
+    lua_settop(lua, 0);
+    snapshotLibraries(lua);
+    lua_context->libraries = luaL_ref(lua, LUA_REGISTRYINDEX);
+    lua_pushvalue(lua, LUA_GLOBALSINDEX);
+    lua_context->globals = luaL_ref(lua, LUA_REGISTRYINDEX);
+    if (debug) {
         lua_sethook(lua, &luaHook, LUA_MASKCALL | LUA_MASKRET, 0);
     }
-    return lua_context;
+    createdCounter_->inc();
+    return lua_context.release();
+}
+
+LuaSharedContext
+LuaStatePool::acquire(bool wait) {
+    LuaState *lua_context = NULL;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    while (idle_.empty() && 0 != max_states_ && states_ >= max_states_) {
+        if (!wait) {
+            return LuaSharedContext();
+        }
+        condition_.wait(lock);
+    }
+    if (!idle_.empty()) {
+        lua_context = idle_.back();
+        idle_.pop_back();
+        reusedCounter_->inc();
+    }
+    else {
+        ++states_;
+    }
+    lock.unlock();
+
+    if (NULL == lua_context) {
+        try {
+            lua_context = create();
+        }
+        catch (...) {
+            lock.lock();
+            --states_;
+            condition_.notify_one();
+            throw;
+        }
+    }
+
+    // fresh globals: new names go to this table, others are looked up in library globals
+    lua_State *lua = lua_context->state.get();
+    lua_newtable(lua);
+    lua_newtable(lua);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_context->globals);
+    lua_setfield(lua, -2, "__index");
+    lua_setmetatable(lua, -2);
+    lua_pushvalue(lua, -1);
+    lua_setfield(lua, -2, "_G");
+    lua_replace(lua, LUA_GLOBALSINDEX);
+
+    return LuaSharedContext(lua_context, boost::bind(&LuaStatePool::release, this, _1));
+}
+
+void
+LuaStatePool::release(LuaState *lua_context) {
+    lua_State *lua = lua_context->state.get();
+    lua_settop(lua, 0);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_context->globals);
+    lua_replace(lua, LUA_GLOBALSINDEX);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_context->libraries);
+    restoreLibraries(lua);
+    lua_settop(lua, 0);
+    lua_context->buffer.clear();
+    lua_context->trace.clear();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (idle_.size() < pool_size_) {
+        idle_.push_back(lua_context);
+        lua_context = NULL;
+    }
+    else {
+        --states_;
+    }
+    condition_.notify_one();
+    lock.unlock();
+
+    delete lua_context;
 }
 
 static LuaSharedThread
@@ -279,22 +594,38 @@ LuaBlock::call(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext>
         return;
     }   
     
-    Context *root_ctx = ctx->rootContext();
-    Context *orig_ctx = ctx->originalStateContext();
-    
-    Context::MutexPtr mutex = root_ctx->param<Context::MutexPtr>(LUA_CONTEXT_MUTEX);
-    boost::function<LuaSharedContext ()> lua_creator = boost::bind(&createLua, ext_);
-    
-    boost::mutex::scoped_lock lock(*mutex);
-    
-    LuaSharedContext lua_context = root_ctx->param(XSCRIPT_LUA, lua_creator);    
-    lua_State *lua = lua_context->state.get();
+    LuaSharedContext lua_context;
     LuaSharedThread lua_thread;
-    
-    if (orig_ctx != root_ctx) {
-        boost::function<LuaSharedThread ()> creator = boost::bind(&createLuaThread, lua, mutex);
-        lua_thread = orig_ctx->param(XSCRIPT_THREAD, creator);
-        lua = lua_thread->get();
+    std::auto_ptr<boost::mutex::scoped_lock> lock;
+
+    // isolated block runs on own state without page lock, but falls back
+    // to shared state of the page if no more states may be created
+    if (isolated_) {
+        lua_context = ext_->statePool()->acquire(false);
+    }
+
+    lua_State *lua = NULL;
+    if (NULL != lua_context.get()) {
+        lua = lua_context->state.get();
+    }
+    else {
+        Context *root_ctx = ctx->rootContext();
+        Context *orig_ctx = ctx->originalStateContext();
+
+        Context::MutexPtr mutex = root_ctx->param<Context::MutexPtr>(LUA_CONTEXT_MUTEX);
+        boost::function<LuaSharedContext ()> lua_creator =
+            boost::bind(&LuaStatePool::acquire, ext_->statePool(), true);
+
+        lock.reset(new boost::mutex::scoped_lock(*mutex));
+
+        lua_context = root_ctx->param(XSCRIPT_LUA, lua_creator);
+        lua = lua_context->state.get();
+
+        if (orig_ctx != root_ctx) {
+            boost::function<LuaSharedThread ()> creator = boost::bind(&createLuaThread, lua, mutex);
+            lua_thread = orig_ctx->param(XSCRIPT_THREAD, creator);
+            lua = lua_thread->get();
+        }
     }
     
     lua_context->buffer.clear();
@@ -302,11 +633,13 @@ LuaBlock::call(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext>
     
     setupLocalData(lua, invoke_ctx.get(), ctx.get(), this);
     
-    if (LUA_ERRMEM == luaL_loadstring(lua, code_.c_str())) {
+    int res = luaL_loadbuffer(lua, bytecode_.data(), bytecode_.size(), code_.c_str());
+    if (LUA_ERRMEM == res) {
         throw std::bad_alloc();
     }
-
-    int res = lua_pcall(lua, 0, LUA_MULTRET, 0);    
+    if (0 == res) {
+        res = lua_pcall(lua, 0, LUA_MULTRET, 0);
+    }
     if (res != 0) {
         processLuaError(lua);
         return;
@@ -322,7 +655,7 @@ LuaBlock::call(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext>
 
     std::string lua_content_str;
     lua_context->buffer.swap(lua_content_str);
-    lock.unlock();
+    lock.reset();
 
     XmlNodeHelper lua_content_node;
     if (!lua_content_str.empty()) {
@@ -359,7 +692,7 @@ LuaBlock::call(boost::shared_ptr<Context> ctx, boost::shared_ptr<InvokeContext>
     invoke_ctx->resultDoc(ret_doc);
 }
 
-LuaExtension::LuaExtension() {
+LuaExtension::LuaExtension() : isolated_blocks_(false), pool_(new LuaStatePool(this)) {
 }
 
 LuaExtension::~LuaExtension() {
@@ -400,13 +733,16 @@ LuaExtension::createBlock(Xml *owner, xmlNodePtr node) {
 
 void
 LuaExtension::init(const Config *config) {
-    (void)config;
     MessageParam<std::vector<LuaRegisterFunc> > param(&funcs_);
     MessageParamBase* param_list[1];
     param_list[0] = &param;
     MessageParams params(1, param_list);
     MessageResultBase result;
     MessageProcessor::instance()->process("REGISTER_LUA_EXTENSION", params, result);
+
+    isolated_blocks_ = config->as<std::string>("/xscript/lua/isolated-blocks", "no") == "yes";
+    pool_->init(config->as<unsigned int>("/xscript/lua/pool-size", 8),
+        config->as<unsigned int>("/xscript/lua/max-states", 0));
 }
 
 void
@@ -418,6 +754,16 @@ LuaExtension::registerExtensions(lua_State *lua) const {
     }
 }
 
+LuaStatePool*
+LuaExtension::statePool() const {
+    return pool_.get();
+}
+
+bool
+LuaExtension::isolatedBlocks() const {
+    return isolated_blocks_;
+}
+
 static ExtensionRegisterer reg_(ExtensionHolder(new LuaExtension()));
 
 } // namespace xscript
@@ -1,6 +1,9 @@
 #ifndef _XSCRIPT_LUA_BLOCK_H_
 #define _XSCRIPT_LUA_BLOCK_H_
 
+#include <memory>
+#include <vector>
+
 #include <boost/function.hpp>
 
 #include <lua.hpp>
@@ -11,6 +14,7 @@
 namespace xscript {
 
 class LuaExtension;
+class LuaStatePool;
 class State;
 class Request;
 class Response;
@@ -23,6 +27,7 @@ public:
     const std::string& getBase() const;
 
 private:
+    virtual void property(const char *name, const char *value);
     virtual void postParse();
 
     void reportError(const char *message, lua_State *lua);
@@ -34,6 +39,8 @@ private:
 private:
     const LuaExtension *ext_;
     std::string code_;
+    std::string bytecode_;
+    bool isolated_;
 };
 
 class LuaExtension : public Extension {
@@ -56,6 +63,14 @@ public:
 
     void registerExtensions(lua_State *lua) const;
 
+    LuaStatePool* statePool() const;
+
+    /**
+     * Whether lua blocks run on own pooled states instead of one state
+     * shared by the page, unless overridden by isolated attribute.
+     */
+    bool isolatedBlocks() const;
+
     typedef boost::function<void (lua_State*)> LuaRegisterFunc;
 private:
     LuaExtension(const LuaExtension &);
@@ -63,6 +78,8 @@ private:
 
 private:
     std::vector<LuaRegisterFunc> funcs_;
+    bool isolated_blocks_;
+    std::auto_ptr<LuaStatePool> pool_;
 };
 
 } // namespace xscript
@@ -46,6 +46,13 @@ public:
     void testLogger();
     void testMeta();
     void testLocal();
+    void testPool();
+    void testIsolated();
+    void testWhileParallel();
+    void testWhileCount();
+    void testWhileBadCount();
+    void testWhileBadLiteralCount();
+    void testWhileError();
 
 private:
     CPPUNIT_TEST_SUITE(LuaTest);
@@ -77,6 +84,13 @@ private:
     CPPUNIT_TEST(testLogger);
     CPPUNIT_TEST(testMeta);
     CPPUNIT_TEST(testLocal);
+    CPPUNIT_TEST(testPool);
+    CPPUNIT_TEST(testIsolated);
+    CPPUNIT_TEST(testWhileParallel);
+    CPPUNIT_TEST(testWhileCount);
+    CPPUNIT_TEST(testWhileBadCount);
+    CPPUNIT_TEST_EXCEPTION(testWhileBadLiteralCount, ParseError);
+    CPPUNIT_TEST(testWhileError);
 
     CPPUNIT_TEST_SUITE_END();
 };
@@ -466,3 +480,130 @@ LuaTest::testLocal() {
     CPPUNIT_ASSERT_EQUAL(54001, ctx->state()->asLong("test5")); // proxy=no a+=50000
     CPPUNIT_ASSERT_EQUAL(4001, ctx->state()->asLong("test6"));  // print a
 }
+
+void
+LuaTest::testPool() {
+
+    using namespace xscript;
+
+    for (int i = 0; i < 2; ++i) {
+        boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-pool.xml");
+        ContextStopper ctx_stopper(ctx);
+
+        XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+        CPPUNIT_ASSERT(NULL != doc.get());
+
+        CPPUNIT_ASSERT_EQUAL(std::string("yes"), ctx->state()->asString("pooled"));
+        CPPUNIT_ASSERT_EQUAL(std::string("yes"), ctx->state()->asString("restored"));
+        CPPUNIT_ASSERT(!ctx->state()->has("leaked"));
+        CPPUNIT_ASSERT(!ctx->state()->has("changed"));
+    }
+}
+
+void
+LuaTest::testIsolated() {
+
+    using namespace xscript;
+
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-isolated.xml");
+    ContextStopper ctx_stopper(ctx);
+
+    XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+    CPPUNIT_ASSERT(NULL != doc.get());
+
+    CPPUNIT_ASSERT_EQUAL(std::string("yes"), ctx->state()->asString("second"));
+    CPPUNIT_ASSERT(!ctx->state()->has("leaked"));
+}
+
+void
+LuaTest::testWhileParallel() {
+
+    using namespace xscript;
+
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-while-parallel.xml");
+    ContextStopper ctx_stopper(ctx);
+
+    XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+    CPPUNIT_ASSERT(NULL != doc.get());
+
+    CPPUNIT_ASSERT(!XmlUtils::xpathExists(doc.get(), "/page/root/lua[6]"));
+    for (int i = 0; i < 5; ++i) {
+        std::string num = boost::lexical_cast<std::string>(i);
+        CPPUNIT_ASSERT_EQUAL(num,
+            XmlUtils::xpathValue(doc.get(), "/page/root/lua[" + boost::lexical_cast<std::string>(i + 1) + "]/i", ""));
+    }
+
+    // iterations have own state
+    CPPUNIT_ASSERT(!ctx->state()->has("index"));
+}
+
+void
+LuaTest::testWhileCount() {
+
+    using namespace xscript;
+
+    char *env[] = {
+        (char*)"QUERY_STRING=pages=3",
+        (char*)NULL
+    };
+
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-while-count.xml", env);
+    ContextStopper ctx_stopper(ctx);
+
+    XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+    CPPUNIT_ASSERT(NULL != doc.get());
+
+    CPPUNIT_ASSERT_EQUAL(std::string("3"), XmlUtils::xpathValue(doc.get(), "/page/state/lua[4]/i", ""));
+    CPPUNIT_ASSERT(!XmlUtils::xpathExists(doc.get(), "/page/state/lua[5]"));
+    CPPUNIT_ASSERT_EQUAL(std::string("2"), XmlUtils::xpathValue(doc.get(), "/page/arg/lua[3]/i", ""));
+    CPPUNIT_ASSERT(!XmlUtils::xpathExists(doc.get(), "/page/arg/lua[4]"));
+}
+
+void
+LuaTest::testWhileBadCount() {
+
+    using namespace xscript;
+
+    const char *counts[] = { "abc", "0", "1001" };
+    for (unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        std::string query = std::string("QUERY_STRING=pages=") + counts[i];
+        char *env[] = {
+            (char*)query.c_str(),
+            (char*)NULL
+        };
+
+        boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-while-count.xml", env);
+        ContextStopper ctx_stopper(ctx);
+
+        XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+        CPPUNIT_ASSERT(NULL != doc.get());
+
+        // count-state block is not affected
+        CPPUNIT_ASSERT(XmlUtils::xpathExists(doc.get(), "/page/state/lua[4]/i"));
+        CPPUNIT_ASSERT(!XmlUtils::xpathExists(doc.get(), "/page/arg"));
+        CPPUNIT_ASSERT_EQUAL(std::string(counts[i]),
+            XmlUtils::xpathValue(doc.get(), "/page/xscript_invoke_failed/@count", ""));
+    }
+}
+
+void
+LuaTest::testWhileBadLiteralCount() {
+
+    TestUtils::createEnv("lua-while-badcount.xml");
+}
+
+void
+LuaTest::testWhileError() {
+
+    using namespace xscript;
+
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("lua-while-error.xml");
+    ContextStopper ctx_stopper(ctx);
+
+    XmlDocSharedHelper doc = ctx->script()->invoke(ctx);
+    CPPUNIT_ASSERT(NULL != doc.get());
+
+    CPPUNIT_ASSERT(!XmlUtils::xpathExists(doc.get(), "/page/root"));
+    CPPUNIT_ASSERT_EQUAL(std::string("2"),
+        XmlUtils::xpathValue(doc.get(), "/page/xscript_invoke_failed/@iteration", ""));
+}
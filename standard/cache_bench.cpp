@@ -0,0 +1,101 @@
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include "xscript/cache_counter.h"
+#include "xscript/profiler.h"
+
+#include "internal/clock_cache.h"
+#include "internal/lrucache.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+/**
+ * Compares LRUCache with ClockCache under concurrent load.
+ * Usage: cache-bench [cache size] [keys] [operations per thread]
+ */
+
+using namespace xscript;
+
+namespace {
+
+struct BenchParams {
+    unsigned int size;
+    unsigned int keys;
+    unsigned int operations;
+    std::vector<std::string> names;
+};
+
+template<typename Cache> void
+work(Cache *cache, const BenchParams *params, unsigned int seed) {
+    Tag tag(false, 1, Tag::UNDEFINED_TIME);
+    int value = 0;
+    for (unsigned int i = 0; i < params->operations; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int random = seed >> 8;
+        // skewed key distribution, half of requests go to 1/16 of keys
+        unsigned int key = (random & 1) ? (random >> 1) % (params->keys / 16 + 1) : (random >> 1) % params->keys;
+        if (0 == random % 10 || !cache->load(params->names[key], value, tag)) {
+            cache->save(params->names[key], key, tag);
+        }
+    }
+}
+
+template<typename Cache> void
+runAll(Cache *cache, const BenchParams *params, unsigned int threads) {
+    boost::thread_group group;
+    for (unsigned int i = 0; i < threads; ++i) {
+        group.create_thread(boost::bind(&work<Cache>, cache, params, i + 1));
+    }
+    group.join_all();
+}
+
+template<typename Cache> double
+bench(const BenchParams &params, unsigned int threads) {
+    std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("bench");
+    Cache cache(params.size, true, *counter);
+    runAll(&cache, &params, threads);
+    boost::uint64_t usec = profile(boost::bind(&runAll<Cache>, &cache, &params, threads));
+    return usec > 0 ? 1000000.0 * threads * params.operations / usec : 0;
+}
+
+} // namespace
+
+int
+main(int argc, char *argv[]) {
+    try {
+        BenchParams params;
+        params.size = argc > 1 ? boost::lexical_cast<unsigned int>(argv[1]) : 4096;
+        params.keys = argc > 2 ? boost::lexical_cast<unsigned int>(argv[2]) : 16384;
+        params.operations = argc > 3 ? boost::lexical_cast<unsigned int>(argv[3]) : 200000;
+
+        params.names.reserve(params.keys);
+        for (unsigned int i = 0; i < params.keys; ++i) {
+            params.names.push_back("key-" + boost::lexical_cast<std::string>(i));
+        }
+
+        typedef LRUCache<std::string, int> LRUCacheType;
+        typedef ClockCache<std::string, int> ClockCacheType;
+
+        printf("%8s %16s %16s\n", "threads", "lru ops/sec", "clock ops/sec");
+        for (unsigned int threads = 1; threads <= 64; threads *= 2) {
+            double lru = bench<LRUCacheType>(params, threads);
+            double clock = bench<ClockCacheType>(params, threads);
+            printf("%8u %16.0f %16.0f\n", threads, lru, clock);
+        }
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,206 @@
+#include "settings.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include "xscript/cache_counter.h"
+
+#include "internal/clock_cache.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+using namespace xscript;
+
+class ClockCacheTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ClockCacheTest);
+    CPPUNIT_TEST(testLoadSave);
+    CPPUNIT_TEST(testEviction);
+    CPPUNIT_TEST(testExactLru);
+    CPPUNIT_TEST(testExpiredFirst);
+    CPPUNIT_TEST(testPrefetch);
+    CPPUNIT_TEST(testMemory);
+    CPPUNIT_TEST(testConcurrent);
+    CPPUNIT_TEST_SUITE_END();
+
+    typedef ClockCache<std::string, int> CacheType;
+
+public:
+    void testLoadSave() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(1000, true, *counter);
+
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        int value = 0;
+        CPPUNIT_ASSERT(!cache.load("1", value, tag));
+
+        for (int i = 0; i < 100; ++i) {
+            cache.save(boost::lexical_cast<std::string>(i), i, tag);
+        }
+        for (int i = 0; i < 100; ++i) {
+            CPPUNIT_ASSERT(cache.load(boost::lexical_cast<std::string>(i), value, tag));
+            CPPUNIT_ASSERT_EQUAL(i, value);
+        }
+
+        cache.save("1", 1000, tag);
+        CPPUNIT_ASSERT(cache.load("1", value, tag));
+        CPPUNIT_ASSERT_EQUAL(1000, value);
+
+        cache.clear();
+        CPPUNIT_ASSERT(!cache.load("1", value, tag));
+    }
+
+    void testEviction() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(3, false, *counter);
+
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        int value = 0;
+        cache.save("1", 1, tag);
+        cache.save("2", 2, tag);
+        cache.save("3", 3, tag);
+
+        CPPUNIT_ASSERT(cache.load("1", value, tag));
+        cache.save("4", 4, tag);
+
+        CPPUNIT_ASSERT(!cache.load("2", value, tag));
+        CPPUNIT_ASSERT(cache.load("1", value, tag));
+        CPPUNIT_ASSERT(cache.load("3", value, tag));
+        CPPUNIT_ASSERT(cache.load("4", value, tag));
+    }
+
+    void testExactLru() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(20, false, *counter);
+
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        int value = 0;
+        for (int i = 0; i < 20; ++i) {
+            cache.save(boost::lexical_cast<std::string>(i), i, tag);
+        }
+
+        // odd elements become the most recently used ones
+        for (int i = 1; i < 20; i += 2) {
+            CPPUNIT_ASSERT(cache.load(boost::lexical_cast<std::string>(i), value, tag));
+        }
+        for (int i = 20; i < 30; ++i) {
+            cache.save(boost::lexical_cast<std::string>(i), i, tag);
+        }
+
+        for (int i = 0; i < 30; ++i) {
+            bool evicted = i < 20 && 0 == i % 2;
+            CPPUNIT_ASSERT_EQUAL(!evicted, cache.load(boost::lexical_cast<std::string>(i), value, tag));
+        }
+    }
+
+    void testExpiredFirst() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(2, true, *counter);
+
+        time_t now = time(NULL);
+        int value = 0;
+        Tag expired(false, 1, now - 1);
+        Tag alive(false, 1, now + 100);
+        cache.save("1", 1, alive);
+        cache.save("2", 2, expired);
+        CPPUNIT_ASSERT(cache.load("1", value, alive));
+
+        cache.save("3", 3, alive);
+        CPPUNIT_ASSERT(cache.load("1", value, alive));
+        CPPUNIT_ASSERT(cache.load("3", value, alive));
+        CPPUNIT_ASSERT(!cache.load("2", value, alive));
+    }
+
+    void testPrefetch() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(10, true, *counter);
+
+        time_t now = time(NULL);
+        Tag tag(false, 1, now + 3);
+        cache.save("1", 1, tag);
+
+        CacheType::CleanupFunc cleanFunc;
+        bool prefetch = false;
+        int value = 0;
+        Tag loaded;
+        CPPUNIT_ASSERT(cache.load("1", value, loaded, cleanFunc, prefetch));
+        CPPUNIT_ASSERT(!prefetch);
+
+        sleep(2);
+        CPPUNIT_ASSERT(cache.load("1", value, loaded, cleanFunc, prefetch));
+        CPPUNIT_ASSERT(prefetch);
+        CPPUNIT_ASSERT(cache.load("1", value, loaded, cleanFunc, prefetch));
+        CPPUNIT_ASSERT(!prefetch);
+        CPPUNIT_ASSERT(cache.load("1", value, loaded));
+    }
+
+    void testMemory() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(64, false, *counter);
+
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        CacheType::CleanupFunc cleanFunc;
+        for (int i = 0; i < 10; ++i) {
+            cache.save(boost::lexical_cast<std::string>(i), i, tag, cleanFunc, 10);
+        }
+        CPPUNIT_ASSERT_EQUAL((std::size_t)100, cache.memoryUsage());
+
+        cache.save("0", 0, tag, cleanFunc, 30);
+        CPPUNIT_ASSERT_EQUAL((std::size_t)120, cache.memoryUsage());
+
+        std::size_t freed = 0;
+        for (int i = 0; i < 10; ++i) {
+            freed += cache.shrink(cleanFunc);
+        }
+        CPPUNIT_ASSERT_EQUAL((std::size_t)120, freed);
+        CPPUNIT_ASSERT_EQUAL((std::size_t)0, cache.memoryUsage());
+        CPPUNIT_ASSERT_EQUAL((std::size_t)0, cache.shrink(cleanFunc));
+    }
+
+    void testConcurrent() {
+        std::auto_ptr<CacheCounter> counter = CacheCounterFactory::instance()->createCounter("test");
+        CacheType cache(2048, true, *counter);
+
+        boost::thread_group threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.create_thread(boost::bind(&ClockCacheTest::work, &cache, i));
+        }
+        threads.join_all();
+
+        Tag tag;
+        int value = 0;
+        for (int i = 0; i < 4; ++i) {
+            std::string key = boost::lexical_cast<std::string>(i) + "-last";
+            CPPUNIT_ASSERT(cache.load(key, value, tag));
+            CPPUNIT_ASSERT_EQUAL(i, value);
+        }
+    }
+
+private:
+    static void work(CacheType *cache, int id) {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        int value = 0;
+        for (int i = 0; i < 20000; ++i) {
+            std::string key = boost::lexical_cast<std::string>(i % 1000);
+            if (!cache->load(key, value, tag)) {
+                cache->save(key, i % 1000, tag);
+            }
+            else if (value != i % 1000) {
+                throw std::runtime_error("wrong value loaded");
+            }
+        }
+        cache->save(boost::lexical_cast<std::string>(id) + "-last", id, tag);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ClockCacheTest );
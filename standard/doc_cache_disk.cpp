@@ -4,6 +4,7 @@
 #include <fstream>
 #include <sstream>
 
+#include <boost/bind.hpp>
 #include <boost/crc.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -65,13 +66,20 @@ public:
         Tag &tag, boost::shared_ptr<CacheData> &cache_data);
     virtual bool saveDoc(const TagKey *key, CacheContext *cache_ctx,
         const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
+
+    virtual bool writeBehindSupported() const;
+    virtual boost::function<bool()> createSaveTask(const TagKey *key,
+        const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
     
 private:
     static void makeDir(const std::string &name);
     static void createDir(const std::string &name);
 
-    static bool load(const std::string &path, const std::string &key, Tag &tag,
-            boost::shared_ptr<CacheData> &cache_data);
+    static bool store(const std::string &path, const std::string &key, const Tag &tag,
+            const boost::shared_ptr<std::string> &buffer);
+
+    bool load(const std::string &path, const std::string &key, Tag &tag,
+            boost::shared_ptr<CacheData> &cache_data, bool allow_refresh, bool &prefetch) const;
     static bool save(const std::string &path, const std::string &key, const Tag &tag,
             const std::string &buffer);
 
@@ -178,6 +186,10 @@ DocCacheDisk::init(const Config *config) {
         config->as<std::string>("/xscript/tagged-cache-disk/no-cache", StringUtils::EMPTY_STRING);
 
     insert2Cache(no_cache);
+
+    docFormat(config->as<std::string>("/xscript/tagged-cache-disk/doc-format", "text"));
+    compression(config->as<std::string>("/xscript/tagged-cache-disk/compression", "none"),
+        config->as<boost::uint32_t>("/xscript/tagged-cache-disk/compression-threshold", 1024));
 }
 
 time_t
@@ -198,7 +210,6 @@ DocCacheDisk::strategy() const {
 bool
 DocCacheDisk::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     Tag &tag, boost::shared_ptr<CacheData> &cache_data) {
-    (void)cache_ctx;
 
     const TaggedKeyDisk *dkey = dynamic_cast<const TaggedKeyDisk*>(key);
     assert(NULL != dkey);
@@ -209,9 +220,11 @@ DocCacheDisk::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     const std::string &key_str = key->asString();
     try {
         //boost::mutex::scoped_lock sl(mutexes_[dkey->number()]);
-        if (!load(path, key_str, tag, cache_data)) {
+        bool prefetch = false;
+        if (!load(path, key_str, tag, cache_data, cache_ctx->allowRefresh(), prefetch)) {
             return false;
         }
+        cache_ctx->needRefresh(prefetch);
     }
     catch (const std::exception &e) {
         log()->error("error while loading doc from disk cache: %s", e.what());
@@ -225,20 +238,37 @@ bool
 DocCacheDisk::saveDoc(const TagKey *key, CacheContext *cache_ctx,
     const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
     (void)cache_ctx;
-    
+    boost::function<bool()> task = createSaveTask(key, tag, cache_data);
+    return !task.empty() && task();
+}
+
+bool
+DocCacheDisk::writeBehindSupported() const {
+    return true;
+}
+
+boost::function<bool()>
+DocCacheDisk::createSaveTask(const TagKey *key,
+    const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
+
     const TaggedKeyDisk *dkey = dynamic_cast<const TaggedKeyDisk*>(key);
     assert(NULL != dkey);
 
-    std::string buffer;
-    if (!cache_data->serialize(buffer)) {
-        return false;
+    boost::shared_ptr<std::string> buffer(new std::string());
+    if (!serialize(cache_data.get(), *buffer)) {
+        return boost::function<bool()>();
     }
 
-    const std::string &key_str = key->asString();
-
     std::string path(root_);
     path.append(dkey->filename());
 
+    return boost::bind(&DocCacheDisk::store, path, key->asString(), tag, buffer);
+}
+
+bool
+DocCacheDisk::store(const std::string &path, const std::string &key_str, const Tag &tag,
+    const boost::shared_ptr<std::string> &buffer) {
+
     try {
         createDir(path);
 
@@ -255,7 +285,7 @@ DocCacheDisk::saveDoc(const TagKey *key, CacheContext *cache_ctx,
 
         close(fd);
 
-        if (!save(buf, key_str, tag, buffer)) {
+        if (!save(buf, key_str, tag, *buffer)) {
             log()->error("can not create doc in disk cache: %s, key: %s", path.c_str(), key_str.c_str());
             return false;
         }
@@ -297,7 +327,7 @@ DocCacheDisk::createDir(const std::string &path) {
 
 bool
 DocCacheDisk::load(const std::string &path, const std::string &key, Tag &tag,
-        boost::shared_ptr<CacheData> &cache_data) {
+        boost::shared_ptr<CacheData> &cache_data, bool allow_refresh, bool &prefetch) const {
 
     std::fstream is(path.c_str(), std::ios::in | std::ios::out);
     if (!is) {
@@ -342,7 +372,11 @@ DocCacheDisk::load(const std::string &path, const std::string &key, Tag &tag,
             log()->info("need prefetch doc");
             is.seekg(0, std::ios::beg);
             is.write((const char*) &VERSION_SIGNATURE_MARKED, sizeof(boost::uint32_t));
-            return false;
+            if (!allow_refresh) {
+                return false;
+            }
+            prefetch = true;
+            is.seekg(sizeof(boost::uint32_t) + 3 * sizeof(time_t), std::ios::beg);
         }
 
         is.read((char*) &key_size, sizeof(boost::uint32_t));
@@ -372,7 +406,7 @@ DocCacheDisk::load(const std::string &path, const std::string &key, Tag &tag,
             throw std::runtime_error("bad doc end signature");
         }
         
-        if (!cache_data->parse(&doc_data[0], doclen)) {
+        if (!parse(cache_data.get(), &doc_data[0], doclen)) {
             log()->info("cannot parse doc");
             return false;
         }
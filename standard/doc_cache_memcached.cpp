@@ -1,14 +1,22 @@
+#include <algorithm>
 #include <list>
+#include <map>
+#include <set>
 
 #include <libmemcached/memcached.h>
 
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include "xscript/average_counter.h"
 #include "xscript/cache_strategy_collector.h"
+#include "xscript/context.h"
 #include "xscript/doc_cache.h"
 #include "xscript/http_utils.h"
+#include "xscript/stat_builder.h"
 #include "xscript/string_utils.h"
 #include "xscript/tag.h"
 #include "xscript/util.h"
@@ -36,6 +44,29 @@ public:
 class MemcachedPool;
 class MemcachedConnection;
 
+/**
+ * Values fetched by one multi-get for tagged blocks of a page. Lives in
+ * the page context, each loadDoc served from here saves a round-trip.
+ */
+class MemcachedPrefetch : private boost::noncopyable {
+public:
+    explicit MemcachedPrefetch(AverageCounter *counter);
+    ~MemcachedPrefetch();
+
+    void add(const std::vector<std::string> &keys, std::map<std::string, std::string> &values);
+    bool take(const std::string &key, std::string &value, bool &found);
+
+private:
+    boost::mutex mutex_;
+    std::map<std::string, std::string> values_;
+    std::set<std::string> misses_;
+    unsigned int requests_;
+    unsigned int served_;
+    AverageCounter *counter_;
+};
+
+typedef boost::shared_ptr<MemcachedPrefetch> MemcachedPrefetchPtr;
+
 /**
  * Implementation of DocCacheStrategy using memcached.
  */
@@ -61,11 +92,81 @@ public:
     virtual bool saveDoc(const TagKey *key, CacheContext *cache_ctx,
         const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
 
+    virtual bool writeBehindSupported() const;
+    virtual boost::function<bool()> createSaveTask(const TagKey *key,
+        const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
+
+    virtual void fillStatBuilder(StatBuilder *builder);
+    virtual bool prefetchSupported() const;
+    virtual void prefetchDocs(Context *ctx, const std::vector<const TagKey*> &keys);
+
+private:
+    bool parseValue(const char *value, size_t vallen, Tag &tag, boost::shared_ptr<CacheData> &cache_data);
+    MemcachedPrefetchPtr createPrefetch();
+    static MemcachedPrefetchPtr emptyPrefetch();
+    bool store(const std::string &mc_key, const boost::shared_ptr<std::string> &val, time_t expire_time);
+
 private:
     boost::uint32_t max_size_;
     std::auto_ptr<MemcachedPool> pool_;
+    bool prefetch_;
+    std::auto_ptr<AverageCounter> prefetch_counter_;
+
+    static const std::string PREFETCH_PARAM;
 };
 
+const std::string DocCacheMemcached::PREFETCH_PARAM("DocCacheMemcached.prefetch");
+
+MemcachedPrefetch::MemcachedPrefetch(AverageCounter *counter) :
+    requests_(0), served_(0), counter_(counter)
+{}
+
+MemcachedPrefetch::~MemcachedPrefetch() {
+    if (0 == requests_) {
+        return;
+    }
+    unsigned int saved = served_ > requests_ ? served_ - requests_ : 0;
+    log()->info("memcached prefetch: %u keys, %u served, %u round-trips saved",
+        (unsigned int)(values_.size() + misses_.size() + served_), served_, saved);
+    counter_->add(saved);
+}
+
+void
+MemcachedPrefetch::add(const std::vector<std::string> &keys, std::map<std::string, std::string> &values) {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++requests_;
+    for (std::vector<std::string>::const_iterator it = keys.begin(), end = keys.end(); it != end; ++it) {
+        std::map<std::string, std::string>::iterator value = values.find(*it);
+        if (values.end() == value) {
+            misses_.insert(*it);
+        }
+        else {
+            values_[*it].swap(value->second);
+        }
+    }
+}
+
+bool
+MemcachedPrefetch::take(const std::string &key, std::string &value, bool &found) {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<std::string, std::string>::iterator it = values_.find(key);
+    if (values_.end() != it) {
+        value.swap(it->second);
+        values_.erase(it);
+        found = true;
+        ++served_;
+        return true;
+    }
+    std::set<std::string>::iterator miss = misses_.find(key);
+    if (misses_.end() != miss) {
+        misses_.erase(miss);
+        found = false;
+        ++served_;
+        return true;
+    }
+    return false;
+}
+
 template<>
 inline void ResourceHolderTraits<memcached_st*>::destroy(memcached_st *value) {
     memcached_free(value);
@@ -220,13 +321,16 @@ MemcachedPool::MemcachedPoolImpl::add(memcached_st *mc) {
     condition_.notify_all();
 }
 
-DocCacheMemcached::DocCacheMemcached() : max_size_(0)
+DocCacheMemcached::DocCacheMemcached() : max_size_(0), prefetch_(false)
 {
     CacheStrategyCollector::instance()->addStrategy(this, name());
 }
 
 DocCacheMemcached::~DocCacheMemcached()
-{}
+{
+    // queued save tasks call store() of this strategy
+    removeFromCaches();
+}
 
 CachedObject::Strategy
 DocCacheMemcached::strategy() const {
@@ -255,6 +359,8 @@ DocCacheMemcached::init(const Config *config) {
     config->subKeys(std::string("/xscript/tagged-cache-memcached/server"), names);
     
     max_size_ = config->as<boost::uint32_t>("/xscript/tagged-cache-memcached/max-size", 1048497);
+    prefetch_ = config->as<std::string>("/xscript/tagged-cache-memcached/prefetch", "yes") == "yes";
+    prefetch_counter_ = AverageCounterFactory::instance()->createCounter("prefetch-saved-round-trips");
     boost::uint32_t workers = config->as<boost::uint32_t>("/xscript/tagged-cache-memcached/workers", 10);
     
     MemcachedSetup setup;
@@ -290,6 +396,10 @@ DocCacheMemcached::init(const Config *config) {
         config->as<std::string>("/xscript/tagged-cache-memcached/no-cache", StringUtils::EMPTY_STRING);
 
     insert2Cache(no_cache);
+
+    docFormat(config->as<std::string>("/xscript/tagged-cache-memcached/doc-format", "text"));
+    compression(config->as<std::string>("/xscript/tagged-cache-memcached/compression", "none"),
+        config->as<boost::uint32_t>("/xscript/tagged-cache-memcached/compression-threshold", 1024));
     
     pool_ = std::auto_ptr<MemcachedPool>(new MemcachedPool(workers, setup));
 }
@@ -315,35 +425,54 @@ bool
 DocCacheMemcached::saveDoc(const TagKey *key, CacheContext *cache_ctx,
     const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
     (void)cache_ctx;
-    log()->debug("saving doc in memcached");
+    boost::function<bool()> task = createSaveTask(key, tag, cache_data);
+    return !task.empty() && task();
+}
+
+bool
+DocCacheMemcached::writeBehindSupported() const {
+    return true;
+}
+
+boost::function<bool()>
+DocCacheMemcached::createSaveTask(const TagKey *key,
+    const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
 
     std::string buf;
-    if (!cache_data->serialize(buf)) {
-        return false;
+    if (!serialize(cache_data.get(), buf)) {
+        return boost::function<bool()>();
     }
     
-    std::string mc_key = key->asString();
-    std::string val;
+    boost::shared_ptr<std::string> val(new std::string());
 
     // Adding Tag
     boost::int32_t time = std::min(tag.last_modified, HttpDateUtils::MAX_LIVE_TIME);
-    val.append((char*)&time, sizeof(time));
+    val->append((char*)&time, sizeof(time));
     time = std::min(tag.expire_time, HttpDateUtils::MAX_LIVE_TIME);
-    val.append((char*)&time, sizeof(time));
+    val->append((char*)&time, sizeof(time));
 
-    val.append(buf);
+    val->append(buf);
     
-    boost::uint32_t size = val.length();
+    boost::uint32_t size = val->length();
     if (size > max_size_) {
         log()->info("object size %d exceeds limit %d", size, max_size_);
-        return false;
+        return boost::function<bool()>();
     }
-    
+
+    return boost::bind(&DocCacheMemcached::store, this, key->asString(), val, tag.expire_time);
+}
+
+bool
+DocCacheMemcached::store(const std::string &mc_key,
+    const boost::shared_ptr<std::string> &val, time_t expire_time) {
+
+    log()->debug("saving doc in memcached");
+
     memcached_return rv;
     {
         std::auto_ptr<MemcachedConnection> mc = pool_->get();
         rv = memcached_set(
-            mc->get(), mc_key.c_str(), mc_key.length(), val.c_str(), val.length(), tag.expire_time, 0);
+            mc->get(), mc_key.c_str(), mc_key.length(), val->c_str(), val->length(), expire_time, 0);
     }
     
     if (MEMCACHED_SUCCESS != rv) {
@@ -357,10 +486,20 @@ DocCacheMemcached::saveDoc(const TagKey *key, CacheContext *cache_ctx,
 bool
 DocCacheMemcached::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     Tag &tag, boost::shared_ptr<CacheData> &cache_data) {
-    (void)cache_ctx;
     log()->debug("loading doc in memcached");
     
     std::string mc_key = key->asString();
+
+    Context *ctx = cache_ctx->context();
+    if (prefetch_ && NULL != ctx) {
+        MemcachedPrefetchPtr prefetch = ctx->param(PREFETCH_PARAM,
+            boost::function<MemcachedPrefetchPtr()>(&DocCacheMemcached::emptyPrefetch));
+        std::string value;
+        bool found = false;
+        if (prefetch.get() && prefetch->take(mc_key, value, found)) {
+            return found && parseValue(value.data(), value.size(), tag, cache_data);
+        }
+    }
     
     size_t vallen = 0;
     uint32_t flags = 0;
@@ -379,17 +518,21 @@ DocCacheMemcached::loadDoc(const TagKey *key, CacheContext *cache_ctx,
         return false;
     }
 
+    return parseValue(val.get(), vallen, tag, cache_data);
+}
+
+bool
+DocCacheMemcached::parseValue(const char *value, size_t vallen,
+    Tag &tag, boost::shared_ptr<CacheData> &cache_data) {
+
     if (vallen <= 2*sizeof(boost::int32_t)) {
         log()->warn("incorrect data length while memcached loading");
         return false;
     }
     
-    log()->debug("Loaded! %s", val.get());
     try {
         log()->debug("Parsing");
 
-        char* value = val.get();
-
         tag.last_modified = *((boost::int32_t*)(value));
         value += sizeof(boost::int32_t);
         tag.expire_time = *((boost::int32_t*)(value));
@@ -400,7 +543,7 @@ DocCacheMemcached::loadDoc(const TagKey *key, CacheContext *cache_ctx,
             return false;
         }
         
-        return cache_data->parse(value, vallen);
+        return parse(cache_data.get(), value, vallen);
     }
     catch (const std::exception &e) {
         log()->error("error while parsing doc from memcached: %s", e.what());
@@ -408,6 +551,83 @@ DocCacheMemcached::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     }
 }
 
+void
+DocCacheMemcached::fillStatBuilder(StatBuilder *builder) {
+    DocCacheStrategy::fillStatBuilder(builder);
+    if (prefetch_) {
+        builder->addCounter(prefetch_counter_.get());
+    }
+}
+
+bool
+DocCacheMemcached::prefetchSupported() const {
+    return prefetch_;
+}
+
+MemcachedPrefetchPtr
+DocCacheMemcached::createPrefetch() {
+    return MemcachedPrefetchPtr(new MemcachedPrefetch(prefetch_counter_.get()));
+}
+
+MemcachedPrefetchPtr
+DocCacheMemcached::emptyPrefetch() {
+    return MemcachedPrefetchPtr();
+}
+
+void
+DocCacheMemcached::prefetchDocs(Context *ctx, const std::vector<const TagKey*> &tag_keys) {
+    std::vector<std::string> keys;
+    keys.reserve(tag_keys.size());
+    for (std::vector<const TagKey*>::const_iterator it = tag_keys.begin(), end = tag_keys.end(); it != end; ++it) {
+        keys.push_back((*it)->asString());
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (keys.size() < 2) {
+        return;
+    }
+
+    MemcachedPrefetchPtr prefetch = ctx->param(PREFETCH_PARAM,
+        boost::function<MemcachedPrefetchPtr()>(boost::bind(&DocCacheMemcached::createPrefetch, this)));
+    if (NULL == prefetch.get()) {
+        return;
+    }
+
+    std::vector<const char*> key_ptrs;
+    std::vector<size_t> key_sizes;
+    key_ptrs.reserve(keys.size());
+    key_sizes.reserve(keys.size());
+    for (std::vector<std::string>::const_iterator it = keys.begin(), end = keys.end(); it != end; ++it) {
+        key_ptrs.push_back(it->c_str());
+        key_sizes.push_back(it->size());
+    }
+
+    std::map<std::string, std::string> values;
+    {
+        std::auto_ptr<MemcachedConnection> mc = pool_->get();
+        memcached_return rv = memcached_mget(mc->get(), &key_ptrs[0], &key_sizes[0], keys.size());
+        if (MEMCACHED_SUCCESS != rv) {
+            log()->warn("Prefetching data from memcached failed: %d", rv);
+            return;
+        }
+
+        memcached_result_st *result = NULL;
+        while (NULL != (result = memcached_fetch_result(mc->get(), NULL, &rv))) {
+            std::string key(memcached_result_key_value(result), memcached_result_key_length(result));
+            values[key].assign(memcached_result_value(result), memcached_result_length(result));
+            memcached_result_free(result);
+        }
+        if (MEMCACHED_END != rv && MEMCACHED_SUCCESS != rv && MEMCACHED_NOTFOUND != rv) {
+            log()->warn("Prefetching data from memcached failed: %d", rv);
+            return;
+        }
+    }
+
+    log()->debug("prefetched %llu of %llu docs from memcached",
+        (unsigned long long)values.size(), (unsigned long long)keys.size());
+    prefetch->add(keys, values);
+}
+
 static ComponentRegisterer<DocCacheMemcached> reg_;
 
 };
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <limits>
 #include <list>
 #include <map>
 
@@ -61,9 +62,12 @@ public:
         Tag &tag, boost::shared_ptr<CacheData> &cache_data);
     virtual bool saveDoc(const TagKey *key, CacheContext *cache_ctx,
         const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
+    virtual bool containsDoc(const TagKey *key);
 
 private:
     DocPool* pool(const TagKey *key) const;
+    boost::uint64_t memoryUsage() const;
+    void shrink(const DocPool::CleanupFunc &cleaner);
 
     static const int DEFAULT_POOL_COUNT;
     static const int DEFAULT_POOL_SIZE;
@@ -72,6 +76,8 @@ private:
 private:
     time_t min_time_;
     unsigned int max_size_;
+    boost::uint64_t memory_limit_;
+    volatile unsigned int shrink_position_;
     std::vector<DocPool*> pools_;
 };
 
@@ -90,7 +96,7 @@ private:
 
 
 DocCacheMemory::DocCacheMemory() :
-        min_time_(Tag::UNDEFINED_TIME), max_size_(0) {
+        min_time_(Tag::UNDEFINED_TIME), max_size_(0), memory_limit_(0), shrink_position_(0) {
     CacheStrategyCollector::instance()->addStrategy(this, name());
 }
 
@@ -115,7 +121,11 @@ DocCacheMemory::init(const Config *config) {
     config->addForbiddenKey("/xscript/tagged-cache-memory/*");
     
     unsigned int pools = config->as<unsigned int>("/xscript/tagged-cache-memory/pools", DEFAULT_POOL_COUNT);
-    unsigned int pool_size = config->as<unsigned int>("/xscript/tagged-cache-memory/pool-size", DEFAULT_POOL_SIZE);
+
+    // Byte budget shared by all pools. Element count is not limited unless pool-size is set.
+    memory_limit_ = config->as<boost::uint64_t>("/xscript/tagged-cache-memory/memory-limit", 0);
+    unsigned int pool_size = config->as<unsigned int>("/xscript/tagged-cache-memory/pool-size",
+        0 == memory_limit_ ? DEFAULT_POOL_SIZE : std::numeric_limits<unsigned int>::max());
 
     max_size_ = pool_size;
     for (unsigned int i = 0; i < pools; ++i) {
@@ -173,7 +183,14 @@ DocCacheMemory::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     assert(NULL != mpool);
 
     DocCleaner cleaner(cache_ctx->context());
-    if (!mpool->loadDoc(key->asString(), tag, cache_data, cleaner)) {
+    if (cache_ctx->allowRefresh()) {
+        bool prefetch = false;
+        if (!mpool->loadDoc(key->asString(), tag, cache_data, cleaner, prefetch)) {
+            return false;
+        }
+        cache_ctx->needRefresh(prefetch);
+    }
+    else if (!mpool->loadDoc(key->asString(), tag, cache_data, cleaner)) {
         return false;
     }
 
@@ -184,6 +201,11 @@ DocCacheMemory::loadDoc(const TagKey *key, CacheContext *cache_ctx,
     return true;
 }
 
+bool
+DocCacheMemory::containsDoc(const TagKey *key) {
+    return pool(key)->containsDoc(key->asString());
+}
+
 bool
 DocCacheMemory::saveDoc(const TagKey *key, CacheContext *cache_ctx,
     const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
@@ -192,7 +214,43 @@ DocCacheMemory::saveDoc(const TagKey *key, CacheContext *cache_ctx,
     DocPool *mpool = pool(key);
     assert(NULL != mpool);
     DocCleaner cleaner(cache_ctx->context());
-    return mpool->saveDoc(key->asString(), tag, cache_data, cleaner);
+    if (0 == memory_limit_) {
+        return mpool->saveDoc(key->asString(), tag, cache_data, cleaner);
+    }
+
+    std::size_t memory = cache_data->memoryUsage();
+    if (memory > memory_limit_) {
+        log()->info("doc of %llu bytes exceeds memory cache limit, key: %s",
+            static_cast<unsigned long long>(memory), key->asString().c_str());
+        return false;
+    }
+
+    bool res = mpool->saveDoc(key->asString(), tag, cache_data, cleaner, memory);
+    shrink(cleaner);
+    return res;
+}
+
+boost::uint64_t
+DocCacheMemory::memoryUsage() const {
+    boost::uint64_t memory = 0;
+    for(std::vector<DocPool*>::const_iterator it = pools_.begin();
+        it != pools_.end();
+        ++it) {
+        memory += (*it)->memoryUsage();
+    }
+    return memory;
+}
+
+void
+DocCacheMemory::shrink(const DocPool::CleanupFunc &cleaner) {
+    // Evict pool tails round-robin until whole cache fits into the budget,
+    // stop if no pool released anything for a full round
+    unsigned int idle = 0;
+    while (idle < pools_.size() && memoryUsage() > memory_limit_) {
+        unsigned int position = __sync_fetch_and_add(&shrink_position_, 1);
+        DocPool *mpool = pools_[position % pools_.size()];
+        idle = mpool->shrink(cleaner) > 0 ? 0 : idle + 1;
+    }
 }
 
 unsigned int
@@ -0,0 +1,177 @@
+#include "settings.h"
+
+#include <memory>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "xscript/cache_strategy_collector.h"
+#include "xscript/config.h"
+#include "xscript/doc_cache.h"
+#include "xscript/doc_cache_strategy.h"
+#include "xscript/logger.h"
+#include "xscript/string_utils.h"
+#include "xscript/tag.h"
+#include "xscript/util.h"
+
+#include "segment_store.h"
+#include "tag_key_memory.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+/**
+ * Local tagged cache in memory mapped segment files. Unlike disk cache
+ * it does not create file per document and needs no external cleanup.
+ */
+class DocCacheSegment :
+            public Component<DocCacheSegment>,
+            public DocCacheStrategy {
+public:
+    DocCacheSegment();
+    virtual ~DocCacheSegment();
+
+    virtual void init(const Config *config);
+
+    virtual time_t minimalCacheTime() const;
+    virtual std::string name() const;
+
+    virtual std::auto_ptr<TagKey> createKey(const Context *ctx,
+        const InvokeContext *invoke_ctx, const CachedObject *obj) const;
+
+    virtual CachedObject::Strategy strategy() const;
+
+    virtual bool loadDoc(const TagKey *key, CacheContext *cache_ctx,
+        Tag &tag, boost::shared_ptr<CacheData> &cache_data);
+    virtual bool saveDoc(const TagKey *key, CacheContext *cache_ctx,
+        const Tag &tag, const boost::shared_ptr<CacheData> &cache_data);
+    virtual bool containsDoc(const TagKey *key);
+
+private:
+    static const time_t DEFAULT_CACHE_TIME;
+
+    time_t min_time_;
+    std::auto_ptr<SegmentStore> store_;
+};
+
+const time_t DocCacheSegment::DEFAULT_CACHE_TIME = 5; // sec
+
+DocCacheSegment::DocCacheSegment() : min_time_(DEFAULT_CACHE_TIME) {
+    CacheStrategyCollector::instance()->addStrategy(this, name());
+}
+
+DocCacheSegment::~DocCacheSegment() {
+}
+
+void
+DocCacheSegment::init(const Config *config) {
+    DocCacheStrategy::init(config);
+
+    config->addForbiddenKey("/xscript/tagged-cache-segment/*");
+
+    std::string root = config->as<std::string>("/xscript/tagged-cache-segment/root-dir");
+    min_time_ = config->as<time_t>("/xscript/tagged-cache-segment/min-cache-time", DEFAULT_CACHE_TIME);
+    if (min_time_ <= 0) {
+        min_time_ = DEFAULT_CACHE_TIME;
+    }
+
+    boost::uint32_t segment_size =
+        config->as<boost::uint32_t>("/xscript/tagged-cache-segment/segment-size", 64 * 1024 * 1024);
+    boost::uint32_t max_segments =
+        config->as<boost::uint32_t>("/xscript/tagged-cache-segment/max-segments", 16);
+
+    FileUtils::makeDir(root, 0777);
+    store_ = std::auto_ptr<SegmentStore>(new SegmentStore(root, segment_size, max_segments));
+
+    std::string no_cache =
+        config->as<std::string>("/xscript/tagged-cache-segment/no-cache", StringUtils::EMPTY_STRING);
+
+    insert2Cache(no_cache);
+
+    docFormat(config->as<std::string>("/xscript/tagged-cache-segment/doc-format", "text"));
+    compression(config->as<std::string>("/xscript/tagged-cache-segment/compression", "none"),
+        config->as<boost::uint32_t>("/xscript/tagged-cache-segment/compression-threshold", 1024));
+}
+
+time_t
+DocCacheSegment::minimalCacheTime() const {
+    return min_time_;
+}
+
+std::string
+DocCacheSegment::name() const {
+    return "segment";
+}
+
+CachedObject::Strategy
+DocCacheSegment::strategy() const {
+    return CachedObject::LOCAL;
+}
+
+std::auto_ptr<TagKey>
+DocCacheSegment::createKey(const Context *ctx, const InvokeContext *invoke_ctx, const CachedObject *obj) const {
+    return std::auto_ptr<TagKey>(new TagKeyMemory(ctx, invoke_ctx, obj));
+}
+
+bool
+DocCacheSegment::loadDoc(const TagKey *key, CacheContext *cache_ctx,
+    Tag &tag, boost::shared_ptr<CacheData> &cache_data) {
+
+    const std::string &key_str = key->asString();
+    SegmentStore::Record record;
+    if (!store_->load(key_str, record)) {
+        return false;
+    }
+
+    tag.expire_time = record.expire_time;
+    tag.last_modified = record.last_modified;
+    if (tag.expired()) {
+        return false;
+    }
+    if (!DocCacheBase::checkTag(NULL, NULL, tag, "loading doc from segment cache")) {
+        return false;
+    }
+
+    bool prefetch = false;
+    if (tag.needPrefetch(record.stored_time) && store_->markPrefetch(key_str)) {
+        log()->info("need prefetch doc");
+        if (!cache_ctx->allowRefresh()) {
+            return false;
+        }
+        prefetch = true;
+    }
+
+    if (!parse(cache_data.get(), record.data, record.size)) {
+        log()->info("cannot parse doc from segment cache");
+        store_->remove(key_str);
+        return false;
+    }
+
+    cache_ctx->needRefresh(prefetch);
+    return true;
+}
+
+// record is only located in mapping, its data is parsed by loadDoc
+bool
+DocCacheSegment::containsDoc(const TagKey *key) {
+    return store_->exists(key->asString());
+}
+
+bool
+DocCacheSegment::saveDoc(const TagKey *key, CacheContext *cache_ctx,
+    const Tag &tag, const boost::shared_ptr<CacheData> &cache_data) {
+    (void)cache_ctx;
+
+    std::string buffer;
+    if (!serialize(cache_data.get(), buffer)) {
+        return false;
+    }
+    return store_->save(key->asString(), tag, buffer.data(), buffer.size());
+}
+
+static ComponentRegisterer<DocCacheSegment> reg_;
+
+} // namespace xscript
@@ -36,6 +36,13 @@ DocPool::loadDoc(const std::string &key, Tag &tag, boost::shared_ptr<CacheData>
     return cache_->load(key, cache_data, tag, cleanFunc);
 }
 
+bool
+DocPool::loadDoc(const std::string &key, Tag &tag, boost::shared_ptr<CacheData> &cache_data,
+        const CleanupFunc &cleanFunc, bool &prefetch) {
+    log()->debug("%s, key: %s", BOOST_CURRENT_FUNCTION, key.c_str());
+    return cache_->load(key, cache_data, tag, cleanFunc, prefetch);
+}
+
 bool
 DocPool::saveDoc(const std::string &key, const Tag &tag, const boost::shared_ptr<CacheData> &cache_data,
         const CleanupFunc &cleanFunc) {
@@ -44,6 +51,30 @@ DocPool::saveDoc(const std::string &key, const Tag &tag, const boost::shared_ptr
     return true;
 }
 
+bool
+DocPool::saveDoc(const std::string &key, const Tag &tag, const boost::shared_ptr<CacheData> &cache_data,
+        const CleanupFunc &cleanFunc, std::size_t memory) {
+    log()->debug("%s, key: %s, memory: %llu", BOOST_CURRENT_FUNCTION, key.c_str(),
+        static_cast<unsigned long long>(memory));
+    cache_->save(key, cache_data, tag, cleanFunc, memory);
+    return true;
+}
+
+bool
+DocPool::containsDoc(const std::string &key) {
+    return cache_->contains(key);
+}
+
+std::size_t
+DocPool::shrink(const CleanupFunc &cleanFunc) {
+    return cache_->shrink(cleanFunc);
+}
+
+std::size_t
+DocPool::memoryUsage() const {
+    return cache_->memoryUsage();
+}
+
 void
 DocPool::clear() {
     cache_->clear();
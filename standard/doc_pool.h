@@ -6,7 +6,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 
-#include "internal/lrucache.h"
+#include "internal/clock_cache.h"
 
 namespace xscript {
 
@@ -25,15 +25,23 @@ public:
     virtual ~DocPool();
 
 private:
-    typedef LRUCache<std::string, boost::shared_ptr<CacheData> > CacheType;
+    typedef ClockCache<std::string, boost::shared_ptr<CacheData> > CacheType;
 
 public:
     typedef CacheType::CleanupFunc CleanupFunc;
 
     bool loadDoc(const std::string &key, Tag &tag, boost::shared_ptr<CacheData> &cache_data,
             const CleanupFunc &cleanFunc);
+    bool loadDoc(const std::string &key, Tag &tag, boost::shared_ptr<CacheData> &cache_data,
+            const CleanupFunc &cleanFunc, bool &prefetch);
     bool saveDoc(const std::string &key, const Tag &tag, const boost::shared_ptr<CacheData> &cache_data,
             const CleanupFunc &cleanFunc);
+    bool containsDoc(const std::string &key);
+    bool saveDoc(const std::string &key, const Tag &tag, const boost::shared_ptr<CacheData> &cache_data,
+            const CleanupFunc &cleanFunc, std::size_t memory);
+
+    std::size_t shrink(const CleanupFunc &cleanFunc);
+    std::size_t memoryUsage() const;
 
     void clear();
     const CacheCounter* getCounter() const;
@@ -23,6 +23,8 @@ class DocPoolTest : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(DocPoolTest);
     CPPUNIT_TEST(testSingleDocument);
     CPPUNIT_TEST(testManyDocuments);
+    CPPUNIT_TEST(testBackgroundPrefetch);
+    CPPUNIT_TEST(testMemoryAccounting);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -59,6 +61,80 @@ public:
 
     }
 
+    void testBackgroundPrefetch() {
+        std::auto_ptr<Config> config = Config::create("test.conf");
+        LoggerFactory::instance()->init(config.get());
+
+        DocPool pool(2, "pool");
+
+        std::string key("1");
+
+        XmlDocSharedHelper doc1(xmlNewDoc((const xmlChar*) "1.0"));
+        boost::shared_ptr<CacheData> saved(new BlockCacheData(
+            doc1, boost::shared_ptr<MetaCore>()));
+
+        time_t t = time(0);
+        Tag tag(false, t, t+6);
+
+        DocPool::CleanupFunc cleanFunc;
+        pool.saveDoc(key, tag, saved, cleanFunc);
+
+        boost::shared_ptr<CacheData> loaded(new BlockCacheData());
+        bool prefetch = true;
+
+        bool res = pool.loadDoc(key, tag, loaded, cleanFunc, prefetch);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("First load successful", true, res);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("No prefetch for fresh doc", false, prefetch);
+
+        sleep(5);
+        res = pool.loadDoc(key, tag, loaded, cleanFunc, prefetch);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("Doc served while awaiting prefetch", true, res);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("Prefetch requested", true, prefetch);
+
+        res = pool.loadDoc(key, tag, loaded, cleanFunc, prefetch);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("Doc served while refreshing", true, res);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("Prefetch requested once", false, prefetch);
+
+        sleep(2);
+        res = pool.loadDoc(key, tag, loaded, cleanFunc, prefetch);
+        CPPUNIT_ASSERT_EQUAL_MESSAGE("Expired checked", false, res);
+    }
+
+    void testMemoryAccounting() {
+        std::auto_ptr<Config> config = Config::create("test.conf");
+        LoggerFactory::instance()->init(config.get());
+
+        DocPool pool(10, "pool");
+
+        XmlDocSharedHelper doc(xmlNewDoc((const xmlChar*) "1.0"));
+        xmlDocSetRootElement(doc.get(), xmlNewDocNode(doc.get(), NULL, (const xmlChar*) "page", NULL));
+        boost::shared_ptr<CacheData> saved(new BlockCacheData(
+            doc, boost::shared_ptr<MetaCore>()));
+        CPPUNIT_ASSERT(saved->memoryUsage() > sizeof(xmlDoc) + sizeof(xmlNode));
+
+        time_t t = time(0);
+        Tag tag(false, t, t + 60);
+
+        DocPool::CleanupFunc cleanFunc;
+        pool.saveDoc("1", tag, saved, cleanFunc, 100);
+        pool.saveDoc("2", tag, saved, cleanFunc, 200);
+        CPPUNIT_ASSERT_EQUAL((size_t)300, pool.memoryUsage());
+
+        pool.saveDoc("2", tag, saved, cleanFunc, 50);
+        CPPUNIT_ASSERT_EQUAL((size_t)150, pool.memoryUsage());
+
+        CPPUNIT_ASSERT_EQUAL((size_t)100, pool.shrink(cleanFunc));
+        CPPUNIT_ASSERT_EQUAL((size_t)50, pool.memoryUsage());
+
+        boost::shared_ptr<CacheData> loaded(new BlockCacheData());
+        CPPUNIT_ASSERT(!pool.loadDoc("1", tag, loaded, cleanFunc));
+        CPPUNIT_ASSERT(pool.loadDoc("2", tag, loaded, cleanFunc));
+
+        CPPUNIT_ASSERT_EQUAL((size_t)50, pool.shrink(cleanFunc));
+        CPPUNIT_ASSERT_EQUAL((size_t)0, pool.shrink(cleanFunc));
+        CPPUNIT_ASSERT_EQUAL((size_t)0, pool.memoryUsage());
+    }
+
     void testManyDocuments() {
         std::auto_ptr<Config> config = Config::create("test.conf");
         LoggerFactory::instance()->init(config.get());
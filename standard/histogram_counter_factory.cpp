@@ -0,0 +1,25 @@
+#include "settings.h"
+
+#include "internal/histogram_counter_impl.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript
+{
+
+class HistogramCounterFactoryImpl : public HistogramCounterFactory {
+public:
+    virtual std::auto_ptr<HistogramCounter> createCounter(const std::string& name, bool want_real);
+};
+
+std::auto_ptr<HistogramCounter> 
+HistogramCounterFactoryImpl::createCounter(const std::string &name, bool want_real) {
+    (void)want_real;
+    return std::auto_ptr<HistogramCounter>(new HistogramCounterImpl(name));
+}
+
+static ComponentImplRegisterer<HistogramCounterFactory> reg_(new HistogramCounterFactoryImpl());
+}
+
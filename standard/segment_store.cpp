@@ -0,0 +1,517 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "xscript/logger.h"
+#include "xscript/string_utils.h"
+#include "xscript/tag.h"
+#include "xscript/util.h"
+
+#include "segment_store.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace xscript {
+
+namespace {
+
+const boost::uint32_t SEGMENT_SIGNATURE = 0x5e6d0a01;
+const boost::uint32_t RECORD_SIGNATURE = 0x7ec0d0a1;
+const boost::uint32_t SEGMENT_HEADER_SIZE = 2 * sizeof(boost::uint32_t);
+const char SEGMENT_PREFIX[] = "segment.";
+
+struct RecordHeader {
+    boost::uint32_t signature;
+    boost::uint32_t crc;
+    boost::uint32_t key_size;
+    boost::uint32_t data_size;
+    boost::int64_t expire_time;
+    boost::int64_t last_modified;
+    boost::int64_t stored_time;
+};
+
+inline boost::uint64_t
+recordSize(boost::uint64_t key_size, boost::uint64_t data_size) {
+    return (sizeof(RecordHeader) + key_size + data_size + 7) & ~(boost::uint64_t)7;
+}
+
+boost::uint32_t
+checksum(const RecordHeader &header, const char *key, const char *data) {
+    uLong crc = crc32(0, (const Bytef*)&header.key_size, sizeof(RecordHeader) - offsetof(RecordHeader, key_size));
+    crc = crc32(crc, (const Bytef*)key, header.key_size);
+    return crc32(crc, (const Bytef*)data, header.data_size);
+}
+
+void
+throwError(const char *message, const std::string &path) {
+    std::stringstream stream;
+    StringUtils::report(message, errno, stream);
+    stream << " " << path;
+    throw std::runtime_error(stream.str());
+}
+
+} // namespace
+
+class SegmentStore::Segment : private boost::noncopyable {
+public:
+    Segment(const std::string &path, boost::uint32_t id, boost::uint32_t size);
+    ~Segment();
+
+    boost::uint32_t id() const;
+    boost::uint32_t size() const;
+    boost::uint32_t end() const;
+    const char* data() const;
+
+    bool valid() const;
+    void end(boost::uint32_t end);
+    bool fits(boost::uint64_t size) const;
+    boost::uint32_t append(const RecordHeader &header, const char *key, const char *data);
+    boost::uint32_t append(const char *record, boost::uint32_t size);
+
+    void sync();
+    void unlink();
+
+private:
+    std::string path_;
+    boost::uint32_t id_;
+    boost::uint32_t size_;
+    boost::uint32_t end_;
+    int fd_;
+    char *data_;
+};
+
+SegmentStore::Segment::Segment(const std::string &path, boost::uint32_t id, boost::uint32_t size) :
+    path_(path), id_(id), size_(size), end_(SEGMENT_HEADER_SIZE), fd_(-1), data_(NULL)
+{
+    bool create = 0 != size;
+    fd_ = ::open(path_.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (-1 == fd_) {
+        throwError("cannot open segment: ", path_);
+    }
+
+    if (create) {
+        if (0 != posix_fallocate(fd_, 0, size_) && -1 == ftruncate(fd_, size_)) {
+            ::close(fd_);
+            throwError("cannot allocate segment: ", path_);
+        }
+    }
+    else {
+        struct stat st;
+        if (-1 == fstat(fd_, &st)) {
+            ::close(fd_);
+            throwError("cannot stat segment: ", path_);
+        }
+        if (st.st_size < (off_t)SEGMENT_HEADER_SIZE || st.st_size > (off_t)0xffffffff) {
+            ::close(fd_);
+            throw std::runtime_error("bad segment size: " + path_);
+        }
+        size_ = st.st_size;
+    }
+
+    void *addr = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (MAP_FAILED == addr) {
+        ::close(fd_);
+        throwError("cannot map segment: ", path_);
+    }
+    data_ = static_cast<char*>(addr);
+
+    if (create) {
+        memcpy(data_, &SEGMENT_SIGNATURE, sizeof(boost::uint32_t));
+        memcpy(data_ + sizeof(boost::uint32_t), &id_, sizeof(boost::uint32_t));
+    }
+}
+
+SegmentStore::Segment::~Segment() {
+    munmap(data_, size_);
+    ::close(fd_);
+}
+
+boost::uint32_t
+SegmentStore::Segment::id() const {
+    return id_;
+}
+
+boost::uint32_t
+SegmentStore::Segment::size() const {
+    return size_;
+}
+
+boost::uint32_t
+SegmentStore::Segment::end() const {
+    return end_;
+}
+
+const char*
+SegmentStore::Segment::data() const {
+    return data_;
+}
+
+bool
+SegmentStore::Segment::valid() const {
+    boost::uint32_t sig, id;
+    memcpy(&sig, data_, sizeof(boost::uint32_t));
+    memcpy(&id, data_ + sizeof(boost::uint32_t), sizeof(boost::uint32_t));
+    return SEGMENT_SIGNATURE == sig && id_ == id;
+}
+
+void
+SegmentStore::Segment::end(boost::uint32_t end) {
+    end_ = end;
+}
+
+bool
+SegmentStore::Segment::fits(boost::uint64_t size) const {
+    return end_ + size <= size_;
+}
+
+boost::uint32_t
+SegmentStore::Segment::append(const RecordHeader &header, const char *key, const char *data) {
+    boost::uint32_t offset = end_;
+    char *ptr = data_ + offset;
+    memcpy(ptr + sizeof(RecordHeader), key, header.key_size);
+    memcpy(ptr + sizeof(RecordHeader) + header.key_size, data, header.data_size);
+    memcpy(ptr, &header, sizeof(RecordHeader));
+    end_ += recordSize(header.key_size, header.data_size);
+    return offset;
+}
+
+boost::uint32_t
+SegmentStore::Segment::append(const char *record, boost::uint32_t size) {
+    boost::uint32_t offset = end_;
+    memcpy(data_ + offset, record, size);
+    end_ += size;
+    return offset;
+}
+
+void
+SegmentStore::Segment::sync() {
+    msync(data_, size_, MS_ASYNC);
+}
+
+void
+SegmentStore::Segment::unlink() {
+    if (-1 == ::unlink(path_.c_str())) {
+        log()->warn("cannot remove segment %s: %d", path_.c_str(), errno);
+    }
+}
+
+const boost::uint32_t SegmentStore::MIN_SEGMENT_SIZE = 65536;
+
+SegmentStore::Record::Record() :
+    data(NULL), size(0), expire_time(0), last_modified(0), stored_time(0)
+{}
+
+SegmentStore::SegmentStore(const std::string &dir, boost::uint32_t segment_size, boost::uint32_t max_segments) :
+    dir_(dir), segment_size_(std::max(segment_size, MIN_SEGMENT_SIZE)),
+    max_segments_(std::max(max_segments, (boost::uint32_t)2)), next_id_(0), compacting_(false)
+{
+    if (!dir_.empty() && '/' != dir_[dir_.size() - 1]) {
+        dir_.push_back('/');
+    }
+    recover();
+}
+
+SegmentStore::~SegmentStore() {
+    if (NULL != active_.get()) {
+        active_->sync();
+    }
+}
+
+void
+SegmentStore::recover() {
+    DIR *dir = opendir(dir_.c_str());
+    if (NULL == dir) {
+        throwError("cannot open segment dir: ", dir_);
+    }
+
+    std::vector<boost::uint32_t> ids;
+    const std::size_t prefix_size = sizeof(SEGMENT_PREFIX) - 1;
+    while (struct dirent *entry = readdir(dir)) {
+        if (strncmp(entry->d_name, SEGMENT_PREFIX, prefix_size) != 0) {
+            continue;
+        }
+        char *end = NULL;
+        unsigned long id = strtoul(entry->d_name + prefix_size, &end, 16);
+        if (NULL != end && '\0' == *end && end != entry->d_name + prefix_size) {
+            ids.push_back(id);
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    char name[32];
+    for (std::vector<boost::uint32_t>::iterator it = ids.begin(), end = ids.end(); it != end; ++it) {
+        snprintf(name, sizeof(name), "%s%08x", SEGMENT_PREFIX, *it);
+        std::string path = dir_ + name;
+        try {
+            boost::shared_ptr<Segment> segment(new Segment(path, *it, 0));
+            if (!segment->valid()) {
+                throw std::runtime_error("bad segment header");
+            }
+            recover(segment);
+            segments_[*it] = segment;
+            active_ = segment;
+            next_id_ = *it + 1;
+        }
+        catch (const std::exception &e) {
+            log()->warn("dropping segment %s: %s", path.c_str(), e.what());
+            ::unlink(path.c_str());
+        }
+    }
+    log()->info("segment store %s: %llu records in %llu segments", dir_.c_str(),
+        (unsigned long long)index_.size(), (unsigned long long)segments_.size());
+}
+
+void
+SegmentStore::recover(const boost::shared_ptr<Segment> &segment) {
+    const char *data = segment->data();
+    boost::uint32_t offset = SEGMENT_HEADER_SIZE;
+    while ((boost::uint64_t)offset + sizeof(RecordHeader) <= segment->size()) {
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(RecordHeader));
+        if (RECORD_SIGNATURE != header.signature) {
+            break;
+        }
+        boost::uint64_t size = recordSize(header.key_size, header.data_size);
+        if (offset + size > segment->size()) {
+            break;
+        }
+        const char *key = data + offset + sizeof(RecordHeader);
+        if (checksum(header, key, key + header.key_size) != header.crc) {
+            log()->warn("bad record checksum in segment %u at %u", segment->id(), offset);
+            break;
+        }
+
+        std::string hash = HashUtils::hexMD5(key, header.key_size);
+        Tag tag(false, header.last_modified, header.expire_time);
+        if (tag.expired()) {
+            index_.erase(hash);
+        }
+        else {
+            Location location = { segment->id(), offset, false, false };
+            index_[hash] = location;
+        }
+        offset += size;
+    }
+    segment->end(offset);
+}
+
+bool
+SegmentStore::load(const std::string &key, Record &record) {
+    return locate(key, record, true);
+}
+
+bool
+SegmentStore::exists(const std::string &key) {
+    Record record;
+    if (!locate(key, record, false)) {
+        return false;
+    }
+    Tag tag(true, record.last_modified, record.expire_time);
+    return !tag.expired();
+}
+
+bool
+SegmentStore::locate(const std::string &key, Record &record, bool reference) {
+    std::string hash = HashUtils::hexMD5(key.data(), key.size());
+    boost::uint32_t offset = 0;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        Index::iterator it = index_.find(hash);
+        if (index_.end() == it) {
+            return false;
+        }
+        SegmentMap::iterator segment = segments_.find(it->second.segment);
+        if (segments_.end() == segment) {
+            index_.erase(it);
+            return false;
+        }
+        if (reference) {
+            it->second.referenced = true;
+        }
+        record.segment = segment->second;
+        offset = it->second.offset;
+    }
+
+    const char *ptr = record.segment->data() + offset;
+    RecordHeader header;
+    memcpy(&header, ptr, sizeof(RecordHeader));
+    ptr += sizeof(RecordHeader);
+    if (header.key_size != key.size() || memcmp(ptr, key.data(), key.size()) != 0) {
+        log()->info("segment record key clashes with other one");
+        record.segment.reset();
+        return false;
+    }
+
+    record.data = ptr + header.key_size;
+    record.size = header.data_size;
+    record.expire_time = header.expire_time;
+    record.last_modified = header.last_modified;
+    record.stored_time = header.stored_time;
+    return true;
+}
+
+bool
+SegmentStore::save(const std::string &key, const Tag &tag, const char *data, boost::uint32_t size) {
+    boost::uint64_t record_size = recordSize(key.size(), size);
+    if (record_size > segment_size_ - SEGMENT_HEADER_SIZE) {
+        log()->info("record size %llu exceeds segment size %u", (unsigned long long)record_size, segment_size_);
+        return false;
+    }
+
+    RecordHeader header;
+    header.signature = RECORD_SIGNATURE;
+    header.key_size = key.size();
+    header.data_size = size;
+    header.expire_time = tag.expire_time;
+    header.last_modified = tag.last_modified;
+    header.stored_time = time(NULL);
+    header.crc = checksum(header, key.data(), data);
+
+    std::string hash = HashUtils::hexMD5(key.data(), key.size());
+    boost::shared_ptr<Segment> victim;
+    try {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (NULL == active_.get() || !active_->fits(record_size)) {
+            victim = roll();
+        }
+        Location location = { active_->id(), active_->append(header, key.data(), data), false, false };
+        index_[hash] = location;
+    }
+    catch (const std::exception &e) {
+        log()->error("cannot save record to segment store: %s", e.what());
+        return false;
+    }
+
+    if (NULL != victim.get()) {
+        compact(victim);
+    }
+    return true;
+}
+
+void
+SegmentStore::remove(const std::string &key) {
+    std::string hash = HashUtils::hexMD5(key.data(), key.size());
+    boost::mutex::scoped_lock lock(mutex_);
+    index_.erase(hash);
+}
+
+bool
+SegmentStore::markPrefetch(const std::string &key) {
+    std::string hash = HashUtils::hexMD5(key.data(), key.size());
+    boost::mutex::scoped_lock lock(mutex_);
+    Index::iterator it = index_.find(hash);
+    if (index_.end() == it || it->second.prefetch) {
+        return false;
+    }
+    it->second.prefetch = true;
+    return true;
+}
+
+std::size_t
+SegmentStore::records() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return index_.size();
+}
+
+std::size_t
+SegmentStore::segments() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return segments_.size();
+}
+
+boost::shared_ptr<SegmentStore::Segment>
+SegmentStore::roll() {
+    char name[32];
+    snprintf(name, sizeof(name), "%s%08x", SEGMENT_PREFIX, next_id_);
+    boost::shared_ptr<Segment> segment(new Segment(dir_ + name, next_id_, segment_size_));
+    ++next_id_;
+
+    if (NULL != active_.get()) {
+        active_->sync();
+    }
+    active_ = segment;
+    segments_[segment->id()] = segment;
+
+    if (segments_.size() > max_segments_ && !compacting_) {
+        compacting_ = true;
+        return segments_.begin()->second;
+    }
+    return boost::shared_ptr<Segment>();
+}
+
+SegmentStore::Index::iterator
+SegmentStore::find(const std::string &hash, boost::uint32_t segment, boost::uint32_t offset) {
+    Index::iterator it = index_.find(hash);
+    if (index_.end() != it && (segment != it->second.segment || offset != it->second.offset)) {
+        return index_.end();
+    }
+    return it;
+}
+
+void
+SegmentStore::compact(boost::shared_ptr<Segment> segment) {
+    while (NULL != segment.get()) {
+        compactSegment(segment);
+        segment->unlink();
+
+        boost::mutex::scoped_lock lock(mutex_);
+        segments_.erase(segment->id());
+        if (segments_.size() > max_segments_) {
+            segment = segments_.begin()->second;
+        }
+        else {
+            segment.reset();
+            compacting_ = false;
+        }
+    }
+}
+
+void
+SegmentStore::compactSegment(const boost::shared_ptr<Segment> &segment) {
+    unsigned int moved = 0, dropped = 0;
+    const char *data = segment->data();
+    for (boost::uint32_t offset = SEGMENT_HEADER_SIZE, end = segment->end(); offset < end; ) {
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(RecordHeader));
+        boost::uint32_t size = recordSize(header.key_size, header.data_size);
+        std::string hash = HashUtils::hexMD5(data + offset + sizeof(RecordHeader), header.key_size);
+        Tag tag(false, header.last_modified, header.expire_time);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        Index::iterator it = find(hash, segment->id(), offset);
+        if (index_.end() != it) {
+            if (it->second.referenced && !tag.expired() && active_->fits(size)) {
+                it->second.offset = active_->append(data + offset, size);
+                it->second.segment = active_->id();
+                it->second.referenced = false;
+                ++moved;
+            }
+            else {
+                index_.erase(it);
+                ++dropped;
+            }
+        }
+        offset += size;
+    }
+    log()->info("segment %u compacted, moved: %u, dropped: %u", segment->id(), moved, dropped);
+}
+
+} // namespace xscript
@@ -0,0 +1,110 @@
+#ifndef _XSCRIPT_STANDARD_SEGMENT_STORE_H_
+#define _XSCRIPT_STANDARD_SEGMENT_STORE_H_
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include "internal/hash.h"
+#include "internal/hashmap.h"
+
+namespace xscript {
+
+class Tag;
+
+/**
+ * Log-structured record storage in preallocated memory mapped segment
+ * files with in-memory index. Records are appended to active segment.
+ * When number of segments exceeds limit the oldest one is compacted:
+ * live records read since they were written move to active segment,
+ * the rest are dropped together with segment file. Index is rebuilt
+ * from segment files on construction, scan of a segment stops at first
+ * record with bad checksum.
+ */
+class SegmentStore : private boost::noncopyable {
+public:
+    SegmentStore(const std::string &dir, boost::uint32_t segment_size, boost::uint32_t max_segments);
+    ~SegmentStore();
+
+    class Segment;
+
+    /**
+     * Data points into segment mapping and stays valid while record holds
+     * segment, even if segment is compacted and removed meanwhile.
+     */
+    struct Record {
+        Record();
+
+        boost::shared_ptr<Segment> segment;
+        const char *data;
+        boost::uint32_t size;
+        time_t expire_time;
+        time_t last_modified;
+        time_t stored_time;
+    };
+
+    bool load(const std::string &key, Record &record);
+
+    /**
+     * Checks for unexpired record. Unlike load it does not count as use,
+     * so probed but never loaded records are dropped by compaction.
+     */
+    bool exists(const std::string &key);
+
+    bool save(const std::string &key, const Tag &tag, const char *data, boost::uint32_t size);
+    void remove(const std::string &key);
+
+    /**
+     * Returns true for the first caller after record was saved.
+     */
+    bool markPrefetch(const std::string &key);
+
+    std::size_t records() const;
+    std::size_t segments() const;
+
+    static const boost::uint32_t MIN_SEGMENT_SIZE;
+
+private:
+    struct Location {
+        boost::uint32_t segment;
+        boost::uint32_t offset;
+        bool referenced;
+        bool prefetch;
+    };
+
+#ifndef HAVE_HASHMAP
+    typedef std::map<std::string, Location> Index;
+#else
+    typedef details::hash_map<std::string, Location, details::StringHash> Index;
+#endif
+    typedef std::map<boost::uint32_t, boost::shared_ptr<Segment> > SegmentMap;
+
+    bool locate(const std::string &key, Record &record, bool reference);
+    void recover();
+    void recover(const boost::shared_ptr<Segment> &segment);
+    boost::shared_ptr<Segment> roll();
+    void compact(boost::shared_ptr<Segment> segment);
+    void compactSegment(const boost::shared_ptr<Segment> &segment);
+    Index::iterator find(const std::string &hash, boost::uint32_t segment, boost::uint32_t offset);
+
+private:
+    std::string dir_;
+    boost::uint32_t segment_size_;
+    boost::uint32_t max_segments_;
+
+    mutable boost::mutex mutex_;
+    Index index_;
+    SegmentMap segments_;
+    boost::shared_ptr<Segment> active_;
+    boost::uint32_t next_id_;
+    bool compacting_;
+};
+
+} // namespace xscript
+
+#endif // _XSCRIPT_STANDARD_SEGMENT_STORE_H_
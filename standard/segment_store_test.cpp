@@ -0,0 +1,206 @@
+#include "settings.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <sys/stat.h>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "xscript/tag.h"
+
+#include "segment_store.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+using namespace xscript;
+
+class SegmentStoreTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SegmentStoreTest);
+    CPPUNIT_TEST(testLoadSave);
+    CPPUNIT_TEST(testRecovery);
+    CPPUNIT_TEST(testCorrupted);
+    CPPUNIT_TEST(testCompaction);
+    CPPUNIT_TEST(testExists);
+    CPPUNIT_TEST(testPrefetch);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp() {
+        boost::filesystem::remove_all(DIR);
+        mkdir(DIR, 0777);
+    }
+
+    void tearDown() {
+        boost::filesystem::remove_all(DIR);
+    }
+
+    void testLoadSave() {
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+        Tag tag(false, 10, Tag::UNDEFINED_TIME);
+
+        SegmentStore::Record record;
+        CPPUNIT_ASSERT(!store.load("key", record));
+
+        CPPUNIT_ASSERT(save(store, "key", "value", tag));
+        CPPUNIT_ASSERT(store.load("key", record));
+        CPPUNIT_ASSERT_EQUAL(std::string("value"), std::string(record.data, record.size));
+        CPPUNIT_ASSERT_EQUAL((time_t)10, record.last_modified);
+        CPPUNIT_ASSERT_EQUAL(Tag::UNDEFINED_TIME, record.expire_time);
+
+        CPPUNIT_ASSERT(save(store, "key", "other value", tag));
+        CPPUNIT_ASSERT(store.load("key", record));
+        CPPUNIT_ASSERT_EQUAL(std::string("other value"), std::string(record.data, record.size));
+
+        store.remove("key");
+        CPPUNIT_ASSERT(!store.load("key", record));
+
+        std::string huge(SegmentStore::MIN_SEGMENT_SIZE, 'x');
+        CPPUNIT_ASSERT(!save(store, "huge", huge, tag));
+    }
+
+    void testRecovery() {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        Tag expired(false, 1, time(NULL) - 1);
+        {
+            SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+            for (int i = 0; i < 1000; ++i) {
+                CPPUNIT_ASSERT(save(store, key(i), value(i), tag));
+            }
+            CPPUNIT_ASSERT(save(store, key(0), "updated", tag));
+            CPPUNIT_ASSERT(save(store, "expired", "value", expired));
+        }
+
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+        CPPUNIT_ASSERT_EQUAL((std::size_t)1000, store.records());
+
+        SegmentStore::Record record;
+        CPPUNIT_ASSERT(store.load(key(0), record));
+        CPPUNIT_ASSERT_EQUAL(std::string("updated"), std::string(record.data, record.size));
+        for (int i = 1; i < 1000; ++i) {
+            CPPUNIT_ASSERT(store.load(key(i), record));
+            CPPUNIT_ASSERT_EQUAL(value(i), std::string(record.data, record.size));
+        }
+        CPPUNIT_ASSERT(!store.load("expired", record));
+
+        CPPUNIT_ASSERT(save(store, "new", "value", tag));
+        CPPUNIT_ASSERT(store.load("new", record));
+    }
+
+    void testCorrupted() {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        {
+            SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+            for (int i = 0; i < 10; ++i) {
+                CPPUNIT_ASSERT(save(store, key(i), value(i), tag));
+            }
+        }
+
+        std::string path = std::string(DIR) + "/segment.00000000";
+        std::string content;
+        {
+            std::ifstream is(path.c_str(), std::ios::binary);
+            content.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        }
+        std::string::size_type pos = content.find(value(5));
+        CPPUNIT_ASSERT(std::string::npos != pos);
+        {
+            std::fstream os(path.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+            os.seekp(pos);
+            os.put('X');
+        }
+
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+        CPPUNIT_ASSERT_EQUAL((std::size_t)5, store.records());
+        SegmentStore::Record record;
+        for (int i = 0; i < 10; ++i) {
+            CPPUNIT_ASSERT_EQUAL(i < 5, store.load(key(i), record));
+        }
+
+        CPPUNIT_ASSERT(save(store, key(5), value(5), tag));
+        CPPUNIT_ASSERT(store.load(key(5), record));
+        CPPUNIT_ASSERT_EQUAL(value(5), std::string(record.data, record.size));
+    }
+
+    void testCompaction() {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 2);
+        SegmentStore::Record record;
+
+        std::string data(1000, 'd');
+        CPPUNIT_ASSERT(save(store, "hot", data, tag));
+        for (int i = 0; i < 1000; ++i) {
+            CPPUNIT_ASSERT(store.load("hot", record));
+            CPPUNIT_ASSERT(save(store, key(i), data, tag));
+        }
+
+        CPPUNIT_ASSERT(store.segments() <= 3);
+        CPPUNIT_ASSERT(store.load("hot", record));
+        CPPUNIT_ASSERT_EQUAL(data, std::string(record.data, record.size));
+        CPPUNIT_ASSERT(!store.load(key(0), record));
+        CPPUNIT_ASSERT(store.load(key(999), record));
+    }
+
+    void testExists() {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 2);
+        SegmentStore::Record record;
+
+        CPPUNIT_ASSERT(!store.exists("hot"));
+        CPPUNIT_ASSERT(save(store, "expired", "value", Tag(false, 1, time(NULL) - 1)));
+        CPPUNIT_ASSERT(!store.exists("expired"));
+
+        // probed record is not kept by compaction, loaded one is
+        std::string data(1000, 'd');
+        CPPUNIT_ASSERT(save(store, "hot", data, tag));
+        CPPUNIT_ASSERT(save(store, "probed", data, tag));
+        for (int i = 0; i < 1000; ++i) {
+            CPPUNIT_ASSERT(store.load("hot", record));
+            CPPUNIT_ASSERT(store.exists("hot"));
+            store.exists("probed");
+            CPPUNIT_ASSERT(save(store, key(i), data, tag));
+        }
+
+        CPPUNIT_ASSERT(store.exists("hot"));
+        CPPUNIT_ASSERT(!store.exists("probed"));
+        CPPUNIT_ASSERT(!store.load("probed", record));
+    }
+
+    void testPrefetch() {
+        Tag tag(false, 1, Tag::UNDEFINED_TIME);
+        SegmentStore store(DIR, SegmentStore::MIN_SEGMENT_SIZE, 4);
+
+        CPPUNIT_ASSERT(!store.markPrefetch("key"));
+        CPPUNIT_ASSERT(save(store, "key", "value", tag));
+        CPPUNIT_ASSERT(store.markPrefetch("key"));
+        CPPUNIT_ASSERT(!store.markPrefetch("key"));
+        CPPUNIT_ASSERT(save(store, "key", "value", tag));
+        CPPUNIT_ASSERT(store.markPrefetch("key"));
+    }
+
+private:
+    static bool save(SegmentStore &store, const std::string &key, const std::string &value, const Tag &tag) {
+        return store.save(key, tag, value.data(), value.size());
+    }
+
+    static std::string key(int i) {
+        return "key-" + boost::lexical_cast<std::string>(i);
+    }
+
+    static std::string value(int i) {
+        return "value-" + boost::lexical_cast<std::string>(i * 7);
+    }
+
+    static const char *DIR;
+};
+
+const char *SegmentStoreTest::DIR = "segment-test";
+
+CPPUNIT_TEST_SUITE_REGISTRATION( SegmentStoreTest );
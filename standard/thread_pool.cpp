@@ -1,6 +1,6 @@
 #include "settings.h"
 
-#include <queue>
+#include <vector>
 #include <cerrno>
 #include <cstring>
 #include <cstdlib>
@@ -10,22 +10,38 @@
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/current_function.hpp>
 
 #include "xscript/util.h"
 #include "xscript/config.h"
+#include "xscript/histogram_counter.h"
 #include "xscript/logger.h"
+#include "xscript/profiler.h"
 #include "xscript/thread_pool.h"
 #include "xscript/simple_counter.h"
 #include "xscript/status_info.h"
 #include "xscript/vhost_data.h"
 
+#include "work_stealing_queue.h"
+
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
 #endif
 
 namespace xscript {
 
+/**
+ * Work-stealing thread pool.
+ *
+ * Every worker owns a lock-free deque for tasks submitted from the worker
+ * itself (nested threaded blocks) and a lock-free inbox for tasks submitted
+ * from outside of the pool. Idle workers steal from other workers' inboxes
+ * and deques before going to sleep. A free thread is reserved before a task
+ * is handed off, so invokeEx never queues more tasks than there are idle
+ * workers, and exactly one sleeper is woken per submitted task.
+ */
 class StandardThreadPool : public ThreadPool, private boost::thread_group {
 public:
     StandardThreadPool();
@@ -35,31 +51,99 @@ public:
     virtual bool invokeEx(boost::function<void()> f_threaded, boost::function<void()> f_unthreaded);
     virtual void stop();
 
-protected:
+private:
+    typedef boost::function<void()> Task;
+
+    struct Worker : private boost::noncopyable {
+        Worker(unsigned int id, size_t capacity);
+
+        unsigned int id;
+        WorkStealingDeque<Task> deque;
+        MPMCBoundedQueue<Task> inbox;
+
+        bool signaled;
+        boost::mutex mutex;
+        boost::condition condition;
+    };
 
-    void handle();
-    bool canRun() const;
-    boost::function<void()> wait();
+    class PoolCounter : public CounterBase {
+    public:
+        PoolCounter(const StandardThreadPool *pool);
+        virtual XmlNodeHelper createReport() const;
+    private:
+        const StandardThreadPool *pool_;
+    };
+
+protected:
+    void handle(Worker *worker);
+    Task* wait(Worker *worker);
+    void execute(const Task &task, const timeval &enqueue_time);
 
 private:
-    typedef boost::function<void()> Task;
+    bool reserveThread();
+    void releaseThread();
+
+    Task* findTask(Worker *worker);
+    Task* stealTask(Worker *worker);
+
+    Worker* popSleeper();
+    bool cancelSleep(Worker *worker);
+    void wakeOne();
+    void signal(Worker *worker);
+
+    void clearTasks();
+
+    static void detachWorker(Worker *worker);
 
 private:
-    bool running_;
-    std::queue<Task> tasks_;
-    unsigned short free_threads_;
+    volatile bool running_;
+    volatile int free_threads_;
+    volatile unsigned int next_worker_;
+
+    volatile unsigned long queued_;
+    volatile unsigned long steals_;
+
+    std::vector<Worker*> workers_;
+    boost::thread_specific_ptr<Worker> current_worker_;
 
-    boost::mutex mutex_;
-    boost::condition condition_;
+    volatile unsigned int sleepers_;
+    std::vector<Worker*> idle_;
+    boost::mutex idle_mutex_;
 
     std::auto_ptr<SimpleCounter> counter_;
+    std::auto_ptr<HistogramCounter> wait_counter_;
+    std::auto_ptr<PoolCounter> pool_counter_;
 };
 
-StandardThreadPool::StandardThreadPool() : running_(true), free_threads_(0) {
+StandardThreadPool::Worker::Worker(unsigned int id, size_t capacity) :
+    id(id), deque(capacity), inbox(capacity), signaled(false)
+{}
+
+StandardThreadPool::PoolCounter::PoolCounter(const StandardThreadPool *pool) :
+    pool_(pool)
+{}
+
+XmlNodeHelper
+StandardThreadPool::PoolCounter::createReport() const {
+    XmlNodeHelper line = pool_->counter_->createReport();
+    xmlSetProp(line.get(), (const xmlChar*) "queued",
+        (const xmlChar*) boost::lexical_cast<std::string>(pool_->queued_).c_str());
+    xmlSetProp(line.get(), (const xmlChar*) "steals",
+        (const xmlChar*) boost::lexical_cast<std::string>(pool_->steals_).c_str());
+    xmlAddChild(line.get(), pool_->wait_counter_->createReport().release());
+    return line;
 }
 
+StandardThreadPool::StandardThreadPool() :
+    running_(true), free_threads_(0), next_worker_(0), queued_(0), steals_(0),
+    current_worker_(&StandardThreadPool::detachWorker), sleepers_(0)
+{}
+
 StandardThreadPool::~StandardThreadPool() {
     stop();
+    for (std::vector<Worker*>::iterator it = workers_.begin(); it != workers_.end(); ++it) {
+        delete *it;
+    }
 }
 
 void
@@ -67,11 +151,18 @@ StandardThreadPool::init(const Config *config) {
 
     try {
         counter_ = SimpleCounterFactory::instance()->createCounter("working-threads", true);
+        wait_counter_ = HistogramCounterFactory::instance()->createCounter("queue-wait", true);
+        pool_counter_ = std::auto_ptr<PoolCounter>(new PoolCounter(this));
         unsigned short nthreads = config->as<unsigned short>("/xscript/pool-workers");
         counter_->max(nthreads);
-        boost::function<void()> f = boost::bind(&StandardThreadPool::handle, this);
+
+        workers_.reserve(nthreads);
+        idle_.reserve(nthreads);
+        for (int i = 0; i < nthreads; ++i) {
+            workers_.push_back(new Worker(i, nthreads));
+        }
         for (int i = 0; i < nthreads; ++i) {
-            create_thread(f);
+            create_thread(boost::bind(&StandardThreadPool::handle, this, workers_[i]));
         }
     }
     catch (const std::exception &e) {
@@ -79,37 +170,68 @@ StandardThreadPool::init(const Config *config) {
         throw;
     }
 
-    StatusInfo::instance()->getStatBuilder().addCounter(counter_.get());
+    StatusInfo::instance()->getStatBuilder().addCounter(pool_counter_.get());
 }
 
 bool
 StandardThreadPool::invokeEx(boost::function<void()> f_threaded, boost::function<void()> f_unthreaded) {
-    boost::mutex::scoped_lock sl(mutex_);
-    if (running_) {
-        if (0 == free_threads_) {
-            sl.unlock();
-            f_unthreaded();
-            return false;
+    if (!running_) {
+        return false;
+    }
+    if (!reserveThread()) {
+        f_unthreaded();
+        return false;
+    }
+
+    timeval enqueue_time;
+    gettimeofday(&enqueue_time, 0);
+    std::auto_ptr<Task> task(new Task(
+        boost::bind(&StandardThreadPool::execute, this, f_threaded, enqueue_time)));
+    __sync_fetch_and_add(&queued_, 1);
+
+    Worker *current = current_worker_.get();
+    if (NULL != current && current->deque.push(task.get())) {
+        task.release();
+        wakeOne();
+        return true;
+    }
+
+    Worker *sleeper = popSleeper();
+    unsigned int start = NULL == sleeper ?
+        __sync_fetch_and_add(&next_worker_, 1) : sleeper->id;
+    for (unsigned int i = 0, size = workers_.size(); i < size; ++i) {
+        if (workers_[(start + i) % size]->inbox.enqueue(task.get())) {
+            task.release();
+            break;
         }
-        tasks_.push(f_threaded);
-        condition_.notify_all();
-	return true;
     }
-    return false;
+
+    if (NULL != sleeper) {
+        signal(sleeper);
+    }
+    else {
+        wakeOne();
+    }
+
+    if (NULL != task.get()) {
+        __sync_fetch_and_sub(&queued_, 1);
+        releaseThread();
+        f_unthreaded();
+        return false;
+    }
+    return true;
 }
 
 void
 StandardThreadPool::stop() {
-    boost::mutex::scoped_lock sl(mutex_);
-    if (running_) {
-        running_ = false;
-        while (!tasks_.empty()) {
-            tasks_.pop();
-        }
-        condition_.notify_all();
-        sl.unlock();
-        join_all();
+    if (!__sync_bool_compare_and_swap(&running_, true, false)) {
+        return;
     }
+    for (std::vector<Worker*>::iterator it = workers_.begin(); it != workers_.end(); ++it) {
+        signal(*it);
+    }
+    join_all();
+    clearTasks();
 }
 
 struct VirtaulHostDataAutoCleaner {
@@ -123,35 +245,176 @@ struct VirtaulHostDataAutoCleaner {
 };
 
 void
-StandardThreadPool::handle() {
+StandardThreadPool::handle(Worker *worker) {
+    current_worker_.reset(worker);
     while (true) {
-        boost::function<void()> f = wait();
-        if (f.empty()) {
+        releaseThread();
+        std::auto_ptr<Task> f(wait(worker));
+        if (NULL == f.get()) {
             return;
         }
+        if (queued_ > 0) {
+            wakeOne();
+        }
         VirtaulHostDataAutoCleaner vhost_data_cleaner;
         SimpleCounter::ScopedCount c(counter_.get());
-        f();
+        (*f)();
     }
 }
 
+StandardThreadPool::Task*
+StandardThreadPool::wait(Worker *worker) {
+    while (running_) {
+        Task *task = findTask(worker);
+        if (NULL != task) {
+            return task;
+        }
+
+        {
+            boost::mutex::scoped_lock sl(idle_mutex_);
+            idle_.push_back(worker);
+            __sync_fetch_and_add(&sleepers_, 1);
+        }
+
+        task = findTask(worker);
+        if (NULL != task || !running_) {
+            if (cancelSleep(worker)) {
+                return task;
+            }
+        }
+
+        boost::mutex::scoped_lock sl(worker->mutex);
+        while (!worker->signaled) {
+            worker->condition.wait(sl);
+        }
+        worker->signaled = false;
+        sl.unlock();
+
+        if (NULL != task) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+void
+StandardThreadPool::execute(const Task &task, const timeval &enqueue_time) {
+    timeval now;
+    gettimeofday(&now, 0);
+    wait_counter_->add(timercmp(&now, &enqueue_time, >) ? now - enqueue_time : 0);
+    task();
+}
+
+bool
+StandardThreadPool::reserveThread() {
+    int free = free_threads_;
+    while (free > 0) {
+        int prev = __sync_val_compare_and_swap(&free_threads_, free, free - 1);
+        if (prev == free) {
+            return true;
+        }
+        free = prev;
+    }
+    return false;
+}
+
+void
+StandardThreadPool::releaseThread() {
+    __sync_fetch_and_add(&free_threads_, 1);
+}
+
+StandardThreadPool::Task*
+StandardThreadPool::findTask(Worker *worker) {
+    Task *task = worker->deque.pop();
+    if (NULL == task) {
+        task = worker->inbox.dequeue();
+    }
+    if (NULL == task) {
+        task = stealTask(worker);
+    }
+    if (NULL != task) {
+        __sync_fetch_and_sub(&queued_, 1);
+    }
+    return task;
+}
+
+StandardThreadPool::Task*
+StandardThreadPool::stealTask(Worker *worker) {
+    for (unsigned int i = 1, size = workers_.size(); i < size; ++i) {
+        Worker *victim = workers_[(worker->id + i) % size];
+        Task *task = victim->inbox.dequeue();
+        if (NULL == task) {
+            task = victim->deque.steal();
+        }
+        if (NULL != task) {
+            __sync_fetch_and_add(&steals_, 1);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+StandardThreadPool::Worker*
+StandardThreadPool::popSleeper() {
+    __sync_synchronize();
+    if (0 == sleepers_) {
+        return NULL;
+    }
+    boost::mutex::scoped_lock sl(idle_mutex_);
+    if (idle_.empty()) {
+        return NULL;
+    }
+    Worker *worker = idle_.back();
+    idle_.pop_back();
+    __sync_fetch_and_sub(&sleepers_, 1);
+    return worker;
+}
+
 bool
-StandardThreadPool::canRun() const {
-    return !tasks_.empty() || !running_;
-}
-
-boost::function<void()>
-StandardThreadPool::wait() {
-    boost::function<void()> f;
-    boost::mutex::scoped_lock sl(mutex_);
-    ++free_threads_;
-    condition_.wait(sl, boost::bind(&StandardThreadPool::canRun, this));
-    if (running_) {
-        f = tasks_.front();
-        tasks_.pop();
-        --free_threads_;
-    }
-    return f;
+StandardThreadPool::cancelSleep(Worker *worker) {
+    boost::mutex::scoped_lock sl(idle_mutex_);
+    for (std::vector<Worker*>::iterator it = idle_.begin(); it != idle_.end(); ++it) {
+        if (*it == worker) {
+            idle_.erase(it);
+            __sync_fetch_and_sub(&sleepers_, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+StandardThreadPool::wakeOne() {
+    Worker *worker = popSleeper();
+    if (NULL != worker) {
+        signal(worker);
+    }
+}
+
+void
+StandardThreadPool::signal(Worker *worker) {
+    boost::mutex::scoped_lock sl(worker->mutex);
+    worker->signaled = true;
+    worker->condition.notify_one();
+}
+
+void
+StandardThreadPool::clearTasks() {
+    for (std::vector<Worker*>::iterator it = workers_.begin(); it != workers_.end(); ++it) {
+        Task *task = NULL;
+        while (NULL != (task = (*it)->deque.pop())) {
+            delete task;
+        }
+        while (NULL != (task = (*it)->inbox.dequeue())) {
+            delete task;
+        }
+    }
+    queued_ = 0;
+}
+
+void
+StandardThreadPool::detachWorker(Worker *worker) {
+    (void)worker;
 }
 
 static ComponentImplRegisterer<ThreadPool> reg_(new StandardThreadPool());
@@ -0,0 +1,202 @@
+#ifndef _XSCRIPT_STANDARD_WORK_STEALING_QUEUE_H_
+#define _XSCRIPT_STANDARD_WORK_STEALING_QUEUE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+namespace xscript {
+
+namespace details {
+
+inline size_t
+roundUpPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace details
+
+/**
+ * Bounded Chase-Lev work-stealing deque of pointers.
+ *
+ * push() and pop() may be called only by the owning thread and work on the
+ * bottom end (LIFO). steal() may be called by any thread and takes items
+ * from the top end (FIFO). No locks are taken on any path.
+ */
+template<typename Type>
+class WorkStealingDeque : private boost::noncopyable {
+public:
+    explicit WorkStealingDeque(size_t capacity);
+
+    bool push(Type *item);
+    Type* pop();
+    Type* steal();
+
+    size_t size() const;
+
+private:
+    volatile long top_;
+    volatile long bottom_;
+    size_t mask_;
+    std::vector<Type*> items_;
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue of pointers (D. Vyukov's
+ * sequence-numbered ring). Both enqueue() and dequeue() are lock-free.
+ */
+template<typename Type>
+class MPMCBoundedQueue : private boost::noncopyable {
+public:
+    explicit MPMCBoundedQueue(size_t capacity);
+
+    bool enqueue(Type *item);
+    Type* dequeue();
+
+private:
+    struct Cell {
+        volatile size_t sequence;
+        Type *item;
+    };
+
+    size_t mask_;
+    std::vector<Cell> cells_;
+    volatile size_t enqueue_pos_;
+    volatile size_t dequeue_pos_;
+};
+
+template<typename Type>
+WorkStealingDeque<Type>::WorkStealingDeque(size_t capacity) :
+    top_(0), bottom_(0), mask_(details::roundUpPowerOfTwo(capacity) - 1),
+    items_(mask_ + 1, static_cast<Type*>(NULL))
+{}
+
+template<typename Type> bool
+WorkStealingDeque<Type>::push(Type *item) {
+    long b = bottom_;
+    long t = top_;
+    if (b - t > static_cast<long>(mask_)) {
+        return false;
+    }
+    items_[b & mask_] = item;
+    __sync_synchronize();
+    bottom_ = b + 1;
+    return true;
+}
+
+template<typename Type> Type*
+WorkStealingDeque<Type>::pop() {
+    long b = bottom_ - 1;
+    bottom_ = b;
+    __sync_synchronize();
+    long t = top_;
+    if (t > b) {
+        bottom_ = b + 1;
+        return NULL;
+    }
+    Type *item = items_[b & mask_];
+    if (t == b) {
+        if (!__sync_bool_compare_and_swap(&top_, t, t + 1)) {
+            item = NULL;
+        }
+        bottom_ = b + 1;
+    }
+    return item;
+}
+
+template<typename Type> Type*
+WorkStealingDeque<Type>::steal() {
+    long t = top_;
+    __sync_synchronize();
+    long b = bottom_;
+    if (t >= b) {
+        return NULL;
+    }
+    Type *item = items_[t & mask_];
+    if (!__sync_bool_compare_and_swap(&top_, t, t + 1)) {
+        return NULL;
+    }
+    return item;
+}
+
+template<typename Type> size_t
+WorkStealingDeque<Type>::size() const {
+    long size = bottom_ - top_;
+    return size > 0 ? static_cast<size_t>(size) : 0;
+}
+
+template<typename Type>
+MPMCBoundedQueue<Type>::MPMCBoundedQueue(size_t capacity) :
+    mask_(details::roundUpPowerOfTwo(capacity) - 1), cells_(mask_ + 1),
+    enqueue_pos_(0), dequeue_pos_(0)
+{
+    for (size_t i = 0; i <= mask_; ++i) {
+        cells_[i].sequence = i;
+        cells_[i].item = NULL;
+    }
+}
+
+template<typename Type> bool
+MPMCBoundedQueue<Type>::enqueue(Type *item) {
+    Cell *cell = NULL;
+    size_t pos = enqueue_pos_;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence;
+        __sync_synchronize();
+        long diff = static_cast<long>(seq) - static_cast<long>(pos);
+        if (0 == diff) {
+            if (__sync_bool_compare_and_swap(&enqueue_pos_, pos, pos + 1)) {
+                break;
+            }
+            pos = enqueue_pos_;
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = enqueue_pos_;
+        }
+    }
+    cell->item = item;
+    __sync_synchronize();
+    cell->sequence = pos + 1;
+    return true;
+}
+
+template<typename Type> Type*
+MPMCBoundedQueue<Type>::dequeue() {
+    Cell *cell = NULL;
+    size_t pos = dequeue_pos_;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence;
+        __sync_synchronize();
+        long diff = static_cast<long>(seq) - static_cast<long>(pos + 1);
+        if (0 == diff) {
+            if (__sync_bool_compare_and_swap(&dequeue_pos_, pos, pos + 1)) {
+                break;
+            }
+            pos = dequeue_pos_;
+        }
+        else if (diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = dequeue_pos_;
+        }
+    }
+    Type *item = cell->item;
+    __sync_synchronize();
+    cell->sequence = pos + mask_ + 1;
+    return item;
+}
+
+} // namespace xscript
+
+#endif // _XSCRIPT_STANDARD_WORK_STEALING_QUEUE_H_
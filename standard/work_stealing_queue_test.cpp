@@ -0,0 +1,177 @@
+#include "settings.h"
+
+#include <vector>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "work_stealing_queue.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+using namespace xscript;
+
+class WorkStealingQueueTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(WorkStealingQueueTest);
+    CPPUNIT_TEST(testDequeOrder);
+    CPPUNIT_TEST(testDequeCapacity);
+    CPPUNIT_TEST(testDequeConcurrentSteal);
+    CPPUNIT_TEST(testQueueOrder);
+    CPPUNIT_TEST(testQueueConcurrent);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void testDequeOrder() {
+        int items[3] = { 0, 1, 2 };
+        WorkStealingDeque<int> deque(4);
+
+        CPPUNIT_ASSERT(NULL == deque.pop());
+        CPPUNIT_ASSERT(NULL == deque.steal());
+
+        for (int i = 0; i < 3; ++i) {
+            CPPUNIT_ASSERT(deque.push(&items[i]));
+        }
+        CPPUNIT_ASSERT_EQUAL((size_t)3, deque.size());
+
+        CPPUNIT_ASSERT_EQUAL(&items[2], deque.pop());
+        CPPUNIT_ASSERT_EQUAL(&items[0], deque.steal());
+        CPPUNIT_ASSERT_EQUAL(&items[1], deque.pop());
+        CPPUNIT_ASSERT(NULL == deque.pop());
+        CPPUNIT_ASSERT_EQUAL((size_t)0, deque.size());
+    }
+
+    void testDequeCapacity() {
+        int item = 0;
+        WorkStealingDeque<int> deque(3);
+
+        for (int i = 0; i < 4; ++i) {
+            CPPUNIT_ASSERT(deque.push(&item));
+        }
+        CPPUNIT_ASSERT(!deque.push(&item));
+        CPPUNIT_ASSERT(NULL != deque.steal());
+        CPPUNIT_ASSERT(deque.push(&item));
+    }
+
+    void testDequeConcurrentSteal() {
+        const int count = 20000;
+        std::vector<int> items(count, 0);
+        WorkStealingDeque<int> deque(64);
+        volatile bool done = false;
+
+        boost::thread_group thieves;
+        for (int i = 0; i < 4; ++i) {
+            thieves.create_thread(boost::bind(&WorkStealingQueueTest::steal, &deque, &done));
+        }
+
+        int pushed = 0;
+        while (pushed < count) {
+            if (deque.push(&items[pushed])) {
+                ++pushed;
+            }
+            else {
+                boost::thread::yield();
+            }
+            if (0 == pushed % 3) {
+                int *item = deque.pop();
+                if (NULL != item) {
+                    ++*item;
+                }
+            }
+        }
+        int *item = NULL;
+        while (NULL != (item = deque.pop())) {
+            ++*item;
+        }
+        done = true;
+        thieves.join_all();
+
+        for (int i = 0; i < count; ++i) {
+            CPPUNIT_ASSERT_EQUAL(1, items[i]);
+        }
+    }
+
+    void testQueueOrder() {
+        int items[3] = { 0, 1, 2 };
+        MPMCBoundedQueue<int> queue(2);
+
+        CPPUNIT_ASSERT(NULL == queue.dequeue());
+        CPPUNIT_ASSERT(queue.enqueue(&items[0]));
+        CPPUNIT_ASSERT(queue.enqueue(&items[1]));
+        CPPUNIT_ASSERT(!queue.enqueue(&items[2]));
+
+        CPPUNIT_ASSERT_EQUAL(&items[0], queue.dequeue());
+        CPPUNIT_ASSERT(queue.enqueue(&items[2]));
+        CPPUNIT_ASSERT_EQUAL(&items[1], queue.dequeue());
+        CPPUNIT_ASSERT_EQUAL(&items[2], queue.dequeue());
+        CPPUNIT_ASSERT(NULL == queue.dequeue());
+    }
+
+    void testQueueConcurrent() {
+        const int count = 20000;
+        std::vector<int> items(count, 0);
+        MPMCBoundedQueue<int> queue(64);
+        volatile bool done = false;
+
+        boost::thread_group consumers;
+        for (int i = 0; i < 4; ++i) {
+            consumers.create_thread(boost::bind(&WorkStealingQueueTest::consume, &queue, &done));
+        }
+
+        boost::thread_group producers;
+        for (int i = 0; i < 2; ++i) {
+            producers.create_thread(boost::bind(&WorkStealingQueueTest::produce,
+                &queue, &items[0] + i * count / 2, count / 2));
+        }
+        producers.join_all();
+        done = true;
+        consumers.join_all();
+
+        for (int i = 0; i < count; ++i) {
+            CPPUNIT_ASSERT_EQUAL(1, items[i]);
+        }
+    }
+
+private:
+    static void steal(WorkStealingDeque<int> *deque, volatile bool *done) {
+        while (!*done || deque->size() > 0) {
+            int *item = deque->steal();
+            if (NULL != item) {
+                __sync_fetch_and_add(item, 1);
+            }
+            else {
+                boost::thread::yield();
+            }
+        }
+    }
+
+    static void produce(MPMCBoundedQueue<int> *queue, int *items, int count) {
+        for (int i = 0; i < count; ++i) {
+            while (!queue->enqueue(&items[i])) {
+                boost::thread::yield();
+            }
+        }
+    }
+
+    static void consume(MPMCBoundedQueue<int> *queue, volatile bool *done) {
+        while (true) {
+            bool finished = *done;
+            int *item = queue->dequeue();
+            if (NULL != item) {
+                __sync_fetch_and_add(item, 1);
+            }
+            else if (finished) {
+                return;
+            }
+            else {
+                boost::thread::yield();
+            }
+        }
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( WorkStealingQueueTest );
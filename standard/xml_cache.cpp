@@ -27,7 +27,7 @@
 
 #include "internal/hash.h"
 #include "internal/hashmap.h"
-#include "internal/lrucache.h"
+#include "internal/clock_cache.h"
 
 #ifndef HAVE_HASHMAP
 #include <map>
@@ -125,7 +125,7 @@ private:
         bool operator() (Element &element, const Tag &tag) const;
     };
     
-    typedef LRUCache<std::string, Element, XmlExpiredFunc> CacheType;
+    typedef ClockCache<std::string, Element, XmlExpiredFunc> CacheType;
     std::auto_ptr<CacheCounter> counter_;
     std::auto_ptr<CacheType> cache_;
 };
@@ -0,0 +1,115 @@
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <libxml/parser.h>
+
+#include "xscript/config.h"
+#include "xscript/doc_cache.h"
+#include "xscript/logger_factory.h"
+#include "xscript/meta.h"
+#include "xscript/profiler.h"
+#include "xscript/xml_util.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+/**
+ * Compares text and binary serialization of block cache data.
+ * Usage: doc-format-bench [iterations] [xml file ...]
+ * Must be started from the tests directory.
+ */
+
+using namespace xscript;
+
+namespace {
+
+void
+serializeAll(BlockCacheData *data, bool binary, unsigned int iterations) {
+    std::string buf;
+    for (unsigned int i = 0; i < iterations; ++i) {
+        binary ? data->serializeBinary(buf) : data->serialize(buf);
+    }
+}
+
+void
+parseAll(const std::string *buf, unsigned int iterations) {
+    for (unsigned int i = 0; i < iterations; ++i) {
+        BlockCacheData data;
+        if (!data.parse(buf->data(), buf->size())) {
+            throw std::runtime_error("can not parse cache data");
+        }
+    }
+}
+
+double
+usecPerOp(boost::uint64_t usec, unsigned int iterations) {
+    return static_cast<double>(usec) / iterations;
+}
+
+XmlDocSharedHelper
+createDoc(unsigned int items) {
+    std::string xml("<result xmlns:x=\"http://www.yandex.ru/xscript\">");
+    for (unsigned int i = 0; i < items; ++i) {
+        std::string id = boost::lexical_cast<std::string>(i);
+        xml.append("<item id=\"").append(id).append("\" x:type=\"test\"><name>name ").append(id).
+            append(" &amp; more</name><value>").append(id).append("</value><x:flag/></item>");
+    }
+    xml.append("</result>");
+    return XmlDocSharedHelper(xmlReadMemory(xml.c_str(), xml.size(), "", "UTF-8", XML_PARSE_NOENT));
+}
+
+void
+bench(const std::string &name, const XmlDocSharedHelper &doc, unsigned int iterations) {
+    XmlUtils::throwUnless(NULL != doc.get());
+    BlockCacheData data(doc, boost::shared_ptr<MetaCore>());
+
+    std::string text, binary;
+    data.serialize(text);
+    data.serializeBinary(binary);
+
+    double text_encode = usecPerOp(profile(boost::bind(&serializeAll, &data, false, iterations)), iterations);
+    double binary_encode = usecPerOp(profile(boost::bind(&serializeAll, &data, true, iterations)), iterations);
+    double text_decode = usecPerOp(profile(boost::bind(&parseAll, &text, iterations)), iterations);
+    double binary_decode = usecPerOp(profile(boost::bind(&parseAll, &binary, iterations)), iterations);
+
+    printf("%-24s %10llu %10llu %10.1f %10.1f %10.1f %10.1f\n", name.c_str(),
+        static_cast<unsigned long long>(text.size()), static_cast<unsigned long long>(binary.size()),
+        text_encode, binary_encode, text_decode, binary_decode);
+}
+
+} // namespace
+
+int
+main(int argc, char *argv[]) {
+    try {
+        std::auto_ptr<Config> config = Config::create("test.conf");
+        LoggerFactory::instance()->init(config.get());
+
+        unsigned int iterations = argc > 1 ? boost::lexical_cast<unsigned int>(argv[1]) : 200;
+
+        printf("%-24s %10s %10s %10s %10s %10s %10s\n", "document", "text size", "bin size",
+            "text enc", "bin enc", "text dec", "bin dec");
+        if (argc > 2) {
+            for (int i = 2; i < argc; ++i) {
+                bench(argv[i], XmlDocSharedHelper(xmlReadFile(argv[i], NULL, XML_PARSE_NOENT)), iterations);
+            }
+        }
+        else {
+            for (unsigned int items = 10; items <= 10000; items *= 10) {
+                bench(boost::lexical_cast<std::string>(items) + " items", createDoc(items), iterations);
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,131 @@
+#include "settings.h"
+
+#include <cstring>
+#include <string>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <libxml/parser.h>
+
+#include "xscript/doc_cache.h"
+#include "xscript/meta.h"
+#include "xscript/xml_helpers.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class BinaryDocTest : public CppUnit::TestFixture {
+public:
+    void testRoundTrip();
+    void testTextReadable();
+    void testFallback();
+    void testCorrupted();
+
+private:
+    CPPUNIT_TEST_SUITE(BinaryDocTest);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testTextReadable);
+    CPPUNIT_TEST(testFallback);
+    CPPUNIT_TEST(testCorrupted);
+    CPPUNIT_TEST_SUITE_END();
+
+    static xscript::XmlDocSharedHelper parseDoc(const char *xml);
+    static std::string dumpDoc(xmlDocPtr doc);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(BinaryDocTest, "binary-doc");
+CPPUNIT_REGISTRY_ADD("binary-doc", "xscript");
+
+static const char *TEST_DOC =
+    "<?pi data?><!--comment-->"
+    "<root xmlns=\"urn:default\" xmlns:p=\"urn:p\" p:attr=\"1\" attr=\"&amp;&lt;\">"
+    "<p:item xml:lang=\"ru\">text<![CDATA[<cdata>]]>more<empty/><!--inner--></p:item>"
+    "<item xml:id=\"id1\" value=\"\"/><plain xmlns=\"\">value</plain>"
+    "</root>";
+
+xscript::XmlDocSharedHelper
+BinaryDocTest::parseDoc(const char *xml) {
+    return xscript::XmlDocSharedHelper(xmlReadMemory(xml, strlen(xml), "", "UTF-8", XML_PARSE_NOENT));
+}
+
+std::string
+BinaryDocTest::dumpDoc(xmlDocPtr doc) {
+    xmlChar *buf = NULL;
+    int size = 0;
+    xmlDocDumpMemoryEnc(doc, &buf, &size, "UTF-8");
+    std::string result((const char*)buf, size);
+    xmlFree(buf);
+    return result;
+}
+
+void
+BinaryDocTest::testRoundTrip() {
+
+    using namespace xscript;
+
+    XmlDocSharedHelper doc = parseDoc(TEST_DOC);
+    boost::shared_ptr<MetaCore> meta(new MetaCore());
+    BlockCacheData saved(doc, meta);
+
+    std::string binary, text;
+    CPPUNIT_ASSERT(saved.serializeBinary(binary));
+    CPPUNIT_ASSERT(saved.serialize(text));
+    CPPUNIT_ASSERT(binary != text);
+
+    BlockCacheData loaded;
+    CPPUNIT_ASSERT(loaded.parse(binary.data(), binary.size()));
+    CPPUNIT_ASSERT(NULL != loaded.docPtr());
+    CPPUNIT_ASSERT_EQUAL(dumpDoc(doc.get()), dumpDoc(loaded.docPtr()));
+    CPPUNIT_ASSERT(NULL != xmlGetID(loaded.docPtr(), (const xmlChar*)"id1"));
+}
+
+void
+BinaryDocTest::testTextReadable() {
+
+    using namespace xscript;
+
+    XmlDocSharedHelper doc = parseDoc(TEST_DOC);
+    BlockCacheData saved(doc, boost::shared_ptr<MetaCore>());
+
+    std::string text;
+    CPPUNIT_ASSERT(saved.serialize(text));
+
+    BlockCacheData loaded;
+    CPPUNIT_ASSERT(loaded.parse(text.data(), text.size()));
+    CPPUNIT_ASSERT_EQUAL(dumpDoc(doc.get()), dumpDoc(loaded.docPtr()));
+}
+
+void
+BinaryDocTest::testFallback() {
+
+    using namespace xscript;
+
+    const char *xml = "<!DOCTYPE a [<!ENTITY e 'x'>]><a>&e;</a>";
+    XmlDocSharedHelper doc(xmlReadMemory(xml, strlen(xml), "", "UTF-8", 0));
+    CPPUNIT_ASSERT(NULL != doc.get());
+    BlockCacheData saved(doc, boost::shared_ptr<MetaCore>());
+
+    std::string binary, text;
+    CPPUNIT_ASSERT(saved.serializeBinary(binary));
+    CPPUNIT_ASSERT(saved.serialize(text));
+    CPPUNIT_ASSERT_EQUAL(text, binary);
+}
+
+void
+BinaryDocTest::testCorrupted() {
+
+    using namespace xscript;
+
+    XmlDocSharedHelper doc = parseDoc(TEST_DOC);
+    BlockCacheData saved(doc, boost::shared_ptr<MetaCore>());
+
+    std::string binary;
+    CPPUNIT_ASSERT(saved.serializeBinary(binary));
+
+    for (std::string::size_type size = 2 * sizeof(boost::uint32_t) + 1; size < binary.size(); ++size) {
+        BlockCacheData loaded;
+        CPPUNIT_ASSERT(!loaded.parse(binary.data(), size));
+    }
+}
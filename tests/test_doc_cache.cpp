@@ -5,6 +5,7 @@
 #include "xscript/config.h"
 #include "xscript/context.h"
 #include "xscript/doc_cache.h"
+#include "xscript/doc_cache_strategy.h"
 #include "xscript/script.h"
 #include "xscript/script_factory.h"
 #include "xscript/state.h"
@@ -15,6 +16,14 @@
 #include <time.h>
 #include <sys/timeb.h>
 
+#include <map>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
 #endif
@@ -25,22 +34,294 @@ public:
     void testStoreLoad();
     void testGetLocalTagged();
     void testGetLocalTaggedPrefetch();
+    void testPrefetchLocalHit();
+    void testWriteQueue();
+    void testWriteDropOldest();
+    void testWriteRemoveStrategy();
 
     // TODO Create mockup strategy to check, that loaded doc from second
     // strategy was stored in first.
 
 private:
+    class MockKey;
+    class MockStrategy;
+    class MockWriter;
+    class MockCache;
+    class WriterConfig;
+
     CPPUNIT_TEST_SUITE(DocCacheTest);
     CPPUNIT_TEST(testMissed);
+    CPPUNIT_TEST(testPrefetchLocalHit);
+    CPPUNIT_TEST(testWriteQueue);
+    CPPUNIT_TEST(testWriteDropOldest);
+    CPPUNIT_TEST(testWriteRemoveStrategy);
 //    CPPUNIT_TEST(testStoreLoad);
 //    CPPUNIT_TEST(testGetLocalTagged);
 //    CPPUNIT_TEST(testGetLocalTaggedPrefetch);
     CPPUNIT_TEST_SUITE_END();
+
+    static bool save(MockCache &cache, xscript::CacheContext *cache_ctx,
+        const std::string &key, time_t expire_time);
 };
 
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(DocCacheTest, "tagged-cache");
 CPPUNIT_REGISTRY_ADD("tagged-cache", "xscript");
 
+// key of mock strategies is the xslt name of invoke context
+class DocCacheTest::MockKey : public xscript::TagKey {
+public:
+    explicit MockKey(const std::string &value) : value_(value) {}
+    virtual const std::string& asString() const {
+        return value_;
+    }
+
+private:
+    std::string value_;
+};
+
+// local strategy holds docs of keys in stored, batching one records requests
+class DocCacheTest::MockStrategy : public xscript::DocCacheStrategy {
+public:
+    MockStrategy(xscript::CachedObject::Strategy strategy, bool batch) :
+        strategy_(strategy), batch_(batch), created_(0)
+    {}
+
+    virtual time_t minimalCacheTime() const {
+        return 1;
+    }
+    virtual std::string name() const {
+        return batch_ ? "mock-batch" : "mock-local";
+    }
+    virtual std::auto_ptr<xscript::TagKey> createKey(const xscript::Context *ctx,
+        const xscript::InvokeContext *invoke_ctx, const xscript::CachedObject *obj) const {
+        (void)ctx;
+        (void)obj;
+        ++created_;
+        return std::auto_ptr<xscript::TagKey>(new MockKey(invoke_ctx->xsltName()));
+    }
+    virtual bool loadDoc(const xscript::TagKey *key, xscript::CacheContext *cache_ctx,
+        xscript::Tag &tag, boost::shared_ptr<xscript::CacheData> &cache_data) {
+        (void)cache_ctx;
+        (void)tag;
+        (void)cache_data;
+        loaded.push_back(key);
+        return false;
+    }
+    virtual bool saveDoc(const xscript::TagKey *key, xscript::CacheContext *cache_ctx,
+        const xscript::Tag &tag, const boost::shared_ptr<xscript::CacheData> &cache_data) {
+        (void)key;
+        (void)cache_ctx;
+        (void)tag;
+        (void)cache_data;
+        return false;
+    }
+    virtual bool prefetchSupported() const {
+        return batch_;
+    }
+    virtual void prefetchDocs(xscript::Context *ctx, const std::vector<const xscript::TagKey*> &keys) {
+        (void)ctx;
+        std::vector<std::string> request;
+        for (std::vector<const xscript::TagKey*>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            request.push_back((*it)->asString());
+            prefetched.push_back(*it);
+        }
+        requests.push_back(request);
+    }
+    virtual bool containsDoc(const xscript::TagKey *key) {
+        return stored.end() != stored.find(key->asString());
+    }
+    virtual xscript::CachedObject::Strategy strategy() const {
+        return strategy_;
+    }
+
+    unsigned int created() const {
+        return created_;
+    }
+
+    std::set<std::string> stored;
+    std::vector<std::vector<std::string> > requests;
+    std::vector<const xscript::TagKey*> prefetched;
+    std::vector<const xscript::TagKey*> loaded;
+
+private:
+    xscript::CachedObject::Strategy strategy_;
+    bool batch_;
+    mutable unsigned int created_;
+};
+
+// write-behind strategy, background saves wait until the strategy is opened
+class DocCacheTest::MockWriter : public xscript::DocCacheStrategy {
+public:
+    MockWriter() : open_(false), started_(0)
+    {}
+
+    virtual time_t minimalCacheTime() const {
+        return 1;
+    }
+    virtual std::string name() const {
+        return "mock-writer";
+    }
+    virtual std::auto_ptr<xscript::TagKey> createKey(const xscript::Context *ctx,
+        const xscript::InvokeContext *invoke_ctx, const xscript::CachedObject *obj) const {
+        (void)ctx;
+        (void)obj;
+        return std::auto_ptr<xscript::TagKey>(new MockKey(invoke_ctx->xsltName()));
+    }
+    virtual bool loadDoc(const xscript::TagKey *key, xscript::CacheContext *cache_ctx,
+        xscript::Tag &tag, boost::shared_ptr<xscript::CacheData> &cache_data) {
+        (void)key;
+        (void)cache_ctx;
+        (void)tag;
+        (void)cache_data;
+        return false;
+    }
+    virtual bool saveDoc(const xscript::TagKey *key, xscript::CacheContext *cache_ctx,
+        const xscript::Tag &tag, const boost::shared_ptr<xscript::CacheData> &cache_data) {
+        (void)cache_ctx;
+        (void)cache_data;
+        boost::mutex::scoped_lock lock(mutex_);
+        synced_.push_back(std::make_pair(key->asString(), tag.expire_time));
+        return true;
+    }
+    virtual bool writeBehindSupported() const {
+        return true;
+    }
+    virtual boost::function<bool()> createSaveTask(const xscript::TagKey *key,
+        const xscript::Tag &tag, const boost::shared_ptr<xscript::CacheData> &cache_data) {
+        (void)cache_data;
+        return boost::bind(&MockWriter::store, this, key->asString(), tag.expire_time);
+    }
+    virtual xscript::CachedObject::Strategy strategy() const {
+        return xscript::CachedObject::LOCAL;
+    }
+
+    void open() {
+        boost::mutex::scoped_lock lock(mutex_);
+        open_ = true;
+        condition_.notify_all();
+    }
+    void waitStarted(unsigned int count) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (started_ < count) {
+            CPPUNIT_ASSERT(condition_.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(5)));
+        }
+    }
+    void waitStored(unsigned int count) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (stored_.size() < count) {
+            CPPUNIT_ASSERT(condition_.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(5)));
+        }
+    }
+
+    typedef std::vector<std::pair<std::string, time_t> > SaveList;
+
+    SaveList stored() {
+        boost::mutex::scoped_lock lock(mutex_);
+        return stored_;
+    }
+    SaveList synced() {
+        boost::mutex::scoped_lock lock(mutex_);
+        return synced_;
+    }
+
+private:
+    bool store(const std::string &key, time_t expire_time) {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++started_;
+        condition_.notify_all();
+        while (!open_) {
+            condition_.wait(lock);
+        }
+        stored_.push_back(std::make_pair(key, expire_time));
+        condition_.notify_all();
+        return true;
+    }
+
+private:
+    boost::mutex mutex_;
+    boost::condition condition_;
+    bool open_;
+    unsigned int started_;
+    SaveList stored_;
+    SaveList synced_;
+};
+
+class DocCacheTest::MockCache : public xscript::DocCacheBase {
+public:
+    explicit MockCache(const std::string &name = "mock-block-cache") : name_(name)
+    {}
+
+    void prefetch(const xscript::CachePrefetchList &objects) {
+        prefetchDocsImpl(objects);
+    }
+    bool load(xscript::InvokeContext *invoke_ctx, xscript::CacheContext *cache_ctx) {
+        xscript::Tag tag;
+        boost::shared_ptr<xscript::CacheData> cache_data(new xscript::BlockCacheData());
+        return loadDocImpl(invoke_ctx, cache_ctx, tag, cache_data);
+    }
+    bool save(xscript::InvokeContext *invoke_ctx, xscript::CacheContext *cache_ctx,
+        const xscript::Tag &tag, const boost::shared_ptr<xscript::CacheData> &cache_data) {
+        return saveDocImpl(invoke_ctx, cache_ctx, tag, cache_data);
+    }
+
+protected:
+    virtual void createUsageCounter(boost::shared_ptr<StatInfo> info) {
+        (void)info;
+    }
+    virtual std::string name() const {
+        return name_;
+    }
+
+private:
+    std::string name_;
+};
+
+// one writer thread with queue of two saves
+class DocCacheTest::WriterConfig : public xscript::Config {
+public:
+    WriterConfig(const std::string &cache_name, const std::string &drop) {
+        std::string prefix = "/xscript/" + cache_name + "-strategies/";
+        values_[prefix + "write-threads"] = "1";
+        values_[prefix + "write-queue-size"] = "2";
+        values_[prefix + "write-drop"] = drop;
+    }
+    virtual void subKeys(const std::string &value, std::vector<std::string> &v) const {
+        (void)value;
+        v.clear();
+    }
+    virtual const std::string& fileName() const {
+        static const std::string name = "writer.conf";
+        return name;
+    }
+
+protected:
+    virtual std::string value(const std::string &value) const {
+        std::map<std::string, std::string>::const_iterator it = values_.find(value);
+        if (values_.end() == it) {
+            throw std::runtime_error("nonexistent config param: " + value);
+        }
+        return it->second;
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+bool
+DocCacheTest::save(MockCache &cache, xscript::CacheContext *cache_ctx,
+    const std::string &key, time_t expire_time) {
+
+    using namespace xscript;
+
+    XmlDocSharedHelper doc(xmlNewDoc((const xmlChar*) "1.0"));
+    xmlDocSetRootElement(doc.get(), xmlNewDocNode(doc.get(), NULL, (const xmlChar*) "page", NULL));
+    boost::shared_ptr<CacheData> cache_data(new BlockCacheData(doc, boost::shared_ptr<MetaCore>()));
+
+    InvokeContext invoke_ctx;
+    invoke_ctx.xsltName(key);
+    return cache.save(&invoke_ctx, cache_ctx, Tag(true, time(NULL), expire_time), cache_data);
+}
+
 void
 DocCacheTest::testMissed() {
     using namespace xscript;
@@ -244,3 +525,170 @@ DocCacheTest::testGetLocalTaggedPrefetch() {
     CPPUNIT_ASSERT(NULL != loaded->doc().get());
 }
 
+void
+DocCacheTest::testPrefetchLocalHit() {
+    using namespace xscript;
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("http-local-tagged.xml");
+    ContextStopper ctx_stopper(ctx);
+
+    TaggedBlock* block = dynamic_cast<TaggedBlock*>(const_cast<Block*>(ctx->script()->block(0)));
+    CPPUNIT_ASSERT(NULL != block);
+    CPPUNIT_ASSERT(block->checkStrategy(CachedObject::LOCAL));
+
+    MockStrategy local(CachedObject::LOCAL, false);
+    MockStrategy batch(CachedObject::DISTRIBUTED, true);
+    local.stored.insert("hit1");
+    local.stored.insert("hit2");
+
+    std::auto_ptr<Config> config = Config::create("test.conf");
+    MockCache cache;
+    cache.addStrategy(&local, local.name());
+    cache.addStrategy(&batch, batch.name());
+    cache.init(config.get());
+
+    const char* names[] = { "hit1", "hit2", "miss1", "miss2" };
+    std::vector<boost::shared_ptr<InvokeContext> > invoke_contexts;
+    std::vector<boost::shared_ptr<CacheContext> > cache_contexts;
+    CachePrefetchList objects;
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        boost::shared_ptr<InvokeContext> invoke_ctx(new InvokeContext());
+        invoke_ctx->xsltName(names[i]);
+        boost::shared_ptr<CacheContext> cache_ctx(new CacheContext(block, ctx.get(), true));
+        invoke_contexts.push_back(invoke_ctx);
+        cache_contexts.push_back(cache_ctx);
+        objects.push_back(std::make_pair(invoke_ctx.get(), cache_ctx.get()));
+    }
+
+    // documents held locally are not requested from batching strategy
+    CachePrefetchList hits(objects.begin(), objects.begin() + 2);
+    cache.prefetch(hits);
+    CPPUNIT_ASSERT(batch.requests.empty());
+
+    cache.prefetch(objects);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, batch.requests.size());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, batch.requests[0].size());
+    CPPUNIT_ASSERT_EQUAL(std::string("miss1"), batch.requests[0][0]);
+    CPPUNIT_ASSERT_EQUAL(std::string("miss2"), batch.requests[0][1]);
+
+    // keys created for prefetch are used by load
+    unsigned int local_created = local.created(), batch_created = batch.created();
+    CPPUNIT_ASSERT(!cache.load(invoke_contexts[2].get(), cache_contexts[2].get()));
+    CPPUNIT_ASSERT_EQUAL(local_created, local.created());
+    CPPUNIT_ASSERT_EQUAL(batch_created, batch.created());
+    CPPUNIT_ASSERT_EQUAL((size_t)1, batch.loaded.size());
+    CPPUNIT_ASSERT(batch.prefetched[0] == batch.loaded[0]);
+}
+
+void
+DocCacheTest::testWriteQueue() {
+    using namespace xscript;
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("http-local-tagged.xml");
+    ContextStopper ctx_stopper(ctx);
+    TaggedBlock* block = dynamic_cast<TaggedBlock*>(const_cast<Block*>(ctx->script()->block(0)));
+    CPPUNIT_ASSERT(NULL != block);
+    CacheContext cache_ctx(block, ctx.get(), true);
+
+    MockWriter writer;
+    WriterConfig config("mock-write-cache", "newest");
+    MockCache cache("mock-write-cache");
+    cache.addStrategy(&writer, writer.name());
+    cache.init(&config);
+
+    time_t now = time(NULL);
+
+    // writer thread takes the first save and waits in it
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "a", now + 100));
+    writer.waitStarted(1);
+
+    // pending save of the same key is replaced in place by the newer one
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "b", now + 100));
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "c", now + 100));
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "b", now + 200));
+
+    // queue is full, new save is dropped
+    CPPUNIT_ASSERT(!save(cache, &cache_ctx, "d", now + 100));
+    CPPUNIT_ASSERT(writer.synced().empty());
+
+    writer.open();
+    writer.waitStored(3);
+    MockWriter::SaveList stored = writer.stored();
+    CPPUNIT_ASSERT_EQUAL((size_t)3, stored.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("a"), stored[0].first);
+    CPPUNIT_ASSERT_EQUAL(std::string("b"), stored[1].first);
+    CPPUNIT_ASSERT_EQUAL(now + 200, stored[1].second);
+    CPPUNIT_ASSERT_EQUAL(std::string("c"), stored[2].first);
+
+    cache.removeStrategy(&writer);
+}
+
+void
+DocCacheTest::testWriteDropOldest() {
+    using namespace xscript;
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("http-local-tagged.xml");
+    ContextStopper ctx_stopper(ctx);
+    TaggedBlock* block = dynamic_cast<TaggedBlock*>(const_cast<Block*>(ctx->script()->block(0)));
+    CPPUNIT_ASSERT(NULL != block);
+    CacheContext cache_ctx(block, ctx.get(), true);
+
+    MockWriter writer;
+    WriterConfig config("mock-write-oldest-cache", "oldest");
+    MockCache cache("mock-write-oldest-cache");
+    cache.addStrategy(&writer, writer.name());
+    cache.init(&config);
+
+    time_t now = time(NULL);
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "a", now + 100));
+    writer.waitStarted(1);
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "b", now + 100));
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "c", now + 100));
+
+    // queue is full, oldest pending save gives way to the new one
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "d", now + 100));
+
+    writer.open();
+    writer.waitStored(3);
+    MockWriter::SaveList stored = writer.stored();
+    CPPUNIT_ASSERT_EQUAL((size_t)3, stored.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("a"), stored[0].first);
+    CPPUNIT_ASSERT_EQUAL(std::string("c"), stored[1].first);
+    CPPUNIT_ASSERT_EQUAL(std::string("d"), stored[2].first);
+
+    cache.removeStrategy(&writer);
+}
+
+void
+DocCacheTest::testWriteRemoveStrategy() {
+    using namespace xscript;
+    boost::shared_ptr<Context> ctx = TestUtils::createEnv("http-local-tagged.xml");
+    ContextStopper ctx_stopper(ctx);
+    TaggedBlock* block = dynamic_cast<TaggedBlock*>(const_cast<Block*>(ctx->script()->block(0)));
+    CPPUNIT_ASSERT(NULL != block);
+    CacheContext cache_ctx(block, ctx.get(), true);
+
+    MockWriter writer;
+    WriterConfig config("mock-write-remove-cache", "newest");
+    MockCache cache("mock-write-remove-cache");
+    cache.addStrategy(&writer, writer.name());
+    cache.init(&config);
+
+    time_t now = time(NULL);
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "a", now + 100));
+    writer.waitStarted(1);
+    CPPUNIT_ASSERT(save(cache, &cache_ctx, "b", now + 100));
+
+    // removal waits for the save running in writer thread
+    boost::thread remover(boost::bind(&MockCache::removeStrategy, &cache, &writer));
+    CPPUNIT_ASSERT(!remover.timed_join(boost::posix_time::milliseconds(100)));
+    writer.open();
+    remover.join();
+
+    // pending saves are dropped, nothing runs in writer threads afterwards
+    MockWriter::SaveList stored = writer.stored();
+    CPPUNIT_ASSERT_EQUAL((size_t)1, stored.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("a"), stored[0].first);
+
+    // strategy is not used anymore
+    CPPUNIT_ASSERT(!save(cache, &cache_ctx, "c", now + 100));
+    CPPUNIT_ASSERT(writer.synced().empty());
+    CPPUNIT_ASSERT_EQUAL((size_t)1, writer.stored().size());
+}
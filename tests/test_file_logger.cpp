@@ -0,0 +1,322 @@
+#include "settings.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "xscript/config.h"
+#include "xscript/xml_helpers.h"
+
+#include "internal/file_logger.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class FileLoggerTest : public CppUnit::TestFixture {
+public:
+    void testThreads();
+    void testDrop();
+    void testBlock();
+    void testDestroy();
+
+private:
+    CPPUNIT_TEST_SUITE(FileLoggerTest);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testDrop);
+    CPPUNIT_TEST(testBlock);
+    CPPUNIT_TEST(testDestroy);
+    CPPUNIT_TEST_SUITE_END();
+
+    class LoggerConfig : public xscript::Config {
+    public:
+        LoggerConfig(const std::string &file, const std::string &overflow, unsigned int buffer_size);
+        virtual void subKeys(const std::string &value, std::vector<std::string> &v) const;
+        virtual const std::string& fileName() const;
+
+    protected:
+        virtual std::string value(const std::string &value) const;
+
+    private:
+        std::map<std::string, std::string> values_;
+    };
+
+    static void produce(xscript::Logger *logger, unsigned int id, unsigned int count);
+    static void produceAndWait(xscript::FileLogger **logger, unsigned int id, unsigned int count,
+        boost::barrier *barrier);
+    static void readLines(int fd, std::vector<std::string> *lines);
+    static std::vector<std::string> readFile(const std::string &name);
+    static unsigned long counter(const xscript::FileLogger &logger, const char *name);
+    static unsigned int checkLines(const std::vector<std::string> &lines, bool gaps);
+    static int openFifo(const std::string &name);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(FileLoggerTest, "file-logger");
+CPPUNIT_REGISTRY_ADD("file-logger", "xscript");
+
+static const std::string LOG_FILE = "file-logger.log";
+static const std::string LOG_FILE2 = "file-logger2.log";
+static const std::string LOG_FIFO = "file-logger.fifo";
+static const std::string LOGGER_KEY = "/xscript/logger-factory/logger";
+
+FileLoggerTest::LoggerConfig::LoggerConfig(const std::string &file, const std::string &overflow,
+    unsigned int buffer_size) {
+    values_[LOGGER_KEY + "/file"] = file;
+    values_[LOGGER_KEY + "/overflow"] = overflow;
+    values_[LOGGER_KEY + "/buffer-size"] = boost::lexical_cast<std::string>(buffer_size);
+    values_[LOGGER_KEY + "/crash-on-errors"] = "no";
+}
+
+void
+FileLoggerTest::LoggerConfig::subKeys(const std::string &value, std::vector<std::string> &v) const {
+    (void)value;
+    v.clear();
+}
+
+const std::string&
+FileLoggerTest::LoggerConfig::fileName() const {
+    return LOG_FILE;
+}
+
+std::string
+FileLoggerTest::LoggerConfig::value(const std::string &value) const {
+    std::map<std::string, std::string>::const_iterator it = values_.find(value);
+    if (values_.end() == it) {
+        throw std::runtime_error("nonexistent config param: " + value);
+    }
+    return it->second;
+}
+
+void
+FileLoggerTest::produce(xscript::Logger *logger, unsigned int id, unsigned int count) {
+    for (unsigned int i = 0; i < count; ++i) {
+        logger->info("thread %u line %u payload-payload-payload-payload", id, i);
+    }
+}
+
+void
+FileLoggerTest::produceAndWait(xscript::FileLogger **logger, unsigned int id, unsigned int count,
+    boost::barrier *barrier) {
+    produce(*logger, id, count);
+    barrier->wait();
+    // logger is destroyed here, thread keeps its ring
+    barrier->wait();
+    // new logger is created here
+    barrier->wait();
+    produce(*logger, id, count);
+}
+
+void
+FileLoggerTest::readLines(int fd, std::vector<std::string> *lines) {
+    std::string data;
+    char buf[4096];
+    while (true) {
+        ssize_t res = read(fd, buf, sizeof(buf));
+        if (res <= 0) {
+            break;
+        }
+        data.append(buf, res);
+    }
+    std::string::size_type pos = 0, end;
+    while (std::string::npos != (end = data.find('\n', pos))) {
+        lines->push_back(data.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    if (pos != data.size()) {
+        // truncated line fails the check
+        lines->push_back("truncated: " + data.substr(pos));
+    }
+}
+
+std::vector<std::string>
+FileLoggerTest::readFile(const std::string &name) {
+    std::vector<std::string> lines;
+    int fd = open(name.c_str(), O_RDONLY);
+    CPPUNIT_ASSERT(-1 != fd);
+    readLines(fd, &lines);
+    close(fd);
+    unlink(name.c_str());
+    return lines;
+}
+
+unsigned long
+FileLoggerTest::counter(const xscript::FileLogger &logger, const char *name) {
+    xscript::XmlNodeHelper report = logger.createReport();
+    xmlChar *value = xmlGetProp(report.get(), (const xmlChar*) name);
+    CPPUNIT_ASSERT(NULL != value);
+    unsigned long result = boost::lexical_cast<unsigned long>((const char*) value);
+    xmlFree(value);
+    return result;
+}
+
+unsigned int
+FileLoggerTest::checkLines(const std::vector<std::string> &lines, bool gaps) {
+    std::map<unsigned int, unsigned int> next;
+    for (std::vector<std::string>::const_iterator it = lines.begin(); it != lines.end(); ++it) {
+        CPPUNIT_ASSERT_EQUAL('[', (*it)[0]);
+        std::string::size_type pos = it->find("] info: thread ");
+        CPPUNIT_ASSERT(std::string::npos != pos);
+        unsigned int id, line;
+        char payload[64];
+        CPPUNIT_ASSERT_EQUAL(3, sscanf(it->c_str() + pos, "] info: thread %u line %u %63s",
+            &id, &line, payload));
+        CPPUNIT_ASSERT_EQUAL(std::string("payload-payload-payload-payload"), std::string(payload));
+
+        // lines of every thread are in order
+        std::map<unsigned int, unsigned int>::iterator n = next.find(id);
+        unsigned int expected = next.end() == n ? 0 : n->second;
+        if (gaps) {
+            CPPUNIT_ASSERT(line >= expected);
+        }
+        else {
+            CPPUNIT_ASSERT_EQUAL(expected, line);
+        }
+        next[id] = line + 1;
+    }
+    return next.size();
+}
+
+int
+FileLoggerTest::openFifo(const std::string &name) {
+    unlink(name.c_str());
+    CPPUNIT_ASSERT_EQUAL(0, mkfifo(name.c_str(), S_IRUSR | S_IWUSR));
+
+    // Writer does not block on open while reader exists. Nobody reads
+    // until the test says so, writing thread stalls when pipe is full.
+    int fd = open(name.c_str(), O_RDONLY | O_NONBLOCK);
+    CPPUNIT_ASSERT(-1 != fd);
+    return fd;
+}
+
+void
+FileLoggerTest::testThreads() {
+
+    using namespace xscript;
+
+    unlink(LOG_FILE.c_str());
+    LoggerConfig config(LOG_FILE, "block", 8192);
+    std::auto_ptr<FileLogger> logger(new FileLogger(Logger::LEVEL_INFO, &config, LOGGER_KEY));
+
+    // small rings wrap around many times
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < 8; ++i) {
+        threads.create_thread(boost::bind(&FileLoggerTest::produce, logger.get(), i, 5000));
+    }
+    threads.join_all();
+    CPPUNIT_ASSERT_EQUAL(0UL, counter(*logger, "dropped"));
+    logger.reset();
+
+    std::vector<std::string> lines = readFile(LOG_FILE);
+    CPPUNIT_ASSERT_EQUAL((size_t)40000, lines.size());
+    CPPUNIT_ASSERT_EQUAL(8U, checkLines(lines, false));
+}
+
+void
+FileLoggerTest::testDrop() {
+
+    using namespace xscript;
+
+    int fd = openFifo(LOG_FIFO);
+    LoggerConfig config(LOG_FIFO, "drop", 0);
+    std::auto_ptr<FileLogger> logger(new FileLogger(Logger::LEVEL_INFO, &config, LOGGER_KEY));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    produce(logger.get(), 0, 20000);
+    unsigned long dropped = counter(*logger, "dropped");
+    CPPUNIT_ASSERT(dropped > 0);
+    CPPUNIT_ASSERT_EQUAL(0UL, counter(*logger, "blocked"));
+
+    std::vector<std::string> lines;
+    boost::thread reader(boost::bind(&FileLoggerTest::readLines, fd, &lines));
+    logger.reset();
+    reader.join();
+    close(fd);
+    unlink(LOG_FIFO.c_str());
+
+    CPPUNIT_ASSERT_EQUAL((size_t)20000, lines.size() + dropped);
+    checkLines(lines, true);
+}
+
+void
+FileLoggerTest::testBlock() {
+
+    using namespace xscript;
+
+    int fd = openFifo(LOG_FIFO);
+    LoggerConfig config(LOG_FIFO, "block", 0);
+    std::auto_ptr<FileLogger> logger(new FileLogger(Logger::LEVEL_INFO, &config, LOGGER_KEY));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    boost::thread producer(boost::bind(&FileLoggerTest::produce, logger.get(), 0, 20000));
+    for (unsigned int i = 0; i < 500 && 0 == counter(*logger, "blocked"); ++i) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    CPPUNIT_ASSERT(counter(*logger, "blocked") > 0);
+
+    std::vector<std::string> lines;
+    boost::thread reader(boost::bind(&FileLoggerTest::readLines, fd, &lines));
+    producer.join();
+    CPPUNIT_ASSERT_EQUAL(0UL, counter(*logger, "dropped"));
+    logger.reset();
+    reader.join();
+    close(fd);
+    unlink(LOG_FIFO.c_str());
+
+    CPPUNIT_ASSERT_EQUAL((size_t)20000, lines.size());
+    checkLines(lines, false);
+}
+
+void
+FileLoggerTest::testDestroy() {
+
+    using namespace xscript;
+
+    unlink(LOG_FILE.c_str());
+    unlink(LOG_FILE2.c_str());
+    LoggerConfig config(LOG_FILE, "block", 0);
+    LoggerConfig config2(LOG_FILE2, "block", 0);
+
+    // Logger is replaced while threads that wrote into it are alive.
+    // New logger is likely allocated at the same address and must not
+    // pick up rings of the destroyed one.
+    std::auto_ptr<FileLogger> logger(new FileLogger(Logger::LEVEL_INFO, &config, LOGGER_KEY));
+    FileLogger *current = logger.get();
+    boost::barrier barrier(5);
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < 4; ++i) {
+        threads.create_thread(boost::bind(&FileLoggerTest::produceAndWait,
+            &current, i, 1000, &barrier));
+    }
+    barrier.wait();
+    logger.reset();
+    barrier.wait();
+    logger.reset(new FileLogger(Logger::LEVEL_INFO, &config2, LOGGER_KEY));
+    current = logger.get();
+    barrier.wait();
+    threads.join_all();
+    logger.reset();
+
+    std::vector<std::string> lines = readFile(LOG_FILE);
+    CPPUNIT_ASSERT_EQUAL((size_t)4000, lines.size());
+    CPPUNIT_ASSERT_EQUAL(4U, checkLines(lines, false));
+
+    lines = readFile(LOG_FILE2);
+    CPPUNIT_ASSERT_EQUAL((size_t)4000, lines.size());
+    CPPUNIT_ASSERT_EQUAL(4U, checkLines(lines, false));
+}
@@ -0,0 +1,171 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "xscript/doc_cache.h"
+
+#include "internal/gzip.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class GzipTest : public CppUnit::TestFixture {
+public:
+    void testRoundTrip();
+    void testWriter();
+    void testCorrupted();
+    void testAccepted();
+    void testCompressible();
+    void testPageCacheData();
+
+private:
+    CPPUNIT_TEST_SUITE(GzipTest);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testWriter);
+    CPPUNIT_TEST(testCorrupted);
+    CPPUNIT_TEST(testAccepted);
+    CPPUNIT_TEST(testCompressible);
+    CPPUNIT_TEST(testPageCacheData);
+    CPPUNIT_TEST_SUITE_END();
+
+    static std::string createData();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(GzipTest, "gzip");
+CPPUNIT_REGISTRY_ADD("gzip", "xscript");
+
+std::string
+GzipTest::createData() {
+    std::string data;
+    for (unsigned int i = 0; i < 500; ++i) {
+        data.append("<li><a href=\"/page?n=").append(1, (char)('0' + i % 10)).append("\">page</a></li>");
+    }
+    return data;
+}
+
+void
+GzipTest::testRoundTrip() {
+
+    using namespace xscript;
+
+    const std::string data = createData();
+    std::string compressed, result;
+    Gzip::compress(data.data(), data.size(), compressed, 9);
+    CPPUNIT_ASSERT(compressed.size() < data.size());
+    CPPUNIT_ASSERT_EQUAL('\x1f', compressed[0]);
+    CPPUNIT_ASSERT_EQUAL('\x8b', compressed[1]);
+
+    Gzip::decompress(compressed.data(), compressed.size(), result);
+    CPPUNIT_ASSERT(data == result);
+}
+
+void
+GzipTest::testWriter() {
+
+    using namespace xscript;
+
+    const std::string data = createData();
+    std::stringstream stream;
+    GzipWriter writer(&stream, 1);
+    for (std::string::size_type pos = 0; pos < data.size(); pos += 777) {
+        writer.write(data.data() + pos, std::min<std::string::size_type>(777, data.size() - pos));
+    }
+    writer.finish();
+    writer.finish();
+
+    std::string compressed = stream.str(), result;
+    Gzip::decompress(compressed.data(), compressed.size(), result);
+    CPPUNIT_ASSERT(data == result);
+}
+
+void
+GzipTest::testCorrupted() {
+
+    using namespace xscript;
+
+    const std::string data = createData();
+    std::string compressed, result;
+    Gzip::compress(data.data(), data.size(), compressed, 9);
+    CPPUNIT_ASSERT_THROW(Gzip::decompress(compressed.data(), compressed.size() / 2, result),
+        std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Gzip::decompress(data.data(), data.size(), result), std::runtime_error);
+}
+
+void
+GzipTest::testAccepted() {
+
+    using namespace xscript;
+
+    CPPUNIT_ASSERT(Gzip::accepted("gzip"));
+    CPPUNIT_ASSERT(Gzip::accepted("gzip, deflate"));
+    CPPUNIT_ASSERT(Gzip::accepted("deflate, X-GZIP"));
+    CPPUNIT_ASSERT(Gzip::accepted("deflate;q=1.0, gzip;q=0.5"));
+    CPPUNIT_ASSERT(Gzip::accepted("*"));
+    CPPUNIT_ASSERT(!Gzip::accepted(""));
+    CPPUNIT_ASSERT(!Gzip::accepted("identity"));
+    CPPUNIT_ASSERT(!Gzip::accepted("deflate, gzip;q=0"));
+    CPPUNIT_ASSERT(!Gzip::accepted("gzip;q=0, *"));
+    CPPUNIT_ASSERT(!Gzip::accepted("*;q=0"));
+    CPPUNIT_ASSERT(!Gzip::accepted("gzipped"));
+}
+
+void
+GzipTest::testCompressible() {
+
+    using namespace xscript;
+
+    CPPUNIT_ASSERT(Gzip::compressible("text/html"));
+    CPPUNIT_ASSERT(Gzip::compressible("Text/Plain; charset=utf-8"));
+    CPPUNIT_ASSERT(Gzip::compressible("application/xml"));
+    CPPUNIT_ASSERT(Gzip::compressible("application/rss+xml"));
+    CPPUNIT_ASSERT(Gzip::compressible("application/json"));
+    CPPUNIT_ASSERT(Gzip::compressible("application/x-javascript"));
+    CPPUNIT_ASSERT(!Gzip::compressible(""));
+    CPPUNIT_ASSERT(!Gzip::compressible("image/png"));
+    CPPUNIT_ASSERT(!Gzip::compressible("application/octet-stream"));
+}
+
+void
+GzipTest::testPageCacheData() {
+
+    using namespace xscript;
+
+    const std::string data = createData();
+    PageCacheData page(data.data(), data.size());
+    page.addHeader("Status", "200 OK");
+    page.addHeader("Content-Type", "text/html; charset=utf-8");
+    page.compress(data.size() + 1);
+    CPPUNIT_ASSERT(!page.gzipped());
+
+    page.compress(1024);
+    CPPUNIT_ASSERT(page.gzipped());
+    CPPUNIT_ASSERT(page.etag(false) != page.etag(true));
+
+    std::string buf;
+    CPPUNIT_ASSERT(page.serialize(buf));
+    CPPUNIT_ASSERT(buf.size() < data.size());
+
+    PageCacheData parsed;
+    CPPUNIT_ASSERT(parsed.parse(buf.data(), buf.size()));
+    CPPUNIT_ASSERT(parsed.gzipped());
+    CPPUNIT_ASSERT_EQUAL(page.etag(true), parsed.etag(true));
+
+    PageCacheData image(data.data(), data.size());
+    image.addHeader("Status", "200 OK");
+    image.addHeader("Content-Type", "image/png");
+    image.compress(1024);
+    CPPUNIT_ASSERT(!image.gzipped());
+
+    PageCacheData error(data.data(), data.size());
+    error.addHeader("Status", "404 Not Found");
+    error.addHeader("Content-Type", "text/html");
+    error.compress(1024);
+    CPPUNIT_ASSERT(!error.gzipped());
+}
@@ -0,0 +1,127 @@
+#include "settings.h"
+
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "xscript/xml_helpers.h"
+
+#include "internal/histogram_counter_impl.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class HistogramTest : public CppUnit::TestFixture {
+public:
+    void testBuckets();
+    void testPercentiles();
+    void testThreads();
+    void testReport();
+
+private:
+    CPPUNIT_TEST_SUITE(HistogramTest);
+    CPPUNIT_TEST(testBuckets);
+    CPPUNIT_TEST(testPercentiles);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testReport);
+    CPPUNIT_TEST_SUITE_END();
+
+    static void fill(xscript::HistogramCounter *counter, unsigned int count);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(HistogramTest, "histogram");
+CPPUNIT_REGISTRY_ADD("histogram", "xscript");
+
+void
+HistogramTest::fill(xscript::HistogramCounter *counter, unsigned int count) {
+    for (unsigned int i = 1; i <= count; ++i) {
+        counter->add(i);
+    }
+}
+
+void
+HistogramTest::testBuckets() {
+
+    using namespace xscript;
+
+    unsigned int prev = 0;
+    for (boost::uint64_t value = 0; value < 100000; ++value) {
+        unsigned int bucket = HistogramCounterImpl::bucket(value);
+        CPPUNIT_ASSERT(bucket >= prev);
+        CPPUNIT_ASSERT(bucket < HistogramCounterImpl::BUCKET_COUNT);
+        boost::uint64_t limit = HistogramCounterImpl::bucketLimit(bucket);
+        CPPUNIT_ASSERT(value <= limit);
+        CPPUNIT_ASSERT(limit - value <= value / 16);
+        prev = bucket;
+    }
+    CPPUNIT_ASSERT_EQUAL(HistogramCounterImpl::BUCKET_COUNT - 1,
+        HistogramCounterImpl::bucket(0xffffffffffffffffULL));
+}
+
+void
+HistogramTest::testPercentiles() {
+
+    using namespace xscript;
+
+    HistogramCounterImpl counter("test");
+    CPPUNIT_ASSERT_EQUAL((boost::uint64_t)0, counter.percentile(0.5));
+
+    fill(&counter, 1000);
+    CPPUNIT_ASSERT_EQUAL((boost::uint64_t)1000, counter.count());
+
+    boost::uint64_t p50 = counter.percentile(0.5);
+    CPPUNIT_ASSERT(p50 >= 500 && p50 <= 500 + 500 / 16);
+    boost::uint64_t p99 = counter.percentile(0.99);
+    CPPUNIT_ASSERT(p99 >= 990 && p99 <= 1000);
+    CPPUNIT_ASSERT_EQUAL((boost::uint64_t)1000, counter.percentile(1.0));
+    CPPUNIT_ASSERT_EQUAL((boost::uint64_t)1, counter.percentile(0.0));
+}
+
+void
+HistogramTest::testThreads() {
+
+    using namespace xscript;
+
+    HistogramCounterImpl counter("test");
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < 8; ++i) {
+        threads.create_thread(boost::bind(&HistogramTest::fill, &counter, 10000));
+    }
+    threads.join_all();
+
+    CPPUNIT_ASSERT_EQUAL((boost::uint64_t)80000, counter.count());
+    boost::uint64_t p50 = counter.percentile(0.5);
+    CPPUNIT_ASSERT(p50 >= 5000 && p50 <= 5000 + 5000 / 16);
+}
+
+void
+HistogramTest::testReport() {
+
+    using namespace xscript;
+
+    HistogramCounterImpl counter("hits");
+    XmlNodeHelper empty = counter.createReport();
+    xmlChar *count = xmlGetProp(empty.get(), (const xmlChar*) "count");
+    CPPUNIT_ASSERT_EQUAL(std::string("0"), std::string((const char*)count));
+    xmlFree(count);
+    CPPUNIT_ASSERT(NULL == xmlHasProp(empty.get(), (const xmlChar*) "p99"));
+
+    fill(&counter, 100);
+    XmlNodeHelper line = counter.createReport();
+    CPPUNIT_ASSERT_EQUAL(std::string("hits"), std::string((const char*)line->name));
+
+    const char* names[] = { "count", "total", "min", "max", "avg", "p50", "p95", "p99", "p999" };
+    const char* values[] = { "100", "5050", "1", "100", "50", "51", "95", "99", "100" };
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        xmlChar *value = xmlGetProp(line.get(), (const xmlChar*) names[i]);
+        CPPUNIT_ASSERT(NULL != value);
+        CPPUNIT_ASSERT_EQUAL(std::string(values[i]), std::string((const char*)value));
+        xmlFree(value);
+    }
+}
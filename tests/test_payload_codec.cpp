@@ -0,0 +1,121 @@
+#include "settings.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "internal/payload_codec.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class PayloadCodecTest : public CppUnit::TestFixture {
+public:
+    void testRoundTrip();
+    void testIncompressible();
+    void testCorrupted();
+    void testType();
+
+private:
+    CPPUNIT_TEST_SUITE(PayloadCodecTest);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testIncompressible);
+    CPPUNIT_TEST(testCorrupted);
+    CPPUNIT_TEST(testType);
+    CPPUNIT_TEST_SUITE_END();
+
+    static std::string createData();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(PayloadCodecTest, "payload-codec");
+CPPUNIT_REGISTRY_ADD("payload-codec", "xscript");
+
+std::string
+PayloadCodecTest::createData() {
+    std::string data;
+    for (unsigned int i = 0; i < 200; ++i) {
+        data.append("<div class=\"item\"><a href=\"/item?id=").append(1, (char)('0' + i % 10)).append("\">item</a></div>");
+    }
+    return data;
+}
+
+void
+PayloadCodecTest::testRoundTrip() {
+
+    using namespace xscript;
+
+    const std::string data = createData();
+    PayloadCodec::Type types[] = { PayloadCodec::DEFLATE, PayloadCodec::LZ4 };
+    for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        if (!PayloadCodec::available(types[i])) {
+            continue;
+        }
+        std::string encoded = data;
+        CPPUNIT_ASSERT(PayloadCodec::encode(types[i], encoded));
+        CPPUNIT_ASSERT(encoded.size() < data.size());
+        CPPUNIT_ASSERT(PayloadCodec::encoded(encoded.data(), encoded.size()));
+        CPPUNIT_ASSERT(!PayloadCodec::encoded(data.data(), data.size()));
+
+        std::string decoded;
+        PayloadCodec::decode(encoded.data(), encoded.size(), decoded);
+        CPPUNIT_ASSERT_EQUAL(data, decoded);
+    }
+}
+
+void
+PayloadCodecTest::testIncompressible() {
+
+    using namespace xscript;
+
+    std::string data;
+    unsigned int seed = 17;
+    for (unsigned int i = 0; i < 256; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data.push_back((char)(seed >> 16));
+    }
+    std::string encoded = data;
+    CPPUNIT_ASSERT(!PayloadCodec::encode(PayloadCodec::DEFLATE, encoded));
+    CPPUNIT_ASSERT_EQUAL(data, encoded);
+
+    CPPUNIT_ASSERT(!PayloadCodec::encode(PayloadCodec::NONE, encoded));
+    CPPUNIT_ASSERT_EQUAL(data, encoded);
+}
+
+void
+PayloadCodecTest::testCorrupted() {
+
+    using namespace xscript;
+
+    std::string encoded = createData();
+    CPPUNIT_ASSERT(PayloadCodec::encode(PayloadCodec::DEFLATE, encoded));
+
+    std::string decoded;
+    for (std::string::size_type size = 0; size < encoded.size(); size += 7) {
+        CPPUNIT_ASSERT_THROW(PayloadCodec::decode(encoded.data(), size, decoded), std::runtime_error);
+    }
+
+    std::string broken = encoded;
+    broken[broken.size() / 2] ^= 0x55;
+    CPPUNIT_ASSERT_THROW(PayloadCodec::decode(broken.data(), broken.size(), decoded), std::runtime_error);
+
+    broken = encoded;
+    broken[sizeof(boost::uint32_t)] = 100;
+    CPPUNIT_ASSERT_THROW(PayloadCodec::decode(broken.data(), broken.size(), decoded), std::runtime_error);
+}
+
+void
+PayloadCodecTest::testType() {
+
+    using namespace xscript;
+
+    CPPUNIT_ASSERT_EQUAL(PayloadCodec::NONE, PayloadCodec::type(""));
+    CPPUNIT_ASSERT_EQUAL(PayloadCodec::NONE, PayloadCodec::type("none"));
+    CPPUNIT_ASSERT_EQUAL(PayloadCodec::DEFLATE, PayloadCodec::type("Deflate"));
+    CPPUNIT_ASSERT_THROW(PayloadCodec::type("snappy"), std::runtime_error);
+    if (!PayloadCodec::available(PayloadCodec::LZ4)) {
+        CPPUNIT_ASSERT_THROW(PayloadCodec::type("lz4"), std::runtime_error);
+    }
+}
@@ -0,0 +1,255 @@
+#include "settings.h"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <zlib.h>
+
+#include "xscript/request.h"
+#include "xscript/response.h"
+#include "xscript/script.h"
+#include "xscript/script_factory.h"
+
+#include "internal/gzip.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+class ResponseTest : public CppUnit::TestFixture {
+public:
+    void testScriptPolicy();
+    void testFlushHead();
+    void testFlushSize();
+    void testTee();
+    void testTeeBroken();
+    void testGzipFlush();
+
+private:
+    CPPUNIT_TEST_SUITE(ResponseTest);
+    CPPUNIT_TEST(testScriptPolicy);
+    CPPUNIT_TEST(testFlushHead);
+    CPPUNIT_TEST(testFlushSize);
+    CPPUNIT_TEST(testTee);
+    CPPUNIT_TEST(testTeeBroken);
+    CPPUNIT_TEST(testGzipFlush);
+    CPPUNIT_TEST_SUITE_END();
+
+    // remembers what was written into the stream at every flush
+    class SyncBuffer : public std::stringbuf {
+    public:
+        const std::vector<std::string>& synced() const;
+
+    protected:
+        virtual int sync();
+
+    private:
+        std::vector<std::string> synced_;
+    };
+
+    static std::string body(const std::string &output);
+    static std::string inflateFlushed(const std::string &data);
+    static std::string createData();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ResponseTest, "response");
+CPPUNIT_REGISTRY_ADD("response", "xscript");
+
+const std::vector<std::string>&
+ResponseTest::SyncBuffer::synced() const {
+    return synced_;
+}
+
+int
+ResponseTest::SyncBuffer::sync() {
+    synced_.push_back(str());
+    return 0;
+}
+
+std::string
+ResponseTest::body(const std::string &output) {
+    std::string::size_type pos = output.find("\r\n\r\n");
+    CPPUNIT_ASSERT(std::string::npos != pos);
+    return output.substr(pos + 4);
+}
+
+std::string
+ResponseTest::inflateFlushed(const std::string &data) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    CPPUNIT_ASSERT_EQUAL(Z_OK, inflateInit2(&stream, 16 + MAX_WBITS));
+
+    // sync flushed gzip stream has no trailer yet but all its data is decodable
+    std::string result;
+    char buffer[4096];
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    int res = Z_OK;
+    while (Z_OK == res && (stream.avail_in > 0 || 0 == stream.avail_out)) {
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = sizeof(buffer);
+        res = inflate(&stream, Z_SYNC_FLUSH);
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    CPPUNIT_ASSERT(Z_OK == res || Z_BUF_ERROR == res);
+    return result;
+}
+
+std::string
+ResponseTest::createData() {
+    std::string data;
+    for (unsigned int i = 0; i < 300; ++i) {
+        data.append("<li><a href=\"/page?n=").append(1, (char)('0' + i % 10)).append("\">page</a></li>");
+    }
+    return data;
+}
+
+void
+ResponseTest::testScriptPolicy() {
+
+    using namespace xscript;
+
+    boost::shared_ptr<Script> script = ScriptFactory::createScript("output-flush.xml");
+    CPPUNIT_ASSERT(script->flushHead());
+    CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint32_t>(8192), script->flushSize());
+
+    script = ScriptFactory::createScript("noblocks.xml");
+    CPPUNIT_ASSERT(!script->flushHead());
+    CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint32_t>(0), script->flushSize());
+}
+
+void
+ResponseTest::testFlushHead() {
+
+    using namespace xscript;
+
+    SyncBuffer buffer;
+    std::ostream stream(&buffer);
+    Request request;
+    Response response(&stream);
+    response.setFlushPolicy(true, 0);
+
+    response.write("<page>", 6, &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("<page>"), body(buffer.synced()[0]));
+
+    response.write("</page>", 7, &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+
+    response.detach(NULL);
+    CPPUNIT_ASSERT_EQUAL(std::string("<page></page>"), body(buffer.str()));
+}
+
+void
+ResponseTest::testFlushSize() {
+
+    using namespace xscript;
+
+    SyncBuffer buffer;
+    std::ostream stream(&buffer);
+    Request request;
+    Response response(&stream);
+    response.setFlushPolicy(false, 100);
+
+    const std::string chunk(60, 'x');
+    response.write(chunk.data(), chunk.size(), &request);
+    CPPUNIT_ASSERT(buffer.synced().empty());
+
+    response.write(chunk.data(), chunk.size(), &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+    CPPUNIT_ASSERT_EQUAL(chunk + chunk, body(buffer.synced()[0]));
+
+    response.write(chunk.data(), chunk.size(), &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+
+    response.write(chunk.data(), chunk.size(), &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, buffer.synced().size());
+}
+
+void
+ResponseTest::testTee() {
+
+    using namespace xscript;
+
+    SyncBuffer buffer;
+    std::ostream stream(&buffer);
+    Request request;
+    Response response(&stream);
+    response.setCacheable();
+    response.setFlushPolicy(true, 0);
+
+    // page being cached reaches client before it is complete
+    response.write("<page>", 6, &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("<page>"), body(buffer.synced()[0]));
+    CPPUNIT_ASSERT(std::string::npos != buffer.synced()[0].find("Expires: "));
+
+    response.write("</page>", 7, &request);
+    response.detach(NULL);
+    CPPUNIT_ASSERT_EQUAL(std::string("<page></page>"), body(buffer.str()));
+}
+
+void
+ResponseTest::testTeeBroken() {
+
+    using namespace xscript;
+
+    SyncBuffer buffer;
+    std::ostream stream(&buffer);
+    Request request;
+    Response response(&stream);
+    response.setCacheable();
+    response.setFlushPolicy(true, 0);
+
+    response.write("<page>", 6, &request);
+
+    // client is gone, stream fails without throwing
+    stream.setstate(std::ios::failbit);
+    response.write("<a/>", 4, &request);
+
+    // teeing is not resumed even if stream looks good again
+    stream.clear();
+    response.write("</page>", 7, &request);
+    response.detach(NULL);
+    CPPUNIT_ASSERT_EQUAL(std::string("<page>"), body(buffer.str()));
+}
+
+void
+ResponseTest::testGzipFlush() {
+
+    using namespace xscript;
+
+    SyncBuffer buffer;
+    std::ostream stream(&buffer);
+    Request request;
+    request.addInputHeader("Accept-Encoding", "gzip");
+    Response response(&stream);
+    response.setContentType("text/html");
+    response.enableGzip(&request, 0);
+    response.setFlushPolicy(true, 0);
+
+    const std::string data = createData();
+    response.write(data.data(), data.size(), &request);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, buffer.synced().size());
+
+    // flushed part is decodable by client before the gzip stream is finished
+    const std::string &head = buffer.synced()[0];
+    CPPUNIT_ASSERT(std::string::npos != head.find("Content-Encoding: gzip\r\n"));
+    CPPUNIT_ASSERT(data == inflateFlushed(body(head)));
+
+    response.write(data.data(), data.size(), &request);
+    response.detach(NULL);
+
+    std::string result;
+    const std::string compressed = body(buffer.str());
+    Gzip::decompress(compressed.data(), compressed.size(), result);
+    CPPUNIT_ASSERT(data + data == result);
+}
@@ -3,6 +3,9 @@
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <boost/lexical_cast.hpp>
+
+#include "xscript/context.h"
 #include "xscript/stylesheet.h"
 #include "xscript/stylesheet_factory.h"
 
@@ -17,6 +20,7 @@ public:
     void testContentType();
     void testOutputMethod();
     void testOutputEncoding();
+    void testApplyReused();
 
 private:
     CPPUNIT_TEST_SUITE(StylesheetTest);
@@ -24,6 +28,7 @@ private:
     CPPUNIT_TEST(testContentType);
     CPPUNIT_TEST(testOutputMethod);
     CPPUNIT_TEST(testOutputEncoding);
+    CPPUNIT_TEST(testApplyReused);
 
     CPPUNIT_TEST_EXCEPTION(testInvalid, std::exception);
     CPPUNIT_TEST_EXCEPTION(testNonexistent, std::exception);
@@ -110,3 +115,33 @@ StylesheetTest::testOutputEncoding() {
     boost::shared_ptr<Stylesheet> custom = StylesheetFactory::createStylesheet("custom.xsl");
     CPPUNIT_ASSERT_EQUAL(std::string("utf-8"), custom->outputEncoding());
 }
+
+void
+StylesheetTest::testApplyReused() {
+
+    using namespace xscript;
+
+    boost::shared_ptr<Stylesheet> sh = StylesheetFactory::createStylesheet("stylesheet.xsl");
+    boost::shared_ptr<Context> ctx;
+    boost::shared_ptr<InvokeContext> invoke_ctx;
+
+    for (int i = 0; i < 10; ++i) {
+        std::string name = boost::lexical_cast<std::string>(i);
+        std::string xml = "<state type=\"test\" name=\"" + name + "\">value</state>";
+        XmlDocHelper doc(xmlParseMemory(xml.c_str(), xml.size()));
+        CPPUNIT_ASSERT(NULL != doc.get());
+
+        XmlDocHelper result = sh->apply(NULL, ctx, invoke_ctx, doc.get());
+        CPPUNIT_ASSERT(NULL != result.get());
+
+        xmlNodePtr root = xmlDocGetRootElement(result.get());
+        CPPUNIT_ASSERT(NULL != root);
+        xmlNodePtr node = root->children;
+        while (NULL != node && !xmlStrEqual(node->name, (const xmlChar*)"name")) {
+            node = node->next;
+        }
+        CPPUNIT_ASSERT(NULL != node);
+        XmlCharHelper content(xmlNodeGetContent(node));
+        CPPUNIT_ASSERT_EQUAL(name, std::string((const char*)content.get()));
+    }
+}
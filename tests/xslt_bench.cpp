@@ -0,0 +1,112 @@
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include "xscript/config.h"
+#include "xscript/context.h"
+#include "xscript/profiler.h"
+#include "xscript/stylesheet.h"
+#include "xscript/stylesheet_factory.h"
+#include "xscript/vhost_data.h"
+#include "xscript/xml_util.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+/**
+ * Compares transforms with fresh and with pooled transform contexts.
+ * Usage: xslt-bench [transforms per thread] [stylesheet ...]
+ * Must be started from the tests directory.
+ */
+
+using namespace xscript;
+
+namespace {
+
+const char *DEFAULT_STYLESHEETS[] = {
+    "stylesheet.xsl", "xmlout.xsl", "htmlout.xsl", "textout.xsl", "custom.xsl"
+};
+
+void
+work(Stylesheet *stylesheet, xmlDocPtr doc, unsigned int transforms) {
+    boost::shared_ptr<Context> ctx;
+    boost::shared_ptr<InvokeContext> invoke_ctx;
+    for (unsigned int i = 0; i < transforms; ++i) {
+        XmlDocHelper result = stylesheet->apply(NULL, ctx, invoke_ctx, doc);
+    }
+}
+
+void
+runAll(Stylesheet *stylesheet, xmlDocPtr doc, unsigned int transforms, unsigned int threads) {
+    boost::thread_group group;
+    for (unsigned int i = 0; i < threads; ++i) {
+        group.create_thread(boost::bind(&work, stylesheet, doc, transforms));
+    }
+    group.join_all();
+}
+
+double
+bench(const std::string &name, xmlDocPtr doc, unsigned int transforms, unsigned int threads, unsigned int pool) {
+    Stylesheet::transformContextPoolSize(pool);
+    boost::shared_ptr<Stylesheet> stylesheet = StylesheetFactory::createStylesheet(name);
+    runAll(stylesheet.get(), doc, transforms / 10 + 1, threads);
+    boost::uint64_t usec = profile(boost::bind(&runAll, stylesheet.get(), doc, transforms, threads));
+    return usec > 0 ? 1000000.0 * threads * transforms / usec : 0;
+}
+
+XmlDocHelper
+createDoc() {
+    std::string xml("<state type=\"bench\" name=\"xslt\">");
+    for (unsigned int i = 0; i < 32; ++i) {
+        xml.append("<item id=\"").append(boost::lexical_cast<std::string>(i)).append("\">value</item>");
+    }
+    xml.append("</state>");
+    XmlDocHelper doc(xmlParseMemory(xml.c_str(), xml.size()));
+    XmlUtils::throwUnless(NULL != doc.get());
+    return doc;
+}
+
+} // namespace
+
+int
+main(int argc, char *argv[]) {
+    try {
+        std::auto_ptr<Config> config = Config::create("test.conf");
+        config->startup();
+        VirtualHostData::instance()->setConfig(config.get());
+
+        unsigned int transforms = argc > 1 ? boost::lexical_cast<unsigned int>(argv[1]) : 20000;
+        std::vector<std::string> names;
+        for (int i = 2; i < argc; ++i) {
+            names.push_back(argv[i]);
+        }
+        if (names.empty()) {
+            names.assign(DEFAULT_STYLESHEETS,
+                DEFAULT_STYLESHEETS + sizeof(DEFAULT_STYLESHEETS) / sizeof(DEFAULT_STYLESHEETS[0]));
+        }
+
+        XmlDocHelper doc = createDoc();
+
+        printf("%-16s %8s %16s %16s\n", "stylesheet", "threads", "fresh ops/sec", "pooled ops/sec");
+        for (std::vector<std::string>::iterator it = names.begin(), end = names.end(); it != end; ++it) {
+            for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+                double fresh = bench(*it, doc.get(), transforms, threads, 0);
+                double pooled = bench(*it, doc.get(), transforms, threads, threads);
+                printf("%-16s %8u %16.0f %16.0f\n", it->c_str(), threads, fresh, pooled);
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}